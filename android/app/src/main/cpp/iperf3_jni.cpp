@@ -1,5 +1,10 @@
 #include <jni.h>
 #include <string>
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <pthread.h>
+#include <vector>
 #include <android/log.h>
 
 // Include our shared platform-agnostic bridge
@@ -8,123 +13,274 @@
 #define LOG_TAG "iperf3_jni"
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
+// Classes and member IDs resolved once in JNI_OnLoad.  The classes are
+// global refs, so the IDs stay valid for the life of the library.
+static struct {
+    JavaVM* vm;
+    pthread_key_t detachKey;        // detaches delivery threads when they exit
+    jclass hashMapClass;
+    jmethodID hashMapInit;
+    jmethodID hashMapPut;
+    jclass arrayListClass;
+    jmethodID arrayListInit;
+    jmethodID arrayListAdd;
+    jclass doubleClass;
+    jmethodID doubleValueOf;
+    jclass longClass;
+    jmethodID longValueOf;
+    jclass integerClass;
+    jmethodID integerValueOf;
+    jclass booleanClass;
+    jmethodID booleanValueOf;
+    jmethodID onProgressBatch;
+    jmethodID onBenchmarkBatch;
+} gJni;
+
+static jclass findGlobalClass(JNIEnv* env, const char* name) {
+    jclass local = env->FindClass(name);
+    if (!local) {
+        return nullptr;
+    }
+    jclass global = static_cast<jclass>(env->NewGlobalRef(local));
+    env->DeleteLocalRef(local);
+    return global;
+}
+
+static void detachThread(void* vm) {
+    static_cast<JavaVM*>(vm)->DetachCurrentThread();
+}
+
+// The env of the calling thread, attaching it on first use.  Native threads
+// such as a session's delivery thread stay attached until they exit.
+static JNIEnv* currentEnv() {
+    JNIEnv* env = nullptr;
+    if (gJni.vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) == JNI_OK) {
+        return env;
+    }
+    if (gJni.vm->AttachCurrentThread(&env, nullptr) != JNI_OK) {
+        return nullptr;
+    }
+    pthread_setspecific(gJni.detachKey, gJni.vm);
+    return env;
+}
+
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+    JNIEnv* env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+    gJni.vm = vm;
+    if (pthread_key_create(&gJni.detachKey, detachThread) != 0) {
+        return JNI_ERR;
+    }
+
+    gJni.hashMapClass = findGlobalClass(env, "java/util/HashMap");
+    gJni.arrayListClass = findGlobalClass(env, "java/util/ArrayList");
+    gJni.doubleClass = findGlobalClass(env, "java/lang/Double");
+    gJni.longClass = findGlobalClass(env, "java/lang/Long");
+    gJni.integerClass = findGlobalClass(env, "java/lang/Integer");
+    gJni.booleanClass = findGlobalClass(env, "java/lang/Boolean");
+    // Loaded from Iperf3Bridge's own initializer, so its class loader is in scope
+    jclass bridgeClass = env->FindClass("com/example/hello_world_app/Iperf3Bridge");
+    if (!gJni.hashMapClass || !gJni.arrayListClass || !gJni.doubleClass || !gJni.longClass ||
+        !gJni.integerClass || !gJni.booleanClass || !bridgeClass) {
+        LOGE("JNI: Failed to resolve classes on load");
+        return JNI_ERR;
+    }
+
+    gJni.hashMapInit = env->GetMethodID(gJni.hashMapClass, "<init>", "()V");
+    gJni.hashMapPut = env->GetMethodID(gJni.hashMapClass, "put",
+                                       "(Ljava/lang/Object;Ljava/lang/Object;)Ljava/lang/Object;");
+    gJni.arrayListInit = env->GetMethodID(gJni.arrayListClass, "<init>", "()V");
+    gJni.arrayListAdd = env->GetMethodID(gJni.arrayListClass, "add", "(Ljava/lang/Object;)Z");
+    gJni.doubleValueOf = env->GetStaticMethodID(gJni.doubleClass, "valueOf", "(D)Ljava/lang/Double;");
+    gJni.longValueOf = env->GetStaticMethodID(gJni.longClass, "valueOf", "(J)Ljava/lang/Long;");
+    gJni.integerValueOf = env->GetStaticMethodID(gJni.integerClass, "valueOf", "(I)Ljava/lang/Integer;");
+    gJni.booleanValueOf = env->GetStaticMethodID(gJni.booleanClass, "valueOf", "(Z)Ljava/lang/Boolean;");
+    gJni.onProgressBatch = env->GetMethodID(bridgeClass, "onProgressBatch", "([J[D)V");
+    gJni.onBenchmarkBatch = env->GetMethodID(bridgeClass, "onBenchmarkBatch", "([J[D)V");
+    env->DeleteLocalRef(bridgeClass);
+    if (env->ExceptionCheck()) {
+        LOGE("JNI: Failed to resolve methods on load");
+        return JNI_ERR;
+    }
+    return JNI_VERSION_1_6;
+}
+
 // Helper function to create a Java HashMap
 jobject createHashMap(JNIEnv* env) {
-    jclass hashMapClass = env->FindClass("java/util/HashMap");
-    jmethodID hashMapInit = env->GetMethodID(hashMapClass, "<init>", "()V");
-    return env->NewObject(hashMapClass, hashMapInit);
+    return env->NewObject(gJni.hashMapClass, gJni.hashMapInit);
 }
 
-// Helper function to put values in HashMap
+// Helper function to put values in HashMap; releases the local ref to value
 void putInHashMap(JNIEnv* env, jobject hashMap, const char* key, jobject value) {
-    jclass hashMapClass = env->FindClass("java/util/HashMap");
-    jmethodID putMethod = env->GetMethodID(hashMapClass, "put",
-                                           "(Ljava/lang/Object;Ljava/lang/Object;)Ljava/lang/Object;");
     jstring jKey = env->NewStringUTF(key);
-    env->CallObjectMethod(hashMap, putMethod, jKey, value);
+    jobject previous = env->CallObjectMethod(hashMap, gJni.hashMapPut, jKey, value);
+    env->DeleteLocalRef(previous);
     env->DeleteLocalRef(jKey);
+    env->DeleteLocalRef(value);
 }
 
 // Helper to create Java Double
 jobject createDouble(JNIEnv* env, double value) {
-    jclass doubleClass = env->FindClass("java/lang/Double");
-    jmethodID doubleInit = env->GetMethodID(doubleClass, "<init>", "(D)V");
-    return env->NewObject(doubleClass, doubleInit, value);
+    return env->CallStaticObjectMethod(gJni.doubleClass, gJni.doubleValueOf, value);
+}
+
+// Helper to create Java Long
+jobject createLong(JNIEnv* env, jlong value) {
+    return env->CallStaticObjectMethod(gJni.longClass, gJni.longValueOf, value);
 }
 
 // Helper to create Java Integer
 jobject createInteger(JNIEnv* env, int value) {
-    jclass integerClass = env->FindClass("java/lang/Integer");
-    jmethodID integerInit = env->GetMethodID(integerClass, "<init>", "(I)V");
-    return env->NewObject(integerClass, integerInit, value);
+    return env->CallStaticObjectMethod(gJni.integerClass, gJni.integerValueOf, value);
 }
 
 // Helper to create Java Boolean
 jobject createBoolean(JNIEnv* env, bool value) {
-    jclass booleanClass = env->FindClass("java/lang/Boolean");
-    jmethodID booleanInit = env->GetMethodID(booleanClass, "<init>", "(Z)V");
-    return env->NewObject(booleanClass, booleanInit, value);
+    return env->CallStaticObjectMethod(gJni.booleanClass, gJni.booleanValueOf,
+                                       value ? JNI_TRUE : JNI_FALSE);
 }
 
-// Progress callback context structure
+// Layout of a progress batch, mirrored by Iperf3ProgressBatch in Kotlin.
+// A batch is one interval: a header, then one record each for the sum, the
+// reverse sum and every stream.
+static const int kBatchHeaderLongs = 5;     // interval, omitted, bidirectional, streamCount, timestampNs
+static const int kBatchHeaderDoubles = 2;   // start, end
+static const int kRecordLongs = 11;         // id, sender, bytes, retransmits, cwnd, packets, lostPackets, outOfOrder,
+                                            // stalls, stallMs, longestStallMs
+static const int kRecordDoubles = 7;        // seconds, bitsPerSecond, rtt, rttVar, jitter, peakBitsPerSecond, burstCv
+
+// Progress callback context structure.  Progress arrives on the session's
+// delivery thread, so the bridge and the arrays are global refs.  The arrays
+// are reused for every interval of a run and only grow when the stream
+// count does.
 struct ProgressContext {
-    JNIEnv* env;
     jobject bridge;
+    jmethodID method;
+    jlongArray longs;
+    jdoubleArray doubles;
+    int recordCapacity;
+    std::vector<jlong> longBuffer;
+    std::vector<jdouble> doubleBuffer;
 };
 
-// C callback function that will be called from iperf3 bridge
-void progressCallback(void* context, int interval, long bytesTransferred,
-                     double bitsPerSecond, double jitter, int lostPackets, double rtt) {
-    ProgressContext* ctx = (ProgressContext*)context;
-    if (!ctx || !ctx->env || !ctx->bridge) return;
-
-    JNIEnv* env = ctx->env;
-    jobject bridge = ctx->bridge;
+static void packRecord(const Iperf3StreamProgress* stream, jlong* longs, jdouble* doubles) {
+    longs[0] = stream->id;
+    longs[1] = stream->sender ? 1 : 0;
+    longs[2] = stream->bytes;
+    longs[3] = stream->retransmits;
+    longs[4] = stream->cwnd;
+    longs[5] = stream->packets;
+    longs[6] = stream->lostPackets;
+    longs[7] = stream->outOfOrder;
+    longs[8] = stream->stalls;
+    longs[9] = stream->stallMs;
+    longs[10] = stream->longestStallMs;
+    doubles[0] = stream->seconds;
+    doubles[1] = stream->bitsPerSecond;
+    doubles[2] = stream->rtt;
+    doubles[3] = stream->rttVar;
+    doubles[4] = stream->jitter;
+    doubles[5] = stream->peakBitsPerSecond;
+    doubles[6] = stream->burstCv;
+}
 
-    // Get the Java class and method
-    jclass bridgeClass = env->GetObjectClass(bridge);
-    jmethodID onProgressMethod = env->GetMethodID(bridgeClass, "onProgress", "(IJDDID)V");
+// Drops the reusable progress arrays so the next interval allocates afresh
+static void releaseProgressArrays(JNIEnv* env, ProgressContext* ctx) {
+    env->DeleteGlobalRef(ctx->longs);
+    env->DeleteGlobalRef(ctx->doubles);
+    ctx->longs = nullptr;
+    ctx->doubles = nullptr;
+    ctx->recordCapacity = 0;
+}
 
-    if (onProgressMethod) {
-        env->CallVoidMethod(bridge, onProgressMethod,
-            (jint)interval,
-            (jlong)bytesTransferred,
-            (jdouble)bitsPerSecond,
-            (jdouble)jitter,
-            (jint)lostPackets,
-            (jdouble)rtt
-        );
+template <typename ArrayType>
+static ArrayType globalArray(JNIEnv* env, ArrayType local) {
+    if (!local) {
+        return nullptr;
     }
+    ArrayType global = static_cast<ArrayType>(env->NewGlobalRef(local));
+    env->DeleteLocalRef(local);
+    return global;
 }
 
-// JNI function: Run iperf3 client
-extern "C" JNIEXPORT jobject JNICALL
-Java_com_example_hello_1world_1app_Iperf3Bridge_nativeRunClient(
-        JNIEnv* env,
-        jobject thiz,
-        jstring host,
-        jint port,
-        jint duration,
-        jint parallel,
-        jboolean reverse,
-        jboolean useUdp,
-        jlong bandwidth) {
-
-    const char* hostStr = env->GetStringUTFChars(host, nullptr);
+// Packs one interval into the context's arrays and hands it to Kotlin in a
+// single call
+static void deliverInterval(JNIEnv* env, ProgressContext* ctx, const Iperf3IntervalProgress* progress) {
+    int records = 2 + progress->streamCount;
+    if (records > ctx->recordCapacity) {
+        releaseProgressArrays(env, ctx);
+        ctx->longs = globalArray(env, env->NewLongArray(kBatchHeaderLongs + records * kRecordLongs));
+        ctx->doubles = globalArray(env, env->NewDoubleArray(kBatchHeaderDoubles + records * kRecordDoubles));
+        if (!ctx->longs || !ctx->doubles) {
+            env->ExceptionClear();
+            releaseProgressArrays(env, ctx);
+            return;
+        }
+        ctx->recordCapacity = records;
+        ctx->longBuffer.resize(kBatchHeaderLongs + records * kRecordLongs);
+        ctx->doubleBuffer.resize(kBatchHeaderDoubles + records * kRecordDoubles);
+    }
 
-    LOGI("JNI: nativeRunClient called");
-    LOGI("JNI: Parameters - host=%s, port=%d, duration=%d, parallel=%d, reverse=%s, protocol=%s, bandwidth=%lld",
-         hostStr, port, duration, parallel,
-         reverse == JNI_TRUE ? "true" : "false",
-         useUdp == JNI_TRUE ? "UDP" : "TCP",
-         (long long)bandwidth);
+    jlong* longs = ctx->longBuffer.data();
+    jdouble* doubles = ctx->doubleBuffer.data();
+    longs[0] = progress->interval;
+    longs[1] = progress->omitted ? 1 : 0;
+    longs[2] = progress->bidirectional ? 1 : 0;
+    longs[3] = progress->streamCount;
+    longs[4] = progress->timestampNs;
+    doubles[0] = progress->start;
+    doubles[1] = progress->end;
+    jlong* longRecord = longs + kBatchHeaderLongs;
+    jdouble* doubleRecord = doubles + kBatchHeaderDoubles;
+    packRecord(&progress->sum, longRecord, doubleRecord);
+    packRecord(&progress->sumReverse, longRecord + kRecordLongs, doubleRecord + kRecordDoubles);
+    for (int i = 0; i < progress->streamCount; i++) {
+        packRecord(&progress->streams[i],
+                   longRecord + (2 + i) * kRecordLongs,
+                   doubleRecord + (2 + i) * kRecordDoubles);
+    }
 
-    // Set up progress callback context
-    ProgressContext progressCtx = {env, thiz};
-
-    // Call our shared C bridge function with progress callback
-    LOGD("JNI: Calling iperf3_run_client_test...");
-    Iperf3Result* bridgeResult = iperf3_run_client_test(
-        hostStr,
-        port,
-        duration,
-        parallel,
-        reverse == JNI_TRUE,
-        useUdp == JNI_TRUE,
-        bandwidth,
-        progressCallback,
-        &progressCtx
-    );
-    LOGD("JNI: iperf3_run_client_test returned");
+    // Only the used part is copied; Kotlin reads the length from the header
+    env->SetLongArrayRegion(ctx->longs, 0, kBatchHeaderLongs + records * kRecordLongs, longs);
+    env->SetDoubleArrayRegion(ctx->doubles, 0, kBatchHeaderDoubles + records * kRecordDoubles, doubles);
+    env->CallVoidMethod(ctx->bridge, ctx->method, ctx->longs, ctx->doubles);
+    if (env->ExceptionCheck()) {
+        LOGE("JNI: Exception in progress handler");
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+    }
+}
 
-    env->ReleaseStringUTFChars(host, hostStr);
+// C callback function that will be called from iperf3 bridge, on the
+// session's delivery thread
+void intervalCallback(void* context, const Iperf3IntervalProgress* progress) {
+    ProgressContext* ctx = (ProgressContext*)context;
+    if (!ctx || !ctx->bridge) return;
+    JNIEnv* env = currentEnv();
+    if (!env) {
+        LOGE("JNI: Failed to attach the progress delivery thread");
+        return;
+    }
+    deliverInterval(env, ctx, progress);
+}
 
-    // Convert C result to Java HashMap
+// Convert a bridge result to a Java HashMap; the result stays owned by the caller
+static jobject resultToHashMap(JNIEnv* env, const Iperf3Result* bridgeResult) {
     LOGD("JNI: Converting result to Java HashMap...");
     jobject result = createHashMap(env);
 
+    if (!bridgeResult) {
+        putInHashMap(env, result, "success", createBoolean(env, false));
+        putInHashMap(env, result, "error", env->NewStringUTF("No result from iperf3 session"));
+        putInHashMap(env, result, "errorCode", createInteger(env, -1));
+        return result;
+    }
+
     if (bridgeResult->success) {
         LOGI("JNI: Test successful, building result map");
         putInHashMap(env, result, "success", createBoolean(env, true));
@@ -132,22 +288,74 @@ Java_com_example_hello_1world_1app_Iperf3Bridge_nativeRunClient(
         putInHashMap(env, result, "receivedBitsPerSecond", createDouble(env, bridgeResult->receivedBitsPerSecond));
         putInHashMap(env, result, "sendMbps", createDouble(env, bridgeResult->sendMbps));
         putInHashMap(env, result, "receiveMbps", createDouble(env, bridgeResult->receiveMbps));
+        putInHashMap(env, result, "sentBytes", createLong(env, bridgeResult->sentBytes));
+        putInHashMap(env, result, "receivedBytes", createLong(env, bridgeResult->receivedBytes));
+        putInHashMap(env, result, "seconds", createDouble(env, bridgeResult->seconds));
+        putInHashMap(env, result, "retransmits", createLong(env, bridgeResult->retransmits));
+        putInHashMap(env, result, "cpuLocal", createDouble(env, bridgeResult->cpuLocal));
+        putInHashMap(env, result, "cpuRemote", createDouble(env, bridgeResult->cpuRemote));
 
         // Add protocol-specific metrics
         if (bridgeResult->rtt > 0) {
             // TCP: RTT data
             LOGD("JNI: Adding RTT data: %.2f ms", bridgeResult->rtt);
             putInHashMap(env, result, "rtt", createDouble(env, bridgeResult->rtt));
+            putInHashMap(env, result, "rttMin", createDouble(env, bridgeResult->rttMin));
+            putInHashMap(env, result, "rttMax", createDouble(env, bridgeResult->rttMax));
         }
-        if (bridgeResult->jitter > 0) {
-            // UDP: Jitter data
+        if (bridgeResult->packets > 0) {
+            // UDP: Jitter and loss
             LOGD("JNI: Adding jitter data: %.2f ms", bridgeResult->jitter);
             putInHashMap(env, result, "jitter", createDouble(env, bridgeResult->jitter));
+            putInHashMap(env, result, "totalPackets", createLong(env, bridgeResult->packets));
+            putInHashMap(env, result, "lostPackets", createLong(env, bridgeResult->lostPackets));
+            putInHashMap(env, result, "lostPercent", createDouble(env, bridgeResult->lostPercent));
+        }
+        if (bridgeResult->peakBitsPerSecond > 0) {
+            putInHashMap(env, result, "peakBitsPerSecond", createDouble(env, bridgeResult->peakBitsPerSecond));
+            putInHashMap(env, result, "burstCv", createDouble(env, bridgeResult->burstCv));
+            putInHashMap(env, result, "stalls", createLong(env, bridgeResult->stalls));
+            putInHashMap(env, result, "stallMs", createLong(env, bridgeResult->stallMs));
+            putInHashMap(env, result, "longestStallMs", createLong(env, bridgeResult->longestStallMs));
+        }
+        if (bridgeResult->microburstBuckets) {
+            jsize count = (jsize)bridgeResult->microburstBucketCount;
+            jlongArray buckets = env->NewLongArray(count);
+            if (buckets) {
+                env->SetLongArrayRegion(buckets, 0, count,
+                                        reinterpret_cast<const jlong*>(bridgeResult->microburstBuckets));
+                putInHashMap(env, result, "microburstBuckets", buckets);
+                putInHashMap(env, result, "microburstFirstBucket",
+                             createLong(env, (jlong)bridgeResult->microburstFirstBucket));
+            }
+        }
+        if (bridgeResult->convergeStop != IPERF3_CONVERGE_OFF) {
+            // As iperf's JSON names them
+            static const char* const stops[] = { "off", "converged", "max_duration", "interrupted" };
+            putInHashMap(env, result, "convergeStop", env->NewStringUTF(stops[bridgeResult->convergeStop]));
+            putInHashMap(env, result, "convergeRelativeCi", createDouble(env, bridgeResult->convergeRelativeCi));
+        }
+        if (bridgeResult->rampStop != IPERF3_RAMP_OFF) {
+            static const char* const stops[] = { "off", "saturated", "cpu", "max_streams", "ended" };
+            putInHashMap(env, result, "rampStop", env->NewStringUTF(stops[bridgeResult->rampStop]));
+            putInHashMap(env, result, "rampSaturationStreams", createLong(env, bridgeResult->rampSaturationStreams));
+            jsize count = (jsize)bridgeResult->rampStepCount;
+            jdoubleArray curve = env->NewDoubleArray(count);
+            if (curve) {
+                if (count > 0) {
+                    env->SetDoubleArrayRegion(curve, 0, count, bridgeResult->rampBitsPerSecond);
+                }
+                putInHashMap(env, result, "rampBitsPerSecond", curve);
+            }
         }
 
         if (bridgeResult->jsonOutput) {
-            LOGD("JNI: Adding JSON output");
-            putInHashMap(env, result, "jsonOutput", env->NewStringUTF(bridgeResult->jsonOutput));
+            // A direct buffer over the native JSON: no copy and no UTF-16 transcoding.
+            // It stays valid until the result is released with nativeReleaseResult.
+            LOGD("JNI: Adding JSON output buffer (%zu bytes)", bridgeResult->jsonOutputLength);
+            putInHashMap(env, result, "jsonBuffer",
+                         env->NewDirectByteBuffer(bridgeResult->jsonOutput,
+                                                  (jlong)bridgeResult->jsonOutputLength));
         }
     } else {
         LOGE("JNI: Test failed with error code %d", bridgeResult->errorCode);
@@ -159,43 +367,464 @@ Java_com_example_hello_1world_1app_Iperf3Bridge_nativeRunClient(
         putInHashMap(env, result, "errorCode", createInteger(env, bridgeResult->errorCode));
     }
 
-    // Clean up
-    LOGD("JNI: Cleaning up bridge result...");
-    iperf3_free_result(bridgeResult);
+    return result;
+}
+
+static Iperf3Session* sessionFromHandle(jlong handle) {
+    return reinterpret_cast<Iperf3Session*>(static_cast<intptr_t>(handle));
+}
+
+static jlong handleFromSession(Iperf3Session* session) {
+    return static_cast<jlong>(reinterpret_cast<intptr_t>(session));
+}
+
+// JNI function: Create an iperf3 client session; returns 0 on failure
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeCreateClient(
+        JNIEnv* env,
+        jobject thiz,
+        jstring host,
+        jint port,
+        jint duration,
+        jint parallel,
+        jboolean reverse,
+        jboolean useUdp,
+        jlong bandwidth,
+        jboolean includeJson,
+        jint microburstStallMs,
+        jboolean keepMicroburstBuckets,
+        jint convergeMinSeconds,
+        jdouble convergeTolerance,
+        jboolean rampStreams,
+        jdouble rampGain) {
+
+    const char* hostStr = env->GetStringUTFChars(host, nullptr);
 
-    LOGI("JNI: nativeRunClient completed, returning result");
+    LOGI("JNI: nativeCreateClient called");
+    LOGI("JNI: Parameters - host=%s, port=%d, duration=%d, parallel=%d, reverse=%s, protocol=%s, bandwidth=%lld",
+         hostStr, port, duration, parallel,
+         reverse == JNI_TRUE ? "true" : "false",
+         useUdp == JNI_TRUE ? "UDP" : "TCP",
+         (long long)bandwidth);
+
+    Iperf3ClientConfig config = {};
+    config.host = hostStr;
+    config.port = port;
+    config.duration = duration;
+    config.parallel = parallel;
+    config.reverse = reverse == JNI_TRUE;
+    config.useUdp = useUdp == JNI_TRUE;
+    config.bandwidth = bandwidth;
+    config.includeJson = includeJson == JNI_TRUE;
+    config.microburstStallMs = microburstStallMs;
+    config.keepMicroburstBuckets = keepMicroburstBuckets == JNI_TRUE;
+    config.convergeMinSeconds = convergeMinSeconds;
+    config.convergeTolerance = convergeTolerance;
+    config.rampStreams = rampStreams == JNI_TRUE;
+    config.rampGain = rampGain;
+    Iperf3Session* session = iperf3_session_create_client(&config);
+
+    env->ReleaseStringUTFChars(host, hostStr);
+    return handleFromSession(session);
+}
+
+// JNI function: Run a session on the calling thread, reporting progress to this bridge
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeRunSession(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle,
+        jint framesPerSecond) {
+
+    Iperf3Session* session = sessionFromHandle(handle);
+    if (!session) {
+        return resultToHashMap(env, nullptr);
+    }
+
+    // Progress is queued by the test and handed to Kotlin from the session's
+    // delivery thread, so a slow handler never holds up the measurement.
+    // Run flushes and joins that thread before it returns.
+    ProgressContext progressCtx = {env->NewGlobalRef(thiz), gJni.onProgressBatch};
+    iperf3_session_set_interval_callback(session, intervalCallback, &progressCtx);
+    if (!iperf3_session_set_async_delivery(session, framesPerSecond, 0)) {
+        LOGW("JNI: Delivering progress on the test thread");
+    }
+
+    LOGD("JNI: Calling iperf3_session_run...");
+    Iperf3Result* bridgeResult = iperf3_session_run(session);
+    LOGD("JNI: iperf3_session_run returned");
+    iperf3_session_set_interval_callback(session, nullptr, nullptr);
+    releaseProgressArrays(env, &progressCtx);
+    env->DeleteGlobalRef(progressCtx.bridge);
+
+    Iperf3DeliveryStats deliveryStats = {};
+    iperf3_session_get_delivery_stats(session, &deliveryStats);
+    LOGI("JNI: Progress delivered %lld, coalesced %lld, dropped %lld",
+         deliveryStats.delivered, deliveryStats.coalesced, deliveryStats.dropped);
+
+    // Detach the result so its JSON buffer can outlive the session
+    if (bridgeResult) {
+        bridgeResult = iperf3_session_take_result(session);
+    }
+    jobject result = resultToHashMap(env, bridgeResult);
+    if (bridgeResult) {
+        putInHashMap(env, result, "resultHandle",
+                     createLong(env, static_cast<jlong>(reinterpret_cast<intptr_t>(bridgeResult))));
+    }
+    putInHashMap(env, result, "progressDelivered", createLong(env, deliveryStats.delivered));
+    putInHashMap(env, result, "progressCoalesced", createLong(env, deliveryStats.coalesced));
+    putInHashMap(env, result, "progressDropped", createLong(env, deliveryStats.dropped));
+    LOGI("JNI: nativeRunSession completed, returning result");
     return result;
 }
 
-// JNI function: Cancel iperf3 client
+// JNI function: Release a result returned by nativeRunSession, and its JSON buffer
 extern "C" JNIEXPORT void JNICALL
-Java_com_example_hello_1world_1app_Iperf3Bridge_nativeCancelClient(
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeReleaseResult(
         JNIEnv* env,
-        jobject thiz) {
-    LOGI("JNI: nativeCancelClient called");
-    iperf3_request_client_cancel();
+        jobject thiz,
+        jlong handle) {
+    iperf3_free_result(reinterpret_cast<Iperf3Result*>(static_cast<intptr_t>(handle)));
 }
 
-// JNI function: Start iperf3 server
-extern "C" JNIEXPORT jboolean JNICALL
+// JNI function: Cancel a session; safe from any thread while it runs
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeCancelSession(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle) {
+    LOGI("JNI: nativeCancelSession called");
+    iperf3_session_cancel(sessionFromHandle(handle));
+}
+
+// JNI function: Free a session and its result, stopping it first if needed
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeFreeSession(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle) {
+    iperf3_session_free(sessionFromHandle(handle));
+}
+
+// JNI function: Start an iperf3 server on its own thread; returns 0 on failure
+extern "C" JNIEXPORT jlong JNICALL
 Java_com_example_hello_1world_1app_Iperf3Bridge_nativeStartServer(
         JNIEnv* env,
         jobject thiz,
         jint port,
         jboolean useUdp) {
 
-    bool success = iperf3_start_server_test(port, useUdp == JNI_TRUE);
-    return success ? JNI_TRUE : JNI_FALSE;
+    Iperf3Session* session = iperf3_session_create_server(port, useUdp == JNI_TRUE);
+    if (!session) {
+        return 0;
+    }
+    if (iperf3_session_get_state(session) != IPERF3_SESSION_CREATED ||
+        !iperf3_session_start(session)) {
+        iperf3_session_free(session);
+        return 0;
+    }
+    return handleFromSession(session);
 }
 
-// JNI function: Stop iperf3 server
+// JNI function: Stop an iperf3 server and free its session
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_example_hello_1world_1app_Iperf3Bridge_nativeStopServer(
         JNIEnv* env,
-        jobject thiz) {
+        jobject thiz,
+        jlong handle) {
+
+    Iperf3Session* session = sessionFromHandle(handle);
+    if (!session) {
+        return JNI_FALSE;
+    }
+    iperf3_session_free(session);
+    return JNI_TRUE;
+}
+
+static double elapsedNs(const timespec& from, const timespec& to) {
+    return (to.tv_sec - from.tv_sec) * 1e9 + (to.tv_nsec - from.tv_nsec);
+}
+
+// JNI function: Measure what one progress event costs to deliver.  Pushes
+// synthetic intervals with the given stream count through the same path as
+// a run, one every intervalMs like a test with that reporting interval, and
+// Kotlin decodes each like a real one without forwarding it.  Returns the
+// mean, median, 99th percentile and maximum wall time per event in ns.
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeBenchmarkProgress(
+        JNIEnv* env,
+        jobject thiz,
+        jint events,
+        jint streams,
+        jint intervalMs) {
+
+    if (events <= 0 || streams <= 0) {
+        return nullptr;
+    }
+    std::vector<Iperf3StreamProgress> streamProgress(streams);
+    for (int i = 0; i < streams; i++) {
+        Iperf3StreamProgress& stream = streamProgress[i];
+        stream = {};
+        stream.id = i + 1;
+        stream.sender = true;
+        stream.cwnd = 64 * 1024;
+        stream.rtt = 1.5;
+    }
+    Iperf3IntervalProgress progress = {};
+    progress.streamCount = streams;
+    progress.streams = streamProgress.data();
+
+    // Delivered synchronously: this measures the JNI crossing, not the ring
+    ProgressContext ctx = {thiz, gJni.onBenchmarkBatch};
+    std::vector<double> samples(events);
+    double interval = intervalMs / 1000.0;
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int i = 0; i < events; i++) {
+        // Pace the events so caches and the JIT see what a real run gives them
+        next.tv_nsec += (long)intervalMs * 1000000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+
+        progress.interval = i + 1;
+        progress.start = i * interval;
+        progress.end = (i + 1) * interval;
+        for (Iperf3StreamProgress& stream : streamProgress) {
+            stream.bytes = 1250000 + i;
+            stream.seconds = interval;
+            stream.bitsPerSecond = stream.bytes * 8 / interval;
+        }
+        progress.sum = streamProgress[0];
+        progress.sum.id = 0;
+
+        timespec before, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        deliverInterval(env, &ctx, &progress);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        samples[i] = elapsedNs(before, after);
+    }
+    releaseProgressArrays(env, &ctx);
+
+    double total = 0;
+    for (double sample : samples) {
+        total += sample;
+    }
+    std::sort(samples.begin(), samples.end());
+    jdouble stats[4] = {
+        total / events,
+        samples[events / 2],
+        samples[(size_t)(events - 1) * 99 / 100],
+        samples[events - 1],
+    };
+    LOGI("JNI: progress delivery, %d streams every %d ms: mean %.0f ns, p50 %.0f ns, p99 %.0f ns, max %.0f ns",
+         streams, intervalMs, stats[0], stats[1], stats[2], stats[3]);
+    jdoubleArray result = env->NewDoubleArray(4);
+    if (result) {
+        env->SetDoubleArrayRegion(result, 0, 4, stats);
+    }
+    return result;
+}
+
+static Iperf3SelfTest* selfTestFromHandle(jlong handle) {
+    return reinterpret_cast<Iperf3SelfTest*>(static_cast<intptr_t>(handle));
+}
+
+// JNI function: Create a loopback self-test; returns 0 on failure
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeCreateSelfTest(
+        JNIEnv* env,
+        jobject thiz,
+        jint port,
+        jint duration) {
+    return static_cast<jlong>(reinterpret_cast<intptr_t>(iperf3_selftest_create(port, duration)));
+}
 
-    bool success = iperf3_stop_server_test();
-    return success ? JNI_TRUE : JNI_FALSE;
+// JNI function: Run a self-test on the calling thread.  Returns the best
+// TCP and UDP figures, with every run in "runs".
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeRunSelfTest(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle) {
+
+    jobject result = createHashMap(env);
+    const Iperf3SelfTestResult* selfTest = iperf3_selftest_run(selfTestFromHandle(handle));
+    if (!selfTest) {
+        putInHashMap(env, result, "success", createBoolean(env, false));
+        putInHashMap(env, result, "error", env->NewStringUTF("No self-test result"));
+        putInHashMap(env, result, "errorCode", createInteger(env, -1));
+        return result;
+    }
+
+    putInHashMap(env, result, "success", createBoolean(env, selfTest->success));
+    putInHashMap(env, result, "tcpBitsPerSecond", createDouble(env, selfTest->tcpBitsPerSecond));
+    putInHashMap(env, result, "tcpCpuPerGbps", createDouble(env, selfTest->tcpCpuPerGbps));
+    putInHashMap(env, result, "tcpPps", createDouble(env, selfTest->tcpPps));
+    putInHashMap(env, result, "udpBitsPerSecond", createDouble(env, selfTest->udpBitsPerSecond));
+    putInHashMap(env, result, "udpCpuPerGbps", createDouble(env, selfTest->udpCpuPerGbps));
+    putInHashMap(env, result, "udpPps", createDouble(env, selfTest->udpPps));
+    putInHashMap(env, result, "udpLostPercent", createDouble(env, selfTest->udpLostPercent));
+    if (selfTest->errorMessage) {
+        putInHashMap(env, result, "error", env->NewStringUTF(selfTest->errorMessage));
+        putInHashMap(env, result, "errorCode", createInteger(env, selfTest->errorCode));
+    }
+
+    jobject runs = env->NewObject(gJni.arrayListClass, gJni.arrayListInit);
+    for (int i = 0; i < selfTest->runCount; i++) {
+        const Iperf3SelfTestRun* run = &selfTest->runs[i];
+        jobject item = createHashMap(env);
+        putInHashMap(env, item, "useUdp", createBoolean(env, run->useUdp));
+        putInHashMap(env, item, "parallel", createInteger(env, run->parallel));
+        putInHashMap(env, item, "success", createBoolean(env, run->success));
+        putInHashMap(env, item, "bitsPerSecond", createDouble(env, run->bitsPerSecond));
+        putInHashMap(env, item, "cpuPercent", createDouble(env, run->cpuPercent));
+        putInHashMap(env, item, "pps", createDouble(env, run->pps));
+        putInHashMap(env, item, "lostPercent", createDouble(env, run->lostPercent));
+        putInHashMap(env, item, "errorCode", createInteger(env, run->errorCode));
+        env->CallBooleanMethod(runs, gJni.arrayListAdd, item);
+        env->DeleteLocalRef(item);
+    }
+    putInHashMap(env, result, "runs", runs);
+    return result;
+}
+
+// JNI function: Cancel a self-test; safe from any thread while it runs
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeCancelSelfTest(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle) {
+    iperf3_selftest_cancel(selfTestFromHandle(handle));
+}
+
+// JNI function: Free a self-test once its run has returned
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeFreeSelfTest(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle) {
+    iperf3_selftest_free(selfTestFromHandle(handle));
+}
+
+static Iperf3Search* searchFromHandle(jlong handle) {
+    return reinterpret_cast<Iperf3Search*>(static_cast<intptr_t>(handle));
+}
+
+// JNI function: Create a UDP lossless-rate search; returns 0 on failure
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeCreateSearch(
+        JNIEnv* env,
+        jobject thiz,
+        jstring host,
+        jint port,
+        jint trialSeconds,
+        jboolean reverse,
+        jlong maxBandwidth,
+        jdouble lossTolerance,
+        jintArray blockSizes) {
+
+    jsize blockSizeCount = blockSizes ? env->GetArrayLength(blockSizes) : 0;
+    if (blockSizeCount > IPERF3_SEARCH_MAX_BLOCK_SIZES) {
+        return 0;
+    }
+    jint blocks[IPERF3_SEARCH_MAX_BLOCK_SIZES];
+    if (blockSizeCount > 0) {
+        env->GetIntArrayRegion(blockSizes, 0, blockSizeCount, blocks);
+    }
+    int blockSizeValues[IPERF3_SEARCH_MAX_BLOCK_SIZES];
+    for (jsize i = 0; i < blockSizeCount; i++) {
+        blockSizeValues[i] = blocks[i];
+    }
+
+    const char* hostStr = env->GetStringUTFChars(host, nullptr);
+    Iperf3SearchConfig config = {};
+    config.host = hostStr;
+    config.port = port;
+    config.trialSeconds = trialSeconds;
+    config.reverse = reverse;
+    config.maxBandwidth = static_cast<long>(maxBandwidth);
+    config.lossTolerance = lossTolerance;
+    config.blockSizes = blockSizeValues;
+    config.blockSizeCount = blockSizeCount;
+    Iperf3Search* search = iperf3_search_create(&config);
+    env->ReleaseStringUTFChars(host, hostStr);
+    return static_cast<jlong>(reinterpret_cast<intptr_t>(search));
+}
+
+// JNI function: Run a search on the calling thread.  Returns the highest
+// passing rate per block size in "blockResults", with every trial in
+// "trials".
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeRunSearch(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle) {
+
+    jobject result = createHashMap(env);
+    const Iperf3SearchResult* search = iperf3_search_run(searchFromHandle(handle));
+    if (!search) {
+        putInHashMap(env, result, "success", createBoolean(env, false));
+        putInHashMap(env, result, "error", env->NewStringUTF("No search result"));
+        putInHashMap(env, result, "errorCode", createInteger(env, -1));
+        return result;
+    }
+
+    putInHashMap(env, result, "success", createBoolean(env, search->success));
+    if (search->errorMessage) {
+        putInHashMap(env, result, "error", env->NewStringUTF(search->errorMessage));
+        putInHashMap(env, result, "errorCode", createInteger(env, search->errorCode));
+    }
+
+    jobject blockResults = env->NewObject(gJni.arrayListClass, gJni.arrayListInit);
+    for (int i = 0; i < search->blockResultCount; i++) {
+        const Iperf3SearchBlockResult* block = &search->blockResults[i];
+        jobject item = createHashMap(env);
+        putInHashMap(env, item, "blockSize", createInteger(env, block->blockSize));
+        putInHashMap(env, item, "maxBitsPerSecond", createDouble(env, block->maxBitsPerSecond));
+        putInHashMap(env, item, "trialCount", createInteger(env, block->trialCount));
+        env->CallBooleanMethod(blockResults, gJni.arrayListAdd, item);
+        env->DeleteLocalRef(item);
+    }
+    putInHashMap(env, result, "blockResults", blockResults);
+
+    jobject trials = env->NewObject(gJni.arrayListClass, gJni.arrayListInit);
+    for (int i = 0; i < search->trialCount; i++) {
+        const Iperf3SearchTrial* trial = &search->trials[i];
+        jobject item = createHashMap(env);
+        putInHashMap(env, item, "blockSize", createInteger(env, trial->blockSize));
+        putInHashMap(env, item, "offeredBitsPerSecond", createDouble(env, trial->offeredBitsPerSecond));
+        putInHashMap(env, item, "receivedBitsPerSecond", createDouble(env, trial->receivedBitsPerSecond));
+        putInHashMap(env, item, "packets", createLong(env, trial->packets));
+        putInHashMap(env, item, "lostPackets", createLong(env, trial->lostPackets));
+        putInHashMap(env, item, "lostPercent", createDouble(env, trial->lostPercent));
+        putInHashMap(env, item, "jitter", createDouble(env, trial->jitter));
+        putInHashMap(env, item, "passed", createBoolean(env, trial->passed));
+        env->CallBooleanMethod(trials, gJni.arrayListAdd, item);
+        env->DeleteLocalRef(item);
+    }
+    putInHashMap(env, result, "trials", trials);
+    return result;
+}
+
+// JNI function: Cancel a search; safe from any thread while it runs
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeCancelSearch(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle) {
+    iperf3_search_cancel(searchFromHandle(handle));
+}
+
+// JNI function: Free a search once its run has returned
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_hello_1world_1app_Iperf3Bridge_nativeFreeSearch(
+        JNIEnv* env,
+        jobject thiz,
+        jlong handle) {
+    iperf3_search_free(searchFromHandle(handle));
 }
 
 // JNI function: Get iperf3 version
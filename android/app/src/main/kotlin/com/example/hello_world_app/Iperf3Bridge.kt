@@ -1,5 +1,32 @@
 package com.example.hello_world_app
 
+import java.io.Closeable
+import java.nio.ByteBuffer
+
+// Result of one client run. json is a direct buffer over the JSON the native
+// test rendered, read in place; it is only valid until the result is closed.
+class Iperf3ClientResult internal constructor(
+    val values: Map<String, Any>,
+    val json: ByteBuffer?,
+    private val handle: Long,
+    private val bridge: Iperf3Bridge
+) : Closeable {
+    private var released = false
+
+    // One copy, for callers such as a platform channel that need a ByteArray
+    fun jsonBytes(): ByteArray? = json?.let { buffer ->
+        ByteArray(buffer.remaining()).also { buffer.duplicate().get(it) }
+    }
+
+    @Synchronized
+    override fun close() {
+        if (!released && handle != 0L) {
+            released = true
+            bridge.releaseResult(handle)
+        }
+    }
+}
+
 class Iperf3Bridge(private val progressHandler: Iperf3ProgressHandler?) {
     companion object {
         init {
@@ -8,26 +35,76 @@ class Iperf3Bridge(private val progressHandler: Iperf3ProgressHandler?) {
         }
     }
 
-    // Store reference for native callbacks
-    private var nativeHandle: Long = 0
+    // Native session handles, so cancel and stop never touch a freed session.
+    // Clients are keyed by handle, servers by port.
+    private val sessionLock = Any()
+    private val activeClients = mutableSetOf<Long>()
+    private val servers = mutableMapOf<Int, Long>()
+    private val activeSelfTests = mutableSetOf<Long>()
+    private val activeSearches = mutableSetOf<Long>()
+
+    // Progress reaches onProgressBatch from a native delivery thread at most
+    // this many times a second; newer intervals replace ones not yet sent.
+    // 0 sends every interval.
+    @Volatile
+    var progressFramesPerSecond: Int = 30
 
     // Native method declarations - these will be implemented in C/C++ via JNI
-    private external fun nativeRunClient(
+    private external fun nativeCreateClient(
         host: String,
         port: Int,
         duration: Int,
         parallel: Int,
         reverse: Boolean,
         useUdp: Boolean,
-        bandwidth: Long
-    ): Map<String, Any>
+        bandwidth: Long,
+        includeJson: Boolean,
+        microburstStallMs: Int,
+        keepMicroburstBuckets: Boolean,
+        convergeMinSeconds: Int,
+        convergeTolerance: Double,
+        rampStreams: Boolean,
+        rampGain: Double
+    ): Long
 
-    private external fun nativeCancelClient()
-    private external fun nativeStartServer(port: Int, useUdp: Boolean): Boolean
-    private external fun nativeStopServer(): Boolean
+    private external fun nativeRunSession(handle: Long, framesPerSecond: Int): Map<String, Any>
+    private external fun nativeReleaseResult(handle: Long)
+    private external fun nativeCancelSession(handle: Long)
+    private external fun nativeFreeSession(handle: Long)
+    private external fun nativeStartServer(port: Int, useUdp: Boolean): Long
+    private external fun nativeStopServer(handle: Long): Boolean
     private external fun nativeGetVersion(): String
+    private external fun nativeCreateSelfTest(port: Int, duration: Int): Long
+    private external fun nativeRunSelfTest(handle: Long): Map<String, Any>
+    private external fun nativeCancelSelfTest(handle: Long)
+    private external fun nativeFreeSelfTest(handle: Long)
+    private external fun nativeCreateSearch(
+        host: String,
+        port: Int,
+        trialSeconds: Int,
+        reverse: Boolean,
+        maxBandwidth: Long,
+        lossTolerance: Double,
+        blockSizes: IntArray
+    ): Long
+    private external fun nativeRunSearch(handle: Long): Map<String, Any>
+    private external fun nativeCancelSearch(handle: Long)
+    private external fun nativeFreeSearch(handle: Long)
+    private external fun nativeBenchmarkProgress(events: Int, streams: Int, intervalMs: Int): DoubleArray?
 
     // Kotlin wrapper methods
+
+    // Runs one client test on the calling thread. Several may run at once
+    // from different threads, each in its own native session. The summary
+    // comes back in values; iperf's full JSON only when includeJson is set.
+    // With microburstStallMs, values also carry the 1 ms bucket figures, and
+    // with keepMicroburstBuckets the buckets themselves as a LongArray.
+    // With convergeMinSeconds the test ends once its throughput has settled,
+    // duration at the latest, and values say why and how closely.
+    // With rampStreams it sends on one stream at first and adds streams up
+    // to parallel while each adds enough; values then carry the curve as a
+    // DoubleArray and where it saturated.
+    // Close the result when done with it to free the native JSON.
     fun runClient(
         host: String,
         port: Int,
@@ -35,49 +112,258 @@ class Iperf3Bridge(private val progressHandler: Iperf3ProgressHandler?) {
         parallel: Int,
         reverse: Boolean,
         useUdp: Boolean = false,
-        bandwidthBps: Long = 0  // Bandwidth in bits/sec (0 = use iperf3 default)
-    ): Map<String, Any> {
-        return nativeRunClient(host, port, duration, parallel, reverse, useUdp, bandwidthBps)
+        bandwidthBps: Long = 0,  // Bandwidth in bits/sec (0 = use iperf3 default)
+        includeJson: Boolean = false,
+        microburstStallMs: Int = 0,  // 0 = no 1 ms buckets
+        keepMicroburstBuckets: Boolean = false,
+        convergeMinSeconds: Int = 0,  // 0 = always run for duration
+        convergeTolerance: Double = 0.0,  // a fraction; 0 = 5%
+        rampStreams: Boolean = false,
+        rampGain: Double = 0.0  // a fraction; 0 = 10%
+    ): Iperf3ClientResult {
+        val handle = nativeCreateClient(
+            host, port, duration, parallel, reverse, useUdp, bandwidthBps, includeJson,
+            microburstStallMs, keepMicroburstBuckets, convergeMinSeconds, convergeTolerance,
+            rampStreams, rampGain
+        )
+        if (handle == 0L) {
+            return Iperf3ClientResult(
+                mapOf("success" to false, "error" to "Failed to create iperf3 session", "errorCode" to -1),
+                null, 0L, this
+            )
+        }
+        synchronized(sessionLock) { activeClients.add(handle) }
+        val values = try {
+            nativeRunSession(handle, progressFramesPerSecond)
+        } finally {
+            synchronized(sessionLock) { activeClients.remove(handle) }
+            nativeFreeSession(handle)
+        }
+        val resultHandle = (values["resultHandle"] as? Long) ?: 0L
+        return Iperf3ClientResult(
+            values - "resultHandle" - "jsonBuffer",
+            values["jsonBuffer"] as? ByteBuffer,
+            resultHandle,
+            this
+        )
+    }
+
+    internal fun releaseResult(handle: Long) {
+        nativeReleaseResult(handle)
     }
 
+    // Cancels every client test currently running
     fun cancelClient() {
-        nativeCancelClient()
+        synchronized(sessionLock) {
+            activeClients.forEach { nativeCancelSession(it) }
+        }
     }
 
     fun startServer(port: Int, useUdp: Boolean = false): Boolean {
-        return nativeStartServer(port, useUdp)
+        synchronized(sessionLock) {
+            if (servers.containsKey(port)) {
+                return false // Server already running on this port
+            }
+            val handle = nativeStartServer(port, useUdp)
+            if (handle == 0L) {
+                return false
+            }
+            servers[port] = handle
+            return true
+        }
+    }
+
+    // Stops the server on the given port, or every server when port is null
+    fun stopServer(port: Int? = null): Boolean {
+        val handles = synchronized(sessionLock) {
+            if (port != null) {
+                listOfNotNull(servers.remove(port))
+            } else {
+                servers.values.toList().also { servers.clear() }
+            }
+        }
+        handles.forEach { nativeStopServer(it) }
+        return handles.isNotEmpty()
+    }
+
+    // Measures what this device's own stack can move: a server and clients
+    // in this process over loopback, TCP and UDP at several stream counts.
+    // Blocks for about six times duration seconds. The best run of each
+    // protocol is in values, every run in "runs".
+    fun selfTest(port: Int = 0, duration: Int = 3): Map<String, Any> {
+        val handle = nativeCreateSelfTest(port, duration)
+        if (handle == 0L) {
+            return mapOf("success" to false, "error" to "Failed to create self-test", "errorCode" to -1)
+        }
+        synchronized(sessionLock) { activeSelfTests.add(handle) }
+        try {
+            return nativeRunSelfTest(handle)
+        } finally {
+            synchronized(sessionLock) { activeSelfTests.remove(handle) }
+            nativeFreeSelfTest(handle)
+        }
+    }
+
+    // Cancels every self-test currently running
+    fun cancelSelfTest() {
+        synchronized(sessionLock) {
+            activeSelfTests.forEach { nativeCancelSelfTest(it) }
+        }
     }
 
-    fun stopServer(): Boolean {
-        return nativeStopServer()
+    // Searches for the highest UDP rate up to maxBandwidth (0 for 1 Gbit/s)
+    // that loses at most lossTolerance percent, in trials of trialSeconds
+    // (0 for 2) picked by binary search, at each of blockSizes (none for
+    // iperf's default). Blocks until every trial has run. The highest
+    // passing rates are in "blockResults", every trial in "trials".
+    fun udpSearch(
+        host: String,
+        port: Int,
+        trialSeconds: Int = 0,
+        reverse: Boolean = false,
+        maxBandwidth: Long = 0,
+        lossTolerance: Double = 0.0,
+        blockSizes: IntArray = IntArray(0)
+    ): Map<String, Any> {
+        val handle = nativeCreateSearch(host, port, trialSeconds, reverse, maxBandwidth, lossTolerance, blockSizes)
+        if (handle == 0L) {
+            return mapOf("success" to false, "error" to "Failed to create search", "errorCode" to -1)
+        }
+        synchronized(sessionLock) { activeSearches.add(handle) }
+        try {
+            return nativeRunSearch(handle)
+        } finally {
+            synchronized(sessionLock) { activeSearches.remove(handle) }
+            nativeFreeSearch(handle)
+        }
+    }
+
+    // Cancels every search currently running
+    fun cancelUdpSearch() {
+        synchronized(sessionLock) {
+            activeSearches.forEach { nativeCancelSearch(it) }
+        }
     }
 
     fun getVersion(): String {
         return nativeGetVersion()
     }
 
-    // Called from JNI to send progress updates
-    // RTT is for TCP, jitter is for UDP
+    // Times progress delivery from native code to a decoded map, with
+    // intervals of the given stream count arriving every intervalMs.
+    // Returns mean, median, p99 and max nanoseconds per event.
+    fun benchmarkProgress(events: Int = 1000, streams: Int = 1, intervalMs: Int = 10): Map<String, Any> {
+        val stats = nativeBenchmarkProgress(events, streams, intervalMs)
+            ?: return mapOf("success" to false)
+        return mapOf(
+            "success" to true,
+            "events" to events,
+            "streams" to streams,
+            "intervalMs" to intervalMs,
+            "meanNs" to stats[0],
+            "medianNs" to stats[1],
+            "p99Ns" to stats[2],
+            "maxNs" to stats[3],
+            // Share of each reporting interval spent delivering its event
+            "intervalShare" to if (intervalMs > 0) stats[0] / (intervalMs * 1e6) else 0.0
+        )
+    }
+
+    // Called from JNI on a session's delivery thread once per delivered
+    // interval, packed as described by Iperf3ProgressBatch. The arrays are
+    // reused for the next interval, so they must not be kept.
+    @Suppress("unused")
+    fun onProgressBatch(longs: LongArray, doubles: DoubleArray) {
+        val progressData = Iperf3ProgressBatch(longs, doubles).toProgressData()
+        progressHandler?.sendProgress(progressData)
+    }
+
+    // Same as onProgressBatch, for benchmark events that go nowhere
     @Suppress("unused")
-    fun onProgress(interval: Int, bytesTransferred: Long, bitsPerSecond: Double, jitter: Double, lostPackets: Int, rtt: Double) {
+    fun onBenchmarkBatch(longs: LongArray, doubles: DoubleArray) {
+        Iperf3ProgressBatch(longs, doubles).toProgressData()
+    }
+}
+
+// One interval as packed by iperf3_jni.cpp: a header, then records for the
+// sum, the reverse sum and each stream. Record 0 is the sum.
+class Iperf3ProgressBatch(private val longs: LongArray, private val doubles: DoubleArray) {
+    companion object {
+        const val HEADER_LONGS = 5     // interval, omitted, bidirectional, streamCount, timestampNs
+        const val HEADER_DOUBLES = 2   // start, end
+        const val RECORD_LONGS = 11    // id, sender, bytes, retransmits, cwnd, packets, lostPackets, outOfOrder,
+                                       // stalls, stallMs, longestStallMs
+        const val RECORD_DOUBLES = 7   // seconds, bitsPerSecond, rtt, rttVar, jitter, peakBitsPerSecond, burstCv
+        const val SUM = 0
+        const val SUM_REVERSE = 1
+        const val FIRST_STREAM = 2
+    }
+
+    val interval: Int get() = longs[0].toInt()
+    val omitted: Boolean get() = longs[1] != 0L
+    val bidirectional: Boolean get() = longs[2] != 0L
+    val streamCount: Int get() = longs[3].toInt()
+    // CLOCK_MONOTONIC (System.nanoTime()) when iperf reported the interval
+    val timestampNs: Long get() = longs[4]
+    val start: Double get() = doubles[0]
+    val end: Double get() = doubles[1]
+
+    private fun long(record: Int, field: Int) = longs[HEADER_LONGS + record * RECORD_LONGS + field]
+    private fun double(record: Int, field: Int) = doubles[HEADER_DOUBLES + record * RECORD_DOUBLES + field]
+
+    fun id(record: Int) = long(record, 0).toInt()
+    fun sender(record: Int) = long(record, 1) != 0L
+    fun bytes(record: Int) = long(record, 2)
+    fun retransmits(record: Int) = long(record, 3)
+    fun cwnd(record: Int) = long(record, 4)
+    fun packets(record: Int) = long(record, 5)
+    fun lostPackets(record: Int) = long(record, 6)
+    fun outOfOrder(record: Int) = long(record, 7)
+    fun stalls(record: Int) = long(record, 8)
+    fun stallMs(record: Int) = long(record, 9)
+    fun longestStallMs(record: Int) = long(record, 10)
+    fun seconds(record: Int) = double(record, 0)
+    fun bitsPerSecond(record: Int) = double(record, 1)
+    fun rtt(record: Int) = double(record, 2)
+    fun rttVar(record: Int) = double(record, 3)
+    fun jitter(record: Int) = double(record, 4)
+    fun peakBitsPerSecond(record: Int) = double(record, 5)
+    fun burstCv(record: Int) = double(record, 6)
+
+    // The map sent to Flutter for each interval
+    // RTT is for TCP, jitter is for UDP
+    fun toProgressData(): Map<String, Any> {
+        val bitsPerSecond = bitsPerSecond(SUM)
         val progressData = mutableMapOf<String, Any>(
             "interval" to interval,
-            "bytesTransferred" to bytesTransferred,
+            "bytesTransferred" to bytes(SUM),
             "bitsPerSecond" to bitsPerSecond,
-            "mbps" to (bitsPerSecond / 1000000.0)
+            "mbps" to (bitsPerSecond / 1000000.0),
+            "timestampNs" to timestampNs
         )
 
         // Add protocol-specific metrics
+        val rtt = rtt(SUM)
         if (rtt > 0) {
             // TCP mode: include RTT
             progressData["rtt"] = rtt
         }
+        val jitter = jitter(SUM)
         if (jitter > 0) {
             // UDP mode: include jitter
             progressData["jitter"] = jitter
-            progressData["lostPackets"] = lostPackets
+            progressData["lostPackets"] = lostPackets(SUM).toInt()
+        }
+        val peak = peakBitsPerSecond(SUM)
+        if (peak > 0) {
+            // 1 ms buckets were recorded
+            progressData["peakBitsPerSecond"] = peak
+            progressData["burstCv"] = burstCv(SUM)
+            progressData["stalls"] = stalls(SUM)
+            progressData["stallMs"] = stallMs(SUM)
+            progressData["longestStallMs"] = longestStallMs(SUM)
         }
 
-        progressHandler?.sendProgress(progressData)
+        return progressData
     }
 }
@@ -13,6 +13,8 @@ import io.flutter.embedding.engine.FlutterEngine
 import io.flutter.plugin.common.MethodChannel
 import io.flutter.plugin.common.EventChannel
 import kotlinx.coroutines.*
+import org.json.JSONArray
+import org.json.JSONObject
 import java.net.InetAddress
 import java.nio.ByteBuffer
 import java.nio.ByteOrder
@@ -37,6 +39,7 @@ class MainActivity : FlutterActivity() {
     private val TAG = "MainActivity"
     private val CHANNEL = "com.example.hello_world_app/iperf3"
     private val PROGRESS_CHANNEL = "com.example.hello_world_app/iperf3_progress"
+    private val SELF_TEST_PREFS = "iperf3_self_test"
     private var iperf3Bridge: Iperf3Bridge? = null
     private var progressHandler: Iperf3ProgressHandler? = null
     private var currentClientJob: Job? = null
@@ -65,6 +68,13 @@ class MainActivity : FlutterActivity() {
                         is Long -> bw
                         else -> 0L
                     }
+                    val includeJson = call.argument<Boolean>("includeJson") ?: false
+                    val microburstStallMs = call.argument<Int>("microburstStallMs") ?: 0
+                    val keepMicroburstBuckets = call.argument<Boolean>("keepMicroburstBuckets") ?: false
+                    val convergeMinSeconds = call.argument<Int>("convergeMinSeconds") ?: 0
+                    val convergeTolerance = call.argument<Double>("convergeTolerance") ?: 0.0
+                    val rampStreams = call.argument<Boolean>("rampStreams") ?: false
+                    val rampGain = call.argument<Double>("rampGain") ?: 0.0
 
                     Log.i(TAG, "=== iperf3 runClient called from Flutter ===")
                     Log.i(TAG, "Parameters: host=$host, port=$port, duration=$duration, parallel=$parallel")
@@ -84,9 +94,16 @@ class MainActivity : FlutterActivity() {
                         try {
                             progressHandler?.sendStatus("running")
                             Log.d(TAG, "Launching coroutine on IO dispatcher...")
+                            // Any JSON crosses the channel as UTF-8 bytes, copied once
+                            // out of the native buffer, which is released right after
                             val testResult = iperf3Bridge?.runClient(
-                                host, port, duration, parallel, reverse, useUdp, bandwidthBps
-                            )
+                                host, port, duration, parallel, reverse, useUdp, bandwidthBps, includeJson,
+                                microburstStallMs, keepMicroburstBuckets, convergeMinSeconds, convergeTolerance,
+                                rampStreams, rampGain
+                            )?.use { run ->
+                                val jsonBytes = run.jsonBytes()
+                                if (jsonBytes != null) run.values + ("jsonBytes" to jsonBytes) else run.values
+                            }
                             Log.i(TAG, "iperf3 client test completed")
                             val success = (testResult?.get("success") as? Boolean) == true
                             val errorMessage = testResult?.get("error") as? String
@@ -187,14 +204,122 @@ class MainActivity : FlutterActivity() {
                 }
 
                 "stopServer" -> {
-                    try {
-                        val success = iperf3Bridge?.stopServer() ?: false
-                        result.success(success)
-                    } catch (e: Exception) {
-                        result.error("IPERF3_ERROR", "Failed to stop server: ${e.message}", null)
+                    // Stops one server when a port is given, otherwise all of them
+                    val port = call.argument<Int>("port")
+
+                    // Stopping joins the server thread, so keep it off the main thread
+                    ioScope.launch {
+                        try {
+                            val success = iperf3Bridge?.stopServer(port) ?: false
+                            withContext(Dispatchers.Main) {
+                                result.success(success)
+                            }
+                        } catch (e: Exception) {
+                            withContext(Dispatchers.Main) {
+                                result.error("IPERF3_ERROR", "Failed to stop server: ${e.message}", null)
+                            }
+                        }
+                    }
+                }
+
+                "benchmarkProgress" -> {
+                    val events = call.argument<Int>("events") ?: 1000
+                    val streams = call.argument<Int>("streams") ?: 1
+                    val intervalMs = call.argument<Int>("intervalMs") ?: 10
+
+                    // Paced at intervalMs, so this takes events * intervalMs
+                    ioScope.launch {
+                        try {
+                            val stats = iperf3Bridge?.benchmarkProgress(events, streams, intervalMs)
+                            Log.i(TAG, "Progress delivery benchmark: $stats")
+                            withContext(Dispatchers.Main) {
+                                result.success(stats)
+                            }
+                        } catch (e: Exception) {
+                            withContext(Dispatchers.Main) {
+                                result.error("IPERF3_ERROR", "Failed to run benchmark: ${e.message}", null)
+                            }
+                        }
+                    }
+                }
+
+                "selfTest" -> {
+                    val force = call.argument<Boolean>("force") ?: false
+                    val cachedOnly = call.argument<Boolean>("cachedOnly") ?: false
+                    val duration = call.argument<Int>("duration") ?: 3
+
+                    // A device's capacity only changes with its build, so the
+                    // result is kept per build fingerprint (device and OS version)
+                    val cached = if (force) null else loadSelfTest()
+                    if (cached != null) {
+                        result.success(cached + ("cached" to true))
+                        return@setMethodCallHandler
+                    }
+                    if (cachedOnly) {
+                        result.success(mapOf("success" to false, "cached" to false))
+                        return@setMethodCallHandler
+                    }
+                    ioScope.launch {
+                        try {
+                            val selfTest = iperf3Bridge?.selfTest(0, duration)
+                                ?: mapOf("success" to false, "error" to "Bridge not ready")
+                            Log.i(TAG, "Self-test: $selfTest")
+                            if (selfTest["success"] == true) {
+                                saveSelfTest(selfTest)
+                            }
+                            withContext(Dispatchers.Main) {
+                                result.success(selfTest + ("cached" to false))
+                            }
+                        } catch (e: Exception) {
+                            Log.e(TAG, "Exception in self-test: ${e.message}", e)
+                            withContext(Dispatchers.Main + NonCancellable) {
+                                result.error("IPERF3_ERROR", "Failed to run self-test: ${e.message}", null)
+                            }
+                        }
                     }
                 }
 
+                "cancelSelfTest" -> {
+                    iperf3Bridge?.cancelSelfTest()
+                    result.success(true)
+                }
+
+                "udpSearch" -> {
+                    val host = call.argument<String>("host") ?: ""
+                    val port = call.argument<Int>("port") ?: 5201
+                    val trialSeconds = call.argument<Int>("trialSeconds") ?: 0
+                    val reverse = call.argument<Boolean>("reverse") ?: false
+                    val maxBandwidthBps = when (val bw = call.argument<Any>("maxBandwidthBps")) {
+                        is Int -> bw.toLong()
+                        is Long -> bw
+                        else -> 0L
+                    }
+                    val lossTolerance = call.argument<Double>("lossTolerance") ?: 0.0
+                    val blockSizes = call.argument<List<Int>>("blockSizes")?.toIntArray() ?: IntArray(0)
+
+                    ioScope.launch {
+                        try {
+                            val search = iperf3Bridge?.udpSearch(
+                                host, port, trialSeconds, reverse, maxBandwidthBps, lossTolerance, blockSizes
+                            ) ?: mapOf("success" to false, "error" to "Bridge not ready")
+                            Log.i(TAG, "UDP search: $search")
+                            withContext(Dispatchers.Main) {
+                                result.success(search)
+                            }
+                        } catch (e: Exception) {
+                            Log.e(TAG, "Exception in UDP search: ${e.message}", e)
+                            withContext(Dispatchers.Main + NonCancellable) {
+                                result.error("IPERF3_ERROR", "Failed to run UDP search: ${e.message}", null)
+                            }
+                        }
+                    }
+                }
+
+                "cancelUdpSearch" -> {
+                    iperf3Bridge?.cancelUdpSearch()
+                    result.success(true)
+                }
+
                 "getVersion" -> {
                     try {
                         val version = iperf3Bridge?.getVersion() ?: "Unknown"
@@ -220,6 +345,35 @@ class MainActivity : FlutterActivity() {
         ioScope.cancel()
     }
 
+    private fun selfTestKey() = "${Build.FINGERPRINT}/${iperf3Bridge?.getVersion()}"
+
+    private fun loadSelfTest(): Map<String, Any>? {
+        val prefs = getSharedPreferences(SELF_TEST_PREFS, Context.MODE_PRIVATE)
+        val json = prefs.getString(selfTestKey(), null) ?: return null
+        return try {
+            @Suppress("UNCHECKED_CAST")
+            jsonToValue(JSONObject(json)) as Map<String, Any>
+        } catch (e: Exception) {
+            Log.w(TAG, "Discarding unreadable self-test result", e)
+            null
+        }
+    }
+
+    // Only the latest build's result is kept
+    private fun saveSelfTest(selfTest: Map<String, Any>) {
+        getSharedPreferences(SELF_TEST_PREFS, Context.MODE_PRIVATE).edit()
+            .clear()
+            .putString(selfTestKey(), JSONObject(selfTest).toString())
+            .apply()
+    }
+
+    private fun jsonToValue(value: Any?): Any? = when (value) {
+        is JSONObject -> value.keys().asSequence().associateWith { jsonToValue(value.get(it)) }
+        is JSONArray -> (0 until value.length()).map { jsonToValue(value.get(it)) }
+        JSONObject.NULL -> null
+        else -> value
+    }
+
     private fun getCurrentWifiGateway(): String? {
         val wifiManager = applicationContext.getSystemService(Context.WIFI_SERVICE) as? WifiManager
             ?: return null
@@ -14,13 +14,30 @@ NS_ASSUME_NONNULL_BEGIN
 @interface Iperf3ResultObjC : NSObject
 
 @property (nonatomic) BOOL success;
-@property (nonatomic, strong, nullable) NSString *jsonOutput;
+/// UTF-8 JSON output, backed by the native result without a copy
+@property (nonatomic, strong, nullable) NSData *jsonData;
 @property (nonatomic, strong, nullable) NSString *errorMessage;
 @property (nonatomic) NSInteger errorCode;
 @property (nonatomic) double sendMbps;
 @property (nonatomic) double receiveMbps;
+@property (nonatomic) double sentBitsPerSecond;
+@property (nonatomic) double receivedBitsPerSecond;
 @property (nonatomic) long long sentBytes;
 @property (nonatomic) long long receivedBytes;
+@property (nonatomic) double seconds;
+/// TCP; RTTs are 0 when not measured on this end
+@property (nonatomic) double rtt;
+@property (nonatomic) double rttMin;
+@property (nonatomic) double rttMax;
+@property (nonatomic) long long retransmits;
+/// UDP
+@property (nonatomic) double jitter;
+@property (nonatomic) long long totalPackets;
+@property (nonatomic) long long lostPackets;
+@property (nonatomic) double lostPercent;
+/// Total CPU use of this and the other host, in percent
+@property (nonatomic) double cpuLocal;
+@property (nonatomic) double cpuRemote;
 
 @end
 
@@ -38,7 +55,8 @@ typedef void (^Iperf3ProgressCallbackBlock)(NSInteger interval,
 /// Progress callback handler
 @property (nonatomic, copy, nullable) Iperf3ProgressCallbackBlock progressCallback;
 
-/// Run iperf3 client test
+/// Run iperf3 client test on the calling thread, in a session of its own;
+/// several may run at once from different threads
 /// @param host Server hostname or IP address
 /// @param port Server port (default: 5201)
 /// @param duration Test duration in seconds
@@ -46,6 +64,7 @@ typedef void (^Iperf3ProgressCallbackBlock)(NSInteger interval,
 /// @param reverse Use reverse mode (server sends, client receives)
 /// @param useUdp Use UDP protocol (default is TCP)
 /// @param bandwidth Target bandwidth in bits/sec for UDP (0 = default)
+/// @param includeJson Also return iperf's full JSON in jsonData
 /// @return Iperf3ResultObjC object with test results
 - (Iperf3ResultObjC *)runClientWithHost:(NSString *)host
                                    port:(NSInteger)port
@@ -53,11 +72,38 @@ typedef void (^Iperf3ProgressCallbackBlock)(NSInteger interval,
                                parallel:(NSInteger)parallel
                                 reverse:(BOOL)reverse
                                  useUdp:(BOOL)useUdp
-                              bandwidth:(long long)bandwidth;
+                              bandwidth:(long long)bandwidth
+                            includeJson:(BOOL)includeJson;
 
-/// Cancel running iperf3 client test
+/// Cancel every running iperf3 client test
 - (void)cancelClient;
 
+/// Measure this device's own stack: a server and clients in this process
+/// over loopback, TCP and UDP at several stream counts, on the calling
+/// thread.  Takes about six times duration seconds.
+/// @return The best TCP and UDP figures, and every run under "runs"
+- (NSDictionary *)selfTestWithDuration:(NSInteger)duration;
+
+/// Cancel every running self-test
+- (void)cancelSelfTest;
+
+/// Search for the highest UDP rate up to maxBandwidth (0 for 1 Gbit/s)
+/// that loses at most lossTolerance percent, in trials of trialSeconds
+/// (0 for 2) picked by binary search, at each of blockSizes (empty for
+/// iperf's default), on the calling thread.
+/// @return The highest passing rates under "blockResults", and every trial
+/// under "trials"
+- (NSDictionary *)udpSearchWithHost:(NSString *)host
+                               port:(NSInteger)port
+                       trialSeconds:(NSInteger)trialSeconds
+                            reverse:(BOOL)reverse
+                       maxBandwidth:(long long)maxBandwidth
+                      lossTolerance:(double)lossTolerance
+                         blockSizes:(NSArray<NSNumber *> *)blockSizes;
+
+/// Cancel every running UDP search
+- (void)cancelUdpSearch;
+
 /// Get iperf3 version string
 - (NSString *)getVersion;
 
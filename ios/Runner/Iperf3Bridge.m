@@ -19,6 +19,12 @@
 @implementation Iperf3Bridge {
     // Store context for C callbacks
     void *_progressContext;
+    // Sessions of the client tests now running, guarded by @synchronized(self)
+    NSMutableSet<NSValue *> *_activeSessions;
+    // Self-tests now running, likewise
+    NSMutableSet<NSValue *> *_activeSelfTests;
+    // UDP searches now running, likewise
+    NSMutableSet<NSValue *> *_activeSearches;
 }
 
 #pragma mark - Initialization
@@ -27,6 +33,9 @@
     self = [super init];
     if (self) {
         _progressContext = (__bridge void *)self;
+        _activeSessions = [NSMutableSet set];
+        _activeSelfTests = [NSMutableSet set];
+        _activeSearches = [NSMutableSet set];
     }
     return self;
 }
@@ -65,24 +74,41 @@ static void iperf3_progress_callback_wrapper(void *context,
                                 parallel:(NSInteger)parallel
                                  reverse:(BOOL)reverse
                                   useUdp:(BOOL)useUdp
-                               bandwidth:(long long)bandwidth {
+                               bandwidth:(long long)bandwidth
+                             includeJson:(BOOL)includeJson {
 
     NSLog(@"Iperf3Bridge: Running client test to %@:%ld", host, (long)port);
     NSLog(@"Iperf3Bridge: Protocol: %@, Duration: %lds, Streams: %ld",
           useUdp ? @"UDP" : @"TCP", (long)duration, (long)parallel);
 
-    // Run iperf3 test (blocking call) with progress callback
-    Iperf3Result *c_result = iperf3_run_client_test(
-        [host UTF8String],
-        (int)port,
-        (int)duration,
-        (int)parallel,
-        reverse ? 1 : 0,
-        useUdp ? 1 : 0,
-        bandwidth,
-        iperf3_progress_callback_wrapper,
-        _progressContext
-    );
+    Iperf3ClientConfig config = {
+        .host = [host UTF8String],
+        .port = (int)port,
+        .duration = (int)duration,
+        .parallel = (int)parallel,
+        .reverse = reverse ? true : false,
+        .useUdp = useUdp ? true : false,
+        .bandwidth = (long)bandwidth,
+        .includeJson = includeJson ? true : false,
+    };
+    Iperf3Session *session = iperf3_session_create_client(&config);
+    NSValue *sessionKey = [NSValue valueWithPointer:session];
+    if (session) {
+        iperf3_session_set_progress_callback(session, iperf3_progress_callback_wrapper, _progressContext);
+        // Hand progress on from a delivery thread, at most at display rate, so
+        // the test thread never waits for the main queue
+        iperf3_session_set_async_delivery(session, 30, 0);
+        @synchronized (self) {
+            [_activeSessions addObject:sessionKey];
+        }
+    }
+
+    // Run iperf3 test (blocking call) in its own session, then detach the
+    // result so its JSON can outlive the session
+    Iperf3Result *c_result = NULL;
+    if (session && iperf3_session_run(session)) {
+        c_result = iperf3_session_take_result(session);
+    }
 
     // Convert C result to Objective-C object
     Iperf3ResultObjC *result = [[Iperf3ResultObjC alloc] init];
@@ -90,9 +116,6 @@ static void iperf3_progress_callback_wrapper(void *context,
     if (c_result) {
         result.success = c_result->success ? YES : NO;
 
-        if (c_result->jsonOutput) {
-            result.jsonOutput = [NSString stringWithUTF8String:c_result->jsonOutput];
-        }
 
         if (c_result->errorMessage) {
             result.errorMessage = [NSString stringWithUTF8String:c_result->errorMessage];
@@ -101,11 +124,33 @@ static void iperf3_progress_callback_wrapper(void *context,
         result.errorCode = c_result->errorCode;
         result.sendMbps = c_result->sendMbps;
         result.receiveMbps = c_result->receiveMbps;
-        result.sentBytes = (long long)(c_result->sendMbps * duration * 1000000 / 8);
-        result.receivedBytes = (long long)(c_result->receiveMbps * duration * 1000000 / 8);
+        result.sentBitsPerSecond = c_result->sentBitsPerSecond;
+        result.receivedBitsPerSecond = c_result->receivedBitsPerSecond;
+        result.sentBytes = c_result->sentBytes;
+        result.receivedBytes = c_result->receivedBytes;
+        result.seconds = c_result->seconds;
+        result.rtt = c_result->rtt;
+        result.rttMin = c_result->rttMin;
+        result.rttMax = c_result->rttMax;
+        result.retransmits = c_result->retransmits;
+        result.jitter = c_result->jitter;
+        result.totalPackets = c_result->packets;
+        result.lostPackets = c_result->lostPackets;
+        result.lostPercent = c_result->lostPercent;
+        result.cpuLocal = c_result->cpuLocal;
+        result.cpuRemote = c_result->cpuRemote;
 
-        // Free C result structure
-        iperf3_free_result(c_result);
+        // Hand the JSON over in place; the result is freed with the data
+        if (c_result->jsonOutput) {
+            Iperf3Result *owned = c_result;
+            result.jsonData = [NSData dataWithBytesNoCopy:c_result->jsonOutput
+                                                   length:c_result->jsonOutputLength
+                                              deallocator:^(void *bytes, NSUInteger length) {
+                iperf3_free_result(owned);
+            }];
+        } else {
+            iperf3_free_result(c_result);
+        }
 
         NSLog(@"Iperf3Bridge: Test completed - Success: %@", result.success ? @"YES" : @"NO");
         if (!result.success && result.errorMessage) {
@@ -118,12 +163,162 @@ static void iperf3_progress_callback_wrapper(void *context,
         NSLog(@"Iperf3Bridge: Failed to get result from C layer");
     }
 
+    // The result is detached already; nothing can cancel it once it leaves the set
+    if (session) {
+        @synchronized (self) {
+            [_activeSessions removeObject:sessionKey];
+        }
+        iperf3_session_free(session);
+    }
+
     return result;
 }
 
 - (void)cancelClient {
-    NSLog(@"Iperf3Bridge: Cancelling client test");
-    iperf3_request_client_cancel();
+    NSLog(@"Iperf3Bridge: Cancelling client tests");
+    @synchronized (self) {
+        for (NSValue *sessionKey in _activeSessions) {
+            iperf3_session_cancel((Iperf3Session *)sessionKey.pointerValue);
+        }
+    }
+}
+
+- (NSDictionary *)selfTestWithDuration:(NSInteger)duration {
+    Iperf3SelfTest *selfTest = iperf3_selftest_create(0, (int)duration);
+    if (!selfTest) {
+        return @{ @"success": @NO, @"error": @"Failed to create self-test", @"errorCode": @(-1) };
+    }
+    NSValue *key = [NSValue valueWithPointer:selfTest];
+    @synchronized (self) {
+        [_activeSelfTests addObject:key];
+    }
+
+    const Iperf3SelfTestResult *r = iperf3_selftest_run(selfTest);
+    NSMutableArray *runs = [NSMutableArray arrayWithCapacity:r->runCount];
+    for (int i = 0; i < r->runCount; i++) {
+        const Iperf3SelfTestRun *run = &r->runs[i];
+        [runs addObject:@{
+            @"useUdp": @(run->useUdp),
+            @"parallel": @(run->parallel),
+            @"success": @(run->success),
+            @"bitsPerSecond": @(run->bitsPerSecond),
+            @"cpuPercent": @(run->cpuPercent),
+            @"pps": @(run->pps),
+            @"lostPercent": @(run->lostPercent),
+            @"errorCode": @(run->errorCode)
+        }];
+    }
+    NSMutableDictionary *values = [@{
+        @"success": @(r->success),
+        @"tcpBitsPerSecond": @(r->tcpBitsPerSecond),
+        @"tcpCpuPerGbps": @(r->tcpCpuPerGbps),
+        @"tcpPps": @(r->tcpPps),
+        @"udpBitsPerSecond": @(r->udpBitsPerSecond),
+        @"udpCpuPerGbps": @(r->udpCpuPerGbps),
+        @"udpPps": @(r->udpPps),
+        @"udpLostPercent": @(r->udpLostPercent),
+        @"runs": runs
+    } mutableCopy];
+    if (r->errorMessage) {
+        values[@"error"] = [NSString stringWithUTF8String:r->errorMessage];
+        values[@"errorCode"] = @(r->errorCode);
+    }
+
+    @synchronized (self) {
+        [_activeSelfTests removeObject:key];
+    }
+    iperf3_selftest_free(selfTest);
+    return [values copy];
+}
+
+- (void)cancelSelfTest {
+    @synchronized (self) {
+        for (NSValue *key in _activeSelfTests) {
+            iperf3_selftest_cancel((Iperf3SelfTest *)key.pointerValue);
+        }
+    }
+}
+
+- (NSDictionary *)udpSearchWithHost:(NSString *)host
+                               port:(NSInteger)port
+                       trialSeconds:(NSInteger)trialSeconds
+                            reverse:(BOOL)reverse
+                       maxBandwidth:(long long)maxBandwidth
+                      lossTolerance:(double)lossTolerance
+                         blockSizes:(NSArray<NSNumber *> *)blockSizes {
+    if (blockSizes.count > IPERF3_SEARCH_MAX_BLOCK_SIZES) {
+        return @{ @"success": @NO, @"error": @"Too many block sizes", @"errorCode": @(-1) };
+    }
+    int blocks[IPERF3_SEARCH_MAX_BLOCK_SIZES];
+    for (NSUInteger i = 0; i < blockSizes.count; i++) {
+        blocks[i] = blockSizes[i].intValue;
+    }
+    Iperf3SearchConfig config = {
+        .host = host.UTF8String,
+        .port = (int)port,
+        .trialSeconds = (int)trialSeconds,
+        .reverse = reverse,
+        .maxBandwidth = (long)maxBandwidth,
+        .lossTolerance = lossTolerance,
+        .blockSizes = blocks,
+        .blockSizeCount = (int)blockSizes.count,
+    };
+    Iperf3Search *search = iperf3_search_create(&config);
+    if (!search) {
+        return @{ @"success": @NO, @"error": @"Failed to create search", @"errorCode": @(-1) };
+    }
+    NSValue *key = [NSValue valueWithPointer:search];
+    @synchronized (self) {
+        [_activeSearches addObject:key];
+    }
+
+    const Iperf3SearchResult *r = iperf3_search_run(search);
+    NSMutableArray *blockResults = [NSMutableArray arrayWithCapacity:r->blockResultCount];
+    for (int i = 0; i < r->blockResultCount; i++) {
+        const Iperf3SearchBlockResult *block = &r->blockResults[i];
+        [blockResults addObject:@{
+            @"blockSize": @(block->blockSize),
+            @"maxBitsPerSecond": @(block->maxBitsPerSecond),
+            @"trialCount": @(block->trialCount)
+        }];
+    }
+    NSMutableArray *trials = [NSMutableArray arrayWithCapacity:r->trialCount];
+    for (int i = 0; i < r->trialCount; i++) {
+        const Iperf3SearchTrial *trial = &r->trials[i];
+        [trials addObject:@{
+            @"blockSize": @(trial->blockSize),
+            @"offeredBitsPerSecond": @(trial->offeredBitsPerSecond),
+            @"receivedBitsPerSecond": @(trial->receivedBitsPerSecond),
+            @"packets": @(trial->packets),
+            @"lostPackets": @(trial->lostPackets),
+            @"lostPercent": @(trial->lostPercent),
+            @"jitter": @(trial->jitter),
+            @"passed": @(trial->passed)
+        }];
+    }
+    NSMutableDictionary *values = [@{
+        @"success": @(r->success),
+        @"blockResults": blockResults,
+        @"trials": trials
+    } mutableCopy];
+    if (r->errorMessage) {
+        values[@"error"] = [NSString stringWithUTF8String:r->errorMessage];
+        values[@"errorCode"] = @(r->errorCode);
+    }
+
+    @synchronized (self) {
+        [_activeSearches removeObject:key];
+    }
+    iperf3_search_free(search);
+    return [values copy];
+}
+
+- (void)cancelUdpSearch {
+    @synchronized (self) {
+        for (NSValue *key in _activeSearches) {
+            iperf3_search_cancel((Iperf3Search *)key.pointerValue);
+        }
+    }
 }
 
 - (NSString *)getVersion {
@@ -7,6 +7,8 @@
 
 #import "Iperf3Plugin.h"
 #import "Iperf3Bridge.h"
+#import <signal.h>
+#import <sys/utsname.h>
 
 @interface Iperf3Plugin()
 
@@ -42,6 +44,10 @@
     if (self) {
         _bridge = [[Iperf3Bridge alloc] init];
         _testQueue = dispatch_queue_create("com.example.hello_world_app.iperf3", DISPATCH_QUEUE_SERIAL);
+        // As iperf's own main() and the Android runtime do: a peer closing
+        // first, such as the in-process server of a self-test, is an error
+        // return rather than a signal that ends the app
+        signal(SIGPIPE, SIG_IGN);
     }
     return self;
 }
@@ -59,6 +65,16 @@
         [self handleGetVersion:call result:result];
     } else if ([@"getDefaultGateway" isEqualToString:call.method]) {
         [self handleGetDefaultGateway:call result:result];
+    } else if ([@"selfTest" isEqualToString:call.method]) {
+        [self handleSelfTest:call result:result];
+    } else if ([@"cancelSelfTest" isEqualToString:call.method]) {
+        [_bridge cancelSelfTest];
+        result(@YES);
+    } else if ([@"udpSearch" isEqualToString:call.method]) {
+        [self handleUdpSearch:call result:result];
+    } else if ([@"cancelUdpSearch" isEqualToString:call.method]) {
+        [_bridge cancelUdpSearch];
+        result(@YES);
     } else {
         result(FlutterMethodNotImplemented);
     }
@@ -76,6 +92,7 @@
     NSNumber *reverse = args[@"reverse"] ?: @NO;
     NSNumber *useUdp = args[@"useUdp"] ?: @NO;
     NSNumber *bandwidthBps = args[@"bandwidthBps"] ?: @0;
+    NSNumber *includeJson = args[@"includeJson"] ?: @NO;
 
     NSLog(@"Iperf3Plugin: Starting client test to %@:%@", host, port);
     NSLog(@"Iperf3Plugin: Parameters - Duration:%@s, Streams:%@, Protocol:%@, Reverse:%@",
@@ -98,7 +115,8 @@
                                                           parallel:[parallel integerValue]
                                                            reverse:[reverse boolValue]
                                                             useUdp:[useUdp boolValue]
-                                                         bandwidth:[bandwidthBps longLongValue]];
+                                                         bandwidth:[bandwidthBps longLongValue]
+                                                       includeJson:[includeJson boolValue]];
 
         // Return result on main thread
         dispatch_async(dispatch_get_main_queue(), ^{
@@ -106,14 +124,35 @@
                 NSLog(@"Iperf3Plugin: Test succeeded");
                 [self sendStatus:@"completed" details:nil];
 
-                result(@{
+                NSMutableDictionary *values = [@{
                     @"success": @YES,
-                    @"jsonOutput": testResult.jsonOutput ?: @"",
+                    @"sentBitsPerSecond": @(testResult.sentBitsPerSecond),
+                    @"receivedBitsPerSecond": @(testResult.receivedBitsPerSecond),
                     @"sendMbps": @(testResult.sendMbps),
                     @"receiveMbps": @(testResult.receiveMbps),
                     @"sentBytes": @(testResult.sentBytes),
-                    @"receivedBytes": @(testResult.receivedBytes)
-                });
+                    @"receivedBytes": @(testResult.receivedBytes),
+                    @"seconds": @(testResult.seconds),
+                    @"retransmits": @(testResult.retransmits),
+                    @"cpuLocal": @(testResult.cpuLocal),
+                    @"cpuRemote": @(testResult.cpuRemote)
+                } mutableCopy];
+                // Protocol-specific metrics, as on Android
+                if (testResult.rtt > 0) {
+                    values[@"rtt"] = @(testResult.rtt);
+                    values[@"rttMin"] = @(testResult.rttMin);
+                    values[@"rttMax"] = @(testResult.rttMax);
+                }
+                if (testResult.totalPackets > 0) {
+                    values[@"jitter"] = @(testResult.jitter);
+                    values[@"totalPackets"] = @(testResult.totalPackets);
+                    values[@"lostPackets"] = @(testResult.lostPackets);
+                    values[@"lostPercent"] = @(testResult.lostPercent);
+                }
+                if (testResult.jsonData) {
+                    values[@"jsonBytes"] = [FlutterStandardTypedData typedDataWithBytes:testResult.jsonData];
+                }
+                result(values);
             } else {
                 NSLog(@"Iperf3Plugin: Test failed - %@", testResult.errorMessage);
                 [self sendStatus:@"error" details:@{
@@ -151,6 +190,81 @@
     result(gateway ?: @"");
 }
 
+// A device's capacity only changes with its model and OS version, so the
+// last self-test is kept in the user defaults under both
+- (NSString *)selfTestKey {
+    struct utsname info;
+    uname(&info);
+    return [NSString stringWithFormat:@"iperf3SelfTest/%s/%@/%@", info.machine,
+            [[NSProcessInfo processInfo] operatingSystemVersionString], [_bridge getVersion]];
+}
+
+- (void)handleSelfTest:(FlutterMethodCall *)call result:(FlutterResult)result {
+    NSDictionary *args = call.arguments;
+    BOOL force = [args[@"force"] ?: @NO boolValue];
+    BOOL cachedOnly = [args[@"cachedOnly"] ?: @NO boolValue];
+    NSInteger duration = [args[@"duration"] ?: @3 integerValue];
+
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    NSString *key = [self selfTestKey];
+    NSDictionary *cached = force ? nil : [defaults dictionaryForKey:key];
+    if (cached) {
+        NSMutableDictionary *values = [cached mutableCopy];
+        values[@"cached"] = @YES;
+        result(values);
+        return;
+    }
+    if (cachedOnly) {
+        result(@{ @"success": @NO, @"cached": @NO });
+        return;
+    }
+
+    // Off the client queue, so a self-test never waits behind a client test
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        NSDictionary *selfTest = [self.bridge selfTestWithDuration:duration];
+        NSLog(@"Iperf3Plugin: Self-test: %@", selfTest);
+        if ([selfTest[@"success"] boolValue]) {
+            for (NSString *old in [[defaults dictionaryRepresentation] allKeys]) {
+                if ([old hasPrefix:@"iperf3SelfTest/"]) {
+                    [defaults removeObjectForKey:old];
+                }
+            }
+            [defaults setObject:selfTest forKey:key];
+        }
+        dispatch_async(dispatch_get_main_queue(), ^{
+            NSMutableDictionary *values = [selfTest mutableCopy];
+            values[@"cached"] = @NO;
+            result(values);
+        });
+    });
+}
+
+- (void)handleUdpSearch:(FlutterMethodCall *)call result:(FlutterResult)result {
+    NSDictionary *args = call.arguments;
+    NSString *host = args[@"host"] ?: @"";
+    NSInteger port = [args[@"port"] ?: @5201 integerValue];
+    NSInteger trialSeconds = [args[@"trialSeconds"] ?: @0 integerValue];
+    BOOL reverse = [args[@"reverse"] ?: @NO boolValue];
+    long long maxBandwidthBps = [args[@"maxBandwidthBps"] ?: @0 longLongValue];
+    double lossTolerance = [args[@"lossTolerance"] ?: @0 doubleValue];
+    NSArray<NSNumber *> *blockSizes = args[@"blockSizes"] ?: @[];
+
+    // Off the client queue, like the self-test
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        NSDictionary *search = [self.bridge udpSearchWithHost:host
+                                                         port:port
+                                                 trialSeconds:trialSeconds
+                                                      reverse:reverse
+                                                 maxBandwidth:maxBandwidthBps
+                                                lossTolerance:lossTolerance
+                                                   blockSizes:blockSizes];
+        NSLog(@"Iperf3Plugin: UDP search: %@", search);
+        dispatch_async(dispatch_get_main_queue(), ^{
+            result(search);
+        });
+    });
+}
+
 #pragma mark - FlutterStreamHandler
 
 - (FlutterError * _Nullable)onListenWithArguments:(id _Nullable)arguments
@@ -0,0 +1,248 @@
+/*
+ * iperf, Copyright (c) 2014, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include "iperf_config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cjson.h"
+#include "iperf_time.h"
+
+/*
+ * Benchmark of cJSON key lookups on the control-channel messages that
+ * get_parameters() and get_results() parse.  Each pass parses the message
+ * and performs the lookups those functions do, with the hashed key index
+ * disabled and enabled.  The lookups of both runs are cross-checked.
+ */
+
+#define STREAMS 128
+#define SERVER_OUTPUT_LINES (STREAMS * 12)
+#define PASSES 2000
+
+static const char *stream_keys[] = {
+    "id", "bytes", "retransmits", "jitter", "errors", "omitted_errors",
+    "packets", "omitted_packets", "start_time", "end_time", NULL
+};
+
+static const char *result_keys[] = {
+    "cpu_util_total", "cpu_util_user", "cpu_util_system",
+    "sender_has_retransmits", "streams", "server_output_text",
+    "congestion_used", NULL
+};
+
+static const char *param_keys[] = {
+    "tcp", "udp", "sctp", "omit", "server_affinity", "time", "num",
+    "blockcount", "MSS", "nodelay", "parallel", "reverse", "bidirectional",
+    "mptcp", "window", "len", "bandwidth", "fqrate", "pacing_timer", "burst",
+    "TOS", "flowlabel", "title", "extra_data", "congestion",
+    "congestion_used", "get_server_output", "udp_counters_64bit",
+    "repeating_payload", "zerocopy", "dont_fragment", "authtoken",
+    "skip_rx_copy", NULL
+};
+
+/* Same shape as send_results() with --get-server-output in text mode */
+static char *
+make_results(void)
+{
+    cJSON *j, *j_streams, *j_stream;
+    char *line, *output, *str;
+    size_t len;
+    int i;
+
+    j = cJSON_CreateObject();
+    cJSON_AddNumberToObject(j, "cpu_util_total", 12.5);
+    cJSON_AddNumberToObject(j, "cpu_util_user", 2.5);
+    cJSON_AddNumberToObject(j, "cpu_util_system", 10.0);
+    cJSON_AddNumberToObject(j, "sender_has_retransmits", 1);
+    cJSON_AddStringToObject(j, "congestion_used", "cubic");
+
+    line = "[  5]   0.00-1.00   sec   112 MBytes   941 Mbits/sec    0   1.21 MBytes\n";
+    len = strlen(line);
+    output = calloc(len * SERVER_OUTPUT_LINES + 1, 1);
+    for (i = 0; i < SERVER_OUTPUT_LINES; i++)
+        memcpy(output + i * len, line, len);
+    cJSON_AddStringToObject(j, "server_output_text", output);
+    free(output);
+
+    j_streams = cJSON_CreateArray();
+    cJSON_AddItemToObject(j, "streams", j_streams);
+    for (i = 0; i < STREAMS; i++) {
+        j_stream = cJSON_CreateObject();
+        cJSON_AddItemToArray(j_streams, j_stream);
+        cJSON_AddNumberToObject(j_stream, "id", i + 5);
+        cJSON_AddNumberToObject(j_stream, "bytes", 1175000000.0 + i);
+        cJSON_AddNumberToObject(j_stream, "retransmits", i % 7);
+        cJSON_AddNumberToObject(j_stream, "jitter", 0);
+        cJSON_AddNumberToObject(j_stream, "errors", 0);
+        cJSON_AddNumberToObject(j_stream, "omitted_errors", 0);
+        cJSON_AddNumberToObject(j_stream, "packets", 0);
+        cJSON_AddNumberToObject(j_stream, "omitted_packets", 0);
+        cJSON_AddNumberToObject(j_stream, "start_time", 0);
+        cJSON_AddNumberToObject(j_stream, "end_time", 10.000043);
+    }
+
+    str = cJSON_PrintUnformatted(j);
+    cJSON_Delete(j);
+    return str;
+}
+
+/* Same shape as send_parameters() for a typical TCP client */
+static char *
+make_parameters(void)
+{
+    cJSON *j;
+    char *str;
+
+    j = cJSON_CreateObject();
+    cJSON_AddTrueToObject(j, "tcp");
+    cJSON_AddNumberToObject(j, "omit", 0);
+    cJSON_AddNumberToObject(j, "time", 10);
+    cJSON_AddNumberToObject(j, "num", 0);
+    cJSON_AddNumberToObject(j, "blockcount", 0);
+    cJSON_AddNumberToObject(j, "parallel", STREAMS);
+    cJSON_AddTrueToObject(j, "reverse");
+    cJSON_AddNumberToObject(j, "len", 131072);
+    cJSON_AddNumberToObject(j, "pacing_timer", 1000);
+    cJSON_AddStringToObject(j, "title", "bench");
+    cJSON_AddStringToObject(j, "congestion", "bbr");
+    cJSON_AddNumberToObject(j, "get_server_output", 1);
+    cJSON_AddNumberToObject(j, "udp_counters_64bit", 1);
+    cJSON_AddStringToObject(j, "client_version", "3.19");
+
+    str = cJSON_PrintUnformatted(j);
+    cJSON_Delete(j);
+    return str;
+}
+
+/* The lookups get_results() does; returns a checksum of the found items */
+static uintptr_t
+lookup_results(cJSON *j)
+{
+    cJSON *j_streams, *j_stream;
+    uintptr_t sum = 0;
+    int i, k, n;
+
+    for (k = 0; result_keys[k] != NULL; k++)
+        sum += (uintptr_t) cJSON_GetObjectItem(j, result_keys[k]);
+    j_streams = cJSON_GetObjectItem(j, "streams");
+    n = cJSON_GetArraySize(j_streams);
+    for (i = 0, j_stream = j_streams->child; i < n; i++, j_stream = j_stream->next)
+        for (k = 0; stream_keys[k] != NULL; k++)
+            sum += (uintptr_t) cJSON_GetObjectItem(j_stream, stream_keys[k]);
+    return sum;
+}
+
+/* The lookups get_parameters() does, including the many that miss */
+static uintptr_t
+lookup_parameters(cJSON *j)
+{
+    uintptr_t sum = 0;
+    int k;
+
+    for (k = 0; param_keys[k] != NULL; k++)
+        sum += (uintptr_t) cJSON_GetObjectItem(j, param_keys[k]);
+    return sum;
+}
+
+static double
+run(const char *name, const char *msg, uintptr_t (*lookup)(cJSON *), int threshold, int lookups_only)
+{
+    struct iperf_time start, end, diff;
+    cJSON *j = NULL;
+    double usecs;
+    int pass;
+
+    cJSON_SetKeyIndexThreshold(threshold);
+    if (lookups_only)
+        j = cJSON_Parse(msg);
+    iperf_time_now(&start);
+    for (pass = 0; pass < PASSES; pass++) {
+        if (!lookups_only)
+            j = cJSON_Parse(msg);
+        lookup(j);
+        if (!lookups_only)
+            cJSON_Delete(j);
+    }
+    iperf_time_now(&end);
+    if (lookups_only)
+        cJSON_Delete(j);
+
+    iperf_time_diff(&end, &start, &diff);
+    usecs = (double) iperf_time_in_usecs(&diff) / PASSES;
+    printf("%-12s %-16s index %-3s %10.2f us/pass\n", name,
+           lookups_only ? "lookups" : "parse+lookups", threshold ? "on" : "off", usecs);
+    return usecs;
+}
+
+/* Lookups through the index must find exactly what the linear walk finds */
+static int
+check(const char *msg, uintptr_t (*lookup)(cJSON *))
+{
+    cJSON *j;
+    uintptr_t linear, hashed;
+
+    j = cJSON_Parse(msg);
+    cJSON_SetKeyIndexThreshold(0);
+    linear = lookup(j);
+    cJSON_SetKeyIndexThreshold(1);
+    lookup(j);
+    hashed = lookup(j);
+    cJSON_Delete(j);
+    return linear == hashed;
+}
+
+int
+main(int argc, char **argv)
+{
+    char *results, *params;
+    int rc = 0;
+
+    results = make_results();
+    params = make_parameters();
+    printf("get_results message: %zu bytes, %d streams\n", strlen(results), STREAMS);
+    printf("get_parameters message: %zu bytes\n", strlen(params));
+
+    if (!check(results, lookup_results) || !check(params, lookup_parameters)) {
+        printf("indexed lookups disagree with linear lookups\n");
+        rc = -1;
+    }
+
+    run("get_results", results, lookup_results, 0, 0);
+    run("get_results", results, lookup_results, 8, 0);
+    run("get_results", results, lookup_results, 0, 1);
+    run("get_results", results, lookup_results, 8, 1);
+    run("get_params", params, lookup_parameters, 0, 0);
+    run("get_params", params, lookup_parameters, 8, 0);
+    run("get_params", params, lookup_parameters, 0, 1);
+    run("get_params", params, lookup_parameters, 8, 1);
+
+    cJSON_free(results);
+    cJSON_free(params);
+    exit(rc);
+}
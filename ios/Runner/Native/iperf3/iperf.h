@@ -30,6 +30,8 @@
 #include "iperf_config.h"
 
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <sys/types.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -54,6 +56,10 @@
 #include "queue.h"
 #include "cjson.h"
 #include "iperf_time.h"
+#include "iperf_microburst.h"
+#include "iperf_converge.h"
+#include "iperf_ramp.h"
+#include "iperf_search.h"
 #include "portable_endian.h"
 
 #if defined(HAVE_SSL)
@@ -74,6 +80,14 @@
 typedef uint64_t atomic_uint_fast64_t;
 #endif // HAVE_STDATOMIC_H
 
+/*
+ * Library state that does not belong to a test, such as i_errno and
+ * gerror, is kept per thread so that tests can run in parallel threads.
+ */
+#if !defined(IPERF_THREAD_LOCAL)
+#define IPERF_THREAD_LOCAL __thread
+#endif // IPERF_THREAD_LOCAL
+
 #if !defined(__IPERF_API_H)
 typedef uint_fast64_t iperf_size_t;
 typedef atomic_uint_fast64_t atomic_iperf_size_t;
@@ -126,6 +140,7 @@ struct iperf_interval_results
     long rtt;
     long rttvar;
     long pmtu;
+    struct iperf_microburst_summary microburst; /* with --microburst */
 };
 
 struct iperf_stream_result
@@ -153,6 +168,42 @@ struct iperf_stream_result
 };
 
 #define COOKIE_SIZE 37		/* size of an ascii uuid */
+/*
+ * A --fast-start client replaces the first cookie character (normally
+ * one of [a-z2-7]) with this marker.  It tells the server that the
+ * parameters follow the cookie without waiting for PARAM_EXCHANGE.
+ */
+#define COOKIE_FAST_START '+'
+
+/* Control-channel message sizes and codec time, with --compress */
+struct iperf_compress_stats
+{
+    iperf_size_t sent_raw;
+    iperf_size_t sent_wire;
+    iperf_size_t received_raw;
+    iperf_size_t received_wire;
+    uint64_t  usecs;                    /* compressing and decompressing */
+};
+
+/* Snapshot cpu_util() measures from, one per test */
+struct cpu_util_state
+{
+    struct iperf_time last;
+    clock_t   clast;
+    struct rusage rlast;
+};
+
+/* Client startup timestamps, reported at TEST_RUNNING */
+struct iperf_startup
+{
+    struct iperf_time begin;            /* before connecting the control channel */
+    struct iperf_time connected;        /* control channel up, cookie sent */
+    struct iperf_time create_streams;   /* CREATE_STREAMS received */
+    struct iperf_time streams;          /* all data streams connected */
+    struct iperf_time test_start;       /* TEST_START received */
+    struct iperf_time test_running;     /* TEST_RUNNING received */
+};
+
 struct iperf_settings
 {
     int       domain;               /* AF_INET or AF_INET6 */
@@ -215,11 +266,15 @@ struct iperf_stream
     struct iperf_stream_result *result;	/* structure pointer to result */
     Timer     *send_timer;
     int       green_light;
-    int       buffer_fd;	/* data to send, file descriptor */
-    char      *buffer;		/* data to send, mmapped */
+    int       buffer_fd;	/* data to send, file descriptor, -1 if none */
+    char      *buffer;		/* data to send, or receive scratch */
+    int       buffer_shared;	/* buffer is the test's shared payload */
     int       pending_size;     /* pending data to send */
+    struct iperf_microburst *microburst; /* 1 ms buckets, with --microburst */
+    int       ramp_held;	/* connected but not sending yet, with --ramp */
     int       diskfile_fd;	/* file to send, file descriptor */
     int	      diskfile_left;	/* remaining file data on disk */
+    int64_t   diskfile_rtot;	/* file data read so far */
 
     /*
      * for udp measurements - This can be a structure outside stream, and
@@ -348,6 +403,26 @@ struct iperf_test
     int	      verbose;                          /* -V option - verbose mode */
     int	      json_output;                      /* -J option - JSON output */
     int	      json_stream;                      /* --json-stream */
+    int	      json_detail;                      /* --json-detail - IPERF_JSON_DETAIL_* */
+    int       fast_start;                       /* --fast-start */
+    int       fast_start_server;                /* server skipped PARAM_EXCHANGE for our fast-start cookie */
+    int       compress;                         /* --compress - threshold in bytes, 0 if off */
+    int       compress_ok;                      /* peer decodes compressed control messages */
+    int       microburst;                       /* --microburst - stall threshold in ms, 0 if off */
+    int       microburst_keep;                  /* size the rings to keep the whole test */
+    int       converge_min;                     /* --converge - seconds of intervals that must agree, 0 if off */
+    double    converge_tolerance;               /* their 95% confidence interval, relative to the mean */
+    struct iperf_converge *converge;            /* the client's, while the test runs */
+    int       converge_stop;                    /* IPERF_CONVERGE_..., why the test ended */
+    double    converge_seconds;                 /* when it converged */
+    double    ramp_gain;                        /* --ramp - least a stream must add to be kept adding, 0 if off */
+    struct iperf_ramp *ramp;                    /* the client's, while the test runs */
+    struct cpu_util_state ramp_cpu;             /* where the ramp's interval CPU use is measured from */
+    int       search;                           /* --search - UDP lossless-rate search */
+    double    search_loss;                      /* percent a passing trial may lose */
+    int       search_blksizes[IPERF_SEARCH_MAX_BLKSIZES]; /* to search at, or -l's if none */
+    int       search_nblksizes;
+    struct iperf_test *search_trial;            /* the trial running, for the signal handler */
     void      (*json_callback) (struct iperf_test *, char *); /* allow user apps to receive the
                                                 JSON strings,instead of writing them to the output file */
     int	      zerocopy;                         /* -Z option - use sendfile */
@@ -374,6 +449,7 @@ struct iperf_test
     double    reporter_interval;
     void      (*stats_callback) (struct iperf_test *);
     void      (*reporter_callback) (struct iperf_test *);
+    TimerQueue *timers;                         /* this test's pending timers */
     Timer     *omit_timer;
     Timer     *timer;
     int        done;
@@ -381,6 +457,7 @@ struct iperf_test
     Timer     *reporter_timer;
 
     double cpu_util[3];                            /* cpu utilization of the test - total, user, system */
+    struct cpu_util_state cpu_state;               /* where cpu_util() measures from */
     double remote_cpu_util[3];                     /* cpu utilization for the remote host/client - total, user, system */
 
     int       num_streams;                      /* total streams in the test (-P) */
@@ -402,6 +479,20 @@ struct iperf_test
     uint server_test_number;                     /* count number of tests performed by a server */
 
     char      cookie[COOKIE_SIZE];
+    struct iperf_startup startup;
+    struct iperf_compress_stats compress_stats;
+
+    /* Payload shared by TCP and SCTP sender streams, see iperf_new_stream() */
+    char     *payload;
+    int       payload_fd;
+    size_t    payload_size;
+    uint64_t  stream_setup_usecs;               /* time spent in iperf_new_stream() */
+
+    /* Server and -B addresses, resolved once per test by iperf_resolve_addresses() */
+    struct addrinfo *server_addrinfo;
+    struct addrinfo *bind_addrinfo;
+    uint64_t  resolve_usecs;                    /* time spent resolving them */
+    uint64_t  stream_connect_usecs;             /* wall time connecting the data streams */
 //    struct iperf_stream *streams;               /* pointer to list of struct stream */
     SLIST_HEAD(slisthead, iperf_stream) streams;
     struct iperf_settings *settings;
@@ -446,6 +537,14 @@ struct iperf_test
 #define UDP_BUFFER_EXTRA 1024
 
 #define MAX_PARAMS_JSON_STRING 8 * 1024
+#define DEFAULT_COMPRESS_THRESHOLD 1024 /* smallest control message worth compressing */
+#define DEFAULT_MICROBURST_STALL 10	/* ms without data that count as a stall */
+#define DEFAULT_CONVERGE_MIN 3		/* seconds */
+#define DEFAULT_CONVERGE_TOLERANCE 5	/* percent */
+#define DEFAULT_RAMP_GAIN 10		/* percent */
+#define DEFAULT_RAMP_STREAMS 8		/* the most --ramp adds without -P */
+#define DEFAULT_SEARCH_RATE 1000000000	/* bits per second --search tries first without -b */
+#define DEFAULT_SEARCH_TRIAL 2		/* seconds per --search trial without -t */
 
 /* constants for command line arg sanity checks */
 #define MB (1024 * 1024)
@@ -465,7 +564,11 @@ struct iperf_test
 
 #define TIMESTAMP_FORMAT "%c "
 
-extern int gerror; /* error value from getaddrinfo(3), for use in internal error handling */
+extern IPERF_THREAD_LOCAL int gerror; /* error value from getaddrinfo(3), for use in internal error handling */
+
+/* Control-channel messages: a length word, then the JSON text (iperf_api.c) */
+int JSON_write(struct iperf_test *test, int fd, cJSON *json);
+cJSON *JSON_read(struct iperf_test *test, int fd, int max_size);
 
 /* UDP "connect" message and reply (textual value for Wireshark, etc. readability - legacy was numeric) */
 
@@ -63,6 +63,13 @@
 #include <sys/cpuset.h>
 #endif /* HAVE_CPUSET_SETAFFINITY */
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if !defined(MFD_CLOEXEC)
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif /* __linux__ */
+
 #if defined(__CYGWIN__) || defined(_WIN32) || defined(_WIN64) || defined(__WINDOWS__)
 #define CPU_SETSIZE __CPU_SETSIZE
 #endif /* __CYGWIN__, _WIN32, _WIN64, __WINDOWS__ */
@@ -85,6 +92,7 @@
 #include "units.h"
 #include "iperf_util.h"
 #include "iperf_locale.h"
+#include "iperf_lz.h"
 #include "version.h"
 #if defined(HAVE_SSL)
 #include <openssl/bio.h>
@@ -99,10 +107,10 @@ static int send_results(struct iperf_test *test);
 static int get_results(struct iperf_test *test);
 static int diskfile_send(struct iperf_stream *sp);
 static int diskfile_recv(struct iperf_stream *sp);
-static int JSON_write(int fd, cJSON *json);
 static void print_interval_results(struct iperf_test *test, struct iperf_stream *sp, cJSON *json_interval_streams);
-static cJSON *JSON_read(int fd, int max_size);
 static int JSONStream_Output(struct iperf_test *test, const char* event_name, cJSON* obj);
+static void iperf_payload_free(struct iperf_test *test);
+static void stream_buffer_free(struct iperf_stream *sp);
 
 
 /*************************** Print usage functions ****************************/
@@ -117,7 +125,7 @@ usage()
 void
 usage_long(FILE *f)
 {
-    fprintf(f, usage_longstr, DEFAULT_NO_MSG_RCVD_TIMEOUT, UDP_RATE / (1024*1024), DEFAULT_PACING_TIMER, DURATION, DEFAULT_TCP_BLKSIZE / 1024, DEFAULT_UDP_BLKSIZE);
+    fprintf(f, usage_longstr, DEFAULT_MICROBURST_STALL, DEFAULT_NO_MSG_RCVD_TIMEOUT, DEFAULT_COMPRESS_THRESHOLD, UDP_RATE / (1024*1024), DEFAULT_PACING_TIMER, DURATION, DEFAULT_CONVERGE_MIN, DEFAULT_CONVERGE_TOLERANCE, DEFAULT_TCP_BLKSIZE / 1024, DEFAULT_UDP_BLKSIZE, IPERF_RAMP_STEP_INTERVALS, DEFAULT_RAMP_GAIN, DEFAULT_RAMP_STREAMS, DEFAULT_SEARCH_RATE / 1000000, DEFAULT_SEARCH_TRIAL);
 }
 
 
@@ -327,12 +335,55 @@ iperf_get_test_json_output_string(struct iperf_test *ipt)
     return ipt->json_output_string;
 }
 
+/*
+ * Hand the rendered JSON output over to the caller, who releases it with
+ * cJSON_free(), so it can outlive the test without being copied.
+ */
+char *
+iperf_take_test_json_output_string(struct iperf_test *ipt)
+{
+    char *str = ipt->json_output_string;
+
+    ipt->json_output_string = NULL;
+    return str;
+}
+
 int
 iperf_get_test_json_stream(struct iperf_test *ipt)
 {
     return ipt->json_stream;
 }
 
+int
+iperf_get_test_json_detail(struct iperf_test *ipt)
+{
+    return ipt->json_detail;
+}
+
+int
+iperf_get_test_fast_start(struct iperf_test *ipt)
+{
+    return ipt->fast_start;
+}
+
+int
+iperf_get_test_compress(struct iperf_test *ipt)
+{
+    return ipt->compress;
+}
+
+int
+iperf_get_test_microburst(struct iperf_test *ipt)
+{
+    return ipt->microburst;
+}
+
+int
+iperf_get_test_converge_stop(struct iperf_test *ipt)
+{
+    return ipt->converge_stop;
+}
+
 int
 iperf_get_test_zerocopy(struct iperf_test *ipt)
 {
@@ -699,6 +750,56 @@ iperf_set_test_json_stream(struct iperf_test *ipt, int json_stream)
     ipt->json_stream = json_stream;
 }
 
+void
+iperf_set_test_json_detail(struct iperf_test *ipt, int json_detail)
+{
+    ipt->json_detail = json_detail;
+}
+
+void
+iperf_set_test_fast_start(struct iperf_test *ipt, int fast_start)
+{
+    ipt->fast_start = fast_start;
+}
+
+void
+iperf_set_test_compress(struct iperf_test *ipt, int compress)
+{
+    ipt->compress = compress;
+}
+
+void
+iperf_set_test_microburst(struct iperf_test *ipt, int stall_ms)
+{
+    ipt->microburst = stall_ms;
+}
+
+void
+iperf_set_test_microburst_keep(struct iperf_test *ipt, int keep)
+{
+    ipt->microburst_keep = keep;
+}
+
+void
+iperf_set_test_converge(struct iperf_test *ipt, int min_secs, double tolerance)
+{
+    ipt->converge_min = min_secs;
+    ipt->converge_tolerance = tolerance;
+}
+
+void
+iperf_set_test_ramp(struct iperf_test *ipt, double gain)
+{
+    ipt->ramp_gain = gain;
+}
+
+void
+iperf_set_test_search(struct iperf_test *ipt, double loss_tolerance)
+{
+    ipt->search = 1;
+    ipt->search_loss = loss_tolerance;
+}
+
 void
 iperf_set_test_json_callback(struct iperf_test *ipt, void (*callback)(struct iperf_test *, char *))
 {
@@ -900,6 +1001,23 @@ iperf_on_new_stream(struct iperf_stream *sp)
     connect_msg(sp);
 }
 
+/* Cost of connecting and creating this test's streams, including the shared payload */
+static void
+iperf_print_stream_setup(struct iperf_test *test)
+{
+    struct iperf_stream *sp;
+    int64_t nstreams = 0;
+    /* The host's, which a simulation (iperf_sim.c) leaves out */
+    long max_rss_kb = iperf_time_is_virtual() ? 0 : get_max_rss_kb();
+
+    SLIST_FOREACH(sp, &test->streams, streams)
+        nstreams++;
+    if (test->json_output)
+        cJSON_AddItemToObject(test->json_start, "stream_setup", iperf_json_printf("streams: %d  resolve_usecs: %d  connect_usecs: %d  usecs: %d  shared_payload_bytes: %d  max_rss_kb: %d", nstreams, (int64_t) test->resolve_usecs, (int64_t) test->stream_connect_usecs, (int64_t) test->stream_setup_usecs, (int64_t) test->payload_size, (int64_t) max_rss_kb));
+    else if (test->verbose)
+        iperf_printf(test, report_stream_setup, (int) nstreams, test->stream_connect_usecs / 1000.0, test->stream_setup_usecs / 1000.0, (int64_t) test->payload_size, (int64_t) max_rss_kb);
+}
+
 void
 iperf_on_test_start(struct iperf_test *test)
 {
@@ -915,11 +1033,41 @@ iperf_on_test_start(struct iperf_test *test)
 		iperf_printf(test, test_start_time, test->protocol->name, test->num_streams, test->settings->blksize, test->omit, test->duration, test->settings->tos);
 	}
     }
+    iperf_print_stream_setup(test);
     if (test->json_stream) {
         JSONStream_Output(test, "start", test->json_start);
     }
 }
 
+static double
+startup_ms(struct iperf_test *test, struct iperf_time *t)
+{
+    struct iperf_time diff;
+
+    iperf_time_diff(t, &test->startup.begin, &diff);
+    return iperf_time_in_usecs(&diff) / 1000.0;
+}
+
+/* Client startup timings, once TEST_RUNNING has been received */
+void
+iperf_print_startup(struct iperf_test *test)
+{
+    struct iperf_startup *st = &test->startup;
+    int early = iperf_time_compare(&st->streams, &st->create_streams) < 0;
+    cJSON *j_startup;
+
+    if (test->json_output) {
+        j_startup = iperf_json_printf("fast_start: %b  fast_start_server: %b  early_connect: %b  connected_ms: %f  create_streams_ms: %f  streams_connected_ms: %f  test_start_ms: %f  test_running_ms: %f", test->fast_start, test->fast_start_server, early, startup_ms(test, &st->connected), startup_ms(test, &st->create_streams), startup_ms(test, &st->streams), startup_ms(test, &st->test_start), startup_ms(test, &st->test_running));
+        if (j_startup == NULL)
+            return;
+        cJSON_AddItemToObject(test->json_start, "startup", j_startup);
+        if (test->json_stream)
+            JSONStream_Output(test, "startup", j_startup);
+    } else if (test->verbose) {
+        iperf_printf(test, report_startup, startup_ms(test, &st->connected), startup_ms(test, &st->create_streams), startup_ms(test, &st->streams), startup_ms(test, &st->test_start), startup_ms(test, &st->test_running), early ? " (fast start, early connect)" : test->fast_start_server ? " (fast start)" : "");
+    }
+}
+
 
 /* This converts an IPv6 string address from IPv4-mapped format into regular
 ** old IPv4 format, which is easier on the eyes of network veterans.
@@ -1086,6 +1234,7 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
         {"verbose", no_argument, NULL, 'V'},
         {"json", no_argument, NULL, 'J'},
         {"json-stream", no_argument, NULL, OPT_JSON_STREAM},
+        {"json-detail", required_argument, NULL, OPT_JSON_DETAIL},
         {"version", no_argument, NULL, 'v'},
         {"server", no_argument, NULL, 's'},
         {"client", required_argument, NULL, 'c'},
@@ -1157,6 +1306,12 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
 	{"fq-rate", required_argument, NULL, OPT_FQ_RATE},
 	{"pacing-timer", required_argument, NULL, OPT_PACING_TIMER},
 	{"connect-timeout", required_argument, NULL, OPT_CONNECT_TIMEOUT},
+        {"fast-start", no_argument, NULL, OPT_FAST_START},
+        {"compress", optional_argument, NULL, OPT_COMPRESS},
+        {"microburst", optional_argument, NULL, OPT_MICROBURST},
+        {"converge", optional_argument, NULL, OPT_CONVERGE},
+        {"ramp", optional_argument, NULL, OPT_RAMP},
+        {"search", optional_argument, NULL, OPT_SEARCH},
         {"idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT},
         {"rcv-timeout", required_argument, NULL, OPT_RCV_TIMEOUT},
         {"snd-timeout", required_argument, NULL, OPT_SND_TIMEOUT},
@@ -1174,6 +1329,8 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
     int portno;
     int blksize;
     int server_flag, client_flag, rate_flag, duration_flag, rcv_timeout_flag, snd_timeout_flag;
+    int streams_flag;
+    int i;
     char *endptr;
 #if defined(HAVE_CPU_AFFINITY)
     char* comma;
@@ -1189,6 +1346,7 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
 
     blksize = 0;
     server_flag = client_flag = rate_flag = duration_flag = rcv_timeout_flag = snd_timeout_flag =0;
+    streams_flag = 0;
 #if defined(HAVE_SSL)
     char *client_username = NULL, *client_rsa_public_key = NULL, *server_rsa_private_key = NULL;
     FILE *ptr_file;
@@ -1252,6 +1410,18 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
                 test->json_output = 1;
                 test->json_stream = 1;
                 break;
+            case OPT_JSON_DETAIL:
+                if (strcmp(optarg, "sums") == 0)
+                    test->json_detail = IPERF_JSON_DETAIL_SUMS;
+                else if (strcmp(optarg, "streams") == 0)
+                    test->json_detail = IPERF_JSON_DETAIL_STREAMS;
+                else if (strcmp(optarg, "full") == 0)
+                    test->json_detail = IPERF_JSON_DETAIL_FULL;
+                else {
+                    i_errno = IEJSONDETAIL;
+                    return -1;
+                }
+                break;
             case 'v':
                 printf("%s (cJSON %s)\n%s\n%s\n", version, cJSON_Version(), get_system_info(),
 		       get_optional_features());
@@ -1363,6 +1533,7 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
                     i_errno = IENUMSTREAMS;
                     return -1;
                 }
+		streams_flag = 1;
 		client_flag = 1;
                 break;
             case 'R':
@@ -1706,6 +1877,79 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
 		test->settings->connect_timeout = unit_atoi(optarg);
 		client_flag = 1;
 		break;
+	    case OPT_FAST_START:
+		test->fast_start = 1;
+		client_flag = 1;
+		break;
+	    case OPT_COMPRESS:
+		test->compress = optarg ? unit_atoi(optarg) : DEFAULT_COMPRESS_THRESHOLD;
+		if (test->compress <= 0) {
+		    i_errno = IECOMPRESS;
+		    return -1;
+		}
+		client_flag = 1;
+		break;
+	    case OPT_MICROBURST:
+		test->microburst = optarg ? atoi(optarg) : DEFAULT_MICROBURST_STALL;
+		if (test->microburst <= 0) {
+		    i_errno = IEMICROBURST;
+		    return -1;
+		}
+		break;
+	    case OPT_CONVERGE:
+		test->converge_min = DEFAULT_CONVERGE_MIN;
+		test->converge_tolerance = DEFAULT_CONVERGE_TOLERANCE;
+		if (optarg) {
+		    slash = strchr(optarg, '/');
+		    if (slash) {
+			*slash = '\0';
+			++slash;
+			test->converge_tolerance = atof(slash);
+		    }
+		    test->converge_min = atoi(optarg);
+		}
+		if (test->converge_min <= 0 || test->converge_tolerance <= 0) {
+		    i_errno = IECONVERGE;
+		    return -1;
+		}
+		test->converge_tolerance /= 100;
+		client_flag = 1;
+		break;
+	    case OPT_RAMP:
+		test->ramp_gain = optarg ? atof(optarg) : DEFAULT_RAMP_GAIN;
+		if (test->ramp_gain <= 0) {
+		    i_errno = IERAMP;
+		    return -1;
+		}
+		test->ramp_gain /= 100;
+		client_flag = 1;
+		break;
+	    case OPT_SEARCH:
+		test->search = 1;
+		test->search_loss = 0;
+		test->search_nblksizes = 0;
+		if (optarg) {
+		    test->search_loss = strtod(optarg, &endptr);
+		    if (*endptr == '/') {
+			do {
+			    if (test->search_nblksizes == IPERF_SEARCH_MAX_BLKSIZES) {
+				i_errno = IESEARCH;
+				return -1;
+			    }
+			    test->search_blksizes[test->search_nblksizes++] = strtol(endptr + 1, &endptr, 10);
+			} while (*endptr == ',');
+		    }
+		    if (*endptr != '\0') {
+			i_errno = IESEARCH;
+			return -1;
+		    }
+		}
+		if (test->search_loss < 0 || test->search_loss >= 100) {
+		    i_errno = IESEARCH;
+		    return -1;
+		}
+		client_flag = 1;
+		break;
 #if defined(HAVE_IPPROTO_MPTCP)
 	    case 'm':
 		set_protocol(test, Ptcp);
@@ -1835,7 +2079,7 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
     test->settings->blksize = blksize;
 
     if (!rate_flag)
-	test->settings->rate = test->protocol->id == Pudp ? UDP_RATE : 0;
+	test->settings->rate = test->protocol->id == Pudp ? (test->search ? DEFAULT_SEARCH_RATE : UDP_RATE) : 0;
 
     /* if no bytes or blocks specified, nor a duration_flag, and we have -F,
     ** get the file-size as the bytes count to be transferred
@@ -1871,6 +2115,43 @@ iperf_parse_arguments(struct iperf_test *test, int argc, char **argv)
         return -1;
     }
 
+    /* --search runs timed UDP trials of its own, at rates up to -b */
+    if (test->search) {
+        if (test->protocol->id != Pudp || test->bidirectional || test->settings->rate == 0 ||
+            test->settings->bytes != 0 || test->settings->blocks != 0 ||
+            test->converge_min > 0 || test->ramp_gain > 0) {
+            i_errno = IESEARCH;
+            return -1;
+        }
+        for (i = 0; i < test->search_nblksizes; ++i)
+            if (test->search_blksizes[i] < MIN_UDP_BLOCKSIZE || test->search_blksizes[i] > MAX_UDP_BLOCKSIZE) {
+                i_errno = IESEARCH;
+                return -1;
+            }
+        if (!duration_flag)
+            test->duration = DEFAULT_SEARCH_TRIAL;
+        if (test->duration == 0) {
+            i_errno = IESEARCH;
+            return -1;
+        }
+    }
+
+    /* --converge ends a timed test early, judging by its interval reports */
+    if (test->converge_min > 0 && (test->duration == 0 || test->stats_interval == 0)) {
+        i_errno = IECONVERGE;
+        return -1;
+    }
+
+    /* --ramp holds back streams this end sends on, judging by its interval reports */
+    if (test->ramp_gain > 0) {
+        if (test->reverse || test->bidirectional || test->stats_interval == 0) {
+            i_errno = IERAMP;
+            return -1;
+        }
+        if (!streams_flag)
+            test->num_streams = DEFAULT_RAMP_STREAMS;
+    }
+
     /* For subsequent calls to getopt */
 #ifdef __APPLE__
     optreset = 1;
@@ -1940,6 +2221,97 @@ iperf_set_send_state(struct iperf_test *test, signed char state)
     return 0;
 }
 
+/*
+ * The rate of the interval about to close, read the way
+ * iperf_stats_callback() will close it.  Returns -1 if there is none.
+ */
+static int
+interval_rate(struct iperf_test *test, struct iperf_time *now, double *bits_per_second)
+{
+    struct iperf_stream *sp;
+    struct iperf_stream_result *rp;
+    struct iperf_time start, diff;
+    iperf_size_t bytes = 0;
+
+    if (SLIST_EMPTY(&test->streams))
+        return -1;
+    SLIST_FOREACH(sp, &test->streams, streams)
+        bytes += sp->sender ? sp->result->bytes_sent_this_interval : sp->result->bytes_received_this_interval;
+
+    rp = SLIST_FIRST(&test->streams)->result;
+    start = TAILQ_EMPTY(&rp->interval_results) ? rp->start_time : rp->end_time;
+    iperf_time_now(now);
+    if (iperf_time_diff(now, &start, &diff))
+        return -1;
+    *bits_per_second = bytes * 8 / iperf_time_in_secs(&diff);
+    return 0;
+}
+
+/*
+ * With --converge, feeds the interval about to close to test->converge.
+ * Returns 1 once the throughput has converged: the test should then end,
+ * with this interval as its last.
+ */
+int
+iperf_check_converge(struct iperf_test *test)
+{
+    struct iperf_stream_result *rp;
+    struct iperf_time now, diff;
+    double bits_per_second;
+
+    if (test->converge == NULL || test->omitting)
+        return 0;
+    if (interval_rate(test, &now, &bits_per_second) < 0)
+        return 0;
+    if (!iperf_converge_add(test->converge, bits_per_second))
+        return 0;
+
+    rp = SLIST_FIRST(&test->streams)->result;
+    test->converge_stop = IPERF_CONVERGE_CONVERGED;
+    iperf_time_diff(&now, &rp->start_time, &diff);
+    test->converge_seconds = iperf_time_in_secs(&diff);
+    return 1;
+}
+
+/*
+ * With --ramp, feeds the interval about to close, and this process's CPU
+ * use over it, to test->ramp, and releases held streams until as many
+ * send as it asks for.  A released stream's throttle starts from now.
+ * Returns the number of streams sending.
+ */
+int
+iperf_check_ramp(struct iperf_test *test)
+{
+    struct iperf_stream *sp;
+    struct iperf_time now;
+    double bits_per_second, pcpu[3], cpu = 0;
+    long cores;
+    int streams, sending = 0;
+
+    if (test->ramp == NULL)
+        return 0;
+    /* A virtual clock's intervals take no CPU time to speak of */
+    if (!iperf_time_is_virtual()) {
+        cpu_util(&test->ramp_cpu, pcpu);
+        cpu_util(&test->ramp_cpu, NULL);
+        cores = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu = pcpu[0] / (cores > 0 ? cores : 1);
+    }
+    if (test->omitting || interval_rate(test, &now, &bits_per_second) < 0)
+        return iperf_ramp_streams(test->ramp);
+
+    streams = iperf_ramp_add(test->ramp, bits_per_second, cpu);
+    SLIST_FOREACH(sp, &test->streams, streams) {
+        if (sp->ramp_held && sending < streams) {
+            sp->ramp_held = 0;
+            sp->result->start_time_fixed = now;
+        }
+        if (!sp->ramp_held)
+            ++sending;
+    }
+    return sending;
+}
+
 void
 iperf_check_throttle(struct iperf_stream *sp, struct iperf_time *nowP)
 {
@@ -1963,6 +2335,11 @@ iperf_check_throttle(struct iperf_stream *sp, struct iperf_time *nowP)
     iperf_time_diff(&sp->result->start_time_fixed, nowP, &temp_time);
     seconds = iperf_time_in_secs(&temp_time);
     bits_sent = sp->result->bytes_sent * 8;
+    if (seconds <= 0) {
+        /* Only a virtual clock stands still while data is sent */
+        sp->green_light = bits_sent == 0;
+        return;
+    }
     bits_per_second = bits_sent / seconds;
     missing_rate = sp->test->settings->rate - bits_per_second;
 
@@ -1974,7 +2351,8 @@ iperf_check_throttle(struct iperf_stream *sp, struct iperf_time *nowP)
 
 #if defined(HAVE_CLOCK_NANOSLEEP) || defined(HAVE_NANOSLEEP)
     // If estimated time to next send is large enough, sleep instead of just CPU looping until green light is set
-    if (missing_rate < 0) {
+    // (but not on a virtual clock, whose simulation moves it on to the green light instead)
+    if (missing_rate < 0 && !iperf_time_is_virtual()) {
         delta_bits = bits_sent - (seconds * sp->test->settings->rate);
         // Calclate time until next data send is required
         time_to_green_light = (SEC_TO_NS * delta_bits / sp->test->settings->rate);
@@ -2106,8 +2484,12 @@ iperf_send_mt(struct iperf_stream *sp)
         test->bytes_sent += r;
         if (!sp->pending_size)
             ++test->blocks_sent;
+        if (sp->microburst) {
+            iperf_time_now(&now);
+            iperf_microburst_add(sp->microburst, &now, r);
+        }
         if (throttle_check_per_message) {
-            if (message_sent == 0)
+            if (message_sent == 0 && !sp->microburst)
                 iperf_time_now(&now);
             iperf_check_throttle(sp, &now);
         }
@@ -2142,6 +2524,11 @@ iperf_recv_mt(struct iperf_stream *sp)
             if (r > 0) {
 	        test->bytes_received += r;
 	        ++test->blocks_received;
+                if (sp->microburst) {
+                    struct iperf_time now;
+                    iperf_time_now(&now);
+                    iperf_microburst_add(sp->microburst, &now, r);
+                }
             }
 
     return 0;
@@ -2165,6 +2552,8 @@ iperf_init_test(struct iperf_test *test)
     }
     SLIST_FOREACH(sp, &test->streams, streams) {
 	sp->result->start_time = sp->result->start_time_fixed = now;
+	if (sp->microburst)
+	    iperf_microburst_start(sp->microburst, &now);
     }
 
     if (test->on_test_start)
@@ -2280,6 +2669,10 @@ iperf_exchange_parameters(struct iperf_test *test)
         test->max_fd = (s > test->max_fd) ? s : test->max_fd;
         test->prot_listener = s;
 
+        if (test->compress)
+            if (iperf_set_send_state(test, COMPRESS_ACCEPTED) != 0)
+                return -1;
+
         // Send the control message to create streams and start the test
 	if (iperf_set_send_state(test, CREATE_STREAMS) != 0)
             return -1;
@@ -2402,6 +2795,8 @@ send_parameters(struct iperf_test *test)
 #endif // HAVE_SSL
 	if (test->settings->skip_rx_copy)
 	    cJSON_AddNumberToObject(j, "skip_rx_copy", test->settings->skip_rx_copy);
+	if (test->compress)
+	    cJSON_AddNumberToObject(j, "compress", test->compress);
 	cJSON_AddStringToObject(j, "client_version", IPERF_VERSION);
 
 	if (test->debug) {
@@ -2410,7 +2805,7 @@ send_parameters(struct iperf_test *test)
 	    cJSON_free(str);
 	}
 
-	if (JSON_write(test->ctrl_sck, j) < 0) {
+	if (JSON_write(test, test->ctrl_sck, j) < 0) {
 	    i_errno = IESENDPARAMS;
 	    r = -1;
 	}
@@ -2428,7 +2823,7 @@ get_parameters(struct iperf_test *test)
     cJSON *j;
     cJSON *j_p;
 
-    j = JSON_read(test->ctrl_sck, MAX_PARAMS_JSON_STRING);
+    j = JSON_read(test, test->ctrl_sck, MAX_PARAMS_JSON_STRING);
     if (j == NULL) {
 	i_errno = IERECVPARAMS;
         r = -1;
@@ -2504,6 +2899,11 @@ get_parameters(struct iperf_test *test)
 	    test->repeating_payload = 1;
 	if ((j_p = iperf_cJSON_GetObjectItemType(j, "zerocopy", cJSON_Number)) != NULL)
 	    test->zerocopy = j_p->valueint;
+	if ((j_p = iperf_cJSON_GetObjectItemType(j, "compress", cJSON_Number)) != NULL && j_p->valueint > 0) {
+	    /* The client can decode what we send; COMPRESS_ACCEPTED tells it the reverse */
+	    test->compress = j_p->valueint;
+	    test->compress_ok = 1;
+	}
 #if defined(HAVE_DONT_FRAGMENT)
 	if ((j_p = iperf_cJSON_GetObjectItemType(j, "dont_fragment", cJSON_Number)) != NULL)
 	    test->settings->dont_fragment = j_p->valueint;
@@ -2622,7 +3022,7 @@ send_results(struct iperf_test *test)
 		printf("send_results\n%s\n", str);
                 cJSON_free(str);
 	    }
-	    if (r == 0 && JSON_write(test->ctrl_sck, j) < 0) {
+	    if (r == 0 && JSON_write(test, test->ctrl_sck, j) < 0) {
 		i_errno = IESENDRESULTS;
 		r = -1;
 	    }
@@ -2665,7 +3065,7 @@ get_results(struct iperf_test *test)
     int retransmits;
     struct iperf_stream *sp;
 
-    j = JSON_read(test->ctrl_sck, 0);
+    j = JSON_read(test, test->ctrl_sck, 0);
     if (j == NULL) {
 	i_errno = IERECVRESULTS;
         r = -1;
@@ -2826,11 +3226,39 @@ get_results(struct iperf_test *test)
 
 /*************************************************************/
 
-static int
-JSON_write(int fd, cJSON *json)
+/*
+ * Once compression has been negotiated, messages of at least
+ * test->compress bytes may be sent as a length word with
+ * JSON_COMPRESSED set, followed by the uncompressed length and the
+ * iperf_lz data.  Messages that don't get smaller go out as before.
+ */
+#define JSON_COMPRESSED 0x80000000U
+
+/* Returns the compressed size, or 0 to send str as is */
+static uint32_t
+JSON_compress(struct iperf_test *test, const char *str, uint32_t hsize, char **cbuf)
 {
-    uint32_t hsize, nsize;
-    char *str;
+    struct iperf_time start, end, diff;
+    uint32_t csize = 0;
+
+    if (!test->compress_ok || hsize < (uint32_t) test->compress || hsize <= 2 * sizeof(uint32_t))
+	return 0;
+    iperf_time_now(&start);
+    *cbuf = malloc(hsize);
+    if (*cbuf != NULL)
+	/* Must save more than the extra length word */
+	csize = iperf_lz_compress(str, hsize, *cbuf, hsize - sizeof(uint32_t) - 1);
+    iperf_time_now(&end);
+    iperf_time_diff(&end, &start, &diff);
+    test->compress_stats.usecs += iperf_time_in_usecs(&diff);
+    return csize;
+}
+
+int
+JSON_write(struct iperf_test *test, int fd, cJSON *json)
+{
+    uint32_t hsize, nsize, csize;
+    char *str, *cbuf = NULL;
     int r = 0;
 
     str = cJSON_PrintUnformatted(json);
@@ -2838,13 +3266,31 @@ JSON_write(int fd, cJSON *json)
 	r = -1;
     else {
 	hsize = strlen(str);
-	nsize = htonl(hsize);
-	if (Nwrite(fd, (char*) &nsize, sizeof(nsize), Ptcp) < 0)
-	    r = -1;
-	else {
-	    if (Nwrite(fd, str, hsize, Ptcp) < 0)
+	csize = JSON_compress(test, str, hsize, &cbuf);
+	if (csize > 0) {
+	    nsize = htonl(csize | JSON_COMPRESSED);
+	    if (Nwrite(fd, (char*) &nsize, sizeof(nsize), Ptcp) < 0)
+		r = -1;
+	    else {
+		nsize = htonl(hsize);
+		if (Nwrite(fd, (char*) &nsize, sizeof(nsize), Ptcp) < 0 ||
+		    Nwrite(fd, cbuf, csize, Ptcp) < 0)
+		    r = -1;
+	    }
+	} else {
+	    nsize = htonl(hsize);
+	    if (Nwrite(fd, (char*) &nsize, sizeof(nsize), Ptcp) < 0)
 		r = -1;
+	    else {
+		if (Nwrite(fd, str, hsize, Ptcp) < 0)
+		    r = -1;
+	    }
+	}
+	if (test->compress) {
+	    test->compress_stats.sent_raw += hsize;
+	    test->compress_stats.sent_wire += csize > 0 ? csize + sizeof(nsize) : hsize;
 	}
+	free(cbuf);
 	cJSON_free(str);
     }
     return r;
@@ -2853,7 +3299,58 @@ JSON_write(int fd, cJSON *json)
 /*************************************************************/
 
 static cJSON *
-JSON_read(int fd, int max_size)
+JSON_read_compressed(struct iperf_test *test, int fd, uint32_t csize, int max_size)
+{
+    uint32_t rsize, nsize;
+    char *cbuf, *str;
+    cJSON *json = NULL;
+    struct iperf_time start, end, diff;
+    char msg_buf[WARN_STR_LEN * 2];
+
+    if (Nread(fd, (char*) &nsize, sizeof(nsize), Ptcp) != sizeof(nsize)) {
+	warning("Failed to read uncompressed JSON data size");
+	return NULL;
+    }
+    rsize = ntohl(nsize);
+    /* The codec can't expand data by more than a factor of 255 */
+    if (csize == 0 || rsize == 0 || rsize >= JSON_COMPRESSED ||
+	(max_size != 0 && rsize > max_size) || rsize / 255 > csize) {
+	snprintf(msg_buf, sizeof(msg_buf), "Compressed JSON data length overflow - %u bytes for %u bytes JSON size is not allowed", csize, rsize);
+	warning(msg_buf);
+	return NULL;
+    }
+
+    cbuf = malloc(csize);
+    str = malloc(rsize + 1);
+    if (cbuf != NULL && str != NULL) {
+	if (Nread(fd, cbuf, csize, Ptcp) == csize) {
+	    iperf_time_now(&start);
+	    if (iperf_lz_decompress(cbuf, csize, str, rsize) == rsize) {
+		str[rsize] = '\0';
+		json = cJSON_Parse(str);
+	    }
+	    else
+		warning("Compressed JSON data is corrupt");
+	    iperf_time_now(&end);
+	    iperf_time_diff(&end, &start, &diff);
+	    test->compress_stats.usecs += iperf_time_in_usecs(&diff);
+	    test->compress_stats.received_raw += rsize;
+	    test->compress_stats.received_wire += csize + sizeof(nsize);
+	}
+	else {
+	    snprintf(msg_buf, sizeof(msg_buf), "Compressed JSON data read failed; errno=%d", errno);
+	    warning(msg_buf);
+	}
+    }
+    free(cbuf);
+    free(str);
+    return json;
+}
+
+/*************************************************************/
+
+cJSON *
+JSON_read(struct iperf_test *test, int fd, int max_size)
 {
     uint32_t hsize, nsize;
     size_t strsize;
@@ -2870,6 +3367,8 @@ JSON_read(int fd, int max_size)
     rc = Nread(fd, (char*) &nsize, sizeof(nsize), Ptcp);
     if (rc == sizeof(nsize)) {
         hsize = ntohl(nsize);
+        if ((hsize & JSON_COMPRESSED) && test->compress)
+            return JSON_read_compressed(test, fd, hsize & ~JSON_COMPRESSED, max_size);
         if (hsize > 0 && (max_size == 0 || hsize <= max_size)) {
 	    /* Allocate a buffer to hold the JSON */
 	    strsize = hsize + 1;              /* +1 for trailing NULL */
@@ -2886,6 +3385,10 @@ JSON_read(int fd, int max_size)
                         */
                         if (rc == hsize) {
                             json = cJSON_Parse(str);
+                            if (test->compress) {
+                                test->compress_stats.received_raw += hsize;
+                                test->compress_stats.received_wire += hsize;
+                            }
                         }
                         else {
                             snprintf(msg_buf, sizeof(msg_buf), "JSON size of data read does not correspond to offered length - expected %d bytes but received %d; errno=%d", hsize, rc, errno);
@@ -3055,6 +3558,15 @@ iperf_new_test()
     }
     memset(test->bitrate_limit_intervals_traffic_bytes, 0, sizeof(iperf_size_t) * MAX_INTERVAL);
 
+    test->timers = tmr_queue_new();
+    if (!test->timers) {
+        free(test->bitrate_limit_intervals_traffic_bytes);
+        free(test->settings);
+        free(test);
+	i_errno = IENEWTEST;
+	return NULL;
+    }
+
     /* By default all output goes to stdout */
     test->outfile = stdout;
 
@@ -3143,6 +3655,8 @@ iperf_defaults(struct iperf_test *testp)
     testp->settings->cntl_ka_count = 0;
 
     testp->json_callback = NULL;
+    testp->json_detail = IPERF_JSON_DETAIL_FULL;
+    testp->payload_fd = -1;
 
 
     memset(testp->cookie, 0, COOKIE_SIZE);
@@ -3229,6 +3743,10 @@ iperf_free_test(struct iperf_test *test)
         SLIST_REMOVE_HEAD(&test->streams, streams);
         iperf_free_stream(sp);
     }
+    iperf_payload_free(test);
+    iperf_free_addresses(test);
+    iperf_converge_free(test->converge);
+    iperf_ramp_free(test->ramp);
     if (test->server_hostname)
 	free(test->server_hostname);
     if (test->tmp_template)
@@ -3291,6 +3809,7 @@ iperf_free_test(struct iperf_test *test)
 	tmr_cancel(test->stats_timer);
     if (test->reporter_timer != NULL)
 	tmr_cancel(test->reporter_timer);
+    tmr_queue_free(test->timers);
 
     /* Free protocol list */
     while (!SLIST_EMPTY(&test->protocols)) {
@@ -3319,7 +3838,7 @@ iperf_free_test(struct iperf_test *test)
     }
 
     if (test->json_output_string) {
-	free(test->json_output_string);
+	cJSON_free(test->json_output_string);
 	test->json_output_string = NULL;
     }
 
@@ -3370,6 +3889,8 @@ iperf_reset_test(struct iperf_test *test)
         SLIST_REMOVE_HEAD(&test->streams, streams);
         iperf_free_stream(sp);
     }
+    iperf_payload_free(test);
+    iperf_free_addresses(test);
     if (test->omit_timer != NULL) {
 	tmr_cancel(test->omit_timer);
 	test->omit_timer = NULL;
@@ -3445,6 +3966,23 @@ iperf_reset_test(struct iperf_test *test)
     test->settings->dont_fragment = 0;
     test->zerocopy = 0;
     test->settings->skip_rx_copy = 0;
+    test->compress = 0;
+    test->compress_ok = 0;
+    memset(&test->compress_stats, 0, sizeof(test->compress_stats));
+    test->converge_min = 0;
+    test->converge_tolerance = 0;
+    iperf_converge_free(test->converge);
+    test->converge = NULL;
+    test->converge_stop = IPERF_CONVERGE_RUNNING;
+    test->converge_seconds = 0;
+    test->ramp_gain = 0;
+    iperf_ramp_free(test->ramp);
+    test->ramp = NULL;
+    test->search = 0;
+    test->search_nblksizes = 0;
+    test->stream_setup_usecs = 0;
+    test->resolve_usecs = 0;
+    test->stream_connect_usecs = 0;
 
 #if defined(HAVE_SSL)
     if (test->settings->authtoken) {
@@ -3517,6 +4055,9 @@ iperf_reset_stats(struct iperf_test *test)
 	}
 	rp->stream_retrans = 0;
 	rp->start_time = now;
+	/* The stream's thread may be adding right now */
+	if (sp->microburst)
+	    iperf_microburst_restart(sp->microburst, &now);
     }
 }
 
@@ -3561,6 +4102,10 @@ iperf_stats_callback(struct iperf_test *test)
         memcpy(&temp.interval_end_time, &rp->end_time, sizeof(struct iperf_time));
         iperf_time_diff(&temp.interval_start_time, &temp.interval_end_time, &temp_time);
         temp.interval_duration = iperf_time_in_secs(&temp_time);
+        if (sp->microburst)
+            iperf_microburst_close(sp->microburst, &temp.interval_end_time, &temp.microburst);
+        else
+            memset(&temp.microburst, 0, sizeof(temp.microburst));
 	if (test->protocol->id == Ptcp) {
 	    if ( has_tcpinfo()) {
 		save_tcpinfo(sp, &temp);
@@ -3650,6 +4195,115 @@ iperf_stats_callback(struct iperf_test *test)
     }
 }
 
+/*
+ * Buckets each --microburst recorder keeps: a few intervals' worth, or
+ * the whole test when asked to keep it, within IPERF_MICROBURST_MAX_BUCKETS.
+ */
+static uint64_t
+microburst_capacity(struct iperf_test *test)
+{
+    uint64_t ms;
+
+    if (test->microburst_keep)
+        ms = test->duration > 0 ? (uint64_t) test->duration * 1000 + 1000 : 0;
+    else
+        ms = test->stats_interval > 0 ? (uint64_t) (test->stats_interval * 4000) : 0;
+    if (ms == 0 || ms > IPERF_MICROBURST_MAX_BUCKETS)
+        return IPERF_MICROBURST_MAX_BUCKETS;
+    return ms;
+}
+
+static cJSON *
+microburst_json(struct iperf_microburst_summary *mb)
+{
+    return iperf_json_printf("peak_bits_per_second: %f  cv: %f  stalls: %d  stall_ms: %d  longest_stall_ms: %d", mb->peak_bits_per_second, mb->cv, mb->stalls, mb->stall_ms, mb->longest_stall_ms);
+}
+
+/* How a --converge test ended, and how sure its throughput is */
+static void
+print_converge(struct iperf_test *test)
+{
+    static const char *stops[] = { "running", "converged", "max_duration", "interrupted" };
+    struct iperf_converge_estimate estimate;
+    struct iperf_stream *sp;
+    struct iperf_time now, diff;
+    char nbuf[UNIT_LEN];
+
+    if (test->converge_stop == IPERF_CONVERGE_RUNNING) {
+        /* The test timer clears test->timer when it runs out */
+        test->converge_stop = test->timer == NULL ? IPERF_CONVERGE_MAX_DURATION : IPERF_CONVERGE_INTERRUPTED;
+        sp = SLIST_FIRST(&test->streams);
+        iperf_time_now(&now);
+        if (sp != NULL && !iperf_time_diff(&now, &sp->result->start_time, &diff))
+            test->converge_seconds = iperf_time_in_secs(&diff);
+    }
+    iperf_converge_estimate(test->converge, &estimate);
+
+    if (test->json_output) {
+        cJSON_AddItemToObject(test->json_end, "convergence", iperf_json_printf("stop_reason: %s  seconds: %f  min_seconds: %d  tolerance: %f  confidence: %f  intervals: %d  bits_per_second: %f  ci_bits_per_second: %f  relative_ci: %f", stops[test->converge_stop], test->converge_seconds, (int64_t) test->converge_min, test->converge_tolerance, 0.95, (int64_t) estimate.intervals, estimate.bits_per_second, estimate.ci_bits_per_second, estimate.relative_ci));
+        return;
+    }
+    unit_snprintf(nbuf, UNIT_LEN, estimate.bits_per_second / 8, test->settings->unit_format);
+    if (test->converge_stop == IPERF_CONVERGE_CONVERGED)
+        iperf_printf(test, report_converged, test->converge_seconds, nbuf, estimate.relative_ci * 100, estimate.intervals);
+    else
+        iperf_printf(test, report_not_converged, stops[test->converge_stop], nbuf, estimate.relative_ci * 100, estimate.intervals, test->converge_tolerance * 100);
+}
+
+/* The --ramp's throughput per stream count, and where it saturated */
+static void
+print_ramp(struct iperf_test *test)
+{
+    static const char *stops[] = { "running", "saturated", "cpu", "max_streams", "ended" };
+    const struct iperf_ramp_step *steps;
+    cJSON *json_ramp, *json_steps;
+    char nbuf[UNIT_LEN], gbuf[16], cbuf[16];
+    int i, nsteps, stop;
+
+    iperf_ramp_end(test->ramp);
+    stop = iperf_ramp_stop(test->ramp);
+    nsteps = iperf_ramp_steps(test->ramp, &steps);
+
+    if (test->json_output) {
+        json_ramp = iperf_json_printf("stop_reason: %s  saturation_streams: %d  max_streams: %d  gain: %f  step_intervals: %d", stops[stop], (int64_t) iperf_ramp_saturation(test->ramp), (int64_t) test->num_streams, test->ramp_gain, (int64_t) IPERF_RAMP_STEP_INTERVALS);
+        json_steps = cJSON_CreateArray();
+        if (json_ramp == NULL || json_steps == NULL) {
+            cJSON_Delete(json_ramp);
+            cJSON_Delete(json_steps);
+            return;
+        }
+        for (i = 0; i < nsteps; i++)
+            cJSON_AddItemToArray(json_steps, iperf_json_printf("streams: %d  bits_per_second: %f  cpu_percent: %f", (int64_t) steps[i].streams, steps[i].bits_per_second, steps[i].cpu_percent));
+        cJSON_AddItemToObject(json_ramp, "steps", json_steps);
+        cJSON_AddItemToObject(test->json_end, "ramp", json_ramp);
+        return;
+    }
+    iperf_printf(test, "%s", report_ramp_header);
+    for (i = 0; i < nsteps; i++) {
+        unit_snprintf(nbuf, UNIT_LEN, steps[i].bits_per_second / 8, test->settings->unit_format);
+        if (i > 0 && steps[i - 1].bits_per_second > 0)
+            snprintf(gbuf, sizeof(gbuf), "%+7.1f%%", (steps[i].bits_per_second / steps[i - 1].bits_per_second - 1) * 100);
+        else
+            snprintf(gbuf, sizeof(gbuf), "%8s", "-");
+        if (steps[i].cpu_percent > 0)
+            snprintf(cbuf, sizeof(cbuf), "%6.1f%%", steps[i].cpu_percent);
+        else
+            snprintf(cbuf, sizeof(cbuf), "%7s", "-");
+        iperf_printf(test, report_ramp_step, steps[i].streams, nbuf, gbuf, cbuf);
+    }
+    switch (stop) {
+    case IPERF_RAMP_SATURATED:
+        iperf_printf(test, report_ramp_saturated, iperf_ramp_saturation(test->ramp), test->ramp_gain * 100);
+        break;
+    case IPERF_RAMP_CPU:
+        iperf_printf(test, report_ramp_cpu, iperf_ramp_saturation(test->ramp), IPERF_RAMP_CPU_LIMIT);
+        break;
+    default:
+        iperf_printf(test, report_ramp_not_saturated, stops[stop], iperf_ramp_streams(test->ramp));
+        break;
+    }
+}
+
 /**
  * Print intermediate results during a test (interval report).
  * Uses print_interval_results to print the results for each stream,
@@ -3719,7 +4373,8 @@ iperf_print_intermediate(struct iperf_test *test)
      *
      * This avoids unneeded memory build up for long sessions.
      */
-    discard_json = test->json_stream == 1 && !(test->role == 's' && test->get_server_output);
+    discard_json = (test->json_stream == 1 && !(test->role == 's' && test->get_server_output)) ||
+        test->json_detail == IPERF_JSON_DETAIL_NONE;
 
     if (test->json_output) {
         json_interval = cJSON_CreateObject();
@@ -3727,10 +4382,14 @@ iperf_print_intermediate(struct iperf_test *test)
 	    return;
         if (!discard_json)
 	    cJSON_AddItemToArray(test->json_intervals, json_interval);
-        json_interval_streams = cJSON_CreateArray();
-	if (json_interval_streams == NULL)
-	    return;
-	cJSON_AddItemToObject(json_interval, "streams", json_interval_streams);
+        /* At the sums-only detail level the per-stream objects are never built. */
+        if (test->json_detail >= IPERF_JSON_DETAIL_STREAMS) {
+            json_interval_streams = cJSON_CreateArray();
+            if (json_interval_streams == NULL)
+                return;
+            cJSON_AddItemToObject(json_interval, "streams", json_interval_streams);
+        } else
+            json_interval_streams = NULL;
     } else {
         json_interval = NULL;
         json_interval_streams = NULL;
@@ -3787,7 +4446,8 @@ iperf_print_intermediate(struct iperf_test *test)
 
         SLIST_FOREACH(sp, &test->streams, streams) {
             if (sp->sender == stream_must_be_sender) {
-                print_interval_results(test, sp, json_interval_streams);
+                if (!test->json_output || json_interval_streams != NULL)
+                    print_interval_results(test, sp, json_interval_streams);
                 /* sum up all streams */
                 irp = TAILQ_LAST(&sp->result->interval_results, irlisthead);
                 if (irp == NULL) {
@@ -3903,10 +4563,12 @@ iperf_print_results(struct iperf_test *test)
     /* print final summary for all intervals */
 
     if (test->json_output) {
-        json_summary_streams = cJSON_CreateArray();
-	if (json_summary_streams == NULL)
-	    return;
-	cJSON_AddItemToObject(test->json_end, "streams", json_summary_streams);
+        if (test->json_detail >= IPERF_JSON_DETAIL_STREAMS) {
+            json_summary_streams = cJSON_CreateArray();
+            if (json_summary_streams == NULL)
+                return;
+            cJSON_AddItemToObject(test->json_end, "streams", json_summary_streams);
+        }
     } else {
 	iperf_printf(test, "%s", report_bw_separator);
 	if (test->verbose)
@@ -4027,11 +4689,16 @@ iperf_print_results(struct iperf_test *test)
         receiver_time = sp->result->receiver_time;
         SLIST_FOREACH(sp, &test->streams, streams) {
             if (sp->sender == stream_must_be_sender) {
-                if (test->json_output) {
+                if (json_summary_streams != NULL) {
                     json_summary_stream = cJSON_CreateObject();
                     if (json_summary_stream == NULL)
                         return;
                     cJSON_AddItemToArray(json_summary_streams, json_summary_stream);
+                    if (sp->microburst) {
+                        struct iperf_microburst_summary total;
+                        iperf_microburst_totals(sp->microburst, &total);
+                        cJSON_AddItemToObject(json_summary_stream, "microburst", microburst_json(&total));
+                    }
                 }
 
                 bytes_sent = sp->result->bytes_sent - sp->result->bytes_sent_omit;
@@ -4082,8 +4749,12 @@ iperf_print_results(struct iperf_test *test)
                 if (test->protocol->id == Ptcp || test->protocol->id == Psctp) {
                     if (test->sender_has_retransmits || test->protocol->id == Psctp) {
                         /* Sender summary, TCP and SCTP with retransmits. */
-                        if (test->json_output)
-                            cJSON_AddItemToObject(json_summary_stream, report_sender, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f  retransmits: %d  max_snd_cwnd:  %d  max_snd_wnd:  %d  max_rtt:  %d  min_rtt:  %d  mean_rtt:  %d sender: %b", (int64_t) sp->socket, (double) start_time, (double) sender_time, (double) sender_time, (int64_t) bytes_sent, bandwidth * 8, (int64_t) sp->result->stream_retrans, (int64_t) sp->result->stream_max_snd_cwnd, (int64_t) sp->result->stream_max_snd_wnd, (int64_t) sp->result->stream_max_rtt, (int64_t) sp->result->stream_min_rtt, (int64_t) ((sp->result->stream_count_rtt == 0) ? 0 : sp->result->stream_sum_rtt / sp->result->stream_count_rtt), stream_must_be_sender));
+                        if (test->json_output) {
+                            if (json_summary_stream != NULL && test->json_detail >= IPERF_JSON_DETAIL_FULL)
+                                cJSON_AddItemToObject(json_summary_stream, report_sender, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f  retransmits: %d  max_snd_cwnd:  %d  max_snd_wnd:  %d  max_rtt:  %d  min_rtt:  %d  mean_rtt:  %d sender: %b", (int64_t) sp->socket, (double) start_time, (double) sender_time, (double) sender_time, (int64_t) bytes_sent, bandwidth * 8, (int64_t) sp->result->stream_retrans, (int64_t) sp->result->stream_max_snd_cwnd, (int64_t) sp->result->stream_max_snd_wnd, (int64_t) sp->result->stream_max_rtt, (int64_t) sp->result->stream_min_rtt, (int64_t) ((sp->result->stream_count_rtt == 0) ? 0 : sp->result->stream_sum_rtt / sp->result->stream_count_rtt), stream_must_be_sender));
+                            else if (json_summary_stream != NULL)
+                                cJSON_AddItemToObject(json_summary_stream, report_sender, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f  retransmits: %d  max_rtt:  %d  min_rtt:  %d  mean_rtt:  %d sender: %b", (int64_t) sp->socket, (double) start_time, (double) sender_time, (double) sender_time, (int64_t) bytes_sent, bandwidth * 8, (int64_t) sp->result->stream_retrans, (int64_t) sp->result->stream_max_rtt, (int64_t) sp->result->stream_min_rtt, (int64_t) ((sp->result->stream_count_rtt == 0) ? 0 : sp->result->stream_sum_rtt / sp->result->stream_count_rtt), stream_must_be_sender));
+                        }
                         else
                             if (test->role == 's' && !sp->sender) {
                                 if (test->verbose)
@@ -4094,8 +4765,10 @@ iperf_print_results(struct iperf_test *test)
                             }
                     } else {
                         /* Sender summary, TCP and SCTP without retransmits. */
-                        if (test->json_output)
-                            cJSON_AddItemToObject(json_summary_stream, report_sender, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f sender: %b", (int64_t) sp->socket, (double) start_time, (double) sender_time, (double) sender_time, (int64_t) bytes_sent, bandwidth * 8,  stream_must_be_sender));
+                        if (test->json_output) {
+                            if (json_summary_stream != NULL)
+                                cJSON_AddItemToObject(json_summary_stream, report_sender, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f sender: %b", (int64_t) sp->socket, (double) start_time, (double) sender_time, (double) sender_time, (int64_t) bytes_sent, bandwidth * 8,  stream_must_be_sender));
+                        }
                         else
                             if (test->role == 's' && !sp->sender) {
                                 if (test->verbose)
@@ -4114,24 +4787,26 @@ iperf_print_results(struct iperf_test *test)
                         lost_percent = 0.0;
                     }
                     if (test->json_output) {
-                        /*
-                         * For historical reasons, we only emit one JSON
-                         * object for the UDP summary, and it contains
-                         * information for both the sender and receiver
-                         * side.
-                         *
-                         * The JSON format as currently defined only includes one
-                         * value for the number of packets.  We usually want that
-                         * to be the sender's value (how many packets were sent
-                         * by the sender).  However this value might not be
-                         * available on the receiver in certain circumstances
-                         * specifically on the server side for a normal test or
-                         * the client side for a reverse-mode test.  If this
-                         * is the case, then use the receiver's count of packets
-                         * instead.
-                         */
-                        int64_t packet_count = sender_packet_count ? sender_packet_count : receiver_packet_count;
-                        cJSON_AddItemToObject(json_summary_stream, "udp", iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f  jitter_ms: %f  lost_packets: %d  packets: %d  lost_percent: %f  out_of_order: %d sender: %b", (int64_t) sp->socket, (double) start_time, (double) sender_time, (double) sender_time, (int64_t) bytes_sent, bandwidth * 8, (double) sp->jitter * 1000.0, (int64_t) (sp->cnt_error - sp->omitted_cnt_error), (int64_t) (packet_count - sp->omitted_packet_count), (double) lost_percent, (int64_t) (sp->outoforder_packets - sp->omitted_outoforder_packets), stream_must_be_sender));
+                        if (json_summary_stream != NULL) {
+                            /*
+                             * For historical reasons, we only emit one JSON
+                             * object for the UDP summary, and it contains
+                             * information for both the sender and receiver
+                             * side.
+                             *
+                             * The JSON format as currently defined only includes one
+                             * value for the number of packets.  We usually want that
+                             * to be the sender's value (how many packets were sent
+                             * by the sender).  However this value might not be
+                             * available on the receiver in certain circumstances
+                             * specifically on the server side for a normal test or
+                             * the client side for a reverse-mode test.  If this
+                             * is the case, then use the receiver's count of packets
+                             * instead.
+                             */
+                            int64_t packet_count = sender_packet_count ? sender_packet_count : receiver_packet_count;
+                            cJSON_AddItemToObject(json_summary_stream, "udp", iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f  jitter_ms: %f  lost_packets: %d  packets: %d  lost_percent: %f  out_of_order: %d sender: %b", (int64_t) sp->socket, (double) start_time, (double) sender_time, (double) sender_time, (int64_t) bytes_sent, bandwidth * 8, (double) sp->jitter * 1000.0, (int64_t) (sp->cnt_error - sp->omitted_cnt_error), (int64_t) (packet_count - sp->omitted_packet_count), (double) lost_percent, (int64_t) (sp->outoforder_packets - sp->omitted_outoforder_packets), stream_must_be_sender));
+                        }
                     }
                     else {
                         /*
@@ -4162,8 +4837,10 @@ iperf_print_results(struct iperf_test *test)
                             percent_received = (int) ( ( (double) bytes_received / (double) sb.st_size ) * 100.0 );
                         }
                         unit_snprintf(sbuf, UNIT_LEN, (double) sb.st_size, 'A');
-                        if (test->json_output)
-                            cJSON_AddItemToObject(json_summary_stream, "diskfile", iperf_json_printf("sent: %d  received: %d  size: %d  percent_sent: %d  percent_received: %d  filename: %s", (int64_t) bytes_sent, (int64_t) bytes_received, (int64_t) sb.st_size, (int64_t) percent_sent, (int64_t) percent_received, test->diskfile_name));
+                        if (test->json_output) {
+                            if (json_summary_stream != NULL)
+                                cJSON_AddItemToObject(json_summary_stream, "diskfile", iperf_json_printf("sent: %d  received: %d  size: %d  percent_sent: %d  percent_received: %d  filename: %s", (int64_t) bytes_sent, (int64_t) bytes_received, (int64_t) sb.st_size, (int64_t) percent_sent, (int64_t) percent_received, test->diskfile_name));
+                        }
                         else
                             if (stream_must_be_sender) {
                                 iperf_printf(test, report_diskfile, ubuf, sbuf, percent_sent, test->diskfile_name);
@@ -4185,8 +4862,10 @@ iperf_print_results(struct iperf_test *test)
                 unit_snprintf(nbuf, UNIT_LEN, bandwidth, test->settings->unit_format);
                 if (test->protocol->id == Ptcp || test->protocol->id == Psctp) {
                     /* Receiver summary, TCP and SCTP */
-                    if (test->json_output)
-                        cJSON_AddItemToObject(json_summary_stream, report_receiver, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f sender: %b", (int64_t) sp->socket, (double) start_time, (double) receiver_time, (double) end_time, (int64_t) bytes_received, bandwidth * 8, stream_must_be_sender));
+                    if (test->json_output) {
+                        if (json_summary_stream != NULL)
+                            cJSON_AddItemToObject(json_summary_stream, report_receiver, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f sender: %b", (int64_t) sp->socket, (double) start_time, (double) receiver_time, (double) end_time, (int64_t) bytes_received, bandwidth * 8, stream_must_be_sender));
+                    }
                     else
                         if (test->role == 's' && sp->sender) {
                             if (test->verbose)
@@ -4354,7 +5033,14 @@ iperf_print_results(struct iperf_test *test)
             }
         }
 
+        if (test->converge && current_mode == upper_mode)
+            print_converge(test);
+        if (test->ramp && current_mode == upper_mode)
+            print_ramp(test);
+
         if (test->json_output && current_mode == upper_mode) {
+            if (test->compress)
+                cJSON_AddItemToObject(test->json_end, "control_compression", iperf_json_printf("negotiated: %b  sent_raw: %d  sent_wire: %d  received_raw: %d  received_wire: %d  usecs: %d", test->compress_ok, (int64_t) test->compress_stats.sent_raw, (int64_t) test->compress_stats.sent_wire, (int64_t) test->compress_stats.received_raw, (int64_t) test->compress_stats.received_wire, (int64_t) test->compress_stats.usecs));
             cJSON_AddItemToObject(test->json_end, "cpu_utilization_percent", iperf_json_printf("host_total: %f  host_user: %f  host_system: %f  remote_total: %f  remote_user: %f  remote_system: %f", (double) test->cpu_util[0], (double) test->cpu_util[1], (double) test->cpu_util[2], (double) test->remote_cpu_util[0], (double) test->remote_cpu_util[1], (double) test->remote_cpu_util[2]));
             if (test->protocol->id == Ptcp) {
                 char *snd_congestion = NULL, *rcv_congestion = NULL;
@@ -4400,6 +5086,8 @@ iperf_print_results(struct iperf_test *test)
                         iperf_printf(test, "rcv_tcp_congestion %s\n", rcv_congestion);
                     }
                 }
+                if (test->compress && current_mode == upper_mode)
+                    iperf_printf(test, report_compress, (uint64_t) test->compress_stats.sent_raw, (uint64_t) test->compress_stats.sent_wire, (uint64_t) test->compress_stats.received_raw, (uint64_t) test->compress_stats.received_wire, test->compress_stats.usecs / 1000.0, test->compress_ok ? "" : " (not negotiated)");
             }
 
             /* Print server output if we're on the client and it was requested/provided */
@@ -4534,8 +5222,10 @@ print_interval_results(struct iperf_test *test, struct iperf_stream *sp, cJSON *
     if (test->protocol->id == Ptcp || test->protocol->id == Psctp) {
 	if ((test->sender_has_retransmits == 1 || test->protocol->id == Psctp) && sp->sender) {
 	    /* Interval, TCP with retransmits. */
-	    if (test->json_output)
+	    if (test->json_output && test->json_detail >= IPERF_JSON_DETAIL_FULL)
 		cJSON_AddItemToArray(json_interval_streams, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f  retransmits: %d  snd_cwnd:  %d  snd_wnd:  %d  rtt:  %d  rttvar: %d  pmtu: %d  omitted: %b sender: %b", (int64_t) sp->socket, (double) st, (double) et, (double) irp->interval_duration, (int64_t) irp->bytes_transferred, bandwidth * 8, (int64_t) irp->interval_retrans, (int64_t) irp->snd_cwnd, (int64_t) irp->snd_wnd, (int64_t) irp->rtt, (int64_t) irp->rttvar, (int64_t) irp->pmtu, irp->omitted, sp->sender));
+	    else if (test->json_output)
+		cJSON_AddItemToArray(json_interval_streams, iperf_json_printf("socket: %d  start: %f  end: %f  seconds: %f  bytes: %d  bits_per_second: %f  retransmits: %d  omitted: %b sender: %b", (int64_t) sp->socket, (double) st, (double) et, (double) irp->interval_duration, (int64_t) irp->bytes_transferred, bandwidth * 8, (int64_t) irp->interval_retrans, irp->omitted, sp->sender));
 	    else {
 		unit_snprintf(cbuf, UNIT_LEN, irp->snd_cwnd, 'A');
 		iperf_printf(test, report_bw_retrans_cwnd_format, sp->socket, mbuf, st, et, ubuf, nbuf, irp->interval_retrans, cbuf, irp->omitted?report_omitted:"");
@@ -4568,6 +5258,17 @@ print_interval_results(struct iperf_test *test, struct iperf_stream *sp, cJSON *
 	}
     }
 
+    if (sp->microburst) {
+	if (test->json_output) {
+	    cJSON *json_stream = cJSON_GetArrayItem(json_interval_streams, cJSON_GetArraySize(json_interval_streams) - 1);
+	    if (json_stream != NULL)
+		cJSON_AddItemToObject(json_stream, "microburst", microburst_json(&irp->microburst));
+	} else if (test->verbose) {
+	    unit_snprintf(nbuf, UNIT_LEN, irp->microburst.peak_bits_per_second / 8, test->settings->unit_format);
+	    iperf_printf(test, report_microburst, sp->socket, mbuf, nbuf, irp->microburst.cv, irp->microburst.stalls, irp->microburst.longest_stall_ms);
+	}
+    }
+
     if (test->logfile || test->forceflush)
         iflush(test);
 }
@@ -4579,8 +5280,7 @@ iperf_free_stream(struct iperf_stream *sp)
     struct iperf_interval_results *irp, *nirp;
 
     /* XXX: need to free interval list too! */
-    munmap(sp->buffer, sp->test->settings->blksize);
-    close(sp->buffer_fd);
+    stream_buffer_free(sp);
     if (sp->diskfile_fd >= 0)
 	close(sp->diskfile_fd);
     for (irp = TAILQ_FIRST(&sp->result->interval_results); irp != NULL; irp = nirp) {
@@ -4588,19 +5288,31 @@ iperf_free_stream(struct iperf_stream *sp)
         free(irp);
     }
     free(sp->result);
+    iperf_microburst_free(sp->microburst);
     if (sp->send_timer != NULL)
 	tmr_cancel(sp->send_timer);
     free(sp);
 }
 
 /**************************************************************************/
-struct iperf_stream *
-iperf_new_stream(struct iperf_test *test, int s, int sender)
+/*
+ * Creates the file behind the shared payload, so that -Z can sendfile()
+ * from it.  A memfd where the kernel has one, else an unlinked temporary
+ * file.  memfd_create(2) is called through syscall(2) since older C
+ * libraries (and Android before API 30) don't wrap it.
+ */
+static int
+payload_file(struct iperf_test *test)
 {
-    struct iperf_stream *sp;
-    int ret = 0;
-
+    int fd;
     char template[1024];
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+    fd = syscall(SYS_memfd_create, "iperf3-payload", MFD_CLOEXEC);
+    if (fd >= 0)
+        return fd;
+#endif /* __linux__ && SYS_memfd_create */
+
     if (test->tmp_template) {
         snprintf(template, sizeof(template) / sizeof(char), "%s", test->tmp_template);
     } else {
@@ -4622,6 +5334,130 @@ iperf_new_stream(struct iperf_test *test, int s, int sender)
         snprintf(template, sizeof(template) / sizeof(char), "%s/iperf3.XXXXXX", tempdir);
     }
 
+    fd = mkstemp(template);
+    if (fd == -1)
+        return -1;
+    if (unlink(template) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * TCP and SCTP senders never write to their buffer, so they all send from
+ * one read-only payload, created and filled when the first of them is.
+ */
+static int
+iperf_payload_create(struct iperf_test *test)
+{
+    size_t size = test->settings->blksize;
+    char *buf;
+    int fd;
+
+    if (test->payload != NULL)
+        return 0;
+    if ((fd = payload_file(test)) < 0)
+        return -1;
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    buf = (char *) mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buf == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (test->repeating_payload)
+        fill_with_repeating_pattern(buf, size);
+    else if (fill_with_random(buf, size) < 0) {
+        munmap(buf, size);
+        close(fd);
+        return -1;
+    }
+    (void) mprotect(buf, size, PROT_READ);
+
+    test->payload = buf;
+    test->payload_fd = fd;
+    test->payload_size = size;
+    return 0;
+}
+
+static void
+iperf_payload_free(struct iperf_test *test)
+{
+    if (test->payload == NULL)
+        return;
+    munmap(test->payload, test->payload_size);
+    close(test->payload_fd);
+    test->payload = NULL;
+    test->payload_fd = -1;
+    test->payload_size = 0;
+}
+
+/*
+ * Resolve the server address, and the -B address if one was given, once
+ * per test.  The control connection and every data stream are created
+ * from these results rather than calling getaddrinfo(3) for each socket.
+ * SOCK_STREAM is only a hint to get one result per address; UDP sockets
+ * use the same addresses.
+ */
+int
+iperf_resolve_addresses(struct iperf_test *test)
+{
+    struct iperf_time start, end, diff;
+
+    if (test->server_addrinfo != NULL)
+        return 0;
+
+    iperf_time_now(&start);
+    if (test->bind_address) {
+        test->bind_addrinfo = netresolve(test->settings->domain, SOCK_STREAM, test->bind_address, 0);
+        if (test->bind_addrinfo == NULL)
+            return -1;
+    }
+    test->server_addrinfo = netresolve(test->settings->domain, SOCK_STREAM, test->server_hostname, test->server_port);
+    if (test->server_addrinfo == NULL) {
+        iperf_free_addresses(test);
+        return -1;
+    }
+    iperf_time_now(&end);
+    iperf_time_diff(&end, &start, &diff);
+    test->resolve_usecs = iperf_time_in_usecs(&diff);
+    return 0;
+}
+
+void
+iperf_free_addresses(struct iperf_test *test)
+{
+    if (test->server_addrinfo) {
+        freeaddrinfo(test->server_addrinfo);
+        test->server_addrinfo = NULL;
+    }
+    if (test->bind_addrinfo) {
+        freeaddrinfo(test->bind_addrinfo);
+        test->bind_addrinfo = NULL;
+    }
+}
+
+/* Stream buffers other than the shared payload are plain heap memory */
+static void
+stream_buffer_free(struct iperf_stream *sp)
+{
+    if (!sp->buffer_shared)
+        free(sp->buffer);
+    sp->buffer = NULL;
+}
+
+struct iperf_stream *
+iperf_new_stream(struct iperf_test *test, int s, int sender)
+{
+    struct iperf_stream *sp;
+    struct iperf_time start, end, diff;
+    int ret = 0;
+
+    iperf_time_now(&start);
+
     sp = (struct iperf_stream *) malloc(sizeof(struct iperf_stream));
     if (!sp) {
         i_errno = IECREATESTREAM;
@@ -4643,32 +5479,38 @@ iperf_new_stream(struct iperf_test *test, int s, int sender)
     memset(sp->result, 0, sizeof(struct iperf_stream_result));
     TAILQ_INIT(&sp->result->interval_results);
 
-    /* Create and randomize the buffer */
-    sp->buffer_fd = mkstemp(template);
-    if (sp->buffer_fd == -1) {
-        i_errno = IECREATESTREAM;
-        free(sp->result);
-        free(sp);
-        return NULL;
-    }
-    if (unlink(template) < 0) {
-        i_errno = IECREATESTREAM;
-        free(sp->result);
-        free(sp);
-        return NULL;
-    }
-    if (ftruncate(sp->buffer_fd, test->settings->blksize) < 0) {
-        i_errno = IECREATESTREAM;
-        free(sp->result);
-        free(sp);
-        return NULL;
-    }
-    sp->buffer = (char *) mmap(NULL, test->settings->blksize, PROT_READ|PROT_WRITE, MAP_PRIVATE, sp->buffer_fd, 0);
-    if (sp->buffer == MAP_FAILED) {
-        i_errno = IECREATESTREAM;
-        free(sp->result);
-        free(sp);
-        return NULL;
+    /*
+     * TCP and SCTP senders share the test's payload.  UDP senders stamp
+     * each datagram into their buffer, --file senders read into it and
+     * receivers receive into it, so those get one of their own.  Every
+     * stream runs in its own thread, so that is per-thread scratch.
+     */
+    if (sender && test->diskfile_name == (char*) 0 &&
+        (test->protocol->id == Ptcp || test->protocol->id == Psctp)) {
+        if (iperf_payload_create(test) < 0) {
+            i_errno = IECREATESTREAM;
+            free(sp->result);
+            free(sp);
+            return NULL;
+        }
+        sp->buffer = test->payload;
+        sp->buffer_fd = test->payload_fd;
+        sp->buffer_shared = 1;
+    } else {
+        sp->buffer = (char *) malloc(test->settings->blksize);
+        if (sp->buffer == NULL) {
+            i_errno = IECREATESTREAM;
+            free(sp->result);
+            free(sp);
+            return NULL;
+        }
+        sp->buffer_fd = -1;
+        if (sender) {
+            if (test->repeating_payload)
+                fill_with_repeating_pattern(sp->buffer, test->settings->blksize);
+            else
+                ret = fill_with_random(sp->buffer, test->settings->blksize);
+        }
     }
     sp->pending_size = 0;
 
@@ -4682,7 +5524,7 @@ iperf_new_stream(struct iperf_test *test, int s, int sender)
 	sp->diskfile_fd = open(test->diskfile_name, sender ? O_RDONLY : (O_WRONLY|O_CREAT|O_TRUNC), S_IRUSR|S_IWUSR);
 	if (sp->diskfile_fd == -1) {
 	    i_errno = IEFILE;
-            munmap(sp->buffer, sp->test->settings->blksize);
+            stream_buffer_free(sp);
             free(sp->result);
             free(sp);
 	    return NULL;
@@ -4695,20 +5537,28 @@ iperf_new_stream(struct iperf_test *test, int s, int sender)
         sp->diskfile_fd = -1;
 
     /* Initialize stream */
-    if (test->repeating_payload)
-        fill_with_repeating_pattern(sp->buffer, test->settings->blksize);
-    else
-        ret = readentropy(sp->buffer, test->settings->blksize);
-
     if ((ret < 0) || (iperf_init_stream(sp, test) < 0)) {
-        close(sp->buffer_fd);
-        munmap(sp->buffer, sp->test->settings->blksize);
+        if (sp->diskfile_fd >= 0)
+            close(sp->diskfile_fd);
+        stream_buffer_free(sp);
         free(sp->result);
         free(sp);
         return NULL;
     }
+    if (test->microburst) {
+        sp->microburst = iperf_microburst_new(test->microburst, microburst_capacity(test));
+        if (sp->microburst == NULL) {
+            i_errno = IECREATESTREAM;
+            iperf_free_stream(sp);
+            return NULL;
+        }
+    }
     iperf_add_stream(test, sp);
 
+    iperf_time_now(&end);
+    iperf_time_diff(&end, &start, &diff);
+    test->stream_setup_usecs += iperf_time_in_usecs(&diff);
+
     return sp;
 }
 
@@ -4851,16 +5701,15 @@ diskfile_send(struct iperf_stream *sp)
 {
     int r;
     int buffer_left = sp->diskfile_left; // represents total data in buffer to be sent out
-    static int rtot;
 
     /* if needed, read enough data from the disk to fill up the buffer */
     if (sp->diskfile_left < sp->test->settings->blksize && !sp->test->done) {
     	r = read(sp->diskfile_fd, sp->buffer, sp->test->settings->blksize -
     		 sp->diskfile_left);
         buffer_left += r;
-    	rtot += r;
+    	sp->diskfile_rtot += r;
     	if (sp->test->debug) {
-    	    printf("read %d bytes from file, %d total\n", r, rtot);
+    	    printf("read %d bytes from file, %" PRId64 " total\n", r, sp->diskfile_rtot);
     	}
 
         // If the buffer doesn't contain a full buffer at this point,
@@ -4960,7 +5809,7 @@ iperf_got_sigend(struct iperf_test *test, int sig)
       (test->role == 's' && test->state == TEST_RUNNING)) {
 
 	test->done = 1;
-	cpu_util(test->cpu_util);
+	cpu_util(&test->cpu_state, test->cpu_util);
 	test->stats_callback(test);
 	iperf_set_test_state(test, DISPLAY_RESULTS); /* change local state only */
 	if (test->on_test_finish)
@@ -5125,23 +5974,24 @@ iperf_json_finish(struct iperf_test *test)
             }
             JSONStream_Output(test, "end", test->json_end);
         }
-        /* Original --json output, single monolithic object */
-        else {
+        /*
+         * Original --json output, single monolithic object.  At the
+         * "none" detail level nobody reads it, so it is not rendered.
+         */
+        else if (test->json_detail != IPERF_JSON_DETAIL_NONE) {
             /*
-             * Get ASCII rendering of JSON structure.  Then make our
-             * own copy of it and return the storage that cJSON
-             * allocated on our behalf.  We keep our own copy
-             * around.
+             * Get ASCII rendering of JSON structure and keep the
+             * storage cJSON allocated for it, rather than a copy;
+             * a long multi-stream result can run to megabytes.
+             * It is released with cJSON_free().
              */
             char *str = cJSON_Print(test->json_top);
             if (str == NULL) {
                 return -1;
             }
-            test->json_output_string = strdup(str);
-            cJSON_free(str);
-            if (test->json_output_string == NULL) {
-                return -1;
-            }
+            if (test->json_output_string)
+                cJSON_free(test->json_output_string);
+            test->json_output_string = str;
             if (test->json_callback != NULL) {
                 (test->json_callback)(test, test->json_output_string);
             } else {
@@ -5250,17 +6100,16 @@ iperf_clearaffinity(struct iperf_test *test)
 #endif /* neither HAVE_SCHED_SETAFFINITY nor HAVE_CPUSET_SETAFFINITY nor HAVE_SETPROCESSAFFINITYMASK */
 }
 
-static char iperf_timestr[100];
-static char linebuffer[1024];
-
 int
 iperf_printf(struct iperf_test *test, const char* format, ...)
 {
     va_list argp;
     int r = 0, r0;
     time_t now;
-    struct tm *ltm = NULL;
+    struct tm ltm;
     char *ct = NULL;
+    char iperf_timestr[100];
+    char linebuffer[1024];
 
     if (pthread_mutex_lock(&(test->print_mutex)) != 0) {
         perror("iperf_print: pthread_mutex_lock");
@@ -5269,8 +6118,8 @@ iperf_printf(struct iperf_test *test, const char* format, ...)
     /* Timestamp if requested */
     if (iperf_get_test_timestamps(test)) {
 	time(&now);
-	ltm = localtime(&now);
-	strftime(iperf_timestr, sizeof(iperf_timestr), iperf_get_test_timestamp_format(test), ltm);
+	localtime_r(&now, &ltm);
+	strftime(iperf_timestr, sizeof(iperf_timestr), iperf_get_test_timestamp_format(test), &ltm);
 	ct = iperf_timestr;
     }
 
@@ -47,6 +47,11 @@ extern "C" { /* open extern "C" */
 typedef u_int64_t atomic_uint_fast64_t;
 #endif // HAVE_STDATOMIC_H
 
+/* i_errno and the iperf_strerror() buffer are per thread */
+#if !defined(IPERF_THREAD_LOCAL)
+#define IPERF_THREAD_LOCAL __thread
+#endif // IPERF_THREAD_LOCAL
+
 struct iperf_test;
 struct iperf_stream_result;
 struct iperf_interval_results;
@@ -71,6 +76,12 @@ typedef atomic_uint_fast64_t atomic_iperf_size_t;
 
 #define WARN_STR_LEN 128
 
+/* JSON detail levels (--json-detail) */
+#define IPERF_JSON_DETAIL_NONE -1    /* library use: quiet like JSON output, but nothing kept or rendered */
+#define IPERF_JSON_DETAIL_SUMS 0     /* interval and end sums only */
+#define IPERF_JSON_DETAIL_STREAMS 1  /* sums plus per-stream objects, without TCP_INFO fields */
+#define IPERF_JSON_DETAIL_FULL 2     /* everything, including TCP_INFO fields (default) */
+
 /* short option equivalents, used to support options that only have long form */
 #define OPT_SCTP 1
 #define OPT_LOGFILE 2
@@ -103,6 +114,13 @@ typedef atomic_uint_fast64_t atomic_iperf_size_t;
 #define OPT_USE_PKCS1_PADDING 30
 #define OPT_CNTL_KA 31
 #define OPT_SKIP_RX_COPY 32
+#define OPT_JSON_DETAIL 33
+#define OPT_FAST_START 34
+#define OPT_COMPRESS 35
+#define OPT_MICROBURST 36
+#define OPT_CONVERGE 37
+#define OPT_RAMP 38
+#define OPT_SEARCH 39
 
 /* states */
 #define TEST_START 1
@@ -121,6 +139,7 @@ typedef atomic_uint_fast64_t atomic_iperf_size_t;
 #define DISPLAY_RESULTS 14
 #define IPERF_START 15
 #define IPERF_DONE 16
+#define COMPRESS_ACCEPTED 17 /* only sent to clients that asked for --compress */
 #define ACCESS_DENIED (-1)
 #define SERVER_ERROR (-2)
 
@@ -153,7 +172,13 @@ char*	iperf_get_test_template( struct iperf_test* ipt );
 int	iperf_get_test_protocol_id( struct iperf_test* ipt );
 int	iperf_get_test_json_output( struct iperf_test* ipt );
 char*	iperf_get_test_json_output_string ( struct iperf_test* ipt );
+char*	iperf_take_test_json_output_string ( struct iperf_test* ipt );
 int	iperf_get_test_json_stream( struct iperf_test* ipt );
+int	iperf_get_test_json_detail( struct iperf_test* ipt );
+int	iperf_get_test_fast_start( struct iperf_test* ipt );
+int	iperf_get_test_compress( struct iperf_test* ipt );
+int	iperf_get_test_microburst( struct iperf_test* ipt );
+int	iperf_get_test_converge_stop( struct iperf_test* ipt );
 int	iperf_get_test_zerocopy( struct iperf_test* ipt );
 int	iperf_get_test_get_server_output( struct iperf_test* ipt );
 char	iperf_get_test_unit_format(struct iperf_test *ipt);
@@ -199,6 +224,14 @@ void    iperf_set_test_template( struct iperf_test *ipt, const char *tmp_templat
 void	iperf_set_test_reverse( struct iperf_test* ipt, int reverse );
 void	iperf_set_test_json_output( struct iperf_test* ipt, int json_output );
 void	iperf_set_test_json_stream( struct iperf_test* ipt, int json_stream );
+void	iperf_set_test_json_detail( struct iperf_test* ipt, int json_detail );
+void	iperf_set_test_fast_start( struct iperf_test* ipt, int fast_start );
+void	iperf_set_test_compress( struct iperf_test* ipt, int compress );
+void	iperf_set_test_microburst( struct iperf_test* ipt, int stall_ms );
+void	iperf_set_test_microburst_keep( struct iperf_test* ipt, int keep );
+void	iperf_set_test_converge( struct iperf_test* ipt, int min_secs, double tolerance );
+void	iperf_set_test_ramp( struct iperf_test* ipt, double gain );
+void	iperf_set_test_search( struct iperf_test* ipt, double loss_tolerance );
 void    iperf_set_test_json_callback(struct iperf_test *ipt, void (*callback)(struct iperf_test *, char *));
 int	iperf_has_zerocopy( void );
 void	iperf_set_test_zerocopy( struct iperf_test* ipt, int zerocopy );
@@ -334,6 +367,8 @@ void build_tcpinfo_message(struct iperf_interval_results *r, char *message);
 
 int iperf_set_send_state(struct iperf_test *test, signed char state);
 void iperf_check_throttle(struct iperf_stream *sp, struct iperf_time *nowP);
+int iperf_check_converge(struct iperf_test *test);
+int iperf_check_ramp(struct iperf_test *test);
 int iperf_send_mt(struct iperf_stream *) /* __attribute__((hot)) */;
 int iperf_recv_mt(struct iperf_stream *);
 void iperf_catch_sigend(void (*handler)(int));
@@ -356,6 +391,7 @@ int set_protocol(struct iperf_test *, int);
 void iperf_on_new_stream(struct iperf_stream *);
 void iperf_on_test_start(struct iperf_test *);
 void iperf_on_connect(struct iperf_test *);
+void iperf_print_startup(struct iperf_test *);
 void iperf_on_test_finish(struct iperf_test *);
 
 extern jmp_buf env;
@@ -364,6 +400,8 @@ extern jmp_buf env;
 int iperf_run_client(struct iperf_test *);
 int iperf_connect(struct iperf_test *);
 int iperf_create_streams(struct iperf_test *, int sender);
+int iperf_resolve_addresses(struct iperf_test *);
+void iperf_free_addresses(struct iperf_test *);
 int iperf_handle_message_client(struct iperf_test *);
 int iperf_client_end(struct iperf_test *);
 
@@ -372,6 +410,7 @@ int iperf_run_server(struct iperf_test *);
 int iperf_server_listen(struct iperf_test *);
 int iperf_accept(struct iperf_test *);
 int iperf_handle_message_server(struct iperf_test *);
+int iperf_server_start_test(struct iperf_test *);
 int iperf_create_pidfile(struct iperf_test *);
 int iperf_delete_pidfile(struct iperf_test *);
 void iperf_check_total_rate(struct iperf_test *, iperf_size_t);
@@ -394,7 +433,7 @@ void iperf_errexit(struct iperf_test *test, const char *format, ...) __attribute
 void iperf_signormalexit(struct iperf_test *test, const char *format, ...) __attribute__ ((format(printf,2,3),noreturn));
 void iperf_exit(struct iperf_test *test, int exit_code, const char *format, va_list argp) __attribute__ ((noreturn));
 char *iperf_strerror(int);
-extern int i_errno;
+extern IPERF_THREAD_LOCAL int i_errno;
 enum {
     IENONE = 0,             // No error
     /* Parameter errors */
@@ -434,6 +473,12 @@ enum {
     IEUDPFILETRANSFER = 34, // Cannot transfer file using UDP
     IESERVERAUTHUSERS = 35,  // Cannot access authorized users file
     IECNTLKA = 36,          // Control connection Keepalive period should be larger than the full retry period (interval * count)
+    IEJSONDETAIL = 37,      // Bad --json-detail argument
+    IECOMPRESS = 38,        // Bad --compress threshold
+    IEMICROBURST = 39,      // Bad --microburst stall threshold
+    IECONVERGE = 40,        // Bad --converge, or not a timed client test with interval reports
+    IERAMP = 41,            // Bad --ramp, or not a client sending with interval reports
+    IESEARCH = 42,          // Bad --search, or not a timed UDP client test
     /* Test errors */
     IENEWTEST = 100,        // Unable to create a new test (check perror)
     IEINITTEST = 101,       // Test initialization failed (check perror)
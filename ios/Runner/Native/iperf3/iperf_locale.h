@@ -59,6 +59,22 @@ extern const char report_authentication_succeeded[] ;
 extern const char report_authentication_failed[] ;
 extern const char report_window[] ;
 extern const char report_autotune[] ;
+extern const char report_startup[] ;
+extern const char report_compress[] ;
+extern const char report_microburst[] ;
+extern const char report_converged[] ;
+extern const char report_not_converged[] ;
+extern const char report_ramp_header[] ;
+extern const char report_ramp_step[] ;
+extern const char report_ramp_saturated[] ;
+extern const char report_ramp_cpu[] ;
+extern const char report_ramp_not_saturated[] ;
+extern const char report_search_start[] ;
+extern const char report_search_header[] ;
+extern const char report_search_trial[] ;
+extern const char report_search_max[] ;
+extern const char report_search_none[] ;
+extern const char report_stream_setup[] ;
 extern const char report_omit_done[] ;
 extern const char report_diskfile[] ;
 extern const char report_done[] ;
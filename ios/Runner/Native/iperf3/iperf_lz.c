@@ -0,0 +1,180 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "iperf_lz.h"
+
+/*
+ * Each sequence is a token byte, holding the literal count in its high
+ * nibble and the match length minus LZ_MIN_MATCH in its low nibble, then
+ * the literals, then the match offset as two little-endian bytes.  A
+ * nibble of 15 means the value continues in the following bytes, each
+ * adding up to 255 and the last one less than 255.  The final sequence
+ * carries literals only and ends the block.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static uint32_t
+lz_hash(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *
+lz_put_length(unsigned char *op, size_t n)
+{
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char) n;
+    return op;
+}
+
+/* Emits one sequence; mlen == 0 means the final, literals-only one */
+static unsigned char *
+lz_put_sequence(unsigned char *op, unsigned char *oend, const unsigned char *lit, size_t nlit, size_t offset, size_t mlen)
+{
+    size_t mcode = mlen ? mlen - LZ_MIN_MATCH : 0;
+    unsigned char *token;
+
+    if ((size_t) (oend - op) < 1 + nlit / 255 + 1 + nlit + 2 + mcode / 255 + 1)
+        return NULL;
+    token = op++;
+    *token = (unsigned char) ((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15)
+        op = lz_put_length(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen == 0)
+        return op;
+    *op++ = (unsigned char) (offset & 0xff);
+    *op++ = (unsigned char) (offset >> 8);
+    *token |= (unsigned char) (mcode < 15 ? mcode : 15);
+    if (mcode >= 15)
+        op = lz_put_length(op, mcode - 15);
+    return op;
+}
+
+size_t
+iperf_lz_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+size_t
+iperf_lz_compress(const char *src, size_t len, char *dst, size_t dstcap)
+{
+    const unsigned char *in = (const unsigned char *) src;
+    const unsigned char *ip = in, *anchor = in, *ref, *end = in + len;
+    unsigned char *op = (unsigned char *) dst, *oend = op + dstcap;
+    uint32_t table[1 << LZ_HASH_BITS];
+    uint32_t h;
+    size_t mlen;
+
+    memset(table, 0, sizeof(table));
+    while (len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+        h = lz_hash(ip);
+        ref = in + table[h];
+        table[h] = (uint32_t) (ip - in);
+        if (ref < ip && ip - ref <= LZ_MAX_OFFSET && memcmp(ref, ip, LZ_MIN_MATCH) == 0) {
+            for (mlen = LZ_MIN_MATCH; ip + mlen < end && ref[mlen] == ip[mlen]; mlen++)
+                ;
+            op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, mlen);
+            if (op == NULL)
+                return 0;
+            ip += mlen;
+            anchor = ip;
+        } else
+            ip++;
+    }
+    op = lz_put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (op == NULL)
+        return 0;
+    return op - (unsigned char *) dst;
+}
+
+/* Reads the continuation bytes of a length nibble of 15 */
+static int
+lz_get_length(const unsigned char **ipp, const unsigned char *iend, size_t *n)
+{
+    unsigned char b;
+
+    do {
+        if (*ipp >= iend)
+            return -1;
+        b = *(*ipp)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+long
+iperf_lz_decompress(const char *src, size_t len, char *dst, size_t dstcap)
+{
+    const unsigned char *ip = (const unsigned char *) src, *iend = ip + len;
+    unsigned char *out = (unsigned char *) dst, *op = out, *oend = out + dstcap;
+    const unsigned char *ref;
+    unsigned char token;
+    size_t nlit, mlen, offset;
+
+    while (ip < iend) {
+        token = *ip++;
+        nlit = token >> 4;
+        if (nlit == 15 && lz_get_length(&ip, iend, &nlit) < 0)
+            return -1;
+        if (nlit > (size_t) (iend - ip) || nlit > (size_t) (oend - op))
+            return -1;
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - out))
+            return -1;
+        mlen = token & 15;
+        if (mlen == 15 && lz_get_length(&ip, iend, &mlen) < 0)
+            return -1;
+        mlen += LZ_MIN_MATCH;
+        if (mlen > (size_t) (oend - op))
+            return -1;
+        /* Byte by byte, since the match may overlap what it produces */
+        for (ref = op - offset; mlen > 0; mlen--)
+            *op++ = *ref++;
+    }
+    return op - out;
+}
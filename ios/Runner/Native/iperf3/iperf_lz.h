@@ -0,0 +1,46 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#ifndef __IPERF_LZ_H
+#define __IPERF_LZ_H
+
+#include <stddef.h>
+
+/*
+ * Small LZ77 codec for control-channel messages, in the style of the LZ4
+ * block format.  No external library is needed, so it is always present.
+ */
+
+/* Worst-case compressed size of len bytes */
+size_t iperf_lz_bound(size_t len);
+
+/* Returns the compressed size, or 0 if it would not fit in dstcap bytes */
+size_t iperf_lz_compress(const char *src, size_t len, char *dst, size_t dstcap);
+
+/* Returns the decompressed size, or -1 if src is malformed or overflows dstcap */
+long iperf_lz_decompress(const char *src, size_t len, char *dst, size_t dstcap);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <stdlib.h>
+
+#include "iperf_ramp.h"
+
+struct iperf_ramp
+{
+    struct iperf_ramp_step *steps;	/* one per stream count measured */
+    int       nsteps;
+    int       max_streams;
+    int       streams;			/* sending now */
+    int       intervals;		/* into the current step */
+    int       stop;
+    int       saturation;
+    double    gain;
+};
+
+struct iperf_ramp *
+iperf_ramp_new(int max_streams, double gain)
+{
+    struct iperf_ramp *ramp;
+
+    ramp = calloc(1, sizeof(*ramp));
+    if (ramp == NULL)
+        return NULL;
+    ramp->max_streams = max_streams > 1 ? max_streams : 1;
+    ramp->streams = 1;
+    ramp->gain = gain;
+    ramp->steps = calloc(ramp->max_streams, sizeof(struct iperf_ramp_step));
+    if (ramp->steps == NULL) {
+        free(ramp);
+        return NULL;
+    }
+    return ramp;
+}
+
+void
+iperf_ramp_free(struct iperf_ramp *ramp)
+{
+    if (ramp == NULL)
+        return;
+    free(ramp->steps);
+    free(ramp);
+}
+
+int
+iperf_ramp_add(struct iperf_ramp *ramp, double bits_per_second, double cpu_percent)
+{
+    struct iperf_ramp_step *step, *prev;
+
+    if (ramp->stop != IPERF_RAMP_RUNNING)
+        return ramp->streams;
+    if (++ramp->intervals < IPERF_RAMP_STEP_INTERVALS)
+        return ramp->streams;
+    ramp->intervals = 0;
+
+    step = &ramp->steps[ramp->nsteps++];
+    step->streams = ramp->streams;
+    step->bits_per_second = bits_per_second;
+    step->cpu_percent = cpu_percent;
+
+    if (ramp->nsteps > 1) {
+        prev = step - 1;
+        if (bits_per_second < prev->bits_per_second * (1 + ramp->gain)) {
+            ramp->stop = IPERF_RAMP_SATURATED;
+            ramp->saturation = prev->streams;
+            return ramp->streams;
+        }
+    }
+    ramp->saturation = ramp->streams;
+    if (cpu_percent >= IPERF_RAMP_CPU_LIMIT)
+        ramp->stop = IPERF_RAMP_CPU;
+    else if (ramp->streams == ramp->max_streams)
+        ramp->stop = IPERF_RAMP_MAX_STREAMS;
+    else
+        ++ramp->streams;
+    return ramp->streams;
+}
+
+void
+iperf_ramp_end(struct iperf_ramp *ramp)
+{
+    if (ramp->stop == IPERF_RAMP_RUNNING)
+        ramp->stop = IPERF_RAMP_ENDED;
+}
+
+int
+iperf_ramp_streams(struct iperf_ramp *ramp)
+{
+    return ramp->streams;
+}
+
+int
+iperf_ramp_stop(struct iperf_ramp *ramp)
+{
+    return ramp->stop;
+}
+
+int
+iperf_ramp_saturation(struct iperf_ramp *ramp)
+{
+    return ramp->saturation;
+}
+
+int
+iperf_ramp_steps(struct iperf_ramp *ramp, const struct iperf_ramp_step **steps)
+{
+    *steps = ramp->steps;
+    return ramp->nsteps;
+}
@@ -0,0 +1,89 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#ifndef __IPERF_RAMP_H
+#define __IPERF_RAMP_H
+
+/*
+ * Parallel-stream ramp (--ramp): the client starts sending on one of its
+ * streams and releases one more at a time, every IPERF_RAMP_STEP_INTERVALS
+ * intervals, for as long as each adds enough throughput.  The rate of the
+ * last interval of each step is the step's, so the new stream's start-up
+ * drops out of it.  The ramp stops adding streams once one adds less than
+ * gain over the step before, once the host's CPU is saturated, or once
+ * every stream is sending; the streams already sending then keep going to
+ * the end of the test.
+ */
+
+#define IPERF_RAMP_STEP_INTERVALS 2
+#define IPERF_RAMP_CPU_LIMIT 90.0	/* percent of all the host's cores */
+
+/* Why the ramp stopped adding streams */
+#define IPERF_RAMP_RUNNING 0
+#define IPERF_RAMP_SATURATED 1		/* the last stream added less than gain */
+#define IPERF_RAMP_CPU 2		/* CPU use reached IPERF_RAMP_CPU_LIMIT */
+#define IPERF_RAMP_MAX_STREAMS 3	/* every stream was sending */
+#define IPERF_RAMP_ENDED 4		/* the test ended first */
+
+struct iperf_ramp;
+
+struct iperf_ramp_step
+{
+    int       streams;
+    double    bits_per_second;
+    double    cpu_percent;		/* of all cores, 0 if not measured */
+};
+
+/*
+ * A ramp up to max_streams, adding streams while each adds at least gain
+ * (a fraction) to the throughput.  Returns NULL when out of memory.
+ */
+struct iperf_ramp *iperf_ramp_new(int max_streams, double gain);
+void iperf_ramp_free(struct iperf_ramp *ramp);
+
+/*
+ * Adds an interval's rate and CPU use at the current number of streams.
+ * Returns how many streams should send from now on.
+ */
+int iperf_ramp_add(struct iperf_ramp *ramp, double bits_per_second, double cpu_percent);
+
+/* Marks a ramp still running as ended by the test */
+void iperf_ramp_end(struct iperf_ramp *ramp);
+
+int iperf_ramp_streams(struct iperf_ramp *ramp);	/* sending now */
+int iperf_ramp_stop(struct iperf_ramp *ramp);		/* IPERF_RAMP_... */
+
+/*
+ * The saturation point: the most streams that were still worth adding,
+ * or with IPERF_RAMP_MAX_STREAMS and IPERF_RAMP_ENDED, the most that were
+ * measured.  0 before the first step.
+ */
+int iperf_ramp_saturation(struct iperf_ramp *ramp);
+
+/* The throughput curve, one step per stream count; returns their number */
+int iperf_ramp_steps(struct iperf_ramp *ramp, const struct iperf_ramp_step **steps);
+
+#endif
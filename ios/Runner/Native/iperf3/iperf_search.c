@@ -0,0 +1,327 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "iperf.h"
+#include "iperf_api.h"
+#include "iperf_locale.h"
+#include "iperf_search.h"
+#include "iperf_util.h"
+#include "units.h"
+
+struct iperf_search
+{
+    struct iperf_search_trial *trials;
+    int       ntrials;
+    int       trials_size;
+    struct iperf_search_result results[IPERF_SEARCH_MAX_BLKSIZES];
+    int       nresults;
+    uint64_t  max_rate;
+    uint64_t  resolution;		/* in bits per second, at least 1 */
+    uint64_t  lo;			/* highest passing rate at this block size */
+    uint64_t  hi;			/* lowest failing one, or the most */
+    double    loss_tolerance;
+};
+
+struct iperf_search *
+iperf_search_new(uint64_t max_rate, double loss_tolerance)
+{
+    struct iperf_search *search;
+
+    search = calloc(1, sizeof(*search));
+    if (search == NULL)
+        return NULL;
+    search->max_rate = max_rate;
+    search->resolution = max_rate * IPERF_SEARCH_RESOLUTION;
+    if (search->resolution < 1)
+        search->resolution = 1;
+    search->loss_tolerance = loss_tolerance;
+    return search;
+}
+
+void
+iperf_search_free(struct iperf_search *search)
+{
+    if (search == NULL)
+        return;
+    free(search->trials);
+    free(search);
+}
+
+int
+iperf_search_begin(struct iperf_search *search, int blksize)
+{
+    struct iperf_search_result *result;
+
+    if (search->nresults == IPERF_SEARCH_MAX_BLKSIZES)
+        return -1;
+    result = &search->results[search->nresults++];
+    result->blksize = blksize;
+    result->max_rate = 0;
+    result->trials = 0;
+    search->lo = 0;
+    search->hi = search->max_rate;
+    return 0;
+}
+
+uint64_t
+iperf_search_next_rate(struct iperf_search *search)
+{
+    if (search->nresults == 0 || search->max_rate == 0)
+        return 0;
+    if (search->results[search->nresults - 1].trials == 0)
+        return search->max_rate;
+    if (search->hi - search->lo <= search->resolution)
+        return 0;
+    return search->lo + (search->hi - search->lo) / 2;
+}
+
+int
+iperf_search_add(struct iperf_search *search, struct iperf_search_trial *trial)
+{
+    struct iperf_search_result *result;
+    struct iperf_search_trial *trials;
+    int size;
+
+    if (search->ntrials == search->trials_size) {
+        size = search->trials_size ? search->trials_size * 2 : 16;
+        trials = realloc(search->trials, size * sizeof(*trials));
+        if (trials == NULL)
+            return -1;
+        search->trials = trials;
+        search->trials_size = size;
+    }
+
+    /* Reordering can make the receiver count more lost than were sent */
+    if (trial->lost < 0)
+        trial->lost = 0;
+    trial->lost_percent = trial->packets > 0 ? 100.0 * trial->lost / trial->packets : 0;
+    trial->passed = trial->packets > 0 && trial->lost_percent <= search->loss_tolerance;
+
+    result = &search->results[search->nresults - 1];
+    ++result->trials;
+    /* A dynamic block size is only known once a trial has run */
+    if (result->blksize == 0)
+        result->blksize = trial->blksize;
+    if (trial->passed) {
+        search->lo = trial->rate;
+        if (trial->rate > result->max_rate)
+            result->max_rate = trial->rate;
+    } else
+        search->hi = trial->rate;
+    search->trials[search->ntrials++] = *trial;
+    return 0;
+}
+
+int
+iperf_search_trials(struct iperf_search *search, const struct iperf_search_trial **trials)
+{
+    *trials = search->trials;
+    return search->ntrials;
+}
+
+int
+iperf_search_results(struct iperf_search *search, const struct iperf_search_result **results)
+{
+    *results = search->results;
+    return search->nresults;
+}
+
+/* Reads a finished trial's loss, jitter and received rate off its streams */
+static void
+trial_results(struct iperf_test *t, struct iperf_search_trial *trial)
+{
+    struct iperf_stream *sp;
+    int must_be_sender = t->mode != RECEIVER;
+    int64_t sender_packets, receiver_packets;
+    double receiver_time = 0, jitter_sum = 0;
+    iperf_size_t received = 0;
+    int streams = 0;
+
+    trial->blksize = t->settings->blksize;
+    SLIST_FOREACH(sp, &t->streams, streams) {
+        if (sp->sender != must_be_sender)
+            continue;
+        if (receiver_time == 0)
+            receiver_time = sp->result->receiver_time;
+        /* The sender's packet count if we have it, else the receiver's */
+        sender_packets = sp->sender ? sp->packet_count : sp->peer_packet_count;
+        receiver_packets = sp->sender ? sp->peer_packet_count : sp->packet_count;
+        trial->packets += (sender_packets ? sender_packets : receiver_packets) - sp->omitted_packet_count;
+        trial->lost += sp->cnt_error;
+        if (sp->omitted_cnt_error > -1)
+            trial->lost -= sp->omitted_cnt_error;
+        jitter_sum += sp->jitter;
+        received += sp->result->bytes_received;
+        ++streams;
+    }
+    if (streams > 0)
+        trial->jitter = jitter_sum / streams * 1000;
+    if (receiver_time > 0)
+        trial->bits_per_second = received * 8 / receiver_time;
+}
+
+/* Runs one trial at rate and blksize; -1 with i_errno set if it failed */
+static int
+run_trial(struct iperf_test *test, struct iperf_test *(*new_trial)(void *arg), void *arg,
+          int blksize, uint64_t rate, struct iperf_search_trial *trial)
+{
+    struct iperf_test *t;
+    int rc;
+
+    t = new_trial(arg);
+    if (t == NULL)
+        return -1;
+    /* Only the search reports; fast start saves each trial round trips */
+    t->search = 0;
+    t->settings->rate = rate;
+    t->settings->blksize = blksize;
+    t->json_output = 1;
+    t->json_stream = 0;
+    t->json_detail = IPERF_JSON_DETAIL_NONE;
+    t->get_server_output = 0;
+    t->fast_start = 1;
+    free(t->logfile);
+    t->logfile = NULL;
+
+    memset(trial, 0, sizeof(*trial));
+    trial->rate = rate;
+    test->search_trial = t;
+    rc = iperf_run_client(t);
+    test->search_trial = NULL;
+    if (rc == 0)
+        trial_results(t, trial);
+    iperf_free_test(t);
+    return rc < 0 ? -1 : 0;
+}
+
+static cJSON *
+search_json(struct iperf_test *test, struct iperf_search *search)
+{
+    const struct iperf_search_trial *trials;
+    const struct iperf_search_result *results;
+    cJSON *json_search, *json_results, *json_trials;
+    int i, n;
+
+    json_search = iperf_json_printf("max_bits_per_second: %d  loss_tolerance: %f  trial_seconds: %d  resolution: %f", (int64_t) test->settings->rate, test->search_loss, (int64_t) test->duration, IPERF_SEARCH_RESOLUTION);
+    json_results = cJSON_CreateArray();
+    json_trials = cJSON_CreateArray();
+    if (json_search == NULL || json_results == NULL || json_trials == NULL) {
+        cJSON_Delete(json_search);
+        cJSON_Delete(json_results);
+        cJSON_Delete(json_trials);
+        return NULL;
+    }
+    n = iperf_search_results(search, &results);
+    for (i = 0; i < n; ++i)
+        cJSON_AddItemToArray(json_results, iperf_json_printf("blksize: %d  max_bits_per_second: %d  trials: %d", (int64_t) results[i].blksize, (int64_t) results[i].max_rate, (int64_t) results[i].trials));
+    n = iperf_search_trials(search, &trials);
+    for (i = 0; i < n; ++i)
+        cJSON_AddItemToArray(json_trials, iperf_json_printf("blksize: %d  offered_bits_per_second: %d  bits_per_second: %f  packets: %d  lost_packets: %d  lost_percent: %f  jitter_ms: %f  passed: %b", (int64_t) trials[i].blksize, (int64_t) trials[i].rate, trials[i].bits_per_second, trials[i].packets, trials[i].lost, trials[i].lost_percent, trials[i].jitter, trials[i].passed));
+    cJSON_AddItemToObject(json_search, "results", json_results);
+    cJSON_AddItemToObject(json_search, "trials", json_trials);
+    return json_search;
+}
+
+int
+iperf_run_search(struct iperf_test *test, struct iperf_test *(*new_trial)(void *arg), void *arg)
+{
+    struct iperf_search *search;
+    struct iperf_search_trial trial;
+    const struct iperf_search_result *results;
+    char obuf[UNIT_LEN], rbuf[UNIT_LEN];
+    int blksizes[IPERF_SEARCH_MAX_BLKSIZES];
+    int nblksizes, ntrials = 0, i, n, rc = 0;
+    uint64_t rate;
+
+    if (test->logfile && iperf_open_logfile(test) < 0)
+        return -1;
+    search = iperf_search_new(test->settings->rate, test->search_loss);
+    if (search == NULL) {
+        i_errno = IEINITTEST;
+        return -1;
+    }
+    nblksizes = test->search_nblksizes;
+    if (nblksizes > 0)
+        memcpy(blksizes, test->search_blksizes, nblksizes * sizeof(int));
+    else {
+        blksizes[0] = test->settings->blksize;
+        nblksizes = 1;
+    }
+
+    if (test->json_output)
+        test->json_top = cJSON_CreateObject();
+    else {
+        unit_snprintf(obuf, UNIT_LEN, (double) test->settings->rate / 8, test->settings->unit_format);
+        iperf_printf(test, report_search_start, obuf, test->duration, test->search_loss);
+        iperf_printf(test, "%s", report_search_header);
+    }
+
+    for (i = 0; i < nblksizes && rc == 0; ++i) {
+        iperf_search_begin(search, blksizes[i]);
+        while ((rate = iperf_search_next_rate(search)) != 0) {
+            if (ntrials++ > 0)
+                usleep(IPERF_SEARCH_REST_MS * 1000);
+            if (run_trial(test, new_trial, arg, blksizes[i], rate, &trial) < 0) {
+                rc = -1;
+                break;
+            }
+            if (iperf_search_add(search, &trial) < 0) {
+                i_errno = IEINITTEST;
+                rc = -1;
+                break;
+            }
+            if (!test->json_output) {
+                unit_snprintf(obuf, UNIT_LEN, (double) trial.rate / 8, test->settings->unit_format);
+                unit_snprintf(rbuf, UNIT_LEN, trial.bits_per_second / 8, test->settings->unit_format);
+                iperf_printf(test, report_search_trial, trial.blksize, obuf, rbuf, trial.lost, trial.packets, trial.lost_percent, trial.jitter, trial.passed ? "pass" : "fail");
+            }
+        }
+    }
+
+    n = iperf_search_results(search, &results);
+    if (rc == 0 && !test->json_output) {
+        for (i = 0; i < n; ++i) {
+            if (results[i].max_rate > 0) {
+                unit_snprintf(obuf, UNIT_LEN, (double) results[i].max_rate / 8, test->settings->unit_format);
+                iperf_printf(test, report_search_max, results[i].blksize, obuf, results[i].trials);
+            } else
+                iperf_printf(test, report_search_none, results[i].blksize, test->search_loss, results[i].trials);
+        }
+    }
+    if (rc == 0 && test->json_top) {
+        test->json_end = search_json(test, search);
+        if (test->json_end)
+            cJSON_AddItemToObject(test->json_top, "search", test->json_end);
+        iperf_json_finish(test);
+    }
+    iperf_search_free(search);
+    return rc;
+}
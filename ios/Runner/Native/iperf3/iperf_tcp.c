@@ -37,6 +37,7 @@
 #include <sys/time.h>
 #include <sys/select.h>
 #include <limits.h>
+#include <poll.h>
 
 #include "iperf.h"
 #include "iperf_api.h"
@@ -379,17 +380,22 @@ iperf_tcp_listen(struct iperf_test *test)
 }
 
 
-/* iperf_tcp_connect
+/* iperf_tcp_connect_start
  *
- * connect to a TCP stream listener
+ * start a non-blocking connect to a TCP stream listener
  * This function is roughly similar to netdial(), and may indeed have
  * been derived from it at some point, but it sets many TCP-specific
- * options between socket creation and connection.
+ * options between socket creation and connection.  It connects to the
+ * addresses resolved once per test by iperf_resolve_addresses() and
+ * returns as soon as the connection is in progress, so that the client
+ * can have all of its streams' handshakes in flight at once.  Call
+ * iperf_tcp_connect_finish() once the socket becomes writable.
  */
 int
-iperf_tcp_connect(struct iperf_test *test)
+iperf_tcp_connect_start(struct iperf_test *test)
 {
-    struct addrinfo *server_res;
+    struct sockaddr_storage server_addr;
+    socklen_t server_addrlen;
     int s, opt;
     socklen_t optlen;
     int saved_errno;
@@ -401,11 +407,18 @@ iperf_tcp_connect(struct iperf_test *test)
         proto = IPPROTO_MPTCP;
 #endif
 
-    s = create_socket(test->settings->domain, SOCK_STREAM, proto, test->bind_address, test->bind_dev, test->bind_port, test->server_hostname, test->server_port, &server_res);
+    if (iperf_resolve_addresses(test) < 0) {
+	i_errno = IESTREAMCONNECT;
+	return -1;
+    }
+    s = create_socket_addr(SOCK_STREAM, proto, test->bind_addrinfo, test->bind_dev, test->bind_port, test->server_addrinfo);
     if (s < 0) {
 	i_errno = IESTREAMCONNECT;
 	return -1;
     }
+    /* Private copy, the flow label is set in it below */
+    server_addrlen = test->server_addrinfo->ai_addrlen;
+    memcpy(&server_addr, test->server_addrinfo->ai_addr, server_addrlen);
 
     /* Set socket options */
     if (test->no_delay) {
@@ -413,7 +426,6 @@ iperf_tcp_connect(struct iperf_test *test)
         if (setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0) {
 	    saved_errno = errno;
 	    close(s);
-	    freeaddrinfo(server_res);
 	    errno = saved_errno;
             i_errno = IESETNODELAY;
             return -1;
@@ -423,7 +435,6 @@ iperf_tcp_connect(struct iperf_test *test)
         if (setsockopt(s, IPPROTO_TCP, TCP_MAXSEG, &opt, sizeof(opt)) < 0) {
 	    saved_errno = errno;
 	    close(s);
-	    freeaddrinfo(server_res);
 	    errno = saved_errno;
             i_errno = IESETMSS;
             return -1;
@@ -433,7 +444,6 @@ iperf_tcp_connect(struct iperf_test *test)
         if (setsockopt(s, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(opt)) < 0) {
 	    saved_errno = errno;
 	    close(s);
-	    freeaddrinfo(server_res);
 	    errno = saved_errno;
             i_errno = IESETBUF;
             return -1;
@@ -441,7 +451,6 @@ iperf_tcp_connect(struct iperf_test *test)
         if (setsockopt(s, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(opt)) < 0) {
 	    saved_errno = errno;
 	    close(s);
-	    freeaddrinfo(server_res);
 	    errno = saved_errno;
             i_errno = IESETBUF;
             return -1;
@@ -452,7 +461,6 @@ iperf_tcp_connect(struct iperf_test *test)
         if (setsockopt(s, IPPROTO_TCP, TCP_USER_TIMEOUT, &opt, sizeof(opt)) < 0) {
 	    saved_errno = errno;
 	    close(s);
-	    freeaddrinfo(server_res);
 	    errno = saved_errno;
             i_errno = IESETUSERTIMEOUT;
             return -1;
@@ -465,7 +473,6 @@ iperf_tcp_connect(struct iperf_test *test)
     if (getsockopt(s, SOL_SOCKET, SO_SNDBUF, &sndbuf_actual, &optlen) < 0) {
 	saved_errno = errno;
 	close(s);
-	freeaddrinfo(server_res);
 	errno = saved_errno;
 	i_errno = IESETBUF;
 	return -1;
@@ -475,7 +482,6 @@ iperf_tcp_connect(struct iperf_test *test)
     }
     if (test->settings->socket_bufsize && test->settings->socket_bufsize > sndbuf_actual) {
         close(s);
-        freeaddrinfo(server_res);
 	i_errno = IESETBUF2;
 	return -1;
     }
@@ -485,7 +491,6 @@ iperf_tcp_connect(struct iperf_test *test)
     if (getsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf_actual, &optlen) < 0) {
 	saved_errno = errno;
 	close(s);
-	freeaddrinfo(server_res);
 	errno = saved_errno;
 	i_errno = IESETBUF;
 	return -1;
@@ -495,7 +500,6 @@ iperf_tcp_connect(struct iperf_test *test)
     }
     if (test->settings->socket_bufsize && test->settings->socket_bufsize > rcvbuf_actual) {
         close(s);
-        freeaddrinfo(server_res);
 	i_errno = IESETBUF2;
 	return -1;
     }
@@ -519,15 +523,14 @@ iperf_tcp_connect(struct iperf_test *test)
 
 #if defined(HAVE_FLOWLABEL)
     if (test->settings->flowlabel) {
-        if (server_res->ai_addr->sa_family != AF_INET6) {
+        if (server_addr.ss_family != AF_INET6) {
 	    saved_errno = errno;
 	    close(s);
-	    freeaddrinfo(server_res);
 	    errno = saved_errno;
             i_errno = IESETFLOW;
             return -1;
 	} else {
-	    struct sockaddr_in6* sa6P = (struct sockaddr_in6*) server_res->ai_addr;
+	    struct sockaddr_in6* sa6P = (struct sockaddr_in6*) &server_addr;
             char freq_buf[sizeof(struct in6_flowlabel_req)];
             struct in6_flowlabel_req *freq = (struct in6_flowlabel_req *)freq_buf;
             int freq_len = sizeof(*freq);
@@ -542,7 +545,6 @@ iperf_tcp_connect(struct iperf_test *test)
             if (setsockopt(s, IPPROTO_IPV6, IPV6_FLOWLABEL_MGR, freq, freq_len) < 0) {
 		saved_errno = errno;
                 close(s);
-                freeaddrinfo(server_res);
 		errno = saved_errno;
                 i_errno = IESETFLOW;
                 return -1;
@@ -553,7 +555,6 @@ iperf_tcp_connect(struct iperf_test *test)
             if (setsockopt(s, IPPROTO_IPV6, IPV6_FLOWINFO_SEND, &opt, sizeof(opt)) < 0) {
 		saved_errno = errno;
                 close(s);
-                freeaddrinfo(server_res);
 		errno = saved_errno;
                 i_errno = IESETFLOW;
                 return -1;
@@ -586,19 +587,53 @@ iperf_tcp_connect(struct iperf_test *test)
 	}
     }
 
+#if defined(TCP_DEFER_ACCEPT)
+    /*
+     * Send the last ACK of the handshake with the cookie instead of on its
+     * own, so that the server accepts streams in the order of their cookies.
+     */
+    opt = 1;
+    if (setsockopt(s, IPPROTO_TCP, TCP_DEFER_ACCEPT, &opt, sizeof(opt)) < 0 && test->debug)
+	printf("Unable to defer the handshake ACK\n");
+#endif /* TCP_DEFER_ACCEPT */
+
     /* Set common socket options */
     iperf_common_sockopts(test, s);
 
-    if (connect(s, (struct sockaddr *) server_res->ai_addr, server_res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+    if (setnonblocking(s, 1) < 0 ||
+        (connect(s, (struct sockaddr *) &server_addr, server_addrlen) < 0 && errno != EINPROGRESS)) {
 	saved_errno = errno;
 	close(s);
-	freeaddrinfo(server_res);
 	errno = saved_errno;
         i_errno = IESTREAMCONNECT;
         return -1;
     }
 
-    freeaddrinfo(server_res);
+    return s;
+}
+
+/* iperf_tcp_connect_finish
+ *
+ * complete a connect started by iperf_tcp_connect_start() once the
+ * socket is writable: check its outcome, put the socket back into
+ * blocking mode and send the cookie.  Closes the socket on failure.
+ */
+int
+iperf_tcp_connect_finish(struct iperf_test *test, int s)
+{
+    int saved_errno, optval;
+    socklen_t optlen;
+
+    optlen = sizeof(optval);
+    if (getsockopt(s, SOL_SOCKET, SO_ERROR, &optval, &optlen) < 0)
+        optval = errno;
+    if (optval != 0 || setnonblocking(s, 0) < 0) {
+        saved_errno = optval ? optval : errno;
+        close(s);
+        errno = saved_errno;
+        i_errno = IESTREAMCONNECT;
+        return -1;
+    }
 
     /* Send cookie for verification */
     if (Nwrite(s, test->cookie, COOKIE_SIZE, Ptcp) < 0) {
@@ -611,3 +646,28 @@ iperf_tcp_connect(struct iperf_test *test)
 
     return s;
 }
+
+/* iperf_tcp_connect
+ *
+ * connect to a TCP stream listener, waiting up to --connect-timeout
+ */
+int
+iperf_tcp_connect(struct iperf_test *test)
+{
+    struct pollfd pfd;
+    int s, rc;
+
+    if ((s = iperf_tcp_connect_start(test)) < 0)
+        return -1;
+
+    pfd.fd = s;
+    pfd.events = POLLOUT;
+    if ((rc = poll(&pfd, 1, test->settings->connect_timeout)) != 1) {
+        close(s);
+        if (rc == 0)
+            errno = ETIMEDOUT;
+        i_errno = IESTREAMCONNECT;
+        return -1;
+    }
+    return iperf_tcp_connect_finish(test, s);
+}
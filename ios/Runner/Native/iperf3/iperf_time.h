@@ -36,6 +36,15 @@ struct iperf_time {
 
 int iperf_time_now(struct iperf_time *time1);
 
+/*
+ * A virtual clock for simulation (iperf_sim.h).  While the calling thread
+ * has one, iperf_time_now() on that thread returns it, so the timers and
+ * everything timed with iperf_time run on it; other threads keep the
+ * system clock.
+ */
+void iperf_time_virtual_set(const struct iperf_time *now);
+int iperf_time_is_virtual(void);
+
 void iperf_time_add_usecs(struct iperf_time *time1, uint64_t usecs);
 
 int iperf_time_compare(struct iperf_time *time1, struct iperf_time *time2);
@@ -52,28 +52,84 @@
 
 /*
  * Read entropy from /dev/urandom
+ * The file is opened for each call rather than kept open in a static,
+ * so that tests in parallel threads don't share it.
  * Errors are fatal.
  * Returns 0 on success.
  */
 int readentropy(void *out, size_t outsize)
 {
-    static FILE *frandom;
     static const char rndfile[] = "/dev/urandom";
+    unsigned char *buf = (unsigned char *)out;
+    ssize_t r;
+    int fd;
 
     if (!outsize) return 0;
 
-    if (frandom == NULL) {
-        frandom = fopen(rndfile, "rb");
-        if (frandom == NULL) {
-            iperf_errexit(NULL, "error - failed to open %s: %s\n",
-                          rndfile, strerror(errno));
+    fd = open(rndfile, O_RDONLY);
+    if (fd < 0) {
+        iperf_errexit(NULL, "error - failed to open %s: %s\n",
+                      rndfile, strerror(errno));
+    }
+    while (outsize > 0) {
+        r = read(fd, buf, outsize);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            iperf_errexit(NULL, "error - failed to read %s: %s\n",
+                          rndfile,
+                          r == 0 ? "EOF" : strerror(errno));
         }
-        setbuf(frandom, NULL);
+        buf += r;
+        outsize -= r;
     }
-    if (fread(out, 1, outsize, frandom) != outsize) {
-        iperf_errexit(NULL, "error - failed to read %s: %s\n",
-                      rndfile,
-                      feof(frandom) ? "EOF" : strerror(errno));
+    close(fd);
+    return 0;
+}
+
+
+/*
+ * Peak resident set size of the process in kilobytes, or -1
+ */
+long get_max_rss_kb(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        return -1;
+#if defined(__APPLE__)
+    return ru.ru_maxrss / 1024;     /* bytes there, kilobytes elsewhere */
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+
+/*
+ * Fills buffer with pseudo-random bytes from a xorshift64* generator
+ * seeded from /dev/urandom.  Far cheaper than reading all of it from
+ * there, and just as incompressible for the network path.
+ * Returns 0 on success.
+ */
+int fill_with_random(void *out, size_t outsize)
+{
+    unsigned char *buf = (unsigned char *)out;
+    uint64_t x, v;
+    size_t n;
+
+    if (readentropy(&x, sizeof(x)) < 0)
+        return -1;
+    if (x == 0)
+        x = 0x9e3779b97f4a7c15ULL;
+    while (outsize > 0) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        v = x * 0x2545f4914f6cdd1dULL;
+        n = outsize < sizeof(v) ? outsize : sizeof(v);
+        memcpy(buf, &v, n);
+        buf += n;
+        outsize -= n;
     }
     return 0;
 }
@@ -186,12 +242,14 @@ timeval_diff(struct timeval * tv0, struct timeval * tv1)
     return time1;
 }
 
+/*
+ * CPU utilization since the last call with a NULL pcpu, measured from the
+ * snapshot in state.  getrusage(2) and clock(3) still count the whole
+ * process, so tests running in parallel see each other's usage.
+ */
 void
-cpu_util(double pcpu[3])
+cpu_util(struct cpu_util_state *state, double pcpu[3])
 {
-    static struct iperf_time last;
-    static clock_t clast;
-    static struct rusage rlast;
     struct iperf_time now, temp_time;
     clock_t ctemp;
     struct rusage rtemp;
@@ -200,9 +258,9 @@ cpu_util(double pcpu[3])
     double systemdiff;
 
     if (pcpu == NULL) {
-        iperf_time_now(&last);
-        clast = clock();
-	getrusage(RUSAGE_SELF, &rlast);
+        iperf_time_now(&state->last);
+        state->clast = clock();
+	getrusage(RUSAGE_SELF, &state->rlast);
         return;
     }
 
@@ -210,15 +268,15 @@ cpu_util(double pcpu[3])
     ctemp = clock();
     getrusage(RUSAGE_SELF, &rtemp);
 
-    iperf_time_diff(&now, &last, &temp_time);
+    iperf_time_diff(&now, &state->last, &temp_time);
     timediff = iperf_time_in_usecs(&temp_time);
 
     userdiff = ((rtemp.ru_utime.tv_sec * 1000000.0 + rtemp.ru_utime.tv_usec) -
-                (rlast.ru_utime.tv_sec * 1000000.0 + rlast.ru_utime.tv_usec));
+                (state->rlast.ru_utime.tv_sec * 1000000.0 + state->rlast.ru_utime.tv_usec));
     systemdiff = ((rtemp.ru_stime.tv_sec * 1000000.0 + rtemp.ru_stime.tv_usec) -
-                  (rlast.ru_stime.tv_sec * 1000000.0 + rlast.ru_stime.tv_usec));
+                  (state->rlast.ru_stime.tv_sec * 1000000.0 + state->rlast.ru_stime.tv_usec));
 
-    pcpu[0] = (((ctemp - clast) * 1000000.0 / CLOCKS_PER_SEC) / timediff) * 100;
+    pcpu[0] = (((ctemp - state->clast) * 1000000.0 / CLOCKS_PER_SEC) / timediff) * 100;
     pcpu[1] = (userdiff / timediff) * 100;
     pcpu[2] = (systemdiff / timediff) * 100;
 }
@@ -226,7 +284,7 @@ cpu_util(double pcpu[3])
 const char *
 get_system_info(void)
 {
-    static char buf[1024];
+    static IPERF_THREAD_LOCAL char buf[1024];
     struct utsname  uts;
 
     memset(buf, 0, 1024);
@@ -651,6 +709,7 @@ state_to_text(signed char state)
         case DISPLAY_RESULTS: txt = "DISPLAY_RESULTS"; break;
         case IPERF_START: txt = "IPERF_START - waiting for a new test"; break;
         case IPERF_DONE: txt = "IPERF_DONE"; break;
+        case COMPRESS_ACCEPTED: txt = "COMPRESS_ACCEPTED"; break;
         case ACCESS_DENIED: txt = "ACCESS_DENIED - Server is busy"; break;
         case SERVER_ERROR: txt = "SERVER_ERROR"; break;
         default: txt = "Unknown State";
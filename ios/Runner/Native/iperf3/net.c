@@ -74,7 +74,7 @@ static int nread_overall_timeout = 30;
  * by including "iperf.h", but net.c lives "below" this layer.  Clearly the
  * presence of this declaration is a sign we need to revisit this layering.
  */
-extern int gerror;
+extern IPERF_THREAD_LOCAL int gerror;
 
 /*
  * timeout_connect adapted from netcat, via OpenBSD and FreeBSD
@@ -123,39 +123,41 @@ timeout_connect(int s, const struct sockaddr *name, socklen_t namelen,
  * Copyright: http://swtch.com/libtask/COPYRIGHT
 */
 
-/* create a socket */
-int
-create_socket(int domain, int type, int proto, const char *local, const char *bind_dev, int local_port, const char *server, int port, struct addrinfo **server_res_out)
+/*
+ * Resolve a host (and port, if nonzero) once, so that the same result can
+ * be handed to create_socket_addr() and netdial_addr() for every socket of
+ * a test.  Returns NULL with gerror set on failure.
+ */
+struct addrinfo *
+netresolve(int domain, int type, const char *host, int port)
 {
-    struct addrinfo hints, *local_res = NULL, *server_res = NULL;
-    int s, saved_errno;
+    struct addrinfo hints, *res = NULL;
     char portstr[6];
 
-    if (local) {
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = domain;
-        hints.ai_socktype = type;
-        if ((gerror = getaddrinfo(local, NULL, &hints, &local_res)) != 0)
-            return -1;
-    }
-
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = domain;
     hints.ai_socktype = type;
     snprintf(portstr, sizeof(portstr), "%d", port);
-    if ((gerror = getaddrinfo(server, portstr, &hints, &server_res)) != 0) {
-	if (local)
-	    freeaddrinfo(local_res);
-        return -1;
-    }
+    if ((gerror = getaddrinfo(host, port ? portstr : NULL, &hints, &res)) != 0)
+        return NULL;
+    return res;
+}
+
+/*
+ * Create a socket for an already resolved server address, bound to the
+ * already resolved local address if one is given.  The addrinfo results
+ * are only read, so they can be shared by all the sockets of a test.
+ */
+int
+create_socket_addr(int type, int proto, const struct addrinfo *local_res, const char *bind_dev, int local_port, const struct addrinfo *server_res)
+{
+    struct sockaddr_storage lcl;
+    socklen_t addrlen;
+    int s, saved_errno;
 
     s = socket(server_res->ai_family, type, proto);
-    if (s < 0) {
-	if (local)
-	    freeaddrinfo(local_res);
-	freeaddrinfo(server_res);
+    if (s < 0)
         return -1;
-    }
 
     if (bind_dev) {
 #if defined(HAVE_SO_BINDTODEVICE)
@@ -165,36 +167,24 @@ create_socket(int domain, int type, int proto, const char *local, const char *bi
         {
             saved_errno = errno;
             close(s);
-            freeaddrinfo(local_res);
-            freeaddrinfo(server_res);
             errno = saved_errno;
             return -1;
         }
     }
 
+    memset(&lcl, 0, sizeof(lcl));
     /* Bind the local address if given a name (with or without --cport) */
-    if (local) {
+    if (local_res) {
+        memcpy(&lcl, local_res->ai_addr, local_res->ai_addrlen);
+        addrlen = local_res->ai_addrlen;
         if (local_port) {
             struct sockaddr_in *lcladdr;
-            lcladdr = (struct sockaddr_in *)local_res->ai_addr;
+            lcladdr = (struct sockaddr_in *) &lcl;
             lcladdr->sin_port = htons(local_port);
         }
-
-        if (bind(s, (struct sockaddr *) local_res->ai_addr, local_res->ai_addrlen) < 0) {
-	    saved_errno = errno;
-	    close(s);
-	    freeaddrinfo(local_res);
-	    freeaddrinfo(server_res);
-	    errno = saved_errno;
-            return -1;
-	}
-        freeaddrinfo(local_res);
     }
     /* No local name, but --cport given */
     else if (local_port) {
-	size_t addrlen;
-	struct sockaddr_storage lcl;
-
 	/* IPv4 */
 	if (server_res->ai_family == AF_INET) {
 	    struct sockaddr_in *lcladdr = (struct sockaddr_in *) &lcl;
@@ -214,32 +204,62 @@ create_socket(int domain, int type, int proto, const char *local, const char *bi
 	/* Unknown protocol */
 	else {
 	    close(s);
-	    freeaddrinfo(server_res);
 	    errno = EAFNOSUPPORT;
             return -1;
 	}
+    }
+    else
+        return s;
 
-        if (bind(s, (struct sockaddr *) &lcl, addrlen) < 0) {
-	    saved_errno = errno;
-	    close(s);
-	    freeaddrinfo(server_res);
-	    errno = saved_errno;
+    if (bind(s, (struct sockaddr *) &lcl, addrlen) < 0) {
+        saved_errno = errno;
+        close(s);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return s;
+}
+
+/* create a socket */
+int
+create_socket(int domain, int type, int proto, const char *local, const char *bind_dev, int local_port, const char *server, int port, struct addrinfo **server_res_out)
+{
+    struct addrinfo *local_res = NULL, *server_res = NULL;
+    int s, saved_errno;
+
+    if (local) {
+        if ((local_res = netresolve(domain, type, local, 0)) == NULL)
             return -1;
-        }
+    }
+
+    if ((server_res = netresolve(domain, type, server, port)) == NULL) {
+	if (local)
+	    freeaddrinfo(local_res);
+        return -1;
+    }
+
+    s = create_socket_addr(type, proto, local_res, bind_dev, local_port, server_res);
+    saved_errno = errno;
+    if (local)
+        freeaddrinfo(local_res);
+    if (s < 0) {
+	freeaddrinfo(server_res);
+        errno = saved_errno;
+        return -1;
     }
 
     *server_res_out = server_res;
     return s;
 }
 
-/* make connection to server */
+/* make connection to an already resolved server address */
 int
-netdial(int domain, int proto, const char *local, const char *bind_dev, int local_port, const char *server, int port, int timeout)
+netdial_addr(int proto, const struct addrinfo *local_res, const char *bind_dev, int local_port, const struct addrinfo *server_res, int timeout)
 {
-    struct addrinfo *server_res = NULL;
     int s, saved_errno;
 
-    s = create_socket(domain, proto, 0, local, bind_dev, local_port, server, port, &server_res);
+    s = create_socket_addr(proto, 0, local_res, bind_dev, local_port, server_res);
     if (s < 0) {
       return -1;
     }
@@ -247,12 +267,37 @@ netdial(int domain, int proto, const char *local, const char *bind_dev, int loca
     if (timeout_connect(s, (struct sockaddr *) server_res->ai_addr, server_res->ai_addrlen, timeout) < 0 && errno != EINPROGRESS) {
 	saved_errno = errno;
 	close(s);
-	freeaddrinfo(server_res);
 	errno = saved_errno;
         return -1;
     }
 
+    return s;
+}
+
+/* make connection to server */
+int
+netdial(int domain, int proto, const char *local, const char *bind_dev, int local_port, const char *server, int port, int timeout)
+{
+    struct addrinfo *local_res = NULL, *server_res = NULL;
+    int s, saved_errno;
+
+    if (local) {
+        if ((local_res = netresolve(domain, proto, local, 0)) == NULL)
+            return -1;
+    }
+
+    if ((server_res = netresolve(domain, proto, server, port)) == NULL) {
+	if (local)
+	    freeaddrinfo(local_res);
+        return -1;
+    }
+
+    s = netdial_addr(proto, local_res, bind_dev, local_port, server_res, timeout);
+    saved_errno = errno;
+    if (local)
+        freeaddrinfo(local_res);
     freeaddrinfo(server_res);
+    errno = saved_errno;
     return s;
 }
 
@@ -0,0 +1,86 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "iperf_converge.h"
+
+int
+main(void)
+{
+    static const double ramp[] = { 10e6, 50e6, 90e6, 100e6, 101e6 };
+    struct iperf_converge *cv;
+    struct iperf_converge_estimate e;
+    int i, rc;
+
+    /* The table, and the expansion past it */
+    assert(iperf_converge_t95(1) == 12.706);
+    assert(iperf_converge_t95(30) == 2.042);
+    assert(fabs(iperf_converge_t95(40) - 2.021) < 0.005);
+    assert(fabs(iperf_converge_t95(120) - 1.980) < 0.002);
+    assert(isinf(iperf_converge_t95(0)));
+
+    /* A window is never shorter than IPERF_CONVERGE_MIN_WINDOW */
+    cv = iperf_converge_new(1, 0.05);
+    assert(cv != NULL);
+    rc = iperf_converge_add(cv, 100e6);
+    assert(rc == 0);
+    iperf_converge_estimate(cv, &e);
+    assert(e.intervals == 1 && e.bits_per_second == 100e6 && e.ci_bits_per_second == 0);
+    rc = iperf_converge_add(cv, 100e6);
+    assert(rc == 0);
+    rc = iperf_converge_add(cv, 100e6);
+    assert(rc == 1);
+    iperf_converge_free(cv);
+
+    /* Slow start leaves the window before the throughput counts as settled */
+    cv = iperf_converge_new(3, 0.05);
+    for (i = 0; i < 5; i++) {
+        rc = iperf_converge_add(cv, ramp[i]);
+        assert(rc == 0);
+    }
+    iperf_converge_estimate(cv, &e);
+    assert(e.intervals == 3);
+    assert(e.relative_ci > 0.05);
+    rc = iperf_converge_add(cv, 99e6);
+    assert(rc == 1);
+    iperf_converge_estimate(cv, &e);
+    assert(e.bits_per_second == 100e6);
+    assert(fabs(e.ci_bits_per_second - 4.303e6 / sqrt(3)) < 1);
+    assert(fabs(e.relative_ci - 4.303e-2 / sqrt(3)) < 1e-8);
+
+    /* Nothing moving never converges */
+    iperf_converge_reset(cv);
+    for (i = 0; i < 5; i++) {
+        rc = iperf_converge_add(cv, 0);
+        assert(rc == 0);
+    }
+    iperf_converge_free(cv);
+
+    return 0;
+}
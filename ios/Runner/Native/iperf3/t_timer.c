@@ -38,6 +38,12 @@
 
 static int flag;
 
+#define MANY_TIMERS 20000
+
+static int64_t expiry[MANY_TIMERS];
+static int64_t last_expiry;
+static int fired, misordered, periodic_fired;
+
 
 static void
 timer_proc( TimerClientData client_data, struct iperf_time* nowP )
@@ -46,6 +52,162 @@ timer_proc( TimerClientData client_data, struct iperf_time* nowP )
 }
 
 
+static void
+many_timer_proc( TimerClientData client_data, struct iperf_time* nowP )
+{
+    if (expiry[client_data.i] < last_expiry)
+	misordered++;
+    last_expiry = expiry[client_data.i];
+    fired++;
+}
+
+
+static void
+periodic_timer_proc( TimerClientData client_data, struct iperf_time* nowP )
+{
+    periodic_fired++;
+}
+
+
+/*
+ * Create, reset and cancel thousands of timers against a fixed clock, check
+ * that the remaining ones fire exactly once and in expiry order, and report
+ * how long the queue operations took.
+ */
+static int
+many_timers(void)
+{
+    static Timer *tps[MANY_TIMERS];
+    struct iperf_time now, later, start, end, diff;
+    TimerClientData cd;
+    int64_t create_usecs, reset_usecs, run_usecs;
+    int i, expected = 0;
+
+    iperf_time_now(&now);
+    srandom(1);
+
+    iperf_time_now(&start);
+    for (i = 0; i < MANY_TIMERS; i++) {
+	expiry[i] = random() % 10000000;
+	cd.i = i;
+	tps[i] = tmr_create(&now, many_timer_proc, cd, expiry[i], 0);
+	if (!tps[i]) {
+	    printf("failed to create timer %d\n", i);
+	    return -1;
+	}
+    }
+    tmr_create(&now, periodic_timer_proc, JunkClientData, 1000000, 1);
+    iperf_time_now(&end);
+    iperf_time_diff(&end, &start, &diff);
+    create_usecs = iperf_time_in_usecs(&diff);
+
+    /* Every third timer is cancelled, every other third is rescheduled */
+    iperf_time_now(&start);
+    for (i = 0; i < MANY_TIMERS; i++) {
+	if (i % 3 == 0) {
+	    tmr_cancel(tps[i]);
+	    continue;
+	}
+	if (i % 3 == 1) {
+	    tps[i]->usecs = expiry[i] / 2;
+	    tmr_reset(&now, tps[i]);
+	    expiry[i] /= 2;
+	}
+	expected++;
+    }
+    iperf_time_now(&end);
+    iperf_time_diff(&end, &start, &diff);
+    reset_usecs = iperf_time_in_usecs(&diff);
+
+    later = now;
+    iperf_time_add_usecs(&later, 10500000);
+    iperf_time_now(&start);
+    tmr_run(&later);
+    iperf_time_now(&end);
+    iperf_time_diff(&end, &start, &diff);
+    run_usecs = iperf_time_in_usecs(&diff);
+
+    printf("%d timers: create %.3f ms, reset/cancel %.3f ms, run %.3f ms\n",
+	   MANY_TIMERS, create_usecs / 1000.0, reset_usecs / 1000.0, run_usecs / 1000.0);
+
+    if (fired != expected || misordered) {
+	printf("%d of %d timers fired, %d out of order\n", fired, expected, misordered);
+	return -1;
+    }
+    if (periodic_fired != 10) {
+	printf("periodic timer fired %d times, expected 10\n", periodic_fired);
+	return -1;
+    }
+    if (tmr_timeout(&later) == NULL) {
+	printf("periodic timer should still be pending\n");
+	return -1;
+    }
+    tmr_destroy();
+    if (tmr_timeout(&later) != NULL) {
+	printf("no timers should be pending\n");
+	return -1;
+    }
+    return 0;
+}
+
+
+static int order[16];
+static int order_len;
+
+
+static void
+order_timer_proc( TimerClientData client_data, struct iperf_time* nowP )
+{
+    if (order_len < 16)
+	order[order_len++] = client_data.i;
+}
+
+
+/*
+ * Timers due at the same time must run in the order they were scheduled,
+ * periodic ones included: iperf's stats timer has to run before the
+ * reporter timer that prints what it collected.
+ */
+static int
+same_time_timers(void)
+{
+    struct iperf_time now, later;
+    TimerClientData cd;
+    int i;
+
+    iperf_time_now(&now);
+    for (i = 0; i < 2; i++) {
+	cd.i = i;
+	tmr_create(&now, order_timer_proc, cd, 1000000, 1);
+    }
+    for (i = 2; i < 6; i++) {
+	cd.i = i;
+	tmr_create(&now, order_timer_proc, cd, 3000000, 0);
+    }
+
+    for (i = 1; i <= 3; i++) {
+	later = now;
+	iperf_time_add_usecs(&later, i * 1000000);
+	tmr_run(&later);
+    }
+    tmr_destroy();
+
+    /* The one-shots were scheduled before the periodic timers' third run */
+    static const int expected[] = { 0, 1, 0, 1, 2, 3, 4, 5, 0, 1 };
+    if (order_len != 10) {
+	printf("%d timers ran, expected 10\n", order_len);
+	return -1;
+    }
+    for (i = 0; i < 10; i++) {
+	if (order[i] != expected[i]) {
+	    printf("timer %d ran in place of timer %d\n", order[i], expected[i]);
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+
 int
 main(int argc, char **argv)
 {
@@ -77,5 +239,11 @@ main(int argc, char **argv)
     }
 
     tmr_destroy();
+
+    if (same_time_timers() < 0)
+	exit(-4);
+
+    if (many_timers() < 0)
+	exit(-3);
     exit(0);
 }
@@ -1,13 +1,19 @@
 #include "iperf3_bridge.h"
+#include "iperf3_bridge_internal.h"
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <time.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 // Include iperf3 headers
 #include "iperf.h"
 #include "iperf_api.h"
+#include "net.h"
 #include "iperf_config.h"
 #include "cjson.h"
 
@@ -30,116 +36,495 @@
 // Platform-agnostic implementation of iperf3 bridge
 // This code is shared between Android and iOS
 
-// Global progress callback storage
-static Iperf3ProgressCallback g_progress_callback = NULL;
-static void* g_progress_context = NULL;
-
 typedef void (*IperfReporterCallbackFn)(struct iperf_test *);
-static IperfReporterCallbackFn g_original_reporter_callback = NULL;
-static int g_last_reported_interval = 0;
 
-static pthread_mutex_t g_client_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct iperf_test* g_active_client_test = NULL;
-static volatile sig_atomic_t g_cancel_client_requested = 0;
+// One queued interval.  The slot owns a copy of the per-stream records.
+typedef struct {
+    Iperf3IntervalProgress progress;
+    Iperf3StreamProgress* streams;
+    int streams_size;
+} ProgressSlot;
+
+// Single-producer single-consumer ring of intervals.  Only the test thread
+// advances tail and only the delivery thread advances head, so neither side
+// ever waits for the other.
+typedef struct {
+    ProgressSlot* slots;
+    size_t mask;                    // slot count - 1, a power of two
+    _Atomic size_t head;            // next slot to deliver
+    _Atomic size_t tail;            // next slot to fill
+} ProgressRing;
+
+struct Iperf3Session {
+    struct iperf_test* test;
+    char role;                      // 'c' or 's'
+    int port;
+    int duration;
+
+    Iperf3ProgressCallback progress_callback;
+    void* progress_context;
+    Iperf3IntervalCallback interval_callback;
+    void* interval_context;
+    IperfReporterCallbackFn original_reporter_callback;
+    struct iperf_time last_interval_end;           // of the newest one already reported
+    int interval_count;
+    Iperf3StreamProgress* streams;                 // per-stream records, reused
+    int streams_size;
+
+    // Asynchronous delivery, see iperf3_session_set_async_delivery()
+    bool async_delivery;
+    int frames_per_second;
+    ProgressRing ring;
+    bool delivery_started;
+    pthread_t delivery_thread;
+    atomic_bool delivery_stopping;
+    atomic_llong delivered;
+    atomic_llong coalesced;
+    atomic_llong dropped;
+
+    // Guards everything below, which other threads may read or change
+    pthread_mutex_t mutex;
+    Iperf3SessionState state;
+    bool cancel_requested;
+    bool has_progress;
+    Iperf3Progress progress;
+    Iperf3Result* result;
+    bool thread_started;
+    pthread_t thread;
+};
+
+// The session running on this thread; the reporter callback only gets the test
+static IPERF_THREAD_LOCAL Iperf3Session* t_current_session = NULL;
+
+static Iperf3Session* session_new(char role) {
+    Iperf3Session* session = (Iperf3Session*)calloc(1, sizeof(Iperf3Session));
+    if (!session) {
+        return NULL;
+    }
+    session->role = role;
+    session->state = IPERF3_SESSION_CREATED;
+    pthread_mutex_init(&session->mutex, NULL);
+    return session;
+}
+
+static Iperf3Result* result_new(void) {
+    return (Iperf3Result*)calloc(1, sizeof(Iperf3Result));
+}
 
-static double get_json_number(cJSON* object, const char* name, double fallback) {
-    if (!object || !name) {
-        return fallback;
+// A session whose test could not be set up carries its error result from the
+// start, so run and wait report it like any other failure.
+static void session_fail(Iperf3Session* session, const char* message, int code) {
+    Iperf3Result* result = result_new();
+    if (result) {
+        result->success = false;
+        result->errorMessage = strdup(message);
+        result->errorCode = code;
     }
-    cJSON* item = cJSON_GetObjectItemCaseSensitive(object, name);
-    return (item && cJSON_IsNumber(item)) ? item->valuedouble : fallback;
+    session->result = result;
+    session->state = IPERF3_SESSION_FINISHED;
 }
 
-static cJSON* get_interval_sum(cJSON* interval) {
-    if (!interval) {
-        return NULL;
+static void discard_json_output(struct iperf_test* test, char* json) {
+    (void)test;
+    (void)json;
+}
+
+static void stream_progress(struct iperf_test* test, struct iperf_stream* sp,
+                            struct iperf_interval_results* irp, Iperf3StreamProgress* out) {
+    memset(out, 0, sizeof(*out));
+    out->id = sp->id;
+    out->sender = sp->sender != 0;
+    out->bytes = (long long)irp->bytes_transferred;
+    out->seconds = irp->interval_duration;
+    if (irp->interval_duration > 0.0) {
+        out->bitsPerSecond = (double)irp->bytes_transferred * 8.0 / irp->interval_duration;
     }
-    cJSON* sum = cJSON_GetObjectItemCaseSensitive(interval, "sum");
-    if (!sum) {
-        sum = cJSON_GetObjectItemCaseSensitive(interval, "sum_sent");
+
+    // Only what iperf itself reports for this protocol and direction
+    if (test->protocol->id == Pudp) {
+        out->packets = irp->interval_packet_count;
+        if (!sp->sender) {
+            out->lostPackets = irp->interval_cnt_error;
+            out->outOfOrder = irp->interval_outoforder_packets;
+            out->jitter = irp->jitter * 1000.0;
+        }
+    } else if (sp->sender && test->sender_has_retransmits == 1) {
+        out->retransmits = irp->interval_retrans;
+        out->cwnd = irp->snd_cwnd;
+        out->rtt = irp->rtt / 1000.0;         // tcp_info reports microseconds
+        out->rttVar = irp->rttvar / 1000.0;
     }
-    if (!sum) {
-        sum = cJSON_GetObjectItemCaseSensitive(interval, "sum_received");
+
+    if (sp->microburst) {
+        out->peakBitsPerSecond = irp->microburst.peak_bits_per_second;
+        out->burstCv = irp->microburst.cv;
+        out->stalls = irp->microburst.stalls;
+        out->stallMs = irp->microburst.stall_ms;
+        out->longestStallMs = irp->microburst.longest_stall_ms;
     }
-    return sum;
 }
 
-static void bridge_reporter_callback(struct iperf_test *test) {
-    if (g_original_reporter_callback) {
-        g_original_reporter_callback(test);
+static void microburst_add(double* peak, double* cv, long long* stalls, long long* stall_ms,
+                           long long* longest, const struct iperf_microburst_summary* mb) {
+    if (mb->peak_bits_per_second > *peak) {
+        *peak = mb->peak_bits_per_second;
     }
+    if (mb->cv > *cv) {
+        *cv = mb->cv;
+    }
+    *stalls += mb->stalls;
+    *stall_ms += mb->stall_ms;
+    if (mb->longest_stall_ms > *longest) {
+        *longest = mb->longest_stall_ms;
+    }
+}
 
-    if (!g_progress_callback || !test || !test->json_intervals) {
-        return;
+// Sums add up, except RTT and jitter, which are averaged over the streams
+// that have one; the counts are kept in the caller until sum_finish().
+static void sum_add(Iperf3StreamProgress* sum, int* rtt_count, int* jitter_count,
+                    const Iperf3StreamProgress* stream) {
+    sum->sender = stream->sender;
+    sum->bytes += stream->bytes;
+    if (stream->seconds > sum->seconds) {
+        sum->seconds = stream->seconds;
+    }
+    sum->bitsPerSecond += stream->bitsPerSecond;
+    sum->retransmits += stream->retransmits;
+    sum->cwnd += stream->cwnd;
+    sum->packets += stream->packets;
+    sum->lostPackets += stream->lostPackets;
+    sum->outOfOrder += stream->outOfOrder;
+    if (stream->rtt > 0.0) {
+        sum->rtt += stream->rtt;
+        sum->rttVar += stream->rttVar;
+        (*rtt_count)++;
+    }
+    if (!stream->sender && stream->packets > 0) {
+        sum->jitter += stream->jitter;
+        (*jitter_count)++;
     }
+    struct iperf_microburst_summary mb = {
+        .peak_bits_per_second = stream->peakBitsPerSecond,
+        .cv = stream->burstCv,
+        .stalls = stream->stalls,
+        .stall_ms = stream->stallMs,
+        .longest_stall_ms = stream->longestStallMs,
+    };
+    microburst_add(&sum->peakBitsPerSecond, &sum->burstCv, &sum->stalls, &sum->stallMs,
+                   &sum->longestStallMs, &mb);
+}
 
-    int interval_count = cJSON_GetArraySize(test->json_intervals);
-    if (interval_count <= g_last_reported_interval) {
-        return;
+static void sum_finish(Iperf3StreamProgress* sum, int rtt_count, int jitter_count) {
+    if (rtt_count > 0) {
+        sum->rtt /= rtt_count;
+        sum->rttVar /= rtt_count;
+    }
+    if (jitter_count > 0) {
+        sum->jitter /= jitter_count;
     }
+}
+
+// iperf_print_intermediate() drops a trailing interval shorter than a tenth
+// of the reporting interval with no data in it; so does the bridge.
+static bool interval_has_data(struct iperf_test* test) {
+    struct iperf_stream* sp;
+    struct iperf_time diff;
 
-    for (int idx = g_last_reported_interval; idx < interval_count; ++idx) {
-        cJSON* interval = cJSON_GetArrayItem(test->json_intervals, idx);
-        cJSON* sum = get_interval_sum(interval);
-        if (!sum) {
+    SLIST_FOREACH(sp, &test->streams, streams) {
+        struct iperf_interval_results* irp = TAILQ_LAST(&sp->result->interval_results, irlisthead);
+        if (!irp) {
             continue;
         }
+        iperf_time_diff(&irp->interval_start_time, &irp->interval_end_time, &diff);
+        if (iperf_time_in_secs(&diff) >= test->stats_interval * 0.10 || irp->bytes_transferred > 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-        double bytes = get_json_number(sum, "bytes", 0.0);
-        double bits_per_second = get_json_number(sum, "bits_per_second", 0.0);
-        double jitter = get_json_number(sum, "jitter_ms", 0.0);
-        double lost_packets = get_json_number(sum, "lost_packets", 0.0);
+// The figures kept for polling and passed to the progress callback
+static void progress_from_interval(const Iperf3IntervalProgress* progress, Iperf3Progress* latest) {
+    latest->interval = progress->interval;
+    latest->bytesTransferred = (long)progress->sum.bytes;
+    latest->bitsPerSecond = progress->sum.bitsPerSecond;
+    latest->jitter = progress->sum.jitter;
+    latest->lostPackets = (int)progress->sum.lostPackets;
+    latest->rtt = progress->sum.rtt;
+}
 
-        g_progress_callback(
-            g_progress_context,
-            idx + 1,
-            (long)bytes,
-            bits_per_second,
-            jitter,
-            (int)lost_packets,
-            0.0
+static void deliver_progress(Iperf3Session* session, const Iperf3IntervalProgress* progress) {
+    if (session->interval_callback) {
+        session->interval_callback(session->interval_context, progress);
+    }
+    if (session->progress_callback) {
+        Iperf3Progress latest;
+        progress_from_interval(progress, &latest);
+        session->progress_callback(
+            session->progress_context,
+            latest.interval,
+            latest.bytesTransferred,
+            latest.bitsPerSecond,
+            latest.jitter,
+            latest.lostPackets,
+            latest.rtt
         );
     }
+    atomic_fetch_add_explicit(&session->delivered, 1, memory_order_relaxed);
+}
+
+static bool ring_init(ProgressRing* ring, int capacity) {
+    size_t size = 2;
+    while (size < (size_t)capacity) {
+        size <<= 1;
+    }
+    ring->slots = (ProgressSlot*)calloc(size, sizeof(ProgressSlot));
+    if (!ring->slots) {
+        return false;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+static void ring_free(ProgressRing* ring) {
+    if (!ring->slots) {
+        return;
+    }
+    for (size_t i = 0; i <= ring->mask; i++) {
+        free(ring->slots[i].streams);
+    }
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+// Test thread: queue an interval, or drop it if the ring is full
+static void ring_push(Iperf3Session* session, const Iperf3IntervalProgress* progress) {
+    ProgressRing* ring = &session->ring;
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > ring->mask) {
+        atomic_fetch_add_explicit(&session->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    // Free slots belong to this thread, so a slot can grow here
+    ProgressSlot* slot = &ring->slots[tail & ring->mask];
+    if (progress->streamCount > slot->streams_size) {
+        Iperf3StreamProgress* streams = (Iperf3StreamProgress*)realloc(
+            slot->streams, progress->streamCount * sizeof(Iperf3StreamProgress));
+        if (!streams) {
+            atomic_fetch_add_explicit(&session->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        slot->streams = streams;
+        slot->streams_size = progress->streamCount;
+    }
+    slot->progress = *progress;
+    if (progress->streamCount > 0) {
+        memcpy(slot->streams, progress->streams, progress->streamCount * sizeof(Iperf3StreamProgress));
+    }
+    slot->progress.streams = slot->streams;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// Delivery thread: hand on what is queued.  With a frame rate only the
+// newest interval is delivered and the older ones are counted as coalesced.
+static void ring_drain(Iperf3Session* session) {
+    ProgressRing* ring = &session->ring;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) {
+        return;
+    }
+    if (session->frames_per_second > 0 && tail - head > 1) {
+        atomic_fetch_add_explicit(&session->coalesced, (long long)(tail - head - 1), memory_order_relaxed);
+        head = tail - 1;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+    for (; head != tail; head++) {
+        deliver_progress(session, &ring->slots[head & ring->mask].progress);
+        atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    }
+}
+
+static void* delivery_thread_func(void* arg) {
+    Iperf3Session* session = (Iperf3Session*)arg;
+    // Without a frame rate, poll often enough for 10 ms reporting intervals
+    long period_ns = session->frames_per_second > 0
+        ? 1000000000L / session->frames_per_second
+        : 5000000L;
+    struct timespec period = { period_ns / 1000000000L, period_ns % 1000000000L };
+    for (;;) {
+        // Anything queued before the stop request is still delivered
+        bool stopping = atomic_load(&session->delivery_stopping);
+        ring_drain(session);
+        if (stopping) {
+            break;
+        }
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+static void delivery_start(Iperf3Session* session) {
+    if (!session->async_delivery) {
+        return;
+    }
+    atomic_store(&session->delivery_stopping, false);
+    if (pthread_create(&session->delivery_thread, NULL, delivery_thread_func, session) != 0) {
+        LOGW("Failed to start the progress delivery thread, delivering synchronously");
+        session->async_delivery = false;
+        return;
+    }
+    session->delivery_started = true;
+}
+
+static void delivery_stop(Iperf3Session* session) {
+    if (!session->delivery_started) {
+        return;
+    }
+    atomic_store(&session->delivery_stopping, true);
+    pthread_join(session->delivery_thread, NULL);
+    session->delivery_started = false;
+}
+
+static void report_interval(Iperf3Session* session, struct iperf_test* test) {
+    struct iperf_stream* first = SLIST_FIRST(&test->streams);
+    if (!first) {
+        return;
+    }
+    struct iperf_interval_results* last = TAILQ_LAST(&first->result->interval_results, irlisthead);
+    // iperf may recycle interval records, so tell intervals apart by end time
+    if (!last || iperf_time_compare(&last->interval_end_time, &session->last_interval_end) == 0) {
+        return;
+    }
+    session->last_interval_end = last->interval_end_time;
+    if (!interval_has_data(test)) {
+        return;
+    }
+
+    int stream_count = 0;
+    struct iperf_stream* sp;
+    SLIST_FOREACH(sp, &test->streams, streams) {
+        stream_count++;
+    }
+    if (stream_count > session->streams_size) {
+        Iperf3StreamProgress* streams = (Iperf3StreamProgress*)realloc(
+            session->streams, stream_count * sizeof(Iperf3StreamProgress));
+        if (streams) {
+            session->streams = streams;
+            session->streams_size = stream_count;
+        }
+    }
+
+    Iperf3IntervalProgress progress;
+    memset(&progress, 0, sizeof(progress));
+    progress.interval = ++session->interval_count;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    progress.timestampNs = (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+    progress.bidirectional = test->mode == BIDIRECTIONAL;
+    progress.omitted = last->omitted != 0;
+    struct iperf_time diff;
+    iperf_time_diff(&first->result->start_time, &last->interval_start_time, &diff);
+    progress.start = iperf_time_in_secs(&diff);
+    iperf_time_diff(&first->result->start_time, &last->interval_end_time, &diff);
+    progress.end = iperf_time_in_secs(&diff);
+
+    int rtt_count = 0, jitter_count = 0;
+    int reverse_rtt_count = 0, reverse_jitter_count = 0;
+    int idx = 0;
+    SLIST_FOREACH(sp, &test->streams, streams) {
+        struct iperf_interval_results* irp = TAILQ_LAST(&sp->result->interval_results, irlisthead);
+        if (!irp) {
+            continue;
+        }
+        Iperf3StreamProgress stream;
+        stream_progress(test, sp, irp, &stream);
+        if (idx < session->streams_size) {
+            session->streams[idx++] = stream;
+        }
+        // Client-to-server streams are the client's senders and the server's receivers
+        bool forward = (test->role == 'c') == (sp->sender != 0);
+        if (progress.bidirectional && !forward) {
+            sum_add(&progress.sumReverse, &reverse_rtt_count, &reverse_jitter_count, &stream);
+        } else {
+            sum_add(&progress.sum, &rtt_count, &jitter_count, &stream);
+        }
+    }
+    sum_finish(&progress.sum, rtt_count, jitter_count);
+    sum_finish(&progress.sumReverse, reverse_rtt_count, reverse_jitter_count);
+    progress.streamCount = idx;
+    progress.streams = session->streams;
+
+    Iperf3Progress latest;
+    progress_from_interval(&progress, &latest);
 
-    g_last_reported_interval = interval_count;
+    pthread_mutex_lock(&session->mutex);
+    session->progress = latest;
+    session->has_progress = true;
+    pthread_mutex_unlock(&session->mutex);
+
+    if (session->async_delivery) {
+        ring_push(session, &progress);
+    } else {
+        deliver_progress(session, &progress);
+    }
 }
 
-Iperf3Result* iperf3_run_client_test(
-    const char* host,
-    int port,
-    int duration,
-    int parallel,
-    bool reverse,
-    bool use_udp,
-    long bandwidth,
-    Iperf3ProgressCallback progressCallback,
-    void* callbackContext) {
+static void bridge_reporter_callback(struct iperf_test *test) {
+    Iperf3Session* session = t_current_session;
+
+    if (!session || session->test != test) {
+        return;
+    }
+    if (session->original_reporter_callback) {
+        session->original_reporter_callback(test);
+    }
+    report_interval(session, test);
+}
 
-    LOGI("=== iperf3 Client Test Starting ===");
+Iperf3Session* iperf3_session_create_client(const Iperf3ClientConfig* config) {
+    if (!config || !config->host) {
+        LOGE("Client session needs a config with a host");
+        return NULL;
+    }
+    const char* host = config->host;
+    int port = config->port;
+    int duration = config->duration;
+    // A ramp needs streams to add
+    int parallel = config->rampStreams && config->parallel <= 1 ? DEFAULT_RAMP_STREAMS : config->parallel;
+    bool reverse = config->reverse;
+    bool use_udp = config->useUdp;
+    long bandwidth = config->bandwidth;
+
+    LOGI("=== iperf3 Client Session Created ===");
     LOGI("Host: %s, Port: %d, Duration: %d sec", host, port, duration);
     LOGI("Protocol: %s, Parallel: %d, Reverse: %s", use_udp ? "UDP" : "TCP", parallel, reverse ? "yes" : "no");
     if (bandwidth > 0) {
         LOGI("Bandwidth limit: %ld bits/sec (%.2f Mbits/sec)", bandwidth, bandwidth / 1000000.0);
     }
 
-    Iperf3Result* result = (Iperf3Result*)malloc(sizeof(Iperf3Result));
-    memset(result, 0, sizeof(Iperf3Result));
-
-    // Store callback for use during test
-    g_progress_callback = progressCallback;
-    g_progress_context = callbackContext;
+    Iperf3Session* session = session_new('c');
+    if (!session) {
+        LOGE("Failed to allocate client session");
+        return NULL;
+    }
+    session->port = port;
+    session->duration = duration;
 
     // Create and configure iperf3 test
     LOGD("Creating iperf3 test instance...");
     struct iperf_test* test = iperf_new_test();
     if (!test) {
         LOGE("Failed to create iperf3 test instance");
-        result->success = false;
-        result->errorMessage = strdup("Failed to create iperf3 test");
-        return result;
+        session_fail(session, "Failed to create iperf3 test", 0);
+        return session;
     }
     LOGD("iperf3 test instance created successfully");
-
+    session->test = test;
     iperf_defaults(test);
     LOGD("Setting client mode...");
     iperf_set_test_role(test, 'c'); // Client mode
@@ -149,14 +534,44 @@ Iperf3Result* iperf3_run_client_test(
     iperf_set_test_duration(test, duration);
     iperf_set_test_num_streams(test, parallel);
     iperf_set_test_reverse(test, reverse ? 1 : 0);
-
-    // Enable JSON output - CRITICAL for getting results!
+    if (config->bidirectional) {
+        iperf_set_test_bidirectional(test, 1);
+    }
+    // Pipeline the handshake; on mobile RTTs each saved round trip is visible.
+    // Servers without fast-start support just take the normal path.
+    iperf_set_test_fast_start(test, 1);
+    // Results with many streams are worth compressing on slow uplinks.
+    iperf_set_test_compress(test, DEFAULT_COMPRESS_THRESHOLD);
+
+    // JSON mode keeps iperf from printing text reports.  The summary is read
+    // from the stream results, so the JSON itself is only built and
+    // rendered when the caller wants it, and then without TCP_INFO (and for
+    // UDP, per-stream) objects every interval.
     iperf_set_test_json_output(test, 1);
-    LOGD("JSON output enabled");
+    if (config->microburstStallMs > 0) {
+        iperf_set_test_microburst(test, config->microburstStallMs);
+        iperf_set_test_microburst_keep(test, config->keepMicroburstBuckets);
+    }
+    if (config->convergeMinSeconds > 0) {
+        iperf_set_test_converge(test, config->convergeMinSeconds,
+                                config->convergeTolerance > 0 ? config->convergeTolerance
+                                                              : DEFAULT_CONVERGE_TOLERANCE / 100.0);
+    }
+    if (config->rampStreams) {
+        iperf_set_test_ramp(test, config->rampGain > 0 ? config->rampGain : DEFAULT_RAMP_GAIN / 100.0);
+    }
+    if (config->includeJson) {
+        iperf_set_test_json_detail(test, use_udp ? IPERF_JSON_DETAIL_SUMS : IPERF_JSON_DETAIL_STREAMS);
+        LOGD("JSON output enabled");
+    } else {
+        iperf_set_test_json_detail(test, IPERF_JSON_DETAIL_NONE);
+    }
+
+    // The JSON goes back to the caller in the result, not to stdout
+    iperf_set_test_json_callback(test, discard_json_output);
 
     // Hook reporter callback so we can emit per-interval updates after iperf processes them.
-    g_original_reporter_callback = test->reporter_callback;
-    g_last_reported_interval = 0;
+    session->original_reporter_callback = test->reporter_callback;
     test->reporter_callback = bridge_reporter_callback;
 
     LOGD("Test parameters configured");
@@ -169,11 +584,8 @@ Iperf3Result* iperf3_run_client_test(
             LOGE("Failed to set UDP protocol! Error code: %d, i_errno: %d", proto_result, i_errno);
             char* err_msg = iperf_strerror(i_errno);
             LOGE("Protocol error: %s", err_msg ? err_msg : "unknown");
-            result->success = false;
-            result->errorMessage = strdup(err_msg ? err_msg : "Failed to set UDP protocol");
-            result->errorCode = proto_result;
-            iperf_free_test(test);
-            return result;
+            session_fail(session, err_msg ? err_msg : "Failed to set UDP protocol", proto_result);
+            return session;
         }
         LOGI("UDP protocol set successfully");
 
@@ -202,11 +614,8 @@ Iperf3Result* iperf3_run_client_test(
             LOGE("Failed to set TCP protocol! Error code: %d, i_errno: %d", proto_result, i_errno);
             char* err_msg = iperf_strerror(i_errno);
             LOGE("Protocol error: %s", err_msg ? err_msg : "unknown");
-            result->success = false;
-            result->errorMessage = strdup(err_msg ? err_msg : "Failed to set TCP protocol");
-            result->errorCode = proto_result;
-            iperf_free_test(test);
-            return result;
+            session_fail(session, err_msg ? err_msg : "Failed to set TCP protocol", proto_result);
+            return session;
         }
         // TCP can also use bandwidth limiting if specified
         if (bandwidth > 0) {
@@ -214,26 +623,183 @@ Iperf3Result* iperf3_run_client_test(
             iperf_set_test_rate(test, bandwidth);
         }
     }
+    if (config->blockSize > 0) {
+        iperf_set_test_blksize(test, config->blockSize);
+    }
+
 
-    // Register this test as the active client so cancellation can target it.
-    pthread_mutex_lock(&g_client_mutex);
-    g_active_client_test = test;
-    g_cancel_client_requested = 0;
-    pthread_mutex_unlock(&g_client_mutex);
+    return session;
+}
+
+// Adds a stream's buckets into the result's.  The streams start recording
+// together, so bucket i of every stream covers the same millisecond.
+static void add_microburst_buckets(struct iperf_microburst* mb, Iperf3Result* result) {
+    uint64_t first;
+    uint64_t count = iperf_microburst_buckets(mb, NULL, UINT64_MAX, &first);
+    if (count == 0) {
+        return;
+    }
+    if (!result->microburstBuckets) {
+        result->microburstBuckets = (unsigned long long*)calloc(count, sizeof(unsigned long long));
+        if (!result->microburstBuckets) {
+            return;
+        }
+        result->microburstFirstBucket = first;
+        result->microburstBucketCount = count;
+    }
+    uint64_t* buckets = (uint64_t*)malloc(count * sizeof(uint64_t));
+    if (!buckets) {
+        return;
+    }
+    count = iperf_microburst_buckets(mb, buckets, count, &first);
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t b = first + i;
+        if (b >= result->microburstFirstBucket &&
+            b - result->microburstFirstBucket < result->microburstBucketCount) {
+            result->microburstBuckets[b - result->microburstFirstBucket] += buckets[i];
+        }
+    }
+    free(buckets);
+}
+
+// Fills in the summary from the stream results, following
+// iperf_print_results(): one data direction, omitted bytes and packets left
+// out, and the sender and receiver times the two ends reported.
+static void summarize_results(struct iperf_test* test, Iperf3Result* result) {
+    int must_be_sender = test->mode != RECEIVER;
+    double sender_time = 0.0, receiver_time = 0.0;
+    long long total_sent = 0, total_received = 0;
+    long long rtt_sum = 0, rtt_count = 0;
+    long rtt_min = 0, rtt_max = 0;
+    double jitter_sum = 0.0;
+    int streams = 0;
+    int buckets_wanted = test->microburst_keep;
+
+    struct iperf_stream* sp = SLIST_FIRST(&test->streams);
+    if (!sp) {
+        return;
+    }
+    sender_time = sp->result->sender_time;
+    receiver_time = sp->result->receiver_time;
+    if (sender_time == 0.0 || receiver_time == 0.0) {
+        struct iperf_time diff;
+        iperf_time_diff(&sp->result->start_time, &sp->result->end_time, &diff);
+        double end_time = iperf_time_in_secs(&diff);
+        if (sender_time == 0.0) {
+            sender_time = receiver_time != 0.0 ? receiver_time : end_time;
+        }
+        if (receiver_time == 0.0) {
+            receiver_time = sender_time;
+        }
+    }
+
+    SLIST_FOREACH(sp, &test->streams, streams) {
+        if (sp->sender != must_be_sender) {
+            continue;
+        }
+        streams++;
+        if (sp->microburst) {
+            struct iperf_microburst_summary total;
+            iperf_microburst_totals(sp->microburst, &total);
+            microburst_add(&result->peakBitsPerSecond, &result->burstCv, &result->stalls,
+                           &result->stallMs, &result->longestStallMs, &total);
+            if (buckets_wanted) {
+                add_microburst_buckets(sp->microburst, result);
+            }
+        }
+        total_sent += (long long)(sp->result->bytes_sent - sp->result->bytes_sent_omit);
+        total_received += (long long)sp->result->bytes_received;
+        if (test->protocol->id == Pudp) {
+            // The sender's packet count if we have it, else the receiver's
+            int64_t sender_packets = sp->sender ? sp->packet_count : sp->peer_packet_count;
+            int64_t receiver_packets = sp->sender ? sp->peer_packet_count : sp->packet_count;
+            int64_t packets = sender_packets ? sender_packets : receiver_packets;
+            result->packets += packets - sp->omitted_packet_count;
+            result->lostPackets += sp->cnt_error;
+            if (sp->omitted_cnt_error > -1) {
+                result->lostPackets -= sp->omitted_cnt_error;
+            }
+            jitter_sum += sp->jitter;
+        } else {
+            // On a receiving stream this is what the sender reported
+            result->retransmits += sp->result->stream_retrans;
+            if (sp->result->stream_count_rtt > 0) {
+                if (rtt_count == 0 || sp->result->stream_min_rtt < rtt_min) {
+                    rtt_min = sp->result->stream_min_rtt;
+                }
+                if (sp->result->stream_max_rtt > rtt_max) {
+                    rtt_max = sp->result->stream_max_rtt;
+                }
+                rtt_sum += sp->result->stream_sum_rtt;
+                rtt_count += sp->result->stream_count_rtt;
+            }
+        }
+    }
+
+    result->sentBytes = total_sent;
+    result->receivedBytes = total_received;
+    result->seconds = sender_time;
+    result->sentBitsPerSecond = sender_time > 0.0 ? total_sent * 8.0 / sender_time : 0.0;
+    result->receivedBitsPerSecond = receiver_time > 0.0 ? total_received * 8.0 / receiver_time : 0.0;
+    result->sendMbps = result->sentBitsPerSecond / 1000000.0;
+    result->receiveMbps = result->receivedBitsPerSecond / 1000000.0;
+    // TCP_INFO RTTs are in microseconds
+    if (rtt_count > 0) {
+        result->rtt = (double)rtt_sum / rtt_count / 1000.0;
+        result->rttMin = rtt_min / 1000.0;
+        result->rttMax = rtt_max / 1000.0;
+    }
+    if (test->protocol->id == Pudp && streams > 0) {
+        result->jitter = jitter_sum / streams * 1000.0;
+        result->lostPercent = result->packets > 0 ? 100.0 * result->lostPackets / result->packets : 0.0;
+    }
+    result->cpuLocal = test->cpu_util[0];
+    result->cpuRemote = test->remote_cpu_util[0];
+    if (test->converge) {
+        struct iperf_converge_estimate estimate;
+        iperf_converge_estimate(test->converge, &estimate);
+        result->convergeStop = (Iperf3ConvergeStop)iperf_get_test_converge_stop(test);
+        result->convergeRelativeCi = estimate.relative_ci;
+    }
+    if (test->ramp) {
+        const struct iperf_ramp_step* steps;
+        int count = iperf_ramp_steps(test->ramp, &steps);
+        result->rampStop = (Iperf3RampStop)iperf_ramp_stop(test->ramp);
+        result->rampSaturationStreams = iperf_ramp_saturation(test->ramp);
+        if (count > 0 && !result->rampBitsPerSecond) {
+            result->rampBitsPerSecond = (double*)calloc(count, sizeof(double));
+            if (result->rampBitsPerSecond) {
+                for (int i = 0; i < count; i++) {
+                    result->rampBitsPerSecond[i] = steps[i].bits_per_second;
+                }
+                result->rampStepCount = count;
+            }
+        }
+    }
+}
+
+static void client_run(Iperf3Session* session) {
+    struct iperf_test* test = session->test;
+    const char* host = iperf_get_test_server_hostname(test);
+    int port = session->port;
+    int duration = session->duration;
+
+    Iperf3Result* result = result_new();
+    if (!result) {
+        return;
+    }
 
     // Run the test
     LOGI("Connecting to server %s:%d...", host, port);
     LOGI("Starting iperf3 client test...");
-    i_errno = IENONE; // Reset global errno before running the client
+    i_errno = IENONE; // Reset this thread's errno before running the client
     int result_code = iperf_run_client(test);
     LOGI("iperf3 client test completed with result code: %d", result_code);
     int final_errno = i_errno; // Capture errno immediately after the run
 
-    pthread_mutex_lock(&g_client_mutex);
-    int was_cancelled = g_cancel_client_requested;
-    g_active_client_test = NULL;
-    g_cancel_client_requested = 0;
-    pthread_mutex_unlock(&g_client_mutex);
+    pthread_mutex_lock(&session->mutex);
+    int was_cancelled = session->cancel_requested;
+    pthread_mutex_unlock(&session->mutex);
 
     // Post-test diagnostics
     LOGI("=== Post-Test Diagnostics ===");
@@ -319,43 +885,29 @@ Iperf3Result* iperf3_run_client_test(
         LOGI("Test succeeded! Retrieving results...");
         result->success = true;
 
-        // Get JSON output which contains all results
-        char* jsonOutput = iperf_get_test_json_output_string(test);
+        summarize_results(test, result);
+        LOGI("Sent %.2f Mbps, received %.2f Mbps, RTT %.2f ms, jitter %.3f ms, loss %.2f%%",
+             result->sendMbps, result->receiveMbps, result->rtt, result->jitter, result->lostPercent);
+
+        // Take the JSON output over from the test, if it was asked for; it is
+        // handed on without copying
+        char* jsonOutput = iperf_take_test_json_output_string(test);
         if (jsonOutput) {
             size_t json_len = strlen(jsonOutput);
             LOGI("JSON output retrieved (length: %zu bytes)", json_len);
 
             // Log last 800 chars of JSON for debugging (shows the "end" section with results)
             if (json_len > 0) {
-                char preview[801];
                 size_t preview_len = json_len < 800 ? json_len : 800;
-                size_t start_pos = json_len > 800 ? json_len - 800 : 0;
-
-                strncpy(preview, jsonOutput + start_pos, preview_len);
-                preview[preview_len] = '\0';
-
-                LOGD("JSON preview (last %zu chars): %s%s",
+                LOGD("JSON preview (last %zu chars): %s%.*s",
                      preview_len,
                      json_len > 800 ? "..." : "",
-                     preview);
+                     (int)preview_len,
+                     jsonOutput + json_len - preview_len);
             }
 
-            result->jsonOutput = strdup(jsonOutput);
-
-            // For now, set basic values to 0
-            // The Flutter layer will parse JSON for detailed results
-            result->sentBitsPerSecond = 0;
-            result->receivedBitsPerSecond = 0;
-            result->sendMbps = 0;
-            result->receiveMbps = 0;
-            result->rtt = 0;
-            result->jitter = 0;
-            LOGI("Results prepared successfully (values set to 0 - Flutter will parse JSON)");
-        } else {
-            LOGE("No JSON output available from iperf3");
-            result->success = false;
-            result->errorMessage = strdup("No JSON output available");
-            result->errorCode = -1;
+            result->jsonOutput = jsonOutput;
+            result->jsonOutputLength = json_len;
         }
     } else if (result_code == 0 && final_errno != 0) {
         // Test appeared to succeed (result_code 0) but i_errno indicates error
@@ -386,100 +938,726 @@ Iperf3Result* iperf3_run_client_test(
         }
 
         result->success = false;
-        result->errorCode = result_code;
+        // iperf's error number says what went wrong; the return code only that it did
+        result->errorCode = final_errno != 0 ? final_errno : result_code;
     }
 
     // Clear errno so future runs start clean
     i_errno = IENONE;
 
-    LOGD("Cleaning up iperf3 test instance...");
-    iperf_free_test(test);
-    g_original_reporter_callback = NULL;
-    g_last_reported_interval = 0;
-    g_progress_callback = NULL;
-    g_progress_context = NULL;
+    pthread_mutex_lock(&session->mutex);
+    session->result = result;
+    pthread_mutex_unlock(&session->mutex);
     LOGI("=== iperf3 Client Test Finished ===");
-    return result;
 }
 
-void iperf3_request_client_cancel(void) {
-    pthread_mutex_lock(&g_client_mutex);
-    if (g_active_client_test) {
-        LOGI("Cancellation requested - signalling active iperf3 client to stop");
-        g_cancel_client_requested = 1;
-        g_active_client_test->done = 1;
-        iperf_set_test_state(g_active_client_test, CLIENT_TERMINATE);
-        if (iperf_set_send_state(g_active_client_test, CLIENT_TERMINATE) != 0) {
-            LOGW("Failed to send CLIENT_TERMINATE state to server: %s",
-                 iperf_strerror(i_errno));
+Iperf3Session* iperf3_session_create_server(int port, bool use_udp) {
+    Iperf3Session* session = session_new('s');
+    if (!session) {
+        LOGE("Failed to allocate server session");
+        return NULL;
+    }
+    session->port = port;
+
+    struct iperf_test* test = iperf_new_test();
+    if (!test) {
+        session_fail(session, "Failed to create iperf3 test", 0);
+        return session;
+    }
+    session->test = test;
+
+    iperf_defaults(test);
+    iperf_set_test_role(test, 's'); // Server mode
+    iperf_set_test_server_port(test, port);
+    session->original_reporter_callback = test->reporter_callback;
+    test->reporter_callback = bridge_reporter_callback;
+
+    // Set protocol for server
+    if (set_protocol(test, use_udp ? Pudp : Ptcp) != 0) {
+        session_fail(session, "Failed to set server protocol", i_errno);
+        return session;
+    }
+    return session;
+}
+
+// Serve one test after another, the way the command-line server does, until
+// the session is cancelled or the server cannot listen at all.
+static void server_run(Iperf3Session* session) {
+    struct iperf_test* test = session->test;
+    Iperf3Result* result = result_new();
+    if (!result) {
+        return;
+    }
+
+    LOGI("=== iperf3 Server Listening on port %d ===", session->port);
+    int rc = 0;
+    int final_errno = IENONE;
+    bool cancelled = false;
+    for (;;) {
+        // Interval numbers start over with every test served
+        memset(&session->last_interval_end, 0, sizeof(session->last_interval_end));
+        session->interval_count = 0;
+        i_errno = IENONE;
+        rc = iperf_run_server(test);
+        final_errno = i_errno;
+        iperf_reset_test(test);
+
+        pthread_mutex_lock(&session->mutex);
+        cancelled = session->cancel_requested;
+        pthread_mutex_unlock(&session->mutex);
+        if (cancelled || rc < -1) {
+            break;
+        }
+        if (rc < 0) {
+            LOGW("iperf3 server test failed: %s", iperf_strerror(final_errno));
         }
+    }
+
+    if (cancelled) {
+        LOGI("iperf3 server on port %d stopped", session->port);
+        result->success = true;
     } else {
-        LOGD("Cancellation requested but no active client test is running");
+        LOGE("iperf3 server on port %d failed: %s", session->port, iperf_strerror(final_errno));
+        result->success = false;
+        result->errorMessage = strdup(iperf_strerror(final_errno));
+        result->errorCode = final_errno;
+    }
+    i_errno = IENONE;
+
+    pthread_mutex_lock(&session->mutex);
+    session->result = result;
+    pthread_mutex_unlock(&session->mutex);
+}
+
+void iperf3_session_set_progress_callback(
+    Iperf3Session* session,
+    Iperf3ProgressCallback callback,
+    void* context
+) {
+    if (!session) {
+        return;
     }
-    pthread_mutex_unlock(&g_client_mutex);
+    session->progress_callback = callback;
+    session->progress_context = context;
 }
 
-// Global server instance
-static struct iperf_test* g_server_test = NULL;
-static pthread_t g_server_thread;
-static bool g_server_running = false;
+void iperf3_session_set_interval_callback(
+    Iperf3Session* session,
+    Iperf3IntervalCallback callback,
+    void* context
+) {
+    if (!session) {
+        return;
+    }
+    session->interval_callback = callback;
+    session->interval_context = context;
+}
 
-static void* server_thread_func(void* arg) {
-    struct iperf_test* test = (struct iperf_test*)arg;
-    iperf_run_server(test);
+bool iperf3_session_set_async_delivery(Iperf3Session* session, int framesPerSecond, int capacity) {
+    if (!session || session->state != IPERF3_SESSION_CREATED || session->async_delivery) {
+        return false;
+    }
+    if (!ring_init(&session->ring, capacity > 0 ? capacity : 64)) {
+        return false;
+    }
+    session->frames_per_second = framesPerSecond > 0 ? framesPerSecond : 0;
+    session->async_delivery = true;
+    return true;
+}
+
+void iperf3_session_get_delivery_stats(Iperf3Session* session, Iperf3DeliveryStats* stats) {
+    if (!session || !stats) {
+        return;
+    }
+    stats->delivered = atomic_load_explicit(&session->delivered, memory_order_relaxed);
+    stats->coalesced = atomic_load_explicit(&session->coalesced, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&session->dropped, memory_order_relaxed);
+}
+
+Iperf3Result* iperf3_session_run(Iperf3Session* session) {
+    if (!session) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&session->mutex);
+    if (session->state != IPERF3_SESSION_CREATED) {
+        // Already run, or never set up: hand back whatever result it has
+        Iperf3Result* result = session->result;
+        pthread_mutex_unlock(&session->mutex);
+        return result;
+    }
+    bool cancelled = session->cancel_requested;
+    session->state = cancelled ? IPERF3_SESSION_FINISHED : IPERF3_SESSION_RUNNING;
+    pthread_mutex_unlock(&session->mutex);
+
+    if (cancelled) {
+        session_fail(session, "Test cancelled by user", IECLIENTTERM);
+        return session->result;
+    }
+
+    Iperf3Session* previous = t_current_session;
+    t_current_session = session;
+    delivery_start(session);
+    if (session->role == 's') {
+        server_run(session);
+    } else {
+        client_run(session);
+    }
+    // Flushes what is still queued, so the last interval arrives before run returns
+    delivery_stop(session);
+    t_current_session = previous;
+
+    pthread_mutex_lock(&session->mutex);
+    session->state = IPERF3_SESSION_FINISHED;
+    Iperf3Result* result = session->result;
+    pthread_mutex_unlock(&session->mutex);
+    return result;
+}
+
+static void* session_thread_func(void* arg) {
+    iperf3_session_run((Iperf3Session*)arg);
     return NULL;
 }
 
-bool iperf3_start_server_test(int port, bool use_udp) {
-    if (g_server_running) {
-        return false; // Server already running
+bool iperf3_session_start(Iperf3Session* session) {
+    if (!session || session->thread_started) {
+        return false;
     }
+    if (pthread_create(&session->thread, NULL, session_thread_func, session) != 0) {
+        LOGE("Failed to start iperf3 session thread");
+        return false;
+    }
+    session->thread_started = true;
+    return true;
+}
+
+Iperf3Result* iperf3_session_wait(Iperf3Session* session) {
+    if (!session) {
+        return NULL;
+    }
+    if (session->thread_started) {
+        pthread_join(session->thread, NULL);
+        session->thread_started = false;
+    }
+    pthread_mutex_lock(&session->mutex);
+    Iperf3Result* result = session->result;
+    pthread_mutex_unlock(&session->mutex);
+    return result;
+}
 
-    g_server_test = iperf_new_test();
-    if (!g_server_test) {
+Iperf3Result* iperf3_session_take_result(Iperf3Session* session) {
+    if (!session) {
+        return NULL;
+    }
+    pthread_mutex_lock(&session->mutex);
+    Iperf3Result* result = NULL;
+    if (session->state == IPERF3_SESSION_FINISHED) {
+        result = session->result;
+        session->result = NULL;
+    }
+    pthread_mutex_unlock(&session->mutex);
+    return result;
+}
+
+Iperf3SessionState iperf3_session_get_state(Iperf3Session* session) {
+    if (!session) {
+        return IPERF3_SESSION_FINISHED;
+    }
+    pthread_mutex_lock(&session->mutex);
+    Iperf3SessionState state = session->state;
+    pthread_mutex_unlock(&session->mutex);
+    return state;
+}
+
+bool iperf3_session_get_progress(Iperf3Session* session, Iperf3Progress* progress) {
+    if (!session || !progress) {
         return false;
     }
+    pthread_mutex_lock(&session->mutex);
+    bool has_progress = session->has_progress;
+    if (has_progress) {
+        *progress = session->progress;
+    }
+    pthread_mutex_unlock(&session->mutex);
+    return has_progress;
+}
 
-    iperf_defaults(g_server_test);
-    iperf_set_test_role(g_server_test, 's'); // Server mode
-    iperf_set_test_server_port(g_server_test, port);
+// Wake a server blocked in select() on its listening or control socket.
+// shutdown() is enough on Linux; Darwin refuses it on a listening socket, so
+// there we connect to ourselves to make accept() return.
+static void server_wake(Iperf3Session* session) {
+    struct iperf_test* test = session->test;
 
-    // Set protocol for server
-    if (use_udp) {
-        set_protocol(g_server_test, Pudp);
+    if (test->ctrl_sck >= 0) {
+        shutdown(test->ctrl_sck, SHUT_RDWR);
+    }
+    if (test->listener >= 0 && shutdown(test->listener, SHUT_RDWR) != 0) {
+        int fd = netdial(AF_UNSPEC, Ptcp, NULL, NULL, 0, "localhost", session->port, 1000);
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void iperf3_session_cancel(Iperf3Session* session) {
+    if (!session) {
+        return;
+    }
+    pthread_mutex_lock(&session->mutex);
+    session->cancel_requested = true;
+    if (session->state == IPERF3_SESSION_RUNNING && session->test) {
+        struct iperf_test* test = session->test;
+        if (session->role == 's') {
+            LOGI("Cancellation requested - stopping iperf3 server on port %d", session->port);
+            server_wake(session);
+        } else {
+            LOGI("Cancellation requested - signalling iperf3 client to stop");
+            test->done = 1;
+            iperf_set_test_state(test, CLIENT_TERMINATE);
+            if (iperf_set_send_state(test, CLIENT_TERMINATE) != 0) {
+                LOGW("Failed to send CLIENT_TERMINATE state to server: %s",
+                     iperf_strerror(i_errno));
+            }
+        }
+    }
+    pthread_mutex_unlock(&session->mutex);
+}
+
+void iperf3_session_free(Iperf3Session* session) {
+    if (!session) {
+        return;
+    }
+    if (session->thread_started) {
+        iperf3_session_cancel(session);
+        iperf3_session_wait(session);
+    }
+    if (session->test) {
+        iperf_free_test(session->test);
+    }
+    iperf3_free_result(session->result);
+    free(session->streams);
+    ring_free(&session->ring);
+    pthread_mutex_destroy(&session->mutex);
+    free(session);
+}
+
+#define CONNECT_TRIES 50                // the server may still be closing the last test
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs one of a sequence of client tests against the same server, retried
+// while the server is still busy with the previous one.  The session is in
+// *client while it runs, under mutex, so that another thread can cancel it.
+// Returns the finished session, whose result iperf3_session_run() hands
+// back again, or NULL if cancelled first or out of memory.
+static Iperf3Session* run_client_retrying(const Iperf3ClientConfig* config, bool fast_start,
+                                          pthread_mutex_t* mutex, const bool* cancel_requested,
+                                          Iperf3Session** client) {
+    for (int tries = 1; ; tries++) {
+        Iperf3Session* session = iperf3_session_create_client(config);
+        if (!session) {
+            return NULL;
+        }
+        if (fast_start && session->test) {
+            iperf_set_test_fast_start(session->test, 1);
+        }
+        pthread_mutex_lock(mutex);
+        bool cancelled = *cancel_requested;
+        if (!cancelled) {
+            *client = session;
+        }
+        pthread_mutex_unlock(mutex);
+        if (cancelled) {
+            iperf3_session_free(session);
+            return NULL;
+        }
+
+        double started = monotonic_seconds();
+        Iperf3Result* result = iperf3_session_run(session);
+        int code = result ? result->errorCode : -1;
+        bool retry = result && !result->success && monotonic_seconds() - started < 1.0 &&
+            (code == IECONNECT || code == IEACCESSDENIED || code == IECTRLCLOSE ||
+             code == IERECVMESSAGE || code == IEINITSTREAM || code == IESTREAMCONNECT);
+
+        pthread_mutex_lock(mutex);
+        *client = NULL;
+        cancelled = *cancel_requested;
+        pthread_mutex_unlock(mutex);
+        if (!retry || cancelled || tries == CONNECT_TRIES) {
+            return session;
+        }
+        iperf3_session_free(session);
+        usleep(100 * 1000);
+    }
+}
+
+#define SELFTEST_DEFAULT_SECONDS 3
+#define SELFTEST_UDP_RATE 10000000000L  // bits/s over all streams; loopback is the limit
+#define SELFTEST_UDP_BLOCK 1460
+#define SELFTEST_SETTLE_MS 250          // between tests, for the server to go back to listening
+
+static const int selftest_parallel[] = { 1, 4, 8 };
+
+struct Iperf3SelfTest {
+    int port;
+    int duration;
+    pthread_mutex_t mutex;
+    bool cancel_requested;
+    Iperf3Session* server;
+    Iperf3Session* client;          // the client test running now, if any
+    Iperf3SelfTestResult result;
+};
+
+Iperf3SelfTest* iperf3_selftest_create(int port, int duration) {
+    Iperf3SelfTest* selftest = (Iperf3SelfTest*)calloc(1, sizeof(Iperf3SelfTest));
+    if (!selftest) {
+        return NULL;
+    }
+    selftest->port = port > 0 ? port : IPERF3_SELFTEST_DEFAULT_PORT;
+    selftest->duration = duration > 0 ? duration : SELFTEST_DEFAULT_SECONDS;
+    pthread_mutex_init(&selftest->mutex, NULL);
+    return selftest;
+}
+
+static bool selftest_cancelled(Iperf3SelfTest* selftest) {
+    pthread_mutex_lock(&selftest->mutex);
+    bool cancelled = selftest->cancel_requested;
+    pthread_mutex_unlock(&selftest->mutex);
+    return cancelled;
+}
+
+// One client test against the self-test's server
+static void selftest_run_one(Iperf3SelfTest* selftest, Iperf3SelfTestRun* run) {
+    Iperf3ClientConfig config = {
+        .host = "127.0.0.1",
+        .port = selftest->port,
+        .duration = selftest->duration,
+        .parallel = run->parallel,
+        .useUdp = run->useUdp,
+        .bandwidth = run->useUdp ? SELFTEST_UDP_RATE / run->parallel : 0,
+        .blockSize = run->useUdp ? SELFTEST_UDP_BLOCK : 0,
+    };
+
+    Iperf3Session* session = run_client_retrying(&config, false, &selftest->mutex,
+                                                 &selftest->cancel_requested, &selftest->client);
+    if (!session) {
+        run->errorCode = selftest_cancelled(selftest) ? IECLIENTTERM : -1;
+        return;
+    }
+    Iperf3Result* result = iperf3_session_run(session);
+    if (result && result->success) {
+        run->success = true;
+        run->bitsPerSecond = result->receivedBitsPerSecond;
+        run->cpuPercent = result->cpuLocal;
+        run->lostPercent = result->lostPercent;
+        if (result->seconds > 0) {
+            int block = run->useUdp ? SELFTEST_UDP_BLOCK : iperf_get_test_blksize(session->test);
+            run->pps = run->useUdp ? result->packets / result->seconds
+                                   : result->sentBytes / (double)block / result->seconds;
+        }
     } else {
-        set_protocol(g_server_test, Ptcp);
+        run->errorCode = result ? result->errorCode : -1;
     }
+    iperf3_session_free(session);
+}
 
-    int result = pthread_create(&g_server_thread, NULL, server_thread_func, g_server_test);
-    if (result != 0) {
-        iperf_free_test(g_server_test);
-        g_server_test = NULL;
-        return false;
+// CPU per Gbit/s received, so runs at different rates compare
+static double selftest_cpu_per_gbps(const Iperf3SelfTestRun* run) {
+    return run->bitsPerSecond > 0 ? run->cpuPercent / (run->bitsPerSecond / 1e9) : 0;
+}
+
+const Iperf3SelfTestResult* iperf3_selftest_run(Iperf3SelfTest* selftest) {
+    if (!selftest) {
+        return NULL;
+    }
+    Iperf3SelfTestResult* result = &selftest->result;
+    if (result->runCount > 0 || result->errorMessage) {
+        return result;  // already run
     }
 
-    g_server_running = true;
-    return true;
+    Iperf3Session* server = iperf3_session_create_server(selftest->port, false);
+    pthread_mutex_lock(&selftest->mutex);
+    selftest->server = server;
+    bool cancelled = selftest->cancel_requested;
+    pthread_mutex_unlock(&selftest->mutex);
+    if (cancelled) {
+        result->errorMessage = strdup("Self-test cancelled by user");
+        result->errorCode = IECLIENTTERM;
+    } else if (!server || iperf3_session_get_state(server) == IPERF3_SESSION_FINISHED ||
+               !iperf3_session_start(server)) {
+        result->errorMessage = strdup("Failed to start the self-test server");
+        result->errorCode = IELISTEN;
+    }
+    if (result->errorMessage) {
+        pthread_mutex_lock(&selftest->mutex);
+        selftest->server = NULL;
+        pthread_mutex_unlock(&selftest->mutex);
+        iperf3_session_free(server);
+        return result;
+    }
+    LOGI("Self-test: server on port %d, %d s per run", selftest->port, selftest->duration);
+
+    const Iperf3SelfTestRun* best_tcp = NULL;
+    const Iperf3SelfTestRun* best_udp = NULL;
+    for (int udp = 0; udp <= 1; udp++) {
+        for (size_t p = 0; p < sizeof(selftest_parallel) / sizeof(selftest_parallel[0]); p++) {
+            if (selftest_cancelled(selftest) || result->runCount >= IPERF3_SELFTEST_MAX_RUNS) {
+                break;
+            }
+            Iperf3SelfTestRun* run = &result->runs[result->runCount++];
+            run->useUdp = udp;
+            run->parallel = selftest_parallel[p];
+            usleep(SELFTEST_SETTLE_MS * 1000);
+            selftest_run_one(selftest, run);
+            LOGI("Self-test: %s -P %d: %s %.1f Mbit/s, cpu %.1f%%", udp ? "UDP" : "TCP", run->parallel,
+                 run->success ? "ok" : "failed", run->bitsPerSecond / 1e6, run->cpuPercent);
+
+            const Iperf3SelfTestRun** best = udp ? &best_udp : &best_tcp;
+            if (run->success && (!*best || run->bitsPerSecond > (*best)->bitsPerSecond)) {
+                *best = run;
+            }
+            if (!run->success) {
+                result->errorCode = run->errorCode;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&selftest->mutex);
+    selftest->server = NULL;
+    pthread_mutex_unlock(&selftest->mutex);
+    iperf3_session_cancel(server);
+    iperf3_session_free(server);
+
+    if (best_tcp) {
+        result->tcpBitsPerSecond = best_tcp->bitsPerSecond;
+        result->tcpCpuPerGbps = selftest_cpu_per_gbps(best_tcp);
+        result->tcpPps = best_tcp->pps;
+    }
+    if (best_udp) {
+        result->udpBitsPerSecond = best_udp->bitsPerSecond;
+        result->udpCpuPerGbps = selftest_cpu_per_gbps(best_udp);
+        result->udpPps = best_udp->pps;
+        result->udpLostPercent = best_udp->lostPercent;
+    }
+    result->success = best_tcp && best_udp;
+    if (result->success) {
+        result->errorCode = 0;
+    } else {
+        result->errorMessage = strdup(selftest_cancelled(selftest) ? "Self-test cancelled by user"
+                                                                   : "Self-test runs failed");
+        if (result->errorCode == 0) {
+            result->errorCode = IECLIENTTERM;
+        }
+    }
+    return result;
+}
+
+void iperf3_selftest_cancel(Iperf3SelfTest* selftest) {
+    if (!selftest) {
+        return;
+    }
+    pthread_mutex_lock(&selftest->mutex);
+    selftest->cancel_requested = true;
+    if (selftest->client) {
+        iperf3_session_cancel(selftest->client);
+    }
+    pthread_mutex_unlock(&selftest->mutex);
 }
 
-bool iperf3_stop_server_test(void) {
-    if (!g_server_running || !g_server_test) {
+void iperf3_selftest_free(Iperf3SelfTest* selftest) {
+    if (!selftest) {
+        return;
+    }
+    free(selftest->result.errorMessage);
+    pthread_mutex_destroy(&selftest->mutex);
+    free(selftest);
+}
+
+struct Iperf3Search {
+    char* host;
+    int port;
+    int seconds;
+    bool reverse;
+    long max_rate;
+    double loss_tolerance;
+    int block_sizes[IPERF3_SEARCH_MAX_BLOCK_SIZES];
+    int block_size_count;
+    pthread_mutex_t mutex;
+    bool cancel_requested;
+    Iperf3Session* client;          // the trial running now, if any
+    struct iperf_search* search;
+    Iperf3SearchTrial* trials;
+    Iperf3SearchResult result;
+};
+
+Iperf3Search* iperf3_search_create(const Iperf3SearchConfig* config) {
+    if (!config || !config->host || config->blockSizeCount > IPERF3_SEARCH_MAX_BLOCK_SIZES) {
+        return NULL;
+    }
+    Iperf3Search* search = (Iperf3Search*)calloc(1, sizeof(Iperf3Search));
+    if (!search) {
+        return NULL;
+    }
+    search->host = strdup(config->host);
+    if (!search->host) {
+        free(search);
+        return NULL;
+    }
+    search->port = config->port;
+    search->seconds = config->trialSeconds > 0 ? config->trialSeconds : DEFAULT_SEARCH_TRIAL;
+    search->reverse = config->reverse;
+    search->max_rate = config->maxBandwidth > 0 ? config->maxBandwidth : DEFAULT_SEARCH_RATE;
+    search->loss_tolerance = config->lossTolerance;
+    for (int i = 0; i < config->blockSizeCount; i++) {
+        search->block_sizes[i] = config->blockSizes[i];
+    }
+    search->block_size_count = config->blockSizeCount;
+    pthread_mutex_init(&search->mutex, NULL);
+    return search;
+}
+
+// One trial at block and rate; false with the result's error set if it failed
+static bool search_run_trial(Iperf3Search* search, int block, uint64_t rate) {
+    Iperf3SearchResult* result = &search->result;
+    Iperf3ClientConfig config = {
+        .host = search->host,
+        .port = search->port,
+        .duration = search->seconds,
+        .parallel = 1,
+        .reverse = search->reverse,
+        .useUdp = true,
+        .bandwidth = (long)rate,
+        .blockSize = block,
+    };
+
+    // Fast start saves each trial its parameter round trip
+    Iperf3Session* session = run_client_retrying(&config, true, &search->mutex,
+                                                 &search->cancel_requested, &search->client);
+    if (!session) {
+        pthread_mutex_lock(&search->mutex);
+        bool cancelled = search->cancel_requested;
+        pthread_mutex_unlock(&search->mutex);
+        result->errorMessage = strdup(cancelled ? "Search cancelled by user" : "Out of memory");
+        result->errorCode = cancelled ? IECLIENTTERM : -1;
         return false;
     }
+    Iperf3Result* trial_result = iperf3_session_run(session);
+    bool ok = trial_result && trial_result->success;
+    if (ok) {
+        struct iperf_search_trial trial = {
+            .blksize = iperf_get_test_blksize(session->test),
+            .rate = rate,
+            .bits_per_second = trial_result->receivedBitsPerSecond,
+            .packets = trial_result->packets,
+            .lost = trial_result->lostPackets,
+            .jitter = trial_result->jitter,
+        };
+        if (iperf_search_add(search->search, &trial) < 0) {
+            result->errorMessage = strdup("Out of memory");
+            result->errorCode = -1;
+            ok = false;
+        } else {
+            LOGI("Search: %d byte blocks at %.1f Mbit/s: %.1f Mbit/s, %.3f%% lost, %s", trial.blksize,
+                 rate / 1e6, trial.bits_per_second / 1e6, trial.lost_percent, trial.passed ? "pass" : "fail");
+        }
+    } else {
+        result->errorMessage = strdup(trial_result && trial_result->errorMessage ? trial_result->errorMessage
+                                                                                 : "Search trial failed");
+        result->errorCode = trial_result ? trial_result->errorCode : -1;
+    }
+    iperf3_session_free(session);
+    return ok;
+}
+
+const Iperf3SearchResult* iperf3_search_run(Iperf3Search* search) {
+    if (!search) {
+        return NULL;
+    }
+    Iperf3SearchResult* result = &search->result;
+    if (search->search || result->errorMessage) {
+        return result;  // already run
+    }
+    search->search = iperf_search_new(search->max_rate, search->loss_tolerance);
+    if (!search->search) {
+        result->errorMessage = strdup("Out of memory");
+        result->errorCode = -1;
+        return result;
+    }
+    LOGI("Search: %s:%d up to %.1f Mbit/s, %d s trials, at most %.3f%% lost", search->host, search->port,
+         search->max_rate / 1e6, search->seconds, search->loss_tolerance);
+
+    int block_count = search->block_size_count > 0 ? search->block_size_count : 1;
+    int trials = 0;
+    for (int i = 0; i < block_count && !result->errorMessage; i++) {
+        int block = search->block_size_count > 0 ? search->block_sizes[i] : 0;
+        uint64_t rate;
+        iperf_search_begin(search->search, block);
+        while ((rate = iperf_search_next_rate(search->search)) != 0) {
+            if (trials++ > 0) {
+                usleep(IPERF_SEARCH_REST_MS * 1000);
+            }
+            if (!search_run_trial(search, block, rate)) {
+                break;
+            }
+        }
+    }
 
-    // Note: pthread_cancel is not supported on Android
-    // For now, we'll just wait for the thread to finish
-    // A production implementation might need a signal mechanism
-    #ifndef __ANDROID__
-    pthread_cancel(g_server_thread);
-    #endif
-    pthread_join(g_server_thread, NULL);
+    const struct iperf_search_result* block_results;
+    int count = iperf_search_results(search->search, &block_results);
+    for (int i = 0; i < count; i++) {
+        result->blockResults[i].blockSize = block_results[i].blksize;
+        result->blockResults[i].maxBitsPerSecond = block_results[i].max_rate;
+        result->blockResults[i].trialCount = block_results[i].trials;
+    }
+    result->blockResultCount = count;
+
+    const struct iperf_search_trial* trial;
+    count = iperf_search_trials(search->search, &trial);
+    search->trials = count > 0 ? (Iperf3SearchTrial*)calloc(count, sizeof(Iperf3SearchTrial)) : NULL;
+    if (search->trials) {
+        for (int i = 0; i < count; i++, trial++) {
+            search->trials[i].blockSize = trial->blksize;
+            search->trials[i].offeredBitsPerSecond = trial->rate;
+            search->trials[i].receivedBitsPerSecond = trial->bits_per_second;
+            search->trials[i].packets = trial->packets;
+            search->trials[i].lostPackets = trial->lost;
+            search->trials[i].lostPercent = trial->lost_percent;
+            search->trials[i].jitter = trial->jitter;
+            search->trials[i].passed = trial->passed;
+        }
+        result->trials = search->trials;
+        result->trialCount = count;
+    }
+    result->success = !result->errorMessage;
+    return result;
+}
 
-    iperf_free_test(g_server_test);
-    g_server_test = NULL;
-    g_server_running = false;
+void iperf3_search_cancel(Iperf3Search* search) {
+    if (!search) {
+        return;
+    }
+    pthread_mutex_lock(&search->mutex);
+    search->cancel_requested = true;
+    if (search->client) {
+        iperf3_session_cancel(search->client);
+    }
+    pthread_mutex_unlock(&search->mutex);
+}
 
-    return true;
+void iperf3_search_free(Iperf3Search* search) {
+    if (!search) {
+        return;
+    }
+    iperf_search_free(search->search);
+    free(search->trials);
+    free(search->result.errorMessage);
+    free(search->host);
+    pthread_mutex_destroy(&search->mutex);
+    free(search);
 }
 
 const char* iperf3_get_version_string(void) {
@@ -489,11 +1667,26 @@ const char* iperf3_get_version_string(void) {
 void iperf3_free_result(Iperf3Result* result) {
     if (result) {
         if (result->jsonOutput) {
-            free(result->jsonOutput);
+            cJSON_free(result->jsonOutput);  // rendered by cJSON, see iperf_json_finish()
         }
         if (result->errorMessage) {
             free(result->errorMessage);
         }
+        free(result->microburstBuckets);
+        free(result->rampBitsPerSecond);
         free(result);
     }
 }
+
+Iperf3Session* iperf3_session_wrap_test(struct iperf_test* test) {
+    Iperf3Session* session = session_new('c');
+    if (session) {
+        session->test = test;
+    }
+    return session;
+}
+
+void iperf3_session_report_interval(Iperf3Session* session) {
+    memset(&session->last_interval_end, 0, sizeof(session->last_interval_end));
+    report_interval(session, session->test);
+}
@@ -32,11 +32,17 @@ SOURCES=(
     "iperf_api.c"
     "iperf_auth.c"
     "iperf_client_api.c"
+    "iperf_converge.c"
     "iperf_error.c"
     "iperf_locale.c"
+    "iperf_lz.c"
+    "iperf_microburst.c"
     "iperf_pthread.c"
+    "iperf_ramp.c"
     "iperf_sctp.c"
+    "iperf_search.c"
     "iperf_server_api.c"
+    "iperf_sim.c"
     "iperf_tcp.c"
     "iperf_time.c"
     "iperf_udp.c"
@@ -122,6 +122,9 @@ typedef struct cJSON
 
     /* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
     char *string;
+
+    /* Hashed member index of a large object, built lazily by cJSON_GetObjectItem. Internal, do not touch. */
+    struct cJSON_KeyIndex *key_index;
 } cJSON;
 
 typedef struct cJSON_Hooks
@@ -174,6 +177,10 @@ CJSON_PUBLIC(cJSON *) cJSON_GetArrayItem(const cJSON *array, int index);
 CJSON_PUBLIC(cJSON *) cJSON_GetObjectItem(const cJSON * const object, const char * const string);
 CJSON_PUBLIC(cJSON *) cJSON_GetObjectItemCaseSensitive(const cJSON * const object, const char * const string);
 CJSON_PUBLIC(cJSON_bool) cJSON_HasObjectItem(const cJSON *object, const char *string);
+/* Objects whose lookups walk at least this many members get a hashed key index, so later
+ * lookups on them are O(1). The index is dropped whenever the object's members change.
+ * 0 disables indexing. Not thread safe: don't look up keys on one tree from several threads. */
+CJSON_PUBLIC(void) cJSON_SetKeyIndexThreshold(int threshold);
 /* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. */
 CJSON_PUBLIC(const char *) cJSON_GetErrorPtr(void);
 
@@ -0,0 +1,76 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#ifndef __IPERF_CONVERGE_H
+#define __IPERF_CONVERGE_H
+
+/*
+ * Convergence of a test's throughput, for ending a timed test as soon as
+ * it has settled (--converge).  The client feeds in the rate of each
+ * interval it reports; once the last window of them agree, so that the 95%
+ * confidence interval of their mean is within tolerance of it, the
+ * throughput has converged.  Only the window counts, so the ramp-up of
+ * slow start drops out of it as the test goes on.
+ */
+
+#define IPERF_CONVERGE_MIN_WINDOW 3	/* intervals */
+
+/* Why a test with --converge ended */
+#define IPERF_CONVERGE_RUNNING 0
+#define IPERF_CONVERGE_CONVERGED 1
+#define IPERF_CONVERGE_MAX_DURATION 2	/* its -t ran out first */
+#define IPERF_CONVERGE_INTERRUPTED 3
+
+struct iperf_converge;
+
+struct iperf_converge_estimate
+{
+    int       intervals;		/* in the window so far */
+    double    bits_per_second;		/* their mean */
+    double    ci_bits_per_second;	/* half-width of its 95% confidence interval, 0 below 2 intervals */
+    double    relative_ci;		/* that over the mean */
+};
+
+/*
+ * A window of window intervals, at least IPERF_CONVERGE_MIN_WINDOW; the
+ * throughput has converged when the relative half-width of the confidence
+ * interval is at most tolerance.  Returns NULL when out of memory.
+ */
+struct iperf_converge *iperf_converge_new(int window, double tolerance);
+void iperf_converge_free(struct iperf_converge *cv);
+
+/* Forget every interval added */
+void iperf_converge_reset(struct iperf_converge *cv);
+
+/* Adds an interval's rate; returns 1 once the full window has converged */
+int iperf_converge_add(struct iperf_converge *cv, double bits_per_second);
+
+void iperf_converge_estimate(struct iperf_converge *cv, struct iperf_converge_estimate *estimate);
+
+/* Two-sided 95% critical value of Student's t with df degrees of freedom */
+double iperf_converge_t95(int df);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#ifndef __IPERF_SIM_H
+#define __IPERF_SIM_H
+
+#include <stdint.h>
+
+struct iperf_test;
+
+/*
+ * Simulation of a whole client/server test inside one process.  Both ends
+ * run on a virtual clock (iperf_time_virtual_set()) and their data streams
+ * go over an in-memory model of the path instead of sockets, so nothing
+ * waits for real time: a test of any duration takes only as long as the
+ * engine needs for its work, and the same tests over the same link give
+ * the same output byte for byte.
+ *
+ * The data streams are byte streams standing in for TCP.  Each direction
+ * has one bottleneck, shared by the streams going that way, which
+ * serializes each block at rate and delivers it delay later; the reader's
+ * acknowledgement takes delay again to come back.  A stream has at most
+ * window bytes sent but not yet acknowledged, which is what bounds it when
+ * the bottleneck does not.
+ *
+ * A rate of 0 asks for a null link instead, to measure the engine itself:
+ * the test runs on the real clock, and each pair of streams shares a ring
+ * of window bytes that blocks are copied into and out of, with no rate or
+ * delay.  Sending, receiving, the throttle, the counters and the stats are
+ * all the ones a real test runs, so the test's throughput is an upper
+ * bound on what one core can push through the engine.
+ */
+struct iperf_sim_link
+{
+    uint64_t  rate;		/* bits per second, 0 for a null link */
+    uint32_t  delay_usecs;	/* one way; not on a null link */
+    uint32_t  window;		/* bytes per stream; 0 for the bandwidth-delay product, at least 4 blocks */
+};
+
+/*
+ * Runs client, set up as for iperf_run_client() but for its host and port,
+ * against server, set up as for iperf_run_server().  The control messages
+ * go over a socketpair and the test is the one iperf would run, timers,
+ * omitting, rate limits and reports included; each end writes its report
+ * to its own outfile.  CPU use is reported as 0, as it would be the host's,
+ * except on a null link, where both ends report the whole process's.
+ * Returns 0, or -1 with i_errno set; either way both tests are then freed
+ * with iperf_free_test().  The calling thread is back on the system clock
+ * when it returns.
+ */
+int iperf_sim_run(struct iperf_test *client, struct iperf_test *server,
+                  const struct iperf_sim_link *link);
+
+#endif
@@ -36,6 +36,10 @@ int readentropy(void *out, size_t outsize);
 
 void fill_with_repeating_pattern(void *out, size_t outsize);
 
+int fill_with_random(void *out, size_t outsize);
+
+long get_max_rss_kb(void);
+
 void make_cookie(char *);
 
 int is_closed(int);
@@ -46,7 +50,8 @@ int timeval_equals(struct timeval *tv0, struct timeval *tv1);
 
 double timeval_diff(struct timeval *tv0, struct timeval *tv1);
 
-void cpu_util(double pcpu[3]);
+struct cpu_util_state;
+void cpu_util(struct cpu_util_state *state, double pcpu[3]);
 
 const char* get_system_info(void);
 
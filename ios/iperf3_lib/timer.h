@@ -54,6 +54,11 @@ extern TimerClientData JunkClientData;	/* for use when you don't care */
 */
 typedef void TimerProc( TimerClientData client_data, struct iperf_time* nowP );
 
+/* A queue of pending timers.  Each iperf test owns one, so that tests in
+** different threads never share timer state.
+*/
+typedef struct TimerQueueStruct TimerQueue;
+
 /* The Timer struct. */
 typedef struct TimerStruct
 {
@@ -62,11 +67,27 @@ typedef struct TimerStruct
     int64_t usecs;
     int periodic;
     struct iperf_time time;
-    struct TimerStruct* prev;
-    struct TimerStruct* next;
-    int hash;
+    TimerQueue* queue;		/* queue the timer belongs to */
+    struct TimerStruct* next;	/* free list link */
+    int heap_index;		/* slot in the queue's heap, -1 if not pending */
+    unsigned long serial;	/* when it was last scheduled, for ties */
 } Timer;
 
+/* Create and free a timer queue.  Freeing a queue cancels its timers. */
+extern TimerQueue* tmr_queue_new( void );
+extern void tmr_queue_free( TimerQueue* q );
+
+/* The _q variants below work on the given queue, the others on a default
+** queue shared by the whole process.  tmr_reset() and tmr_cancel() work on
+** the queue the timer was created in.
+*/
+extern Timer* tmr_create_q(
+    TimerQueue* q, struct iperf_time* nowP, TimerProc* timer_proc,
+    TimerClientData client_data, int64_t usecs, int periodic );
+extern struct timeval* tmr_timeout_q( TimerQueue* q, struct iperf_time* nowP );
+extern void tmr_run_q( TimerQueue* q, struct iperf_time* nowP );
+extern void tmr_destroy_q( TimerQueue* q );
+
 /* Set up a timer, either periodic or one-shot. Returns (Timer*) 0 on errors. */
 extern Timer* tmr_create(
     struct iperf_time* nowP, TimerProc* timer_proc, TimerClientData client_data,
@@ -0,0 +1,485 @@
+import 'dart:async';
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:isolate';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+// dart:ffi binding to the native session bridge (native/src/iperf3_ffi.h),
+// so tests run without a platform channel hop.  Progress records are read
+// straight out of native memory when a native port says they are there.
+
+// Must match IPERF3_FFI_ABI_VERSION and the structs in iperf3_ffi.h
+const int _abiVersion = 4;
+const int _finished = -1;
+const int _flagReverse = 0x1;
+const int _flagUdp = 0x2;
+const int _flagIncludeJson = 0x4;
+const int _flagMicroburstBuckets = 0x8;
+const int _flagRamp = 0x10;
+// Iperf3ConvergeStop, as iperf's JSON names them
+const List<String> _convergeStops = ['off', 'converged', 'max_duration', 'interrupted'];
+// Iperf3RampStop, likewise
+const List<String> _rampStops = ['off', 'saturated', 'cpu', 'max_streams', 'ended'];
+
+final class Iperf3FfiProgress extends Struct {
+  @Int64()
+  external int timestampNs;
+  @Int64()
+  external int interval;
+  @Double()
+  external double start;
+  @Double()
+  external double end;
+  @Int64()
+  external int omitted;
+  @Int64()
+  external int streamCount;
+  @Int64()
+  external int bytes;
+  @Double()
+  external double bitsPerSecond;
+  @Int64()
+  external int retransmits;
+  @Int64()
+  external int cwnd;
+  @Double()
+  external double rtt;
+  @Double()
+  external double rttVar;
+  @Int64()
+  external int packets;
+  @Int64()
+  external int lostPackets;
+  @Int64()
+  external int outOfOrder;
+  @Double()
+  external double jitter;
+  @Int64()
+  external int reverseBytes;
+  @Double()
+  external double reverseBitsPerSecond;
+  @Double()
+  external double peakBitsPerSecond;
+  @Double()
+  external double burstCv;
+  @Int64()
+  external int stalls;
+  @Int64()
+  external int stallMs;
+  @Int64()
+  external int longestStallMs;
+}
+
+final class Iperf3FfiResult extends Struct {
+  @Int64()
+  external int success;
+  @Int64()
+  external int errorCode;
+  external Pointer<Utf8> errorMessage;
+  @Double()
+  external double sentBitsPerSecond;
+  @Double()
+  external double receivedBitsPerSecond;
+  @Int64()
+  external int sentBytes;
+  @Int64()
+  external int receivedBytes;
+  @Double()
+  external double seconds;
+  @Double()
+  external double rtt;
+  @Double()
+  external double rttMin;
+  @Double()
+  external double rttMax;
+  @Int64()
+  external int retransmits;
+  @Double()
+  external double jitter;
+  @Int64()
+  external int packets;
+  @Int64()
+  external int lostPackets;
+  @Double()
+  external double lostPercent;
+  @Double()
+  external double cpuLocal;
+  @Double()
+  external double cpuRemote;
+  external Pointer<Uint8> json;
+  @Int64()
+  external int jsonLength;
+  @Int64()
+  external int progressDelivered;
+  @Int64()
+  external int progressCoalesced;
+  @Int64()
+  external int progressDropped;
+  @Double()
+  external double peakBitsPerSecond;
+  @Double()
+  external double burstCv;
+  @Int64()
+  external int stalls;
+  @Int64()
+  external int stallMs;
+  @Int64()
+  external int longestStallMs;
+  external Pointer<Uint64> microburstBuckets;
+  @Int64()
+  external int microburstBucketCount;
+  @Int64()
+  external int microburstFirstBucket;
+  @Int64()
+  external int convergeStop;
+  @Double()
+  external double convergeRelativeCi;
+  @Int64()
+  external int rampStop;
+  @Int64()
+  external int rampSaturationStreams;
+  external Pointer<Double> rampBitsPerSecond;
+  @Int64()
+  external int rampStepCount;
+}
+
+final class _Handle extends Opaque {}
+
+// iperf3_ffi_create_client(), which grows with the client options; the
+// lookup and the field share these so they cannot drift apart
+typedef _CreateClientNative = Pointer<_Handle> Function(
+    Pointer<Utf8>, Int32, Int32, Int32, Int64, Int32, Int32, Int32, Double, Double);
+typedef _CreateClientDart = Pointer<_Handle> Function(
+    Pointer<Utf8>, int, int, int, int, int, int, int, double, double);
+
+class _Bindings {
+  _Bindings(DynamicLibrary lib)
+      : abiVersion = lib.lookupFunction<Int32 Function(), int Function()>(
+            'iperf3_ffi_abi_version', isLeaf: true),
+        version = lib.lookupFunction<Pointer<Utf8> Function(), Pointer<Utf8> Function()>(
+            'iperf3_ffi_version', isLeaf: true),
+        nowNs = lib.lookupFunction<Int64 Function(), int Function()>(
+            'iperf3_ffi_now_ns', isLeaf: true),
+        createClient = lib.lookupFunction<_CreateClientNative, _CreateClientDart>(
+            'iperf3_ffi_create_client'),
+        createServer = lib.lookupFunction<
+            Pointer<_Handle> Function(Int32, Int32),
+            Pointer<_Handle> Function(int, int)>('iperf3_ffi_create_server'),
+        start = lib.lookupFunction<
+            Int32 Function(Pointer<_Handle>, Int64, Pointer<Void>, Int32),
+            int Function(Pointer<_Handle>, int, Pointer<Void>, int)>('iperf3_ffi_start'),
+        readProgress = lib.lookupFunction<
+            Int32 Function(Pointer<_Handle>, Pointer<Iperf3FfiProgress>, Int32),
+            int Function(Pointer<_Handle>, Pointer<Iperf3FfiProgress>, int)>(
+            'iperf3_ffi_read_progress', isLeaf: true),
+        takeResult = lib.lookupFunction<
+            Pointer<Iperf3FfiResult> Function(Pointer<_Handle>),
+            Pointer<Iperf3FfiResult> Function(Pointer<_Handle>)>('iperf3_ffi_take_result'),
+        freeResult = lib.lookupFunction<
+            Void Function(Pointer<Iperf3FfiResult>),
+            void Function(Pointer<Iperf3FfiResult>)>('iperf3_ffi_free_result'),
+        cancel = lib.lookupFunction<
+            Void Function(Pointer<_Handle>),
+            void Function(Pointer<_Handle>)>('iperf3_ffi_cancel'),
+        free = lib.lookupFunction<
+            Void Function(Pointer<_Handle>),
+            void Function(Pointer<_Handle>)>('iperf3_ffi_free');
+
+  final int Function() abiVersion;
+  final Pointer<Utf8> Function() version;
+  final int Function() nowNs;
+  final _CreateClientDart createClient;
+  final Pointer<_Handle> Function(int, int) createServer;
+  final int Function(Pointer<_Handle>, int, Pointer<Void>, int) start;
+  final int Function(Pointer<_Handle>, Pointer<Iperf3FfiProgress>, int) readProgress;
+  final Pointer<Iperf3FfiResult> Function(Pointer<_Handle>) takeResult;
+  final void Function(Pointer<Iperf3FfiResult>) freeResult;
+  final void Function(Pointer<_Handle>) cancel;
+  final void Function(Pointer<_Handle>) free;
+}
+
+class Iperf3Ffi {
+  static _Bindings? _bindings;
+  static bool _loaded = false;
+
+  // The library is built into the app on iOS and shipped as
+  // libiperf3_ffi.so on Android; null when it is missing or out of date
+  static _Bindings? get _lib {
+    if (!_loaded) {
+      _loaded = true;
+      try {
+        final lib = Platform.isIOS || Platform.isMacOS
+            ? DynamicLibrary.process()
+            : DynamicLibrary.open('libiperf3_ffi.so');
+        final bindings = _Bindings(lib);
+        if (bindings.abiVersion() == _abiVersion) {
+          _bindings = bindings;
+        }
+      } on ArgumentError {
+        _bindings = null;
+      }
+    }
+    return _bindings;
+  }
+
+  static bool get isAvailable => _lib != null;
+
+  static String get version => _lib!.version().toDartString();
+
+  // Monotonic clock of the progress 'timestampNs' values, on both paths
+  static int nowNs() => _lib!.nowNs();
+}
+
+// One client or server test driven over dart:ffi.  Progress maps have the
+// keys of Iperf3Service.getProgressStream(); the result map those of
+// Iperf3Service.runClient().
+class Iperf3FfiTest {
+  Iperf3FfiTest._(this._handle);
+
+  factory Iperf3FfiTest.client({
+    required String serverHost,
+    int port = 5201,
+    int durationSeconds = 10,
+    int parallelStreams = 1,
+    bool reverse = false,
+    bool useUdp = false,
+    int? bandwidthMbps,
+    bool includeJson = false,
+    int microburstStallMs = 0,  // 1 ms buckets, counting stalls this long; 0 = off
+    bool keepMicroburstBuckets = false,  // return them as 'microburstBuckets'
+    // End once the last this many seconds of intervals agree to within
+    // convergeTolerance (a fraction, 0 for 5%) at 95% confidence;
+    // durationSeconds is then the most it runs.  0 = off.
+    int convergeMinSeconds = 0,
+    double convergeTolerance = 0.0,
+    // Send on one stream at first and add one every two intervals while
+    // each adds at least rampGain (a fraction, 0 for 10%), up to
+    // parallelStreams (8 if that is 1).  Not with reverse.
+    bool rampStreams = false,
+    double rampGain = 0.0,
+  }) {
+    final lib = Iperf3Ffi._lib;
+    if (lib == null) {
+      throw UnsupportedError('iperf3 FFI library is not available');
+    }
+    final host = serverHost.toNativeUtf8();
+    try {
+      final flags = (reverse ? _flagReverse : 0) |
+          (useUdp ? _flagUdp : 0) |
+          (includeJson ? _flagIncludeJson : 0) |
+          (keepMicroburstBuckets ? _flagMicroburstBuckets : 0) |
+          (rampStreams ? _flagRamp : 0);
+      final handle = lib.createClient(host, port, durationSeconds, parallelStreams,
+          bandwidthMbps != null ? bandwidthMbps * 1000000 : 0, flags, microburstStallMs,
+          convergeMinSeconds, convergeTolerance, rampGain);
+      return Iperf3FfiTest._(_checked(handle));
+    } finally {
+      malloc.free(host);
+    }
+  }
+
+  factory Iperf3FfiTest.server({int port = 5201, bool useUdp = false}) {
+    final lib = Iperf3Ffi._lib;
+    if (lib == null) {
+      throw UnsupportedError('iperf3 FFI library is not available');
+    }
+    return Iperf3FfiTest._(_checked(lib.createServer(port, useUdp ? 1 : 0)));
+  }
+
+  static Pointer<_Handle> _checked(Pointer<_Handle> handle) {
+    if (handle == nullptr) {
+      throw StateError('Out of memory creating iperf3 test');
+    }
+    return handle;
+  }
+
+  static const int _batch = 16;
+
+  Pointer<_Handle>? _handle;
+  ReceivePort? _port;
+  final Pointer<Iperf3FfiProgress> _records = calloc<Iperf3FfiProgress>(_batch);
+  final StreamController<Map<String, dynamic>> _progress =
+      StreamController<Map<String, dynamic>>.broadcast();
+  final Completer<Map<String, dynamic>> _result = Completer<Map<String, dynamic>>();
+
+  Stream<Map<String, dynamic>> get progress => _progress.stream;
+
+  // Completes when the test is over; the native side is released by then
+  Future<Map<String, dynamic>> get result => _result.future;
+
+  // At most framesPerSecond progress events a second, 0 for every interval
+  void start({int framesPerSecond = 30}) {
+    final handle = _handle;
+    if (handle == null || _port != null) {
+      throw StateError('iperf3 test already started or released');
+    }
+    final port = ReceivePort('iperf3_ffi');
+    _port = port;
+    port.listen(_onMessage);
+    final status = Iperf3Ffi._lib!.start(handle, port.sendPort.nativePort,
+        NativeApi.postCObject.cast<Void>(), framesPerSecond);
+    if (status != 0) {
+      _finish({'success': false, 'error': 'Failed to start iperf3 test'});
+    }
+  }
+
+  void cancel() {
+    final handle = _handle;
+    if (handle != null) {
+      Iperf3Ffi._lib!.cancel(handle);
+    }
+  }
+
+  void _onMessage(dynamic message) {
+    final handle = _handle;
+    if (handle == null) {
+      return;
+    }
+    _drain(handle);
+    if (message == _finished) {
+      _collect(handle);
+    }
+  }
+
+  void _drain(Pointer<_Handle> handle) {
+    final lib = Iperf3Ffi._lib!;
+    int count;
+    do {
+      count = lib.readProgress(handle, _records, _batch);
+      for (var i = 0; i < count; i++) {
+        _progress.add(_progressData(_records[i]));
+      }
+    } while (count == _batch);
+  }
+
+  Future<void> _collect(Pointer<_Handle> handle) async {
+    final lib = Iperf3Ffi._lib!;
+    final result = lib.takeResult(handle);
+    if (result == nullptr) {
+      _finish({'success': false, 'error': 'iperf3 test has no result'});
+      return;
+    }
+    try {
+      final map = _resultData(result.ref);
+      final json = result.ref.json;
+      final length = result.ref.jsonLength;
+      if (json != nullptr && length > 0) {
+        // Decoded in place from native memory, off the UI isolate
+        final address = json.address;
+        map['json'] = await Isolate.run(() => utf8.decoder
+            .fuse(const JsonDecoder())
+            .convert(Pointer<Uint8>.fromAddress(address).asTypedList(length)));
+      }
+      _finish(map);
+    } finally {
+      lib.freeResult(result);
+    }
+  }
+
+  void _finish(Map<String, dynamic> result) {
+    if (_result.isCompleted) {
+      return;
+    }
+    final handle = _handle;
+    _handle = null;
+    if (handle != null) {
+      Iperf3Ffi._lib!.free(handle);
+    }
+    calloc.free(_records);
+    _port?.close();
+    _progress.close();
+    _result.complete(result);
+  }
+
+  static Map<String, dynamic> _progressData(Iperf3FfiProgress record) {
+    final progressData = <String, dynamic>{
+      'interval': record.interval,
+      'bytesTransferred': record.bytes,
+      'bitsPerSecond': record.bitsPerSecond,
+      'mbps': record.bitsPerSecond / 1000000.0,
+      'timestampNs': record.timestampNs,
+    };
+    if (record.rtt > 0) {
+      progressData['rtt'] = record.rtt;
+    }
+    if (record.jitter > 0) {
+      progressData['jitter'] = record.jitter;
+      progressData['lostPackets'] = record.lostPackets;
+    }
+    if (record.peakBitsPerSecond > 0) {
+      progressData['peakBitsPerSecond'] = record.peakBitsPerSecond;
+      progressData['burstCv'] = record.burstCv;
+      progressData['stalls'] = record.stalls;
+      progressData['stallMs'] = record.stallMs;
+      progressData['longestStallMs'] = record.longestStallMs;
+    }
+    return progressData;
+  }
+
+  static Map<String, dynamic> _resultData(Iperf3FfiResult result) {
+    if (result.success == 0) {
+      return {
+        'success': false,
+        'error': result.errorMessage == nullptr
+            ? 'Unknown error'
+            : result.errorMessage.toDartString(),
+        'errorCode': result.errorCode,
+      };
+    }
+    final resultData = <String, dynamic>{
+      'success': true,
+      'sentBitsPerSecond': result.sentBitsPerSecond,
+      'receivedBitsPerSecond': result.receivedBitsPerSecond,
+      'sendMbps': result.sentBitsPerSecond / 1000000.0,
+      'receiveMbps': result.receivedBitsPerSecond / 1000000.0,
+      'sentBytes': result.sentBytes,
+      'receivedBytes': result.receivedBytes,
+      'seconds': result.seconds,
+      'retransmits': result.retransmits,
+      'cpuLocal': result.cpuLocal,
+      'cpuRemote': result.cpuRemote,
+      'progressDelivered': result.progressDelivered,
+      'progressCoalesced': result.progressCoalesced,
+      'progressDropped': result.progressDropped,
+    };
+    if (result.rtt > 0) {
+      resultData['rtt'] = result.rtt;
+      resultData['rttMin'] = result.rttMin;
+      resultData['rttMax'] = result.rttMax;
+    }
+    if (result.packets > 0) {
+      resultData['jitter'] = result.jitter;
+      resultData['totalPackets'] = result.packets;
+      resultData['lostPackets'] = result.lostPackets;
+      resultData['lostPercent'] = result.lostPercent;
+    }
+    if (result.peakBitsPerSecond > 0) {
+      resultData['peakBitsPerSecond'] = result.peakBitsPerSecond;
+      resultData['burstCv'] = result.burstCv;
+      resultData['stalls'] = result.stalls;
+      resultData['stallMs'] = result.stallMs;
+      resultData['longestStallMs'] = result.longestStallMs;
+    }
+    if (result.microburstBuckets != nullptr && result.microburstBucketCount > 0) {
+      // Copied, since the native result is freed once this map is built
+      resultData['microburstBuckets'] = Int64List.fromList(
+          result.microburstBuckets.cast<Int64>().asTypedList(result.microburstBucketCount));
+      resultData['microburstFirstBucket'] = result.microburstFirstBucket;
+    }
+    if (result.convergeStop > 0 && result.convergeStop < _convergeStops.length) {
+      resultData['convergeStop'] = _convergeStops[result.convergeStop];
+      resultData['convergeRelativeCi'] = result.convergeRelativeCi;
+    }
+    if (result.rampStop > 0 && result.rampStop < _rampStops.length) {
+      resultData['rampStop'] = _rampStops[result.rampStop];
+      resultData['rampSaturationStreams'] = result.rampSaturationStreams;
+      resultData['rampBitsPerSecond'] = result.rampBitsPerSecond != nullptr
+          ? Float64List.fromList(result.rampBitsPerSecond.asTypedList(result.rampStepCount))
+          : Float64List(0);
+    }
+    return resultData;
+  }
+}
@@ -1,108 +1,22 @@
 import 'dart:async';
 import 'dart:convert';
 import 'dart:developer' as developer;
+import 'dart:isolate';
+import 'dart:typed_data';
 import 'package:flutter/services.dart';
 
+import 'iperf3_ffi.dart';
+
 class Iperf3Service {
   static const MethodChannel _channel = MethodChannel('com.example.hello_world_app/iperf3');
   static const EventChannel _progressChannel = EventChannel('com.example.hello_world_app/iperf3_progress');
 
   Stream<Map<String, dynamic>>? _progressStream;
 
-  // Parse iperf3 JSON output to extract results
-  Map<String, dynamic> _parseIperf3Json(String jsonOutput) {
-    try {
-      final json = jsonDecode(jsonOutput);
-      final results = <String, dynamic>{};
-
-      // Extract end summary data
-      if (json['end'] != null) {
-        final end = json['end'];
-
-        // Check if this is TCP or UDP test
-        // UDP has jitter_ms in sum, TCP doesn't
-        final isUdp = end['sum'] != null && end['sum']['jitter_ms'] != null;
-        final isTcp = !isUdp;
-
-        if (isTcp) {
-          // TCP: Has separate sum_sent and sum_received
-          developer.log('Parsing TCP test results', name: 'Iperf3Service');
-
-          // Get sent data (upload speed)
-          if (end['sum_sent'] != null) {
-            final sumSent = end['sum_sent'];
-            results['sentBitsPerSecond'] = sumSent['bits_per_second'] ?? 0.0;
-            results['sendMbps'] = (sumSent['bits_per_second'] ?? 0.0) / 1000000.0;
-            results['sentBytes'] = sumSent['bytes'] ?? 0;
-          }
-
-          // Get received data (download speed)
-          if (end['sum_received'] != null) {
-            final sumReceived = end['sum_received'];
-            results['receivedBitsPerSecond'] = sumReceived['bits_per_second'] ?? 0.0;
-            results['receiveMbps'] = (sumReceived['bits_per_second'] ?? 0.0) / 1000000.0;
-            results['receivedBytes'] = sumReceived['bytes'] ?? 0;
-          }
-
-          // Get TCP-specific data (RTT)
-          if (end['streams'] != null && end['streams'] is List && (end['streams'] as List).isNotEmpty) {
-            final firstStream = end['streams'][0];
-            if (firstStream['sender'] != null && firstStream['sender']['mean_rtt'] != null) {
-              results['rtt'] = firstStream['sender']['mean_rtt'] / 1000.0; // Convert microseconds to milliseconds
-            }
-          }
-        } else {
-          // UDP: Has sum_sent (and sometimes sum_received in bidirectional mode)
-          developer.log('Parsing UDP test results', name: 'Iperf3Service');
-
-          // Get sent data (upload speed) - UDP always has sum_sent
-          if (end['sum_sent'] != null) {
-            final sumSent = end['sum_sent'];
-            results['sentBitsPerSecond'] = sumSent['bits_per_second'] ?? 0.0;
-            results['sendMbps'] = (sumSent['bits_per_second'] ?? 0.0) / 1000000.0;
-            results['sentBytes'] = sumSent['bytes'] ?? 0;
-          }
-
-          // Get received data (download speed) - UDP only has this in reverse mode
-          if (end['sum_received'] != null) {
-            final sumReceived = end['sum_received'];
-            results['receivedBitsPerSecond'] = sumReceived['bits_per_second'] ?? 0.0;
-            results['receiveMbps'] = (sumReceived['bits_per_second'] ?? 0.0) / 1000000.0;
-            results['receivedBytes'] = sumReceived['bytes'] ?? 0;
-          } else {
-            // No sum_received means one-way UDP test
-            results['receivedBitsPerSecond'] = 0.0;
-            results['receiveMbps'] = 0.0;
-            results['receivedBytes'] = 0;
-          }
-
-          // UDP-specific metrics (jitter, packet loss) from sum
-          if (end['sum'] != null) {
-            final sum = end['sum'];
-            if (sum['jitter_ms'] != null) {
-              results['jitter'] = sum['jitter_ms'];
-            }
-            if (sum['lost_packets'] != null) {
-              results['lostPackets'] = sum['lost_packets'];
-            }
-            if (sum['packets'] != null) {
-              results['totalPackets'] = sum['packets'];
-            }
-            if (sum['lost_percent'] != null) {
-              results['lostPercent'] = sum['lost_percent'];
-            }
-          }
-        }
-      }
-
-      developer.log('Parsed JSON results: sendMbps=${results['sendMbps']}, receiveMbps=${results['receiveMbps']}, jitter=${results['jitter']}',
-                   name: 'Iperf3Service');
-
-      return results;
-    } catch (e) {
-      developer.log('Failed to parse JSON: $e', name: 'Iperf3Service', error: e);
-      return {};
-    }
+  // Decode the UTF-8 JSON bytes off the UI isolate; large reports with many
+  // intervals would otherwise stall a frame
+  static Future<dynamic> _decodeJsonBytes(Uint8List bytes) {
+    return Isolate.run(() => utf8.decoder.fuse(json.decoder).convert(bytes));
   }
 
   // Run iperf3 client test
@@ -114,6 +28,26 @@ class Iperf3Service {
     bool reverse = false,
     bool useUdp = false,
     int? bandwidthMbps,  // Target bandwidth in Mbps (null = use iperf3 default)
+    bool includeJson = false,  // Also return iperf's full report, decoded, as 'json'
+    // Record throughput in 1 ms buckets and count gaps this long as stalls
+    // (Android); 0 = off
+    int microburstStallMs = 0,
+    bool keepMicroburstBuckets = false,  // Also return them as 'microburstBuckets'
+    // End once the last this many seconds of intervals agree to within
+    // convergeTolerance (a fraction, 0 for 5%) at 95% confidence, with
+    // durationSeconds as the limit (Android).  The result then says why in
+    // 'convergeStop' ('converged', 'max_duration' or 'interrupted') and
+    // how closely in 'convergeRelativeCi'.  0 = off.
+    int convergeMinSeconds = 0,
+    double convergeTolerance = 0.0,
+    // Send on one stream at first and add one every two intervals while each
+    // adds at least rampGain (a fraction, 0 for 10%), up to parallelStreams
+    // (8 if that is 1); not with reverse (Android).  The result then has the
+    // throughput per stream count in 'rampBitsPerSecond', the most streams
+    // still worth adding in 'rampSaturationStreams' and why it stopped in
+    // 'rampStop' ('saturated', 'cpu', 'max_streams' or 'ended').
+    bool rampStreams = false,
+    double rampGain = 0.0,
   }) async {
     try {
       developer.log('=== Flutter: Starting iperf3 client test ===', name: 'Iperf3Service');
@@ -135,6 +69,13 @@ class Iperf3Service {
         'reverse': reverse,
         'useUdp': useUdp,
         'bandwidthBps': bandwidthBps,
+        'includeJson': includeJson,
+        'microburstStallMs': microburstStallMs,
+        'keepMicroburstBuckets': keepMicroburstBuckets,
+        'convergeMinSeconds': convergeMinSeconds,
+        'convergeTolerance': convergeTolerance,
+        'rampStreams': rampStreams,
+        'rampGain': rampGain,
       });
 
       developer.log('Native method returned', name: 'Iperf3Service');
@@ -143,18 +84,13 @@ class Iperf3Service {
       if (resultMap['success'] == true) {
         developer.log('✓ Test completed successfully', name: 'Iperf3Service');
 
-        // Parse JSON output to extract actual results
-        if (resultMap['jsonOutput'] != null && resultMap['jsonOutput'] is String) {
-          developer.log('Parsing JSON output...', name: 'Iperf3Service');
-          final parsedResults = _parseIperf3Json(resultMap['jsonOutput'] as String);
-
-          // Merge parsed results into the result map (overwriting the 0 values from native)
-          resultMap.addAll(parsedResults);
-
-          developer.log('Final results: sendMbps=${resultMap['sendMbps']}, receiveMbps=${resultMap['receiveMbps']}',
-                       name: 'Iperf3Service');
-        } else {
-          developer.log('⚠️ No JSON output to parse', name: 'Iperf3Service');
+        // The summary is computed natively; the full report only comes
+        // along when asked for
+        developer.log('Results: sendMbps=${resultMap['sendMbps']}, receiveMbps=${resultMap['receiveMbps']}',
+                     name: 'Iperf3Service');
+        final jsonBytes = resultMap.remove('jsonBytes');
+        if (jsonBytes is Uint8List) {
+          resultMap['json'] = await _decodeJsonBytes(jsonBytes);
         }
       } else {
         developer.log('✗ Test failed: ${resultMap['error']}', name: 'Iperf3Service');
@@ -183,10 +119,12 @@ class Iperf3Service {
     }
   }
 
-  // Stop iperf3 server
-  Future<bool> stopServer() async {
+  // Stop iperf3 server on [port], or every running server when it is null
+  Future<bool> stopServer({int? port}) async {
     try {
-      final bool result = await _channel.invokeMethod('stopServer');
+      final bool result = await _channel.invokeMethod('stopServer', {
+        if (port != null) 'port': port,
+      });
       return result;
     } on PlatformException catch (e) {
       throw Exception('Failed to stop iperf3 server: ${e.message}');
@@ -203,6 +141,163 @@ class Iperf3Service {
     }
   }
 
+  // Measures what this device's own network stack can move, with a server
+  // and clients inside the app over loopback: the best TCP and UDP
+  // throughput, CPU percent per Gbit/s and packets per second, and every
+  // run under 'runs'.  The result is cached per device and OS build and
+  // comes back with 'cached' set; [force] runs it again, and [cachedOnly]
+  // returns without success instead of running it.  A fresh run takes about
+  // six times [durationSeconds].
+  Future<Map<String, dynamic>> selfTest({
+    bool force = false,
+    bool cachedOnly = false,
+    int durationSeconds = 3,
+  }) async {
+    try {
+      final Map<dynamic, dynamic>? result = await _channel.invokeMethod('selfTest', {
+        'force': force,
+        'cachedOnly': cachedOnly,
+        'duration': durationSeconds,
+      });
+      return Map<String, dynamic>.from(result ?? const {});
+    } on PlatformException catch (e) {
+      throw Exception('Failed to run iperf3 self-test: ${e.message}');
+    }
+  }
+
+  Future<void> cancelSelfTest() async {
+    try {
+      await _channel.invokeMethod('cancelSelfTest');
+    } on PlatformException catch (e) {
+      throw Exception('Failed to cancel iperf3 self-test: ${e.message}');
+    }
+  }
+
+  // Searches for the highest UDP rate, up to maxBandwidthMbps, that loses
+  // at most lossTolerancePercent of its datagrams, after RFC 2544's
+  // throughput test: trials of trialSeconds at rates picked by binary
+  // search, until the highest passing and lowest failing rates are within
+  // 1% of the most.  This runs at each of blockSizes in turn (iperf's
+  // default when empty).  Returns the highest passing rate per block size
+  // in 'blockResults' and every trial, with its offered and received rate,
+  // loss and jitter, in 'trials'.
+  Future<Map<String, dynamic>> udpSearch({
+    required String serverHost,
+    int port = 5201,
+    int trialSeconds = 2,
+    bool reverse = false,
+    int maxBandwidthMbps = 1000,
+    double lossTolerancePercent = 0.0,
+    List<int> blockSizes = const [],
+  }) async {
+    try {
+      final Map<dynamic, dynamic>? result = await _channel.invokeMethod('udpSearch', {
+        'host': serverHost,
+        'port': port,
+        'trialSeconds': trialSeconds,
+        'reverse': reverse,
+        'maxBandwidthBps': maxBandwidthMbps * 1000000,
+        'lossTolerance': lossTolerancePercent,
+        'blockSizes': blockSizes,
+      });
+      return Map<String, dynamic>.from(result ?? const {});
+    } on PlatformException catch (e) {
+      throw Exception('Failed to run UDP search: ${e.message}');
+    }
+  }
+
+  Future<void> cancelUdpSearch() async {
+    try {
+      await _channel.invokeMethod('cancelUdpSearch');
+    } on PlatformException catch (e) {
+      throw Exception('Failed to cancel UDP search: ${e.message}');
+    }
+  }
+
+  // Measures native-to-Kotlin progress delivery per event (Android only).
+  // Events are paced at intervalMs, so this takes events * intervalMs.
+  Future<Map<String, dynamic>> benchmarkProgress({
+    int events = 1000,
+    int streams = 1,
+    int intervalMs = 10,
+  }) async {
+    try {
+      final Map<dynamic, dynamic>? stats = await _channel.invokeMethod('benchmarkProgress', {
+        'events': events,
+        'streams': streams,
+        'intervalMs': intervalMs,
+      });
+      return Map<String, dynamic>.from(stats ?? const {});
+    } on PlatformException catch (e) {
+      throw Exception('Failed to run progress benchmark: ${e.message}');
+    }
+  }
+
+  // Compares how long an interval takes from iperf's report to this isolate
+  // over dart:ffi and over the platform channel, against a loopback server.
+  // Returns mean, p50, p99 and max in microseconds for each path; the
+  // channel path is measured only where its progress carries timestampNs
+  // (Android).
+  Future<Map<String, dynamic>> measureProgressLatency({
+    int port = 5299,
+    int durationSeconds = 5,
+    int framesPerSecond = 30,
+  }) async {
+    if (!Iperf3Ffi.isAvailable) {
+      throw UnsupportedError('iperf3 FFI library is not available');
+    }
+    final server = Iperf3FfiTest.server(port: port);
+    server.start();
+    try {
+      final ffiLatencies = <int>[];
+      final client = Iperf3FfiTest.client(
+        serverHost: '127.0.0.1',
+        port: port,
+        durationSeconds: durationSeconds,
+      );
+      final subscription = client.progress.listen((progress) {
+        ffiLatencies.add(Iperf3Ffi.nowNs() - (progress['timestampNs'] as int));
+      });
+      client.start(framesPerSecond: framesPerSecond);
+      await client.result;
+      await subscription.cancel();
+
+      final channelLatencies = <int>[];
+      final channelSubscription = getProgressStream().listen((progress) {
+        final timestampNs = progress['timestampNs'];
+        if (timestampNs is int) {
+          channelLatencies.add(Iperf3Ffi.nowNs() - timestampNs);
+        }
+      });
+      await runClient(serverHost: '127.0.0.1', port: port, durationSeconds: durationSeconds);
+      await channelSubscription.cancel();
+
+      return {
+        'ffi': _latencyStats(ffiLatencies),
+        if (channelLatencies.isNotEmpty) 'channel': _latencyStats(channelLatencies),
+      };
+    } finally {
+      server.cancel();
+      await server.result;
+    }
+  }
+
+  static Map<String, dynamic> _latencyStats(List<int> latenciesNs) {
+    if (latenciesNs.isEmpty) {
+      return {'count': 0};
+    }
+    final sorted = List<int>.of(latenciesNs)..sort();
+    double us(int ns) => ns / 1000.0;
+    int at(double quantile) => sorted[((sorted.length - 1) * quantile).round()];
+    return {
+      'count': sorted.length,
+      'meanUs': us(sorted.reduce((a, b) => a + b)) / sorted.length,
+      'p50Us': us(at(0.50)),
+      'p99Us': us(at(0.99)),
+      'maxUs': us(sorted.last),
+    };
+  }
+
   Future<bool> cancelClient() async {
     try {
       final bool? wasRunning = await _channel.invokeMethod<bool>('cancelClient');
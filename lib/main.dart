@@ -50,6 +50,8 @@ class _Iperf3TestPageState extends State<Iperf3TestPage> {
   Map<String, dynamic>? _testResults;
   String? _errorMessage;
   Map<String, dynamic>? _currentProgress; // Single live update (replaces previous)
+  Map<String, dynamic>? _deviceCapacity; // Loopback self-test, shown next to results
+  bool _measuringCapacity = false;
   bool _hostFieldEdited = false;
   bool _settingHostProgrammatically = false;
 
@@ -63,6 +65,7 @@ class _Iperf3TestPageState extends State<Iperf3TestPage> {
     });
     _listenToProgress();
     _initializeDefaultGateway();
+    _loadDeviceCapacity(run: false);
   }
 
   void _listenToProgress() {
@@ -128,6 +131,29 @@ class _Iperf3TestPageState extends State<Iperf3TestPage> {
     }
   }
 
+  // Without [run], only a self-test already cached for this device is shown
+  Future<void> _loadDeviceCapacity({required bool run}) async {
+    setState(() {
+      _measuringCapacity = run;
+    });
+    try {
+      final result = await _iperf3Service.selfTest(cachedOnly: !run);
+      if (!mounted) return;
+      setState(() {
+        if (result['success'] == true) {
+          _deviceCapacity = result;
+        }
+        _measuringCapacity = false;
+      });
+    } catch (e) {
+      debugPrint('Device self-test failed: $e');
+      if (!mounted) return;
+      setState(() {
+        _measuringCapacity = false;
+      });
+    }
+  }
+
   Future<void> _runTest() async {
     if (!_formKey.currentState!.validate()) {
       return;
@@ -596,6 +622,23 @@ class _Iperf3TestPageState extends State<Iperf3TestPage> {
                           _buildResultRow('RTT (Latency)', '${_testResults!['rtt']?.toStringAsFixed(2)} ms'),
                         if (_testResults!.containsKey('jitter'))
                           _buildResultRow('Jitter', '${_testResults!['jitter']?.toStringAsFixed(2)} ms'),
+                        const Divider(),
+                        // What this device can move over loopback, for comparison
+                        if (_deviceCapacity != null) ...[
+                          _buildResultRow('Device TCP Capacity',
+                              '${(_deviceCapacity!['tcpBitsPerSecond'] / 1e6).toStringAsFixed(0)} Mbits/sec'),
+                          _buildResultRow('Device UDP Capacity',
+                              '${(_deviceCapacity!['udpBitsPerSecond'] / 1e6).toStringAsFixed(0)} Mbits/sec'),
+                        ] else
+                          TextButton.icon(
+                            onPressed: _measuringCapacity || _isRunning
+                                ? null
+                                : () => _loadDeviceCapacity(run: true),
+                            icon: const Icon(Icons.memory),
+                            label: Text(_measuringCapacity
+                                ? 'Measuring device capacity...'
+                                : 'Measure device capacity'),
+                          ),
                       ],
                     ),
                   ),
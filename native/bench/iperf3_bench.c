@@ -0,0 +1,417 @@
+#include "iperf3_bridge.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iperf_config.h"
+#include "iperf_api.h"
+#include "cjson.h"
+
+// Loopback end-to-end benchmark for Linux hosts.  Runs an in-process server
+// and client through the session bridge, the same code the apps run, over
+// a fixed matrix of tests, and compares each test against a stored baseline.
+//
+//   iperf3_bench [-t seconds] [-p port] [-c port] [-b baseline.json] [-w out.json] [-J] [-v] [pattern...]
+//
+// -b compares against a baseline and exits 1 if any test regressed beyond
+// the baseline's tolerances.  -w writes this run's figures as a baseline,
+// keeping the tolerances of the -b one.  Only tests whose name contains one
+// of the patterns are run.  The bridge logs to stderr; -v keeps that.
+//
+// -c sends the clients to another port than the server's, such as an
+// iperf3_impair relay in front of it:
+//
+//   iperf3_impair -l 15202 -r 127.0.0.1:15201 -d 10 -L 0.5 &
+//   iperf3_bench -c 15202 udp/
+//
+// Baselines belong to the machine they were recorded on: record one with -w
+// on the machine that runs the gate.
+
+#define BENCH_DEFAULT_PORT 15201
+#define BENCH_DEFAULT_SECONDS 3
+#define BENCH_UDP_RATE 1000000000L  // bits/s over all streams of a UDP test
+#define BENCH_CONNECT_TRIES 50      // the server may still be closing the last test
+#define BENCH_SETTLE_MS 250         // between tests, for the server to go back to listening
+
+// Default tolerances, as fractions of the baseline figure
+#define BENCH_TOLERANCE_THROUGHPUT 0.15
+#define BENCH_TOLERANCE_PPS 0.15
+#define BENCH_TOLERANCE_CPU 0.25
+
+typedef enum { MODE_FORWARD, MODE_REVERSE, MODE_BIDIR } BenchMode;
+
+static const char* mode_names[] = { "forward", "reverse", "bidir" };
+
+typedef struct {
+    bool udp;
+    int parallel;
+    int blockSize;
+    BenchMode mode;
+    char name[64];
+} BenchTest;
+
+typedef struct {
+    bool ok;
+    double bitsPerSecond;       // as received
+    double cpuPercent;          // the whole process, so client and server
+    double pps;                 // UDP datagrams, or TCP writes, per second
+    double lostPercent;
+    char error[128];
+} BenchResult;
+
+typedef struct {
+    double throughput;
+    double pps;
+    double cpu;
+} BenchTolerance;
+
+static FILE* out;
+static FILE* out_err;
+
+static const bool matrix_udp[] = { false, true };
+static const int matrix_parallel[] = { 1, 4, 16 };
+static const int matrix_tcp_blocks[] = { 16 * 1024, 128 * 1024 };
+static const int matrix_udp_blocks[] = { 512, 1460 };
+
+static int build_matrix(BenchTest* tests, int max) {
+    int count = 0;
+    for (size_t u = 0; u < sizeof(matrix_udp) / sizeof(matrix_udp[0]); u++) {
+        const int* blocks = matrix_udp[u] ? matrix_udp_blocks : matrix_tcp_blocks;
+        for (size_t p = 0; p < sizeof(matrix_parallel) / sizeof(matrix_parallel[0]); p++) {
+            for (int b = 0; b < 2; b++) {
+                for (int m = MODE_FORWARD; m <= MODE_BIDIR && count < max; m++) {
+                    BenchTest* t = &tests[count++];
+                    t->udp = matrix_udp[u];
+                    t->parallel = matrix_parallel[p];
+                    t->blockSize = blocks[b];
+                    t->mode = (BenchMode)m;
+                    if (t->blockSize % 1024 == 0) {
+                        snprintf(t->name, sizeof(t->name), "%s/P%d/%dK/%s", t->udp ? "udp" : "tcp",
+                                 t->parallel, t->blockSize / 1024, mode_names[m]);
+                    } else {
+                        snprintf(t->name, sizeof(t->name), "%s/P%d/%d/%s", t->udp ? "udp" : "tcp",
+                                 t->parallel, t->blockSize, mode_names[m]);
+                    }
+                }
+            }
+        }
+    }
+    return count;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_test(const BenchTest* t, int port, int seconds, BenchResult* out) {
+    Iperf3ClientConfig config = {
+        .host = "127.0.0.1",
+        .port = port,
+        .duration = seconds,
+        .parallel = t->parallel,
+        .reverse = t->mode == MODE_REVERSE,
+        .bidirectional = t->mode == MODE_BIDIR,
+        .useUdp = t->udp,
+        .bandwidth = t->udp ? BENCH_UDP_RATE / t->parallel : 0,
+        .blockSize = t->blockSize,
+    };
+    memset(out, 0, sizeof(*out));
+
+    for (int tries = 0; tries < BENCH_CONNECT_TRIES; tries++) {
+        Iperf3Session* session = iperf3_session_create_client(&config);
+        if (!session) {
+            snprintf(out->error, sizeof(out->error), "out of memory");
+            return;
+        }
+        double started = now_seconds();
+        Iperf3Result* result = iperf3_session_run(session);
+        // Turned away while the server was still busy with the last test
+        int code = result ? result->errorCode : 0;
+        bool retry = result && !result->success && now_seconds() - started < 1.0 &&
+            (code == IECONNECT || code == IEACCESSDENIED || code == IECTRLCLOSE ||
+             code == IERECVMESSAGE || code == IEINITSTREAM || code == IESTREAMCONNECT);
+        if (result && result->success) {
+            out->ok = true;
+            out->bitsPerSecond = result->receivedBitsPerSecond;
+            out->cpuPercent = result->cpuLocal;
+            out->lostPercent = result->lostPercent;
+            if (result->seconds > 0) {
+                out->pps = t->udp ? result->packets / result->seconds
+                                  : result->sentBytes / (double)t->blockSize / result->seconds;
+            }
+        } else if (!retry) {
+            snprintf(out->error, sizeof(out->error), "%s",
+                     result && result->errorMessage ? result->errorMessage : "no result");
+        }
+        iperf3_session_free(session);
+        if (!retry) {
+            return;
+        }
+        sleep_ms(100);
+    }
+    snprintf(out->error, sizeof(out->error), "server not reachable on port %d", port);
+}
+
+static double json_number(cJSON* object, const char* key, double fallback) {
+    cJSON* item = cJSON_GetObjectItem(object, key);
+    return item && cJSON_IsNumber(item) ? item->valuedouble : fallback;
+}
+
+static cJSON* read_json_file(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = size >= 0 ? (char*)malloc(size + 1) : NULL;
+    cJSON* json = NULL;
+    if (text && fread(text, 1, size, f) == (size_t)size) {
+        text[size] = '\0';
+        json = cJSON_Parse(text);
+    }
+    free(text);
+    fclose(f);
+    return json;
+}
+
+// CPU is compared per Gbit/s received, so a faster run may use more of it
+static double cpu_cost(double cpuPercent, double bitsPerSecond) {
+    return bitsPerSecond > 0 ? cpuPercent / (bitsPerSecond / 1e9) : 0;
+}
+
+// Appends what regressed against base to why; returns true if anything did
+static bool compare(const BenchResult* r, cJSON* base, const BenchTolerance* tol, char* why, size_t size) {
+    double bps = json_number(base, "bits_per_second", 0);
+    double pps = json_number(base, "pps", 0);
+    double cost = cpu_cost(json_number(base, "cpu_percent", 0), bps);
+    bool regressed = false;
+    why[0] = '\0';
+
+    if (bps > 0 && r->bitsPerSecond < bps * (1 - tol->throughput)) {
+        size_t len = strlen(why);
+        snprintf(why + len, size - len, " throughput %+.1f%%", 100 * (r->bitsPerSecond / bps - 1));
+        regressed = true;
+    }
+    if (pps > 0 && r->pps < pps * (1 - tol->pps)) {
+        size_t len = strlen(why);
+        snprintf(why + len, size - len, " pps %+.1f%%", 100 * (r->pps / pps - 1));
+        regressed = true;
+    }
+    double now = cpu_cost(r->cpuPercent, r->bitsPerSecond);
+    if (cost > 0 && now > cost * (1 + tol->cpu)) {
+        size_t len = strlen(why);
+        snprintf(why + len, size - len, " cpu/Gbps %+.1f%%", 100 * (now / cost - 1));
+        regressed = true;
+    }
+    return regressed;
+}
+
+static bool selected(const char* name, int count, char** patterns) {
+    if (count == 0) {
+        return true;
+    }
+    for (int i = 0; i < count; i++) {
+        if (strstr(name, patterns[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void bench_usage(void) {
+    fprintf(stderr, "usage: iperf3_bench [-t seconds] [-p port] [-c port] [-b baseline.json] [-w out.json] [-J] [-v] [pattern...]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    int seconds = BENCH_DEFAULT_SECONDS;
+    int port = BENCH_DEFAULT_PORT;
+    int client_port = 0;
+    const char* baseline_path = NULL;
+    const char* write_path = NULL;
+    bool json_output = false, verbose = false;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "t:p:c:b:w:Jv")) != -1) {
+        switch (ch) {
+            case 't': seconds = atoi(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            case 'c': client_port = atoi(optarg); break;
+            case 'b': baseline_path = optarg; break;
+            case 'w': write_path = optarg; break;
+            case 'J': json_output = true; break;
+            case 'v': verbose = true; break;
+            default: bench_usage();
+        }
+    }
+    if (seconds < 1 || port <= 0 || client_port < 0) {
+        bench_usage();
+    }
+    if (client_port == 0) {
+        client_port = port;
+    }
+
+    cJSON* baseline = NULL;
+    cJSON* baseline_runs = NULL;
+    BenchTolerance tol = { BENCH_TOLERANCE_THROUGHPUT, BENCH_TOLERANCE_PPS, BENCH_TOLERANCE_CPU };
+    if (baseline_path) {
+        baseline = read_json_file(baseline_path);
+        if (!baseline) {
+            fprintf(stderr, "iperf3_bench: cannot read baseline %s\n", baseline_path);
+            return 2;
+        }
+        baseline_runs = cJSON_GetObjectItem(baseline, "runs");
+        cJSON* t = cJSON_GetObjectItem(baseline, "tolerance");
+        tol.throughput = json_number(t, "bits_per_second", tol.throughput);
+        tol.pps = json_number(t, "pps", tol.pps);
+        tol.cpu = json_number(t, "cpu_per_gbps", tol.cpu);
+    }
+
+    // Our own output goes to the real stdout and stderr; the bridge's logging
+    // and the server's text reports nowhere
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    out_err = fdopen(dup(STDERR_FILENO), "w");
+    setvbuf(out_err, NULL, _IONBF, 0);
+    if (!verbose) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+    }
+
+    // As on Android: a peer closing first is an error return, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    Iperf3Session* server = iperf3_session_create_server(port, false);
+    if (!server || !iperf3_session_start(server)) {
+        fprintf(out_err, "iperf3_bench: cannot start the server on port %d\n", port);
+        return 2;
+    }
+
+    BenchTest tests[64];
+    int count = build_matrix(tests, 64);
+    int failures = 0, regressions = 0;
+    cJSON* runs = cJSON_CreateObject();
+    cJSON* report = cJSON_CreateArray();
+
+    if (!json_output) {
+        fprintf(out, "%-24s %12s %8s %12s %8s  %s\n", "test", "Mbit/s", "cpu %", "pps", "loss %", "baseline");
+    }
+    for (int i = 0; i < count; i++) {
+        const BenchTest* t = &tests[i];
+        if (!selected(t->name, argc - optind, argv + optind)) {
+            continue;
+        }
+        BenchResult r;
+        sleep_ms(BENCH_SETTLE_MS);
+        run_test(t, client_port, seconds, &r);
+
+        char status[160] = "";
+        cJSON* base = baseline_runs ? cJSON_GetObjectItem(baseline_runs, t->name) : NULL;
+        if (!r.ok) {
+            snprintf(status, sizeof(status), "FAILED: %s", r.error);
+            failures++;
+        } else if (!baseline) {
+            status[0] = '\0';
+        } else if (!base) {
+            snprintf(status, sizeof(status), "not in baseline");
+        } else {
+            char why[128];
+            if (compare(&r, base, &tol, why, sizeof(why))) {
+                snprintf(status, sizeof(status), "REGRESSED:%s", why);
+                regressions++;
+            } else {
+                snprintf(status, sizeof(status), "ok");
+            }
+        }
+
+        if (r.ok) {
+            cJSON* run = cJSON_CreateObject();
+            cJSON_AddNumberToObject(run, "bits_per_second", r.bitsPerSecond);
+            cJSON_AddNumberToObject(run, "cpu_percent", r.cpuPercent);
+            cJSON_AddNumberToObject(run, "pps", r.pps);
+            cJSON_AddItemToObject(runs, t->name, run);
+        }
+        if (json_output) {
+            cJSON* item = cJSON_CreateObject();
+            cJSON_AddStringToObject(item, "name", t->name);
+            cJSON_AddBoolToObject(item, "ok", r.ok);
+            cJSON_AddNumberToObject(item, "bits_per_second", r.bitsPerSecond);
+            cJSON_AddNumberToObject(item, "cpu_percent", r.cpuPercent);
+            cJSON_AddNumberToObject(item, "pps", r.pps);
+            cJSON_AddNumberToObject(item, "lost_percent", r.lostPercent);
+            cJSON_AddStringToObject(item, "status", status);
+            cJSON_AddItemToArray(report, item);
+        } else {
+            fprintf(out, "%-24s %12.1f %8.1f %12.0f %8.2f  %s\n", t->name, r.bitsPerSecond / 1e6,
+                   r.cpuPercent, r.pps, r.lostPercent, status);
+            fflush(out);
+        }
+    }
+
+    iperf3_session_cancel(server);
+    iperf3_session_free(server);
+
+    if (json_output) {
+        cJSON* top = cJSON_CreateObject();
+        cJSON_AddStringToObject(top, "version", iperf3_get_version_string());
+        cJSON_AddNumberToObject(top, "seconds", seconds);
+        cJSON_AddItemToObject(top, "tests", report);
+        cJSON_AddNumberToObject(top, "failures", failures);
+        cJSON_AddNumberToObject(top, "regressions", regressions);
+        char* text = cJSON_Print(top);
+        fprintf(out, "%s\n", text);
+        cJSON_free(text);
+        cJSON_Delete(top);
+    } else {
+        cJSON_Delete(report);
+        fprintf(out, "%d failed, %d regressed\n", failures, regressions);
+    }
+
+    if (write_path) {
+        cJSON* top = cJSON_CreateObject();
+        cJSON* t = cJSON_CreateObject();
+        cJSON_AddNumberToObject(t, "bits_per_second", tol.throughput);
+        cJSON_AddNumberToObject(t, "pps", tol.pps);
+        cJSON_AddNumberToObject(t, "cpu_per_gbps", tol.cpu);
+        cJSON_AddItemToObject(top, "tolerance", t);
+        cJSON_AddNumberToObject(top, "seconds", seconds);
+        cJSON_AddItemToObject(top, "runs", runs);
+        char* text = cJSON_Print(top);
+        FILE* f = fopen(write_path, "w");
+        if (!f || fprintf(f, "%s\n", text) < 0) {
+            fprintf(out_err, "iperf3_bench: cannot write %s\n", write_path);
+            failures++;
+        }
+        if (f) {
+            fclose(f);
+        }
+        cJSON_free(text);
+        cJSON_Delete(top);
+    } else {
+        cJSON_Delete(runs);
+    }
+    cJSON_Delete(baseline);
+
+    if (failures > 0) {
+        return 2;
+    }
+    return regressions > 0 ? 1 : 0;
+}
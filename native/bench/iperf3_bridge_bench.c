@@ -0,0 +1,209 @@
+#include "iperf3_bridge.h"
+#include "iperf3_bridge_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "iperf_config.h"
+#include "iperf.h"
+#include "iperf_api.h"
+
+// Microbenchmark of the bridge's interval extraction: the reporter callback
+// turning the newest interval of a test with P streams into an
+// Iperf3IntervalProgress and handing it to the interval callback.  The
+// engine's own hot paths are timed by b_engine in native/iperf3/src.
+//
+//   iperf3_bridge_bench [-J] [-n samples] [-t min_sample_ms]
+//
+// Each case is calibrated to an iteration count whose run takes at least the
+// minimum sample time, run once to warm up, then sampled.  The median and
+// the median absolute deviation are the figures to compare.  -J prints the
+// results as JSON.
+
+#define BENCH_SAMPLES 21
+#define BENCH_MIN_SAMPLE_MS 20
+
+static const int stream_counts[] = { 1, 8, 128 };
+
+// Keeps results alive so the compiler can't drop the work
+static volatile uintptr_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void on_interval(void* context, const Iperf3IntervalProgress* progress) {
+    (void)context;
+    sink += progress->streamCount;
+}
+
+// A connected pair of loopback UDP sockets for the streams to hold
+static int udp_pair(int fds[2]) {
+    struct sockaddr_in addr[2];
+    socklen_t len;
+
+    fds[0] = fds[1] = -1;
+    for (int i = 0; i < 2; i++) {
+        memset(&addr[i], 0, sizeof(addr[i]));
+        addr[i].sin_family = AF_INET;
+        addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        len = sizeof(addr[i]);
+        if ((fds[i] = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+            bind(fds[i], (struct sockaddr*)&addr[i], sizeof(addr[i])) < 0 ||
+            getsockname(fds[i], (struct sockaddr*)&addr[i], &len) < 0) {
+            return -1;
+        }
+    }
+    if (connect(fds[0], (struct sockaddr*)&addr[1], sizeof(addr[1])) < 0 ||
+        connect(fds[1], (struct sockaddr*)&addr[0], sizeof(addr[0])) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// A running UDP client test with one interval recorded on each of its
+// streams, wrapped in a session that reports to on_interval()
+static Iperf3Session* session_with_streams(int streams) {
+    struct iperf_test* test = iperf_new_test();
+    if (!test) {
+        return NULL;
+    }
+    iperf_defaults(test);
+    set_protocol(test, Pudp);
+    iperf_set_test_role(test, 'c');
+    iperf_set_test_blksize(test, 1460);
+    test->udp_counters_64bit = 1;
+
+    int fds[2];
+    if (udp_pair(fds) < 0) {
+        iperf_free_test(test);
+        return NULL;
+    }
+    close(fds[1]);
+    for (int i = 0; i < streams; i++) {
+        if (!iperf_new_stream(test, fds[0], 1)) {
+            iperf_free_test(test);
+            return NULL;
+        }
+    }
+
+    struct iperf_time now;
+    struct iperf_stream* sp;
+    iperf_time_now(&now);
+    SLIST_FOREACH(sp, &test->streams, streams) {
+        sp->result->start_time = sp->result->start_time_fixed = now;
+        sp->result->bytes_sent_this_interval = 1250000;
+        sp->result->bytes_sent = 1250000;
+        sp->packet_count = 856;
+    }
+    test->state = TEST_RUNNING;
+    iperf_stats_callback(test);
+
+    Iperf3Session* session = iperf3_session_wrap_test(test);
+    if (!session) {
+        iperf_free_test(test);
+        return NULL;
+    }
+    iperf3_session_set_interval_callback(session, on_interval, NULL);
+    return session;
+}
+
+// Times iters extractions, in ns each
+static double sample(Iperf3Session* session, uint64_t iters) {
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < iters; i++) {
+        iperf3_session_report_interval(session);
+    }
+    return (double)(now_ns() - start) / iters;
+}
+
+int main(int argc, char** argv) {
+    int samples = BENCH_SAMPLES, min_sample_ms = BENCH_MIN_SAMPLE_MS;
+    int json = 0, ch;
+
+    while ((ch = getopt(argc, argv, "Jn:t:")) != -1) {
+        switch (ch) {
+            case 'J':
+                json = 1;
+                break;
+            case 'n':
+                samples = atoi(optarg);
+                break;
+            case 't':
+                min_sample_ms = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-J] [-n samples] [-t min_sample_ms]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (samples < 1 || min_sample_ms < 1) {
+        fprintf(stderr, "samples and sample time must be positive\n");
+        return 2;
+    }
+
+    double* ns = (double*)calloc(samples, sizeof(double));
+    double* dev = (double*)calloc(samples, sizeof(double));
+    if (!ns || !dev) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if (json) {
+        printf("{\"benchmarks\":[");
+    } else {
+        printf("%-24s %12s %12s %10s\n", "benchmark", "iterations", "median ns", "mad ns");
+    }
+    for (size_t c = 0; c < sizeof(stream_counts) / sizeof(stream_counts[0]); c++) {
+        char name[32];
+        snprintf(name, sizeof(name), "bridge/extract/%d", stream_counts[c]);
+        Iperf3Session* session = session_with_streams(stream_counts[c]);
+        if (!session) {
+            fprintf(stderr, "%s: setup failed\n", name);
+            return 1;
+        }
+
+        uint64_t iters = 1;
+        while (sample(session, iters) * iters < min_sample_ms * 1e6 && iters < (1ULL << 40)) {
+            iters *= 2;
+        }
+        sample(session, iters);
+        for (int i = 0; i < samples; i++) {
+            ns[i] = sample(session, iters);
+        }
+        qsort(ns, samples, sizeof(double), compare_double);
+        double median = ns[samples / 2];
+        for (int i = 0; i < samples; i++) {
+            dev[i] = ns[i] > median ? ns[i] - median : median - ns[i];
+        }
+        qsort(dev, samples, sizeof(double), compare_double);
+        double mad = dev[samples / 2];
+        iperf3_session_free(session);
+
+        if (json) {
+            printf("%s{\"name\":\"%s\",\"iterations\":%llu,\"median_ns\":%.1f,\"mad_ns\":%.1f}",
+                   c ? "," : "", name, (unsigned long long)iters, median, mad);
+        } else {
+            printf("%-24s %12llu %12.1f %10.1f\n", name, (unsigned long long)iters, median, mad);
+        }
+    }
+    if (json) {
+        printf("]}\n");
+    }
+    free(ns);
+    free(dev);
+    return 0;
+}
@@ -0,0 +1,1127 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+// User-space impairment relay for Linux hosts, a stand-in for tc/netem where
+// there are no privileges for it.  Listens on one port for both TCP and UDP,
+// the way an iperf3 server does, and relays everything to the real server,
+// impairing it on the way:
+//
+//   iperf3_impair -l 15202 -r 127.0.0.1:5201 [options]
+//   iperf3 -c 127.0.0.1 -p 15202 ...
+//
+//   -d ms        one-way delay
+//   -j ms        jitter, uniform in +-ms around the delay
+//   -L pct       Bernoulli loss
+//   -G p,r[,h,k] Gilbert-Elliott loss: p and r are the percent chances of
+//                going from good to bad and back per packet, h and k the
+//                loss percent in the bad (default 100) and good (0) states
+//   -R pct       reordering: the packet skips the delay, so it overtakes
+//                the ones before it (needs -d); jitter alone never reorders
+//   -D pct       duplication
+//   -b rate      link rate in bits/s, with K, M or G; 0 = unlimited
+//   -q packets   queue limit per direction, delayed packets included
+//   -a dir       impair "up" (client to server), "down" or "both" (default)
+//   -s seed      random seed, so runs are reproducible
+//   -J           statistics as JSON on exit (SIGINT or SIGTERM)
+//
+// Loss, reordering, duplication and the queue limit apply to UDP datagrams.
+// TCP is terminated on each side and relayed as a byte stream, so its data
+// only sees the delay and the rate, and a full queue stops the relay reading
+// from the sender instead of dropping.  iperf's TCP figures such as
+// retransmits and cwnd therefore describe the hop to the relay.
+//
+// One thread moves everything: datagrams are read and sent in batches with
+// recvmmsg() and sendmmsg(), and held packets wait in a timer wheel of
+// WHEEL_TICK_NS slots, which is also the timing resolution.
+
+#define DEFAULT_QUEUE_LIMIT 10000
+#define BATCH 64                    // datagrams per recvmmsg()/sendmmsg()
+#define MAX_DATAGRAM 65536
+#define TCP_CHUNK 65536
+#define TCP_WINDOW (4 << 20)        // bytes a TCP side may have in the relay
+#define SOCKET_BUFFER (4 << 20)
+#define FLOW_BUCKETS 256
+#define FLOW_IDLE_NS (60 * 1000000000ULL)
+
+#define WHEEL_SHIFT 16              // 65.5 us ticks
+#define WHEEL_TICK_NS (1ULL << WHEEL_SHIFT)
+#define WHEEL_BITS 13               // a lap of 8192 ticks, about 0.5 s
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+enum { UP = 0, DOWN = 1 };
+static const char* dir_names[] = { "up", "down" };
+
+typedef enum { EP_UDP_LISTEN, EP_UDP_FLOW, EP_TCP_LISTEN, EP_TCP, EP_TIMER } EndpointKind;
+
+struct TcpConn;
+struct Flow;
+
+typedef struct {
+    EndpointKind kind;
+    int fd;
+    struct TcpConn* conn;           // EP_TCP
+    int side;                       // EP_TCP: UP reads from the client, DOWN from the server
+} Endpoint;
+
+typedef struct Packet {
+    struct Packet* next;
+    uint64_t due;
+    int dir;
+    bool fin;                       // TCP: shut down the write side after this
+    struct Flow* flow;              // UDP
+    struct TcpConn* conn;           // TCP
+    size_t len;
+    size_t offset;                  // TCP: bytes already written
+    size_t cap;
+    unsigned char data[];
+} Packet;
+
+typedef struct Flow {
+    struct Flow* next;
+    struct sockaddr_storage client;
+    socklen_t client_len;
+    Endpoint upstream;              // connected to the server
+    uint64_t last_active;
+    int inflight;                   // packets in the wheel
+} Flow;
+
+typedef struct TcpConn {
+    Endpoint side[2];               // [UP] faces the client, [DOWN] the server
+    Packet* out_head[2];            // waiting to be written to side[i]
+    Packet* out_tail[2];
+    size_t held[2];                 // bytes read from side[i] not yet written on
+    bool read_paused[2];
+    bool eof[2];                    // side[i] has closed its write side
+    bool want_out[2];
+    bool connected;                 // the server side
+    bool dead;
+    int inflight;
+    struct TcpConn* next_dead;
+} TcpConn;
+
+typedef struct {
+    unsigned long long rx_packets, rx_bytes;
+    unsigned long long tx_packets, tx_bytes;
+    unsigned long long lost, duplicated, reordered, queue_drops, send_drops;
+} DirStats;
+
+typedef struct {
+    uint64_t busy_until;            // when the link finishes sending what it has
+    uint64_t last_due;              // packets leave in order unless reordered
+    int queued;
+} Link;
+
+typedef struct {
+    double delay_ns, jitter_ns;
+    double loss, reorder, duplicate;
+    bool gilbert;
+    double ge_p, ge_r, ge_bad_loss, ge_good_loss;
+    double rate;                    // bits/s
+    int queue_limit;
+    bool impair[2];
+} Impairment;
+
+static Impairment imp;
+static Link links[2];
+static DirStats stats[2];
+static bool ge_bad[2];
+static uint64_t rng_state;
+
+static int epfd;
+static Endpoint udp_listen, tcp_listen, timer_ep;
+static struct sockaddr_storage upstream_addr;
+static socklen_t upstream_len;
+static Flow* flows[FLOW_BUCKETS];
+static TcpConn* dead_conns;         // closed, freed once nothing of theirs is in the wheel
+static volatile sig_atomic_t stopping;
+static bool verbose;
+
+static struct {
+    Packet* head[WHEEL_SLOTS];
+    Packet* tail[WHEEL_SLOTS];
+    uint64_t bitmap[WHEEL_SLOTS / 64];
+    uint64_t current;               // first tick not yet delivered
+    Packet* overflow;               // beyond the current lap, oldest first
+    Packet* overflow_tail;
+    size_t count;                   // in the slots, not the overflow
+} wheel;
+
+static Packet* free_small;          // pooled packets of the two sizes
+static Packet* free_large;
+#define SMALL_CAP 2048
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64*, seeded once, so a seed gives the same impairments every run
+static double random_unit(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static Packet* packet_new(size_t len) {
+    Packet** pool = len <= SMALL_CAP ? &free_small : &free_large;
+    Packet* p = *pool;
+    if (p) {
+        *pool = p->next;
+    } else {
+        size_t cap = len <= SMALL_CAP ? SMALL_CAP : MAX_DATAGRAM;
+        p = (Packet*)malloc(sizeof(Packet) + cap);
+        if (!p) {
+            return NULL;
+        }
+        p->cap = cap;
+    }
+    p->next = NULL;
+    p->fin = false;
+    p->flow = NULL;
+    p->conn = NULL;
+    p->len = len;
+    p->offset = 0;
+    return p;
+}
+
+static void packet_free(Packet* p) {
+    Packet** pool = p->cap == SMALL_CAP ? &free_small : &free_large;
+    p->next = *pool;
+    *pool = p;
+}
+
+// Timer wheel
+
+static void wheel_insert(Packet* p, uint64_t tick) {
+    size_t slot = tick & WHEEL_MASK;
+    p->next = NULL;
+    if (wheel.tail[slot]) {
+        wheel.tail[slot]->next = p;
+    } else {
+        wheel.head[slot] = p;
+        wheel.bitmap[slot / 64] |= 1ULL << (slot % 64);
+    }
+    wheel.tail[slot] = p;
+    wheel.count++;
+}
+
+// The wheel only takes packets due in the current lap.  Later ones wait in
+// the overflow, in the order they came, and move into the wheel together
+// when their lap starts, so packets due in the same tick never change order.
+static void wheel_schedule(Packet* p) {
+    uint64_t tick = p->due >> WHEEL_SHIFT;
+    if (tick < wheel.current) {
+        tick = wheel.current;
+    }
+    if ((tick >> WHEEL_BITS) != (wheel.current >> WHEEL_BITS)) {
+        p->next = NULL;
+        if (wheel.overflow_tail) {
+            wheel.overflow_tail->next = p;
+        } else {
+            wheel.overflow = p;
+        }
+        wheel.overflow_tail = p;
+    } else {
+        wheel_insert(p, tick);
+    }
+}
+
+// At the start of a lap: moves the overflow packets due in it into the wheel
+static void wheel_cascade(void) {
+    Packet* list = wheel.overflow;
+    wheel.overflow = wheel.overflow_tail = NULL;
+    while (list) {
+        Packet* p = list;
+        list = p->next;
+        wheel_schedule(p);
+    }
+}
+
+// The slot at or after the current tick holding packets, as a tick
+static bool wheel_next_tick(uint64_t* tick) {
+    if (wheel.count == 0) {
+        return false;
+    }
+    size_t start = wheel.current & WHEEL_MASK;
+    for (size_t scanned = 0; scanned <= WHEEL_SLOTS; ) {
+        size_t slot = (start + scanned) & WHEEL_MASK;
+        uint64_t bits = wheel.bitmap[slot / 64] >> (slot % 64);
+        if (bits) {
+            size_t found = slot + __builtin_ctzll(bits);
+            *tick = wheel.current + ((found - start) & WHEEL_MASK);
+            return true;
+        }
+        scanned += 64 - slot % 64;
+    }
+    return false;
+}
+
+// When the wheel next has something to do, or UINT64_MAX
+static uint64_t wheel_next_due(void) {
+    uint64_t tick;
+    if (wheel_next_tick(&tick)) {
+        return tick << WHEEL_SHIFT;
+    }
+    if (wheel.overflow) {
+        return ((wheel.current | WHEEL_MASK) + 1) << WHEEL_SHIFT;
+    }
+    return UINT64_MAX;
+}
+
+// Every lap of the wheel starts by taking in its packets from the overflow
+static void wheel_move_to(uint64_t tick) {
+    bool lapped = (tick >> WHEEL_BITS) != (wheel.current >> WHEEL_BITS);
+    wheel.current = tick;
+    if (lapped && wheel.overflow) {
+        wheel_cascade();
+    }
+}
+
+// Takes every packet in the ticks up to now, in order
+static Packet* wheel_advance(uint64_t now) {
+    uint64_t now_tick = now >> WHEEL_SHIFT;
+    Packet* head = NULL;
+    Packet** tail = &head;
+
+    while (wheel.current <= now_tick) {
+        uint64_t tick;
+        bool found = wheel_next_tick(&tick);
+        if (!found) {
+            tick = (wheel.current | WHEEL_MASK) + 1;    // nothing more in this lap
+        }
+        if (tick > now_tick) {
+            wheel_move_to(now_tick + 1);
+            break;
+        }
+        if (!found) {
+            wheel_move_to(tick);
+            continue;
+        }
+        size_t slot = tick & WHEEL_MASK;
+        *tail = wheel.head[slot];
+        while (*tail) {
+            tail = &(*tail)->next;
+            wheel.count--;
+        }
+        wheel.head[slot] = wheel.tail[slot] = NULL;
+        wheel.bitmap[slot / 64] &= ~(1ULL << (slot % 64));
+        wheel_move_to(tick + 1);
+    }
+    return head;
+}
+
+// Sockets
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void set_buffers(int fd) {
+    int size = SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+static void watch(Endpoint* ep, uint32_t events, int op) {
+    struct epoll_event ev = { .events = events, .data.ptr = ep };
+    if (epoll_ctl(epfd, op, ep->fd, &ev) != 0 && verbose) {
+        perror("iperf3_impair: epoll_ctl");
+    }
+}
+
+// UDP flows, one per client address, each with its own socket to the server
+
+static unsigned flow_hash(const struct sockaddr_storage* addr, socklen_t len) {
+    const unsigned char* bytes = (const unsigned char*)addr;
+    unsigned hash = 2166136261u;
+    for (socklen_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash % FLOW_BUCKETS;
+}
+
+static Flow* flow_get(const struct sockaddr_storage* addr, socklen_t len, uint64_t now) {
+    unsigned bucket = flow_hash(addr, len);
+    for (Flow* f = flows[bucket]; f; f = f->next) {
+        if (f->client_len == len && memcmp(&f->client, addr, len) == 0) {
+            f->last_active = now;
+            return f;
+        }
+    }
+    int fd = socket(upstream_addr.ss_family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (connect(fd, (struct sockaddr*)&upstream_addr, upstream_len) != 0) {
+        close(fd);
+        return NULL;
+    }
+    set_nonblocking(fd);
+    set_buffers(fd);
+    Flow* f = (Flow*)calloc(1, sizeof(Flow));
+    if (!f) {
+        close(fd);
+        return NULL;
+    }
+    memcpy(&f->client, addr, len);
+    f->client_len = len;
+    f->upstream.kind = EP_UDP_FLOW;
+    f->upstream.fd = fd;
+    f->last_active = now;
+    f->next = flows[bucket];
+    flows[bucket] = f;
+    watch(&f->upstream, EPOLLIN, EPOLL_CTL_ADD);
+    return f;
+}
+
+// Flows of finished tests, once nothing of theirs is in the wheel
+static void flow_reap(uint64_t now) {
+    for (int b = 0; b < FLOW_BUCKETS; b++) {
+        Flow** link = &flows[b];
+        while (*link) {
+            Flow* f = *link;
+            if (f->inflight == 0 && now - f->last_active > FLOW_IDLE_NS) {
+                *link = f->next;
+                close(f->upstream.fd);
+                free(f);
+            } else {
+                link = &f->next;
+            }
+        }
+    }
+}
+
+// Impairment.  Decides a packet's fate and when it leaves; returns false
+// if it is dropped.
+
+static bool lose(int dir) {
+    if (imp.gilbert) {
+        if (ge_bad[dir]) {
+            ge_bad[dir] = random_unit() >= imp.ge_r;
+        } else {
+            ge_bad[dir] = random_unit() < imp.ge_p;
+        }
+        if (random_unit() < (ge_bad[dir] ? imp.ge_bad_loss : imp.ge_good_loss)) {
+            return true;
+        }
+    }
+    return imp.loss > 0 && random_unit() < imp.loss;
+}
+
+static bool schedule(int dir, size_t len, bool datagram, uint64_t now, uint64_t* due, bool* reordered) {
+    Link* link = &links[dir];
+    *reordered = false;
+    if (!imp.impair[dir]) {
+        *due = now;
+        return true;
+    }
+    if (datagram) {
+        if (lose(dir)) {
+            stats[dir].lost++;
+            return false;
+        }
+        if (link->queued >= imp.queue_limit) {
+            stats[dir].queue_drops++;
+            return false;
+        }
+    }
+
+    // Serialization on a link of the given rate, then the delay
+    uint64_t depart = now;
+    if (imp.rate > 0) {
+        uint64_t start = link->busy_until > now ? link->busy_until : now;
+        link->busy_until = start + (uint64_t)(len * 8e9 / imp.rate);
+        depart = link->busy_until;
+    }
+    if (datagram && imp.reorder > 0 && random_unit() < imp.reorder) {
+        *due = depart;
+        *reordered = true;
+        return true;
+    }
+    double delay = imp.delay_ns;
+    if (imp.jitter_ns > 0) {
+        delay += (2 * random_unit() - 1) * imp.jitter_ns;
+        if (delay < 0) {
+            delay = 0;
+        }
+    }
+    *due = depart + (uint64_t)delay;
+    if (*due < link->last_due) {
+        *due = link->last_due;
+    }
+    link->last_due = *due;
+    return true;
+}
+
+static void enqueue(Packet* p, int dir, uint64_t due) {
+    p->dir = dir;
+    p->due = due;
+    links[dir].queued++;
+    if (p->flow) {
+        p->flow->inflight++;
+    }
+    if (p->conn) {
+        p->conn->inflight++;
+    }
+    wheel_schedule(p);
+}
+
+static void relay_datagram(int dir, Flow* flow, const unsigned char* data, size_t len, uint64_t now) {
+    stats[dir].rx_packets++;
+    stats[dir].rx_bytes += len;
+    uint64_t due;
+    bool reordered;
+    if (!schedule(dir, len, true, now, &due, &reordered)) {
+        return;
+    }
+    int copies = imp.impair[dir] && imp.duplicate > 0 && random_unit() < imp.duplicate ? 2 : 1;
+    for (int i = 0; i < copies; i++) {
+        Packet* p = packet_new(len);
+        if (!p) {
+            stats[dir].queue_drops++;
+            return;
+        }
+        memcpy(p->data, data, len);
+        p->flow = flow;
+        enqueue(p, dir, due);
+    }
+    stats[dir].duplicated += copies - 1;
+    stats[dir].reordered += reordered;
+}
+
+// Batched datagram output, one batch per socket
+
+typedef struct {
+    int fd;
+    int count;
+    struct mmsghdr msgs[BATCH];
+    struct iovec iovs[BATCH];
+    Packet* packets[BATCH];
+} SendBatch;
+
+#define SEND_BATCHES 16
+static SendBatch batches[SEND_BATCHES];
+static int batch_count;
+
+static void batch_flush(SendBatch* b) {
+    int sent = 0;
+    while (sent < b->count) {
+        int n = sendmmsg(b->fd, b->msgs + sent, b->count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        sent += n;
+    }
+    for (int i = 0; i < b->count; i++) {
+        Packet* p = b->packets[i];
+        if (i < sent) {
+            stats[p->dir].tx_packets++;
+            stats[p->dir].tx_bytes += p->len;
+        } else {
+            stats[p->dir].send_drops++;
+        }
+        packet_free(p);
+    }
+    b->count = 0;
+}
+
+static void batch_flush_all(void) {
+    for (int i = 0; i < batch_count; i++) {
+        batch_flush(&batches[i]);
+    }
+    batch_count = 0;
+}
+
+static void batch_add(int fd, Packet* p, struct sockaddr_storage* to, socklen_t to_len) {
+    SendBatch* b = NULL;
+    for (int i = 0; i < batch_count; i++) {
+        if (batches[i].fd == fd) {
+            b = &batches[i];
+            break;
+        }
+    }
+    if (!b) {
+        if (batch_count == SEND_BATCHES) {
+            batch_flush_all();
+        }
+        b = &batches[batch_count++];
+        b->fd = fd;
+        b->count = 0;
+    }
+    int i = b->count++;
+    b->packets[i] = p;
+    b->iovs[i].iov_base = p->data;
+    b->iovs[i].iov_len = p->len;
+    memset(&b->msgs[i], 0, sizeof(b->msgs[i]));
+    b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+    b->msgs[i].msg_hdr.msg_iovlen = 1;
+    b->msgs[i].msg_hdr.msg_name = to;
+    b->msgs[i].msg_hdr.msg_namelen = to_len;
+    if (b->count == BATCH) {
+        batch_flush(b);
+    }
+}
+
+// Batched datagram input
+
+static unsigned char rx_buffers[BATCH][MAX_DATAGRAM];
+
+static void read_datagrams(Endpoint* ep, uint64_t now) {
+    struct mmsghdr msgs[BATCH];
+    struct iovec iovs[BATCH];
+    struct sockaddr_storage from[BATCH];
+
+    // A few batches per wakeup, so one busy socket cannot starve the rest
+    for (int round = 0; round < 8; round++) {
+        for (int i = 0; i < BATCH; i++) {
+            iovs[i].iov_base = rx_buffers[i];
+            iovs[i].iov_len = MAX_DATAGRAM;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (ep->kind == EP_UDP_LISTEN) {
+                msgs[i].msg_hdr.msg_name = &from[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            }
+        }
+        int n = recvmmsg(ep->fd, msgs, BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (ep->kind == EP_UDP_LISTEN) {
+                Flow* flow = flow_get(&from[i], msgs[i].msg_hdr.msg_namelen, now);
+                if (flow) {
+                    relay_datagram(UP, flow, rx_buffers[i], msgs[i].msg_len, now);
+                }
+            } else {
+                Flow* flow = (Flow*)((char*)ep - offsetof(Flow, upstream));
+                flow->last_active = now;
+                relay_datagram(DOWN, flow, rx_buffers[i], msgs[i].msg_len, now);
+            }
+        }
+        if (n < BATCH) {
+            return;
+        }
+    }
+}
+
+// TCP relay
+
+static void tcp_update_events(TcpConn* c, int side) {
+    if (c->dead) {
+        return;
+    }
+    uint32_t events = 0;
+    if (!c->read_paused[side] && !c->eof[side]) {
+        events |= EPOLLIN;
+    }
+    if (c->want_out[side]) {
+        events |= EPOLLOUT;
+    }
+    watch(&c->side[side], events, EPOLL_CTL_MOD);
+}
+
+static void tcp_kill(TcpConn* c) {
+    if (c->dead) {
+        return;
+    }
+    c->dead = true;
+    for (int s = 0; s < 2; s++) {
+        close(c->side[s].fd);
+        while (c->out_head[s]) {
+            Packet* p = c->out_head[s];
+            c->out_head[s] = p->next;
+            packet_free(p);
+        }
+    }
+    c->next_dead = dead_conns;
+    dead_conns = c;
+}
+
+// Outside event handling, so no pending event can refer to a freed conn
+static void tcp_reap(void) {
+    TcpConn** link = &dead_conns;
+    while (*link) {
+        TcpConn* c = *link;
+        if (c->inflight == 0) {
+            *link = c->next_dead;
+            free(c);
+        } else {
+            link = &c->next_dead;
+        }
+    }
+}
+
+// Both sides have closed and everything has been written
+static void tcp_maybe_finish(TcpConn* c) {
+    if (c->eof[UP] && c->eof[DOWN] && !c->out_head[UP] && !c->out_head[DOWN] && c->inflight == 0) {
+        tcp_kill(c);
+    }
+}
+
+// Writes what is queued for side; data read from the other side
+static void tcp_flush(TcpConn* c, int side) {
+    int from = side == UP ? DOWN : UP;
+    int dir = from;
+    if (side == DOWN && !c->connected) {
+        return;
+    }
+    while (c->out_head[side]) {
+        Packet* p = c->out_head[side];
+        if (p->fin) {
+            shutdown(c->side[side].fd, SHUT_WR);
+        } else {
+            ssize_t n = send(c->side[side].fd, p->data + p->offset, p->len - p->offset, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                tcp_kill(c);
+                return;
+            }
+            p->offset += n;
+            stats[dir].tx_bytes += n;
+            c->held[from] -= n;
+            if (p->offset < p->len) {
+                continue;
+            }
+            stats[dir].tx_packets++;
+        }
+        c->out_head[side] = p->next;
+        if (!c->out_head[side]) {
+            c->out_tail[side] = NULL;
+        }
+        packet_free(p);
+    }
+    bool want_out = c->out_head[side] != NULL;
+    bool resume = c->read_paused[from] && c->held[from] < TCP_WINDOW / 2;
+    if (resume) {
+        c->read_paused[from] = false;
+        tcp_update_events(c, from);
+    }
+    if (want_out != c->want_out[side]) {
+        c->want_out[side] = want_out;
+        tcp_update_events(c, side);
+    }
+}
+
+static void tcp_read(TcpConn* c, int side, uint64_t now) {
+    int dir = side;
+    if (c->eof[side]) {
+        return;
+    }
+    for (int round = 0; round < 16 && !c->read_paused[side]; round++) {
+        Packet* p = packet_new(TCP_CHUNK);
+        if (!p) {
+            return;
+        }
+        ssize_t n = recv(c->side[side].fd, p->data, TCP_CHUNK, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            packet_free(p);
+            return;
+        }
+        if (n < 0) {
+            packet_free(p);
+            tcp_kill(c);
+            return;
+        }
+        uint64_t due;
+        bool reordered;
+        schedule(dir, n, false, now, &due, &reordered);
+        p->len = n;
+        p->conn = c;
+        if (n == 0) {
+            // Passed on once the data before it has been
+            p->fin = true;
+            c->eof[side] = true;
+            tcp_update_events(c, side);
+            enqueue(p, dir, due);
+            return;
+        }
+        stats[dir].rx_packets++;
+        stats[dir].rx_bytes += n;
+        c->held[side] += n;
+        enqueue(p, dir, due);
+        if (c->held[side] >= TCP_WINDOW) {
+            c->read_paused[side] = true;
+            tcp_update_events(c, side);
+        }
+    }
+}
+
+static void tcp_accept(void) {
+    for (;;) {
+        int fd = accept4(tcp_listen.fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            return;
+        }
+        int up = socket(upstream_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (up < 0) {
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(up, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(up, (struct sockaddr*)&upstream_addr, upstream_len) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            close(up);
+            continue;
+        }
+        TcpConn* c = (TcpConn*)calloc(1, sizeof(TcpConn));
+        if (!c) {
+            close(fd);
+            close(up);
+            continue;
+        }
+        for (int s = 0; s < 2; s++) {
+            c->side[s].kind = EP_TCP;
+            c->side[s].conn = c;
+            c->side[s].side = s;
+        }
+        c->side[UP].fd = fd;
+        c->side[DOWN].fd = up;
+        c->want_out[DOWN] = true;       // tells us when the connect completes
+        watch(&c->side[UP], EPOLLIN, EPOLL_CTL_ADD);
+        watch(&c->side[DOWN], EPOLLIN | EPOLLOUT, EPOLL_CTL_ADD);
+    }
+}
+
+static void tcp_event(Endpoint* ep, uint32_t events, uint64_t now) {
+    TcpConn* c = ep->conn;
+    int side = ep->side;
+    if (c->dead) {
+        return;
+    }
+    if ((events & EPOLLERR) && c->connected) {
+        tcp_kill(c);
+        return;
+    }
+    if (side == DOWN && !c->connected && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(ep->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            if (verbose) {
+                fprintf(stderr, "iperf3_impair: cannot reach the server: %s\n", strerror(err));
+            }
+            tcp_kill(c);
+            return;
+        }
+        c->connected = true;
+    }
+    if (events & EPOLLOUT) {
+        tcp_flush(c, side);
+    }
+    if (!c->dead && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        tcp_read(c, side, now);
+    }
+    if (!c->dead) {
+        tcp_maybe_finish(c);
+    }
+}
+
+// Delivery of what the wheel says is due
+
+static void deliver(Packet* list) {
+    while (list) {
+        Packet* p = list;
+        list = p->next;
+        p->next = NULL;
+        links[p->dir].queued--;
+
+        if (p->flow) {
+            Flow* f = p->flow;
+            f->inflight--;
+            if (p->dir == UP) {
+                batch_add(f->upstream.fd, p, NULL, 0);
+            } else {
+                batch_add(udp_listen.fd, p, &f->client, f->client_len);
+            }
+            continue;
+        }
+
+        TcpConn* c = p->conn;
+        c->inflight--;
+        if (c->dead) {
+            packet_free(p);
+            continue;
+        }
+        int to = p->dir == UP ? DOWN : UP;
+        if (c->out_tail[to]) {
+            c->out_tail[to]->next = p;
+        } else {
+            c->out_head[to] = p;
+        }
+        c->out_tail[to] = p;
+        tcp_flush(c, to);
+        if (!c->dead) {
+            tcp_maybe_finish(c);
+        }
+    }
+}
+
+// Setup and reporting
+
+static int open_listener(int type, const struct sockaddr* addr, socklen_t len) {
+    int fd = socket(addr->sa_family, type, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, addr, len) != 0 || (type == SOCK_STREAM && listen(fd, 128) != 0)) {
+        close(fd);
+        return -1;
+    }
+    set_nonblocking(fd);
+    set_buffers(fd);
+    return fd;
+}
+
+static bool resolve(const char* host, const char* port, bool passive, struct sockaddr_storage* out, socklen_t* len) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        return false;
+    }
+    memcpy(out, res->ai_addr, res->ai_addrlen);
+    *len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static double parse_rate(const char* text) {
+    char* end;
+    double rate = strtod(text, &end);
+    switch (*end) {
+        case 'k': case 'K': rate *= 1e3; break;
+        case 'm': case 'M': rate *= 1e6; break;
+        case 'g': case 'G': rate *= 1e9; break;
+    }
+    return rate;
+}
+
+static void print_stats(bool json) {
+    if (json) {
+        printf("{\n");
+        for (int d = UP; d <= DOWN; d++) {
+            const DirStats* s = &stats[d];
+            printf("  \"%s\": {\"rx_packets\": %llu, \"rx_bytes\": %llu, \"tx_packets\": %llu, \"tx_bytes\": %llu, "
+                   "\"lost\": %llu, \"duplicated\": %llu, \"reordered\": %llu, \"queue_drops\": %llu, "
+                   "\"send_drops\": %llu}%s\n",
+                   dir_names[d], s->rx_packets, s->rx_bytes, s->tx_packets, s->tx_bytes, s->lost,
+                   s->duplicated, s->reordered, s->queue_drops, s->send_drops, d == UP ? "," : "");
+        }
+        printf("}\n");
+    } else {
+        printf("%-5s %12s %14s %12s %10s %10s %10s %10s %10s\n", "dir", "rx packets", "rx bytes",
+               "tx packets", "lost", "dup", "reordered", "queue drop", "send drop");
+        for (int d = UP; d <= DOWN; d++) {
+            const DirStats* s = &stats[d];
+            printf("%-5s %12llu %14llu %12llu %10llu %10llu %10llu %10llu %10llu\n", dir_names[d],
+                   s->rx_packets, s->rx_bytes, s->tx_packets, s->lost, s->duplicated, s->reordered,
+                   s->queue_drops, s->send_drops);
+        }
+    }
+    fflush(stdout);
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static void impair_usage(void) {
+    fprintf(stderr,
+            "usage: iperf3_impair -l port -r host:port [-B bind] [-d ms] [-j ms] [-L pct] [-G p,r[,h,k]]\n"
+            "                     [-R pct] [-D pct] [-b rate] [-q packets] [-a up|down|both] [-s seed] [-J] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* listen_port = NULL;
+    const char* bind_host = NULL;
+    char* remote = NULL;
+    const char* apply = "both";
+    bool json = false;
+    unsigned long long seed = 1;
+    int ch;
+
+    imp.queue_limit = DEFAULT_QUEUE_LIMIT;
+    imp.ge_bad_loss = 1.0;
+    while ((ch = getopt(argc, argv, "l:r:B:d:j:L:G:R:D:b:q:a:s:Jv")) != -1) {
+        switch (ch) {
+            case 'l': listen_port = optarg; break;
+            case 'r': remote = optarg; break;
+            case 'B': bind_host = optarg; break;
+            case 'd': imp.delay_ns = atof(optarg) * 1e6; break;
+            case 'j': imp.jitter_ns = atof(optarg) * 1e6; break;
+            case 'L': imp.loss = atof(optarg) / 100; break;
+            case 'G': {
+                double h = 100, k = 0;
+                if (sscanf(optarg, "%lf,%lf,%lf,%lf", &imp.ge_p, &imp.ge_r, &h, &k) < 2) {
+                    impair_usage();
+                }
+                imp.gilbert = true;
+                imp.ge_p /= 100;
+                imp.ge_r /= 100;
+                imp.ge_bad_loss = h / 100;
+                imp.ge_good_loss = k / 100;
+                break;
+            }
+            case 'R': imp.reorder = atof(optarg) / 100; break;
+            case 'D': imp.duplicate = atof(optarg) / 100; break;
+            case 'b': imp.rate = parse_rate(optarg); break;
+            case 'q': imp.queue_limit = atoi(optarg); break;
+            case 'a': apply = optarg; break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'J': json = true; break;
+            case 'v': verbose = true; break;
+            default: impair_usage();
+        }
+    }
+    char* colon = remote ? strrchr(remote, ':') : NULL;
+    if (!listen_port || !colon || imp.queue_limit <= 0) {
+        impair_usage();
+    }
+    imp.impair[UP] = strcmp(apply, "down") != 0;
+    imp.impair[DOWN] = strcmp(apply, "up") != 0;
+    rng_state = seed ? seed : 1;
+
+    // host:port, or [v6 address]:port
+    *colon = '\0';
+    char* remote_host = remote;
+    size_t host_len = strlen(remote_host);
+    if (remote_host[0] == '[' && host_len > 1 && remote_host[host_len - 1] == ']') {
+        remote_host[host_len - 1] = '\0';
+        remote_host++;
+    }
+    if (!resolve(remote_host, colon + 1, false, &upstream_addr, &upstream_len)) {
+        fprintf(stderr, "iperf3_impair: cannot resolve %s\n", remote_host);
+        return 2;
+    }
+    struct sockaddr_storage local;
+    socklen_t local_len;
+    if (!resolve(bind_host, listen_port, true, &local, &local_len)) {
+        fprintf(stderr, "iperf3_impair: cannot resolve the listen address\n");
+        return 2;
+    }
+
+    epfd = epoll_create1(0);
+    udp_listen.kind = EP_UDP_LISTEN;
+    udp_listen.fd = open_listener(SOCK_DGRAM, (struct sockaddr*)&local, local_len);
+    tcp_listen.kind = EP_TCP_LISTEN;
+    tcp_listen.fd = open_listener(SOCK_STREAM, (struct sockaddr*)&local, local_len);
+    timer_ep.kind = EP_TIMER;
+    timer_ep.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (epfd < 0 || udp_listen.fd < 0 || tcp_listen.fd < 0 || timer_ep.fd < 0) {
+        fprintf(stderr, "iperf3_impair: cannot listen on port %s: %s\n", listen_port, strerror(errno));
+        return 2;
+    }
+    watch(&udp_listen, EPOLLIN, EPOLL_CTL_ADD);
+    watch(&tcp_listen, EPOLLIN, EPOLL_CTL_ADD);
+    watch(&timer_ep, EPOLLIN, EPOLL_CTL_ADD);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    wheel.current = now_ns() >> WHEEL_SHIFT;
+    uint64_t armed = UINT64_MAX;
+    uint64_t last_reap = now_ns();
+
+    while (!stopping) {
+        uint64_t next = wheel_next_due();
+        if (next != armed) {
+            // An absolute timer, so the wakeup does not drift with the loop
+            struct itimerspec its;
+            memset(&its, 0, sizeof(its));
+            if (next != UINT64_MAX) {
+                uint64_t at = next > 0 ? next : 1;
+                its.it_value.tv_sec = at / 1000000000ULL;
+                its.it_value.tv_nsec = at % 1000000000ULL;
+            }
+            timerfd_settime(timer_ep.fd, TFD_TIMER_ABSTIME, &its, NULL);
+            armed = next;
+        }
+
+        struct epoll_event events[64];
+        int n = epoll_wait(epfd, events, 64, 1000);
+        if (n < 0 && errno != EINTR) {
+            perror("iperf3_impair: epoll_wait");
+            break;
+        }
+        uint64_t now = now_ns();
+        for (int i = 0; i < n; i++) {
+            Endpoint* ep = (Endpoint*)events[i].data.ptr;
+            switch (ep->kind) {
+                case EP_UDP_LISTEN:
+                case EP_UDP_FLOW:
+                    read_datagrams(ep, now);
+                    break;
+                case EP_TCP_LISTEN:
+                    tcp_accept();
+                    break;
+                case EP_TCP:
+                    tcp_event(ep, events[i].events, now);
+                    break;
+                case EP_TIMER: {
+                    uint64_t expirations;
+                    if (read(ep->fd, &expirations, sizeof(expirations)) < 0) {
+                        // Nothing to read when the timer was re-armed meanwhile
+                    }
+                    armed = UINT64_MAX;
+                    break;
+                }
+            }
+        }
+
+        // Packets with no delay are due now and leave in this same pass
+        deliver(wheel_advance(now_ns()));
+        batch_flush_all();
+        tcp_reap();
+
+        if (now - last_reap > 1000000000ULL) {
+            flow_reap(now);
+            last_reap = now;
+        }
+    }
+
+    print_stats(json);
+    return 0;
+}
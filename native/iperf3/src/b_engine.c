@@ -0,0 +1,709 @@
+/*
+ * iperf, Copyright (c) 2014, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include "iperf_config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "iperf.h"
+#include "iperf_api.h"
+#include "iperf_sim.h"
+#include "iperf_udp.h"
+#include "iperf_util.h"
+#include "timer.h"
+#include "version.h"
+
+/*
+ * Benchmarks of the engine's per-packet, per-interval and per-message
+ * paths:
+ *
+ *   timer/...          timer.c queue operations with 64 timers pending
+ *   udp/...            iperf_udp_send() then iperf_udp_recv() of one
+ *                      datagram over loopback, header encode and decode
+ *                      included
+ *   throttle/check     iperf_check_throttle() while under the rate
+ *   stats/P            iperf_stats_callback() with P streams
+ *   json/render/P      the interval object iperf_reporter_callback()
+ *                      builds, rendered unformatted
+ *   json/parse/P       cJSON_Parse() of that rendering
+ *   framing/...        JSON_write() then JSON_read() of a control
+ *                      message over a socketpair, with and without lz
+ *   null/P             one 1460-byte block through a whole test with P
+ *                      streams over a null link (iperf_sim.h): sent,
+ *                      copied through memory and received, with the
+ *                      counters, stats and timers a real test runs; the
+ *                      test's setup and results exchange are included
+ *   null/P/throttled   the same under a --bitrate it never reaches, so
+ *                      the throttle is checked on every block
+ *
+ * Each benchmark is calibrated to an iteration count whose run takes at
+ * least the minimum sample time, run once to warm up, then sampled.  The
+ * median and the median absolute deviation are the figures to compare;
+ * the mean and extremes are there to spot noisy machines.
+ *
+ * Usage: b_engine [-J] [-l] [-n samples] [-t min_sample_ms] [pattern...]
+ * Only benchmarks whose name contains one of the patterns are run.  -J
+ * prints the results as JSON, -l lists the benchmarks.
+ */
+
+#define BENCH_TIMERS 64
+#define BENCH_SAMPLES 21
+#define BENCH_MIN_SAMPLE_MS 20
+
+struct bench {
+    const char *name;
+    int (*setup)(struct bench *b);
+    void (*run)(struct bench *b, uint64_t iters);
+    void (*teardown)(struct bench *b);
+    int arg;
+
+    /* Filled in by setup */
+    struct iperf_test *test;
+    struct iperf_stream *tx, *rx;
+    TimerQueue *queue;
+    Timer *timer;
+    struct iperf_time now;
+    cJSON *json;
+    char *text;
+    FILE *out;
+    int fds[2];
+};
+
+struct bench_stats {
+    uint64_t iters;
+    double median, mad, mean, stddev, min, max, p90;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Keeps results alive so the compiler can't drop the work */
+static volatile uintptr_t sink;
+
+/*************************************************************/
+
+static int
+udp_pair(int fds[2])
+{
+    struct sockaddr_in addr[2];
+    socklen_t len;
+    int i;
+
+    fds[0] = fds[1] = -1;
+    for (i = 0; i < 2; i++) {
+        memset(&addr[i], 0, sizeof(addr[i]));
+        addr[i].sin_family = AF_INET;
+        addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        len = sizeof(addr[i]);
+        if ((fds[i] = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+            bind(fds[i], (struct sockaddr *) &addr[i], sizeof(addr[i])) < 0 ||
+            getsockname(fds[i], (struct sockaddr *) &addr[i], &len) < 0)
+            return -1;
+    }
+    if (connect(fds[0], (struct sockaddr *) &addr[1], sizeof(addr[1])) < 0 ||
+        connect(fds[1], (struct sockaddr *) &addr[0], sizeof(addr[0])) < 0)
+        return -1;
+    return 0;
+}
+
+static void
+close_fds(struct bench *b)
+{
+    if (b->fds[0] >= 0)
+        close(b->fds[0]);
+    if (b->fds[1] >= 0)
+        close(b->fds[1]);
+    b->fds[0] = b->fds[1] = -1;
+}
+
+/*
+ * A running UDP client test with b->arg sending streams on one loopback
+ * socket (streams never close their socket), and one interval recorded.
+ */
+static int
+streams_setup(struct bench *b)
+{
+    struct iperf_stream *sp;
+    int i;
+
+    b->test = iperf_new_test();
+    if (b->test == NULL)
+        return -1;
+    iperf_defaults(b->test);
+    set_protocol(b->test, Pudp);
+    iperf_set_test_role(b->test, 'c');
+    iperf_set_test_blksize(b->test, 1460);
+    b->test->udp_counters_64bit = 1;
+    if (udp_pair(b->fds) < 0)
+        return -1;
+    for (i = 0; i < b->arg; i++)
+        if (iperf_new_stream(b->test, b->fds[0], 1) == NULL)
+            return -1;
+
+    iperf_time_now(&b->now);
+    SLIST_FOREACH(sp, &b->test->streams, streams) {
+        sp->result->start_time = sp->result->start_time_fixed = b->now;
+        sp->result->bytes_sent_this_interval = 1250000;
+        sp->result->bytes_sent = 1250000;
+        sp->packet_count = 856;
+    }
+    b->test->state = TEST_RUNNING;
+    iperf_stats_callback(b->test);
+    return 0;
+}
+
+static void
+streams_teardown(struct bench *b)
+{
+    if (b->test)
+        iperf_free_test(b->test);
+    b->test = NULL;
+    close_fds(b);
+}
+
+/*************************************************************/
+
+static void
+timer_proc(TimerClientData client_data, struct iperf_time *nowP)
+{
+    (void) nowP;
+    sink += client_data.l;
+}
+
+/* A queue with BENCH_TIMERS timers due far in the future */
+static int
+timer_setup(struct bench *b)
+{
+    int i;
+
+    b->queue = tmr_queue_new();
+    if (b->queue == NULL)
+        return -1;
+    iperf_time_now(&b->now);
+    for (i = 0; i < BENCH_TIMERS; i++)
+        if (tmr_create_q(b->queue, &b->now, timer_proc, JunkClientData,
+                         3600000000LL + i * 1000, 0) == NULL)
+            return -1;
+    if (b->arg) {
+        b->timer = tmr_create_q(b->queue, &b->now, timer_proc, JunkClientData, 1000, 1);
+        if (b->timer == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+static void
+timer_teardown(struct bench *b)
+{
+    if (b->queue)
+        tmr_queue_free(b->queue);
+    b->queue = NULL;
+}
+
+static void
+timer_create_cancel(struct bench *b, uint64_t iters)
+{
+    Timer *t;
+
+    while (iters--) {
+        t = tmr_create_q(b->queue, &b->now, timer_proc, JunkClientData, 1000000, 0);
+        tmr_cancel(t);
+    }
+}
+
+static void
+timer_timeout(struct bench *b, uint64_t iters)
+{
+    while (iters--)
+        sink += (uintptr_t) tmr_timeout_q(b->queue, &b->now);
+}
+
+/* A periodic 1 ms timer that is due on every call */
+static void
+timer_run_periodic(struct bench *b, uint64_t iters)
+{
+    while (iters--) {
+        iperf_time_add_usecs(&b->now, 1000);
+        tmr_run_q(b->queue, &b->now);
+    }
+}
+
+/*************************************************************/
+
+/* One sender and one receiver stream, connected to each other */
+static int
+udp_setup(struct bench *b)
+{
+    b->test = iperf_new_test();
+    if (b->test == NULL)
+        return -1;
+    iperf_defaults(b->test);
+    set_protocol(b->test, Pudp);
+    iperf_set_test_role(b->test, 'c');
+    iperf_set_test_blksize(b->test, b->arg);
+    b->test->udp_counters_64bit = 1;
+    if (udp_pair(b->fds) < 0)
+        return -1;
+    b->tx = iperf_new_stream(b->test, b->fds[0], 1);
+    b->rx = iperf_new_stream(b->test, b->fds[1], 0);
+    if (b->tx == NULL || b->rx == NULL)
+        return -1;
+    b->test->state = TEST_RUNNING;
+    return 0;
+}
+
+static void
+udp_send_recv(struct bench *b, uint64_t iters)
+{
+    while (iters--) {
+        iperf_udp_send(b->tx);
+        iperf_udp_recv(b->rx);
+    }
+}
+
+/*************************************************************/
+
+/* Sending at a third of a 1 Gbit/s --bitrate, so never put to sleep */
+static int
+throttle_setup(struct bench *b)
+{
+    if (streams_setup(b) < 0)
+        return -1;
+    iperf_set_test_rate(b->test, 1000000000);
+    b->tx = SLIST_FIRST(&b->test->streams);
+    b->tx->result->start_time_fixed.secs -= 1;
+    b->tx->result->bytes_sent = 1000000000 / 8 / 3;
+    return 0;
+}
+
+static void
+throttle_check(struct bench *b, uint64_t iters)
+{
+    while (iters--)
+        iperf_check_throttle(b->tx, &b->now);
+    sink += b->tx->green_light;
+}
+
+/*************************************************************/
+
+static void
+stats_callback(struct bench *b, uint64_t iters)
+{
+    while (iters--)
+        iperf_stats_callback(b->test);
+}
+
+/*************************************************************/
+
+static int
+json_setup(struct bench *b)
+{
+    if (streams_setup(b) < 0)
+        return -1;
+    iperf_set_test_json_output(b->test, 1);
+    return iperf_json_start(b->test);
+}
+
+/* iperf_json_finish() would free the output, and print it */
+static void
+json_teardown(struct bench *b)
+{
+    if (b->test) {
+        cJSON_Delete(b->test->json_top);
+        b->test->json_top = NULL;
+    }
+    streams_teardown(b);
+}
+
+/* Builds the newest interval object and takes it back out of the output */
+static char *
+json_render_one(struct bench *b)
+{
+    cJSON *interval;
+    char *str;
+
+    iperf_reporter_callback(b->test);
+    interval = cJSON_DetachItemFromArray(b->test->json_intervals, 0);
+    if (interval == NULL)
+        return NULL;
+    str = cJSON_PrintUnformatted(interval);
+    cJSON_Delete(interval);
+    return str;
+}
+
+static void
+json_render(struct bench *b, uint64_t iters)
+{
+    char *str;
+
+    while (iters--) {
+        str = json_render_one(b);
+        sink += (uintptr_t) str;
+        cJSON_free(str);
+    }
+}
+
+static int
+json_parse_setup(struct bench *b)
+{
+    if (json_setup(b) < 0)
+        return -1;
+    b->text = json_render_one(b);
+    return b->text != NULL ? 0 : -1;
+}
+
+static void
+json_parse_teardown(struct bench *b)
+{
+    cJSON_free(b->text);
+    b->text = NULL;
+    json_teardown(b);
+}
+
+static void
+json_parse(struct bench *b, uint64_t iters)
+{
+    cJSON *j;
+
+    while (iters--) {
+        j = cJSON_Parse(b->text);
+        sink += (uintptr_t) j;
+        cJSON_Delete(j);
+    }
+}
+
+/*************************************************************/
+
+/* Same shape as the message send_results() sends for b->arg streams */
+static cJSON *
+make_results(int streams)
+{
+    cJSON *j, *j_streams;
+    int i;
+
+    j = iperf_json_printf("cpu_util_total: %f  cpu_util_user: %f  cpu_util_system: %f  sender_has_retransmits: %d  congestion_used: %s",
+                          12.5, 2.5, 10.0, (int64_t) 1, "cubic");
+    j_streams = cJSON_CreateArray();
+    cJSON_AddItemToObject(j, "streams", j_streams);
+    for (i = 0; i < streams; i++)
+        cJSON_AddItemToArray(j_streams, iperf_json_printf("id: %d  bytes: %d  retransmits: %d  jitter: %f  errors: %d  omitted_errors: %d  packets: %d  omitted_packets: %d  start_time: %f  end_time: %f",
+            (int64_t) i + 5, (int64_t) 1175000000 + i, (int64_t) i % 7, 0.0, (int64_t) 0, (int64_t) 0, (int64_t) 0, (int64_t) 0, 0.0, 10.000043));
+    return j;
+}
+
+/* b->arg streams in the message; lz-compressed when negative */
+static int
+framing_setup(struct bench *b)
+{
+    int bufsize = 1 << 20;
+
+    b->test = iperf_new_test();
+    if (b->test == NULL)
+        return -1;
+    iperf_defaults(b->test);
+    if (b->arg < 0) {
+        b->test->compress = DEFAULT_COMPRESS_THRESHOLD;
+        b->test->compress_ok = 1;
+    }
+    b->json = make_results(abs(b->arg));
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, b->fds) < 0)
+        return -1;
+    setsockopt(b->fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    setsockopt(b->fds[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    return 0;
+}
+
+static void
+framing_teardown(struct bench *b)
+{
+    cJSON_Delete(b->json);
+    b->json = NULL;
+    streams_teardown(b);
+}
+
+static void
+framing_write_read(struct bench *b, uint64_t iters)
+{
+    cJSON *j;
+
+    while (iters--) {
+        JSON_write(b->test, b->fds[0], b->json);
+        j = JSON_read(b->test, b->fds[1], 0);
+        sink += (uintptr_t) j;
+        cJSON_Delete(j);
+    }
+}
+
+/*************************************************************/
+
+static int
+null_setup(struct bench *b)
+{
+    b->out = fopen("/dev/null", "w");
+    return b->out != NULL ? 0 : -1;
+}
+
+static void
+null_teardown(struct bench *b)
+{
+    if (b->out)
+        fclose(b->out);
+    b->out = NULL;
+}
+
+static struct iperf_test *
+null_test(struct bench *b, char role, uint64_t blocks)
+{
+    struct iperf_test *test = iperf_new_test();
+
+    if (test == NULL)
+        return NULL;
+    iperf_defaults(test);
+    test->outfile = b->out;
+    if (role == 'c') {
+        iperf_set_test_duration(test, 0);
+        iperf_set_test_blocks(test, blocks);
+        iperf_set_test_num_streams(test, abs(b->arg));
+        iperf_set_test_blksize(test, 1460);
+        if (b->arg < 0)
+            iperf_set_test_rate(test, 1000000000000ULL);
+    }
+    iperf_set_test_role(test, role);
+    return test;
+}
+
+/* A test of iters blocks, as long as the calibration makes it */
+static void
+null_run(struct bench *b, uint64_t iters)
+{
+    struct iperf_sim_link link = { 0, 0, 0 };
+    struct iperf_test *client, *server;
+
+    client = null_test(b, 'c', iters);
+    server = null_test(b, 's', 0);
+    if (client != NULL && server != NULL && iperf_sim_run(client, server, &link) < 0)
+        fprintf(stderr, "%s: %s\n", b->name, iperf_strerror(i_errno));
+    if (client)
+        iperf_free_test(client);
+    if (server)
+        iperf_free_test(server);
+}
+
+/*************************************************************/
+
+static struct bench benches[] = {
+    { "timer/create_cancel", timer_setup, timer_create_cancel, timer_teardown, 0 },
+    { "timer/timeout", timer_setup, timer_timeout, timer_teardown, 0 },
+    { "timer/run_periodic", timer_setup, timer_run_periodic, timer_teardown, 1 },
+    { "udp/send_recv/64", udp_setup, udp_send_recv, streams_teardown, 64 },
+    { "udp/send_recv/1460", udp_setup, udp_send_recv, streams_teardown, 1460 },
+    { "throttle/check", throttle_setup, throttle_check, streams_teardown, 1 },
+    { "stats/1", streams_setup, stats_callback, streams_teardown, 1 },
+    { "stats/8", streams_setup, stats_callback, streams_teardown, 8 },
+    { "stats/32", streams_setup, stats_callback, streams_teardown, 32 },
+    { "stats/128", streams_setup, stats_callback, streams_teardown, 128 },
+    { "json/render/1", json_setup, json_render, json_teardown, 1 },
+    { "json/render/8", json_setup, json_render, json_teardown, 8 },
+    { "json/render/128", json_setup, json_render, json_teardown, 128 },
+    { "json/parse/1", json_parse_setup, json_parse, json_parse_teardown, 1 },
+    { "json/parse/8", json_parse_setup, json_parse, json_parse_teardown, 8 },
+    { "json/parse/128", json_parse_setup, json_parse, json_parse_teardown, 128 },
+    { "framing/results/1", framing_setup, framing_write_read, framing_teardown, 1 },
+    { "framing/results/128", framing_setup, framing_write_read, framing_teardown, 128 },
+    { "framing/results/128/lz", framing_setup, framing_write_read, framing_teardown, -128 },
+    { "null/1", null_setup, null_run, null_teardown, 1 },
+    { "null/8", null_setup, null_run, null_teardown, 8 },
+    { "null/1/throttled", null_setup, null_run, null_teardown, -1 },
+    { NULL }
+};
+
+/* Times iters runs, in ns per run */
+static double
+sample(struct bench *b, uint64_t iters)
+{
+    uint64_t start = now_ns();
+
+    b->run(b, iters);
+    return (double) (now_ns() - start) / iters;
+}
+
+static void
+measure(struct bench *b, int samples, uint64_t min_sample_ns, struct bench_stats *st)
+{
+    double *ns, *dev, sum = 0, sq = 0;
+    uint64_t iters = 1;
+    int i;
+
+    /* Double the count until one run is long enough to time reliably */
+    while (iters < (1ULL << 40) && sample(b, iters) * iters < min_sample_ns)
+        iters *= 2;
+    sample(b, iters);
+
+    ns = calloc(samples, sizeof(double));
+    dev = calloc(samples, sizeof(double));
+    for (i = 0; i < samples; i++) {
+        ns[i] = sample(b, iters);
+        sum += ns[i];
+    }
+    qsort(ns, samples, sizeof(double), compare_double);
+
+    st->iters = iters;
+    st->min = ns[0];
+    st->max = ns[samples - 1];
+    st->median = ns[samples / 2];
+    st->p90 = ns[(samples - 1) * 9 / 10];
+    st->mean = sum / samples;
+    for (i = 0; i < samples; i++) {
+        sq += (ns[i] - st->mean) * (ns[i] - st->mean);
+        dev[i] = fabs(ns[i] - st->median);
+    }
+    st->stddev = samples > 1 ? sqrt(sq / (samples - 1)) : 0;
+    qsort(dev, samples, sizeof(double), compare_double);
+    st->mad = dev[samples / 2];
+    free(ns);
+    free(dev);
+}
+
+static int
+selected(const char *name, int npatterns, char **patterns)
+{
+    int i;
+
+    if (npatterns == 0)
+        return 1;
+    for (i = 0; i < npatterns; i++)
+        if (strstr(name, patterns[i]) != NULL)
+            return 1;
+    return 0;
+}
+
+static void
+bench_usage(void)
+{
+    fprintf(stderr, "usage: b_engine [-J] [-l] [-n samples] [-t min_sample_ms] [pattern...]\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench *b;
+    struct bench_stats st;
+    cJSON *j = NULL, *j_results = NULL;
+    char *str;
+    int samples = BENCH_SAMPLES, min_sample_ms = BENCH_MIN_SAMPLE_MS;
+    int json = 0, list = 0, rc = 0, ch;
+
+    while ((ch = getopt(argc, argv, "Jln:t:")) != -1) {
+        switch (ch) {
+            case 'J':
+                json = 1;
+                break;
+            case 'l':
+                list = 1;
+                break;
+            case 'n':
+                samples = atoi(optarg);
+                break;
+            case 't':
+                min_sample_ms = atoi(optarg);
+                break;
+            default:
+                bench_usage();
+        }
+    }
+    if (samples < 1 || min_sample_ms < 1)
+        bench_usage();
+
+    if (json) {
+        j = iperf_json_printf("version: %s  samples: %d  min_sample_ms: %d",
+                              IPERF_VERSION, (int64_t) samples, (int64_t) min_sample_ms);
+        j_results = cJSON_CreateArray();
+        cJSON_AddItemToObject(j, "benchmarks", j_results);
+    } else if (!list)
+        printf("%-24s %10s %11s %9s %11s %11s %11s\n",
+               "benchmark", "iters", "median ns", "mad %", "mean ns", "min ns", "p90 ns");
+
+    for (b = benches; b->name != NULL; b++) {
+        if (!selected(b->name, argc - optind, argv + optind))
+            continue;
+        if (list) {
+            printf("%s\n", b->name);
+            continue;
+        }
+        b->fds[0] = b->fds[1] = -1;
+        if (b->setup(b) < 0) {
+            fprintf(stderr, "%s: setup failed: %s\n", b->name, iperf_strerror(i_errno));
+            b->teardown(b);
+            rc = 1;
+            continue;
+        }
+        measure(b, samples, (uint64_t) min_sample_ms * 1000000, &st);
+        b->teardown(b);
+
+        if (json)
+            cJSON_AddItemToArray(j_results, iperf_json_printf("name: %s  iterations: %d  median_ns: %f  mad_ns: %f  mean_ns: %f  stddev_ns: %f  min_ns: %f  max_ns: %f  p90_ns: %f",
+                b->name, (int64_t) st.iters, st.median, st.mad, st.mean, st.stddev, st.min, st.max, st.p90));
+        else {
+            printf("%-24s %10llu %11.1f %9.2f %11.1f %11.1f %11.1f\n", b->name,
+                   (unsigned long long) st.iters, st.median,
+                   st.median > 0 ? 100 * st.mad / st.median : 0, st.mean, st.min, st.p90);
+            fflush(stdout);
+        }
+    }
+
+    if (json) {
+        str = cJSON_Print(j);
+        printf("%s\n", str);
+        cJSON_free(str);
+        cJSON_Delete(j);
+    }
+    exit(rc);
+}
@@ -260,6 +260,8 @@ static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
     return node;
 }
 
+static void key_index_free(cJSON * const object);
+
 /* Delete a cJSON structure. */
 CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
 {
@@ -279,6 +281,7 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
         {
             global_hooks.deallocate(item->string);
         }
+        key_index_free(item);
         global_hooks.deallocate(item);
         item = next;
     }
@@ -1888,21 +1891,165 @@ CJSON_PUBLIC(cJSON *) cJSON_GetArrayItem(const cJSON *array, int index)
     return get_array_item(array, (size_t)index);
 }
 
+#if defined(__clang__) || (defined(__GNUC__)  && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ > 5))))
+    #pragma GCC diagnostic push
+#endif
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wcast-qual"
+#endif
+/* helper function to cast away const */
+static void* cast_away_const(const void* string)
+{
+    return (void*)string;
+}
+#if defined(__clang__) || (defined(__GNUC__)  && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ > 5))))
+    #pragma GCC diagnostic pop
+#endif
+
+/* Hashed key index for objects with many members. Slots use linear probing and are
+ * filled in member order, so the first of several equal keys is still the one found. */
+typedef struct cJSON_KeyIndex
+{
+    size_t count;
+    size_t mask;
+    cJSON *slots[1];
+} cJSON_KeyIndex;
+
+#define CJSON_KEY_INDEX_DEFAULT_THRESHOLD 8
+
+static size_t key_index_threshold = CJSON_KEY_INDEX_DEFAULT_THRESHOLD;
+
+CJSON_PUBLIC(void) cJSON_SetKeyIndexThreshold(int threshold)
+{
+    key_index_threshold = (threshold > 0) ? (size_t)threshold : 0;
+}
+
+/* FNV-1a over the lower-cased key, so case-insensitive lookups hash the same way */
+static size_t key_hash(const unsigned char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *key != '\0'; key++)
+    {
+        hash ^= (uint32_t)tolower(*key);
+        hash *= 16777619u;
+    }
+
+    return (size_t)hash;
+}
+
+static void key_index_free(cJSON * const object)
+{
+    if (object->key_index != NULL)
+    {
+        global_hooks.deallocate(object->key_index);
+        object->key_index = NULL;
+    }
+}
+
+static void key_index_insert(cJSON_KeyIndex * const index, cJSON * const item)
+{
+    size_t slot = key_hash((const unsigned char*)item->string) & index->mask;
+
+    while (index->slots[slot] != NULL)
+    {
+        slot = (slot + 1) & index->mask;
+    }
+    index->slots[slot] = item;
+    index->count++;
+}
+
+/* Index all members of object, keeping the load factor at or below one half. */
+static void key_index_build(cJSON * const object)
+{
+    cJSON_KeyIndex *index = NULL;
+    cJSON *child = NULL;
+    size_t count = 0;
+    size_t slots = 16;
+
+    key_index_free(object);
+    for (child = object->child; child != NULL; child = child->next)
+    {
+        if (child->string == NULL)
+        {
+            return;
+        }
+        count++;
+    }
+    while (slots < count * 2)
+    {
+        slots *= 2;
+    }
+
+    index = (cJSON_KeyIndex*)global_hooks.allocate(sizeof(cJSON_KeyIndex) + (slots - 1) * sizeof(cJSON*));
+    if (index == NULL)
+    {
+        return;
+    }
+    memset(index, '\0', sizeof(cJSON_KeyIndex) + (slots - 1) * sizeof(cJSON*));
+    index->mask = slots - 1;
+    for (child = object->child; child != NULL; child = child->next)
+    {
+        key_index_insert(index, child);
+    }
+    object->key_index = index;
+}
+
+/* Keep an existing index in step with a member appended to the object. */
+static void key_index_append(cJSON * const object, cJSON * const item)
+{
+    if (object->key_index == NULL)
+    {
+        return;
+    }
+    if ((item->string == NULL) || ((object->key_index->count + 1) * 2 > object->key_index->mask + 1))
+    {
+        /* rebuilt on the next lookup that needs it */
+        key_index_free(object);
+        return;
+    }
+    key_index_insert(object->key_index, item);
+}
+
+static cJSON *key_index_lookup(const cJSON_KeyIndex * const index, const char * const name, const cJSON_bool case_sensitive)
+{
+    size_t slot = key_hash((const unsigned char*)name) & index->mask;
+    cJSON *candidate = NULL;
+
+    for (candidate = index->slots[slot]; candidate != NULL; candidate = index->slots[slot])
+    {
+        if (case_sensitive ? (strcmp(name, candidate->string) == 0) : (case_insensitive_strcmp((const unsigned char*)name, (const unsigned char*)candidate->string) == 0))
+        {
+            return candidate;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+
+    return NULL;
+}
+
 static cJSON *get_object_item(const cJSON * const object, const char * const name, const cJSON_bool case_sensitive)
 {
     cJSON *current_element = NULL;
+    size_t walked = 0;
 
     if ((object == NULL) || (name == NULL))
     {
         return NULL;
     }
 
+    if (object->key_index != NULL)
+    {
+        return key_index_lookup(object->key_index, name, case_sensitive);
+    }
+
     current_element = object->child;
     if (case_sensitive)
     {
         while ((current_element != NULL) && (current_element->string != NULL) && (strcmp(name, current_element->string) != 0))
         {
             current_element = current_element->next;
+            walked++;
         }
     }
     else
@@ -1910,9 +2057,17 @@ static cJSON *get_object_item(const cJSON * const object, const char * const nam
         while ((current_element != NULL) && (case_insensitive_strcmp((const unsigned char*)name, (const unsigned char*)(current_element->string)) != 0))
         {
             current_element = current_element->next;
+            walked++;
         }
     }
 
+    /* Only objects we own get an index: a reference shares members it can't track. */
+    if ((key_index_threshold > 0) && (walked >= key_index_threshold) &&
+        ((object->type & 0xFF) == cJSON_Object) && !(object->type & cJSON_IsReference))
+    {
+        key_index_build((cJSON*)cast_away_const(object));
+    }
+
     if ((current_element == NULL) || (current_element->string == NULL)) {
         return NULL;
     }
@@ -1961,6 +2116,7 @@ static cJSON *create_reference(const cJSON *item, const internal_hooks * const h
     reference->string = NULL;
     reference->type |= cJSON_IsReference;
     reference->next = reference->prev = NULL;
+    reference->key_index = NULL;
     return reference;
 }
 
@@ -1993,6 +2149,7 @@ static cJSON_bool add_item_to_array(cJSON *array, cJSON *item)
             array->child->prev = item;
         }
     }
+    key_index_append(array, item);
 
     return true;
 }
@@ -2003,22 +2160,6 @@ CJSON_PUBLIC(cJSON_bool) cJSON_AddItemToArray(cJSON *array, cJSON *item)
     return add_item_to_array(array, item);
 }
 
-#if defined(__clang__) || (defined(__GNUC__)  && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ > 5))))
-    #pragma GCC diagnostic push
-#endif
-#ifdef __GNUC__
-#pragma GCC diagnostic ignored "-Wcast-qual"
-#endif
-/* helper function to cast away const */
-static void* cast_away_const(const void* string)
-{
-    return (void*)string;
-}
-#if defined(__clang__) || (defined(__GNUC__)  && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ > 5))))
-    #pragma GCC diagnostic pop
-#endif
-
-
 static cJSON_bool add_item_to_object(cJSON * const object, const char * const string, cJSON * const item, const internal_hooks * const hooks, const cJSON_bool constant_key)
 {
     char *new_key = NULL;
@@ -2227,6 +2368,7 @@ CJSON_PUBLIC(cJSON *) cJSON_DetachItemViaPointer(cJSON *parent, cJSON * const it
     /* make sure the detached item doesn't point anywhere anymore */
     item->prev = NULL;
     item->next = NULL;
+    key_index_free(parent);
 
     return item;
 }
@@ -2286,6 +2428,7 @@ CJSON_PUBLIC(cJSON_bool) cJSON_InsertItemInArray(cJSON *array, int which, cJSON
         return add_item_to_array(array, newitem);
     }
 
+    key_index_free(array);
     newitem->next = after_inserted;
     newitem->prev = after_inserted->prev;
     after_inserted->prev = newitem;
@@ -2345,6 +2488,7 @@ CJSON_PUBLIC(cJSON_bool) cJSON_ReplaceItemViaPointer(cJSON * const parent, cJSON
     item->next = NULL;
     item->prev = NULL;
     cJSON_Delete(item);
+    key_index_free(parent);
 
     return true;
 }
@@ -25,6 +25,7 @@
  * file for complete information.
  */
 #include <errno.h>
+#include <math.h>
 #include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +39,7 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <pthread.h>
+#include <poll.h>
 #include "android_pthread_compat.h"
 
 #include "iperf.h"
@@ -46,6 +48,7 @@
 #include "iperf_locale.h"
 #include "iperf_time.h"
 #include "net.h"
+#include "iperf_tcp.h"
 #include "timer.h"
 
 #if defined(HAVE_TCP_CONGESTION)
@@ -98,87 +101,316 @@ iperf_client_worker_run(void *s) {
     return NULL;
 }
 
-int
-iperf_create_streams(struct iperf_test *test, int sender)
+/* Starts a thread for every stream without one, except those --ramp holds */
+static int
+client_start_threads(struct iperf_test *test)
 {
-    if (NULL == test)
-    {
-        iperf_err(NULL, "No test\n");
+    struct iperf_stream *sp;
+    pthread_attr_t attr;
+
+    if (pthread_attr_init(&attr) != 0) {
+        i_errno = IEPTHREADATTRINIT;
         return -1;
     }
-    int i, s;
-#if defined(HAVE_TCP_CONGESTION)
-    int saved_errno;
-#endif /* HAVE_TCP_CONGESTION */
-    struct iperf_stream *sp;
+    SLIST_FOREACH(sp, &test->streams, streams) {
+        if (sp->thread_created || sp->ramp_held)
+            continue;
+        if (pthread_create(&(sp->thr), &attr, &iperf_client_worker_run, sp) != 0) {
+            i_errno = IEPTHREADCREATE;
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+        sp->thread_created = 1;
+        if (test->debug_level >= DEBUG_LEVEL_INFO) {
+            iperf_printf(test, "Thread FD %d created\n", sp->socket);
+        }
+    }
+    if (pthread_attr_destroy(&attr) != 0) {
+        i_errno = IEPTHREADATTRDESTROY;
+        return -1;
+    }
+    return 0;
+}
+
+/* Local port of stream i with --cport, 0 to let the kernel pick one */
+static int
+stream_bind_port(struct iperf_test *test, int sender, int i)
+{
+    int port = test->bind_port;
+
+    if (port) {
+        port += i;
+        // If Bidir make sure send and receive ports are different
+        if (!sender && test->mode == BIDIRECTIONAL)
+            port += test->num_streams;
+    }
+    return port;
+}
 
+/*
+ * Start the TCP connects of all streams at once, so that -P streams cost
+ * about one round trip instead of one each, then finish them and send
+ * their cookies strictly in index order.  The server numbers streams in
+ * the order it accepts them and get_results() pairs its per-stream
+ * results with ours by that number, so it must accept them in this order
+ * too.  Where iperf_tcp_connect_start() can hold back the last ACK of the
+ * handshake until the cookie, the server accepts a stream only once its
+ * cookie arrives; elsewhere it accepts them in the order of the SYNs unless
+ * the path drops or reorders them.  --connect-timeout bounds the whole
+ * batch.
+ */
+static int
+tcp_connect_streams(struct iperf_test *test, int sender, int *fds)
+{
+    struct pollfd *pfds;
+    struct iperf_time now, deadline, diff;
+    int i, n = 0, rc, timeout, saved_errno;
     int orig_bind_port = test->bind_port;
-    for (i = 0; i < test->num_streams; ++i) {
 
+    pfds = calloc(test->num_streams, sizeof(struct pollfd));
+    if (pfds == NULL) {
+        i_errno = IECREATESTREAM;
+        return -1;
+    }
+    for (i = 0; i < test->num_streams; i++)
+        pfds[i].fd = -1;
+
+    for (i = 0; i < test->num_streams; i++) {
+        test->bind_port = stream_bind_port(test, sender, i);
+        pfds[i].fd = iperf_tcp_connect_start(test);
         test->bind_port = orig_bind_port;
-	if (orig_bind_port) {
-	    test->bind_port += i;
-            // If Bidir make sure send and receive ports are different
-            if (!sender && test->mode == BIDIRECTIONAL)
-                test->bind_port += test->num_streams;
+        if (pfds[i].fd < 0)
+            goto fail;
+        pfds[i].events = POLLOUT;
+    }
+
+    iperf_time_now(&deadline);
+    if (test->settings->connect_timeout >= 0)
+        iperf_time_add_usecs(&deadline, (int64_t) test->settings->connect_timeout * 1000);
+    while (n < test->num_streams) {
+        timeout = -1;
+        if (test->settings->connect_timeout >= 0) {
+            iperf_time_now(&now);
+            timeout = 0;
+            if (iperf_time_diff(&deadline, &now, &diff) == 0)
+                timeout = (iperf_time_in_usecs(&diff) + 999) / 1000;
         }
-        s = test->protocol->connect(test);
-        test->bind_port = orig_bind_port;
-        if (s < 0)
-            return -1;
+        rc = poll(&pfds[n], 1, timeout);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0) {
+            if (rc == 0)
+                errno = ETIMEDOUT;
+            i_errno = IESTREAMCONNECT;
+            goto fail;
+        }
+        fds[n] = pfds[n].fd;
+        pfds[n].fd = -1;
+        if (iperf_tcp_connect_finish(test, fds[n]) < 0)
+            goto fail;
+        n++;
+    }
+    free(pfds);
+    return n;
+
+  fail:
+    saved_errno = errno;
+    for (i = 0; i < test->num_streams; i++)
+        if (pfds[i].fd >= 0)
+            close(pfds[i].fd);
+    while (n > 0)
+        close(fds[--n]);
+    free(pfds);
+    errno = saved_errno;
+    return -1;
+}
 
+/* Turn a connected socket into a stream, closing it on failure */
+static int
+client_new_stream(struct iperf_test *test, int s, int sender)
+{
 #if defined(HAVE_TCP_CONGESTION)
-	if (test->protocol->id == Ptcp) {
-	    if (test->congestion) {
-		if (setsockopt(s, IPPROTO_TCP, TCP_CONGESTION, test->congestion, strlen(test->congestion)) < 0) {
-		    saved_errno = errno;
-		    close(s);
-		    errno = saved_errno;
-		    i_errno = IESETCONGESTION;
-		    return -1;
-		}
-	    }
-	    {
-		socklen_t len = TCP_CA_NAME_MAX;
-		char ca[TCP_CA_NAME_MAX + 1];
-                int rc;
-		rc = getsockopt(s, IPPROTO_TCP, TCP_CONGESTION, ca, &len);
-                if (rc < 0 && test->congestion) {
-		    saved_errno = errno;
-		    close(s);
-		    errno = saved_errno;
-		    i_errno = IESETCONGESTION;
-		    return -1;
-		}
-	        if (test->congestion_used) {
-	          if (test->debug)
-	            printf("Overriding existing congestion algorithm: %s\n", test->congestion_used);
-	          free(test->congestion_used);
-	        }
-                // Set actual used congestion alg, or set to unknown if could not get it
-                if (rc < 0)
-                    test->congestion_used = strdup("unknown");
-                else
-                    test->congestion_used = strdup(ca);
-		if (test->debug) {
-		    printf("Congestion algorithm is %s\n", test->congestion_used);
-		}
-	    }
-	}
+    int saved_errno;
 #endif /* HAVE_TCP_CONGESTION */
+    struct iperf_stream *sp;
 
-        sp = iperf_new_stream(test, s, sender);
-        if (!sp)
-            return -1;
+#if defined(HAVE_TCP_CONGESTION)
+    if (test->protocol->id == Ptcp) {
+        if (test->congestion) {
+            if (setsockopt(s, IPPROTO_TCP, TCP_CONGESTION, test->congestion, strlen(test->congestion)) < 0) {
+                saved_errno = errno;
+                close(s);
+                errno = saved_errno;
+                i_errno = IESETCONGESTION;
+                return -1;
+            }
+        }
+        {
+            socklen_t len = TCP_CA_NAME_MAX;
+            char ca[TCP_CA_NAME_MAX + 1];
+            int rc;
+            rc = getsockopt(s, IPPROTO_TCP, TCP_CONGESTION, ca, &len);
+            if (rc < 0 && test->congestion) {
+                saved_errno = errno;
+                close(s);
+                errno = saved_errno;
+                i_errno = IESETCONGESTION;
+                return -1;
+            }
+            if (test->congestion_used) {
+                if (test->debug)
+                    printf("Overriding existing congestion algorithm: %s\n", test->congestion_used);
+                free(test->congestion_used);
+            }
+            // Set actual used congestion alg, or set to unknown if could not get it
+            if (rc < 0)
+                test->congestion_used = strdup("unknown");
+            else
+                test->congestion_used = strdup(ca);
+            if (test->debug) {
+                printf("Congestion algorithm is %s\n", test->congestion_used);
+            }
+        }
+    }
+#endif /* HAVE_TCP_CONGESTION */
+
+    sp = iperf_new_stream(test, s, sender);
+    if (!sp)
+        return -1;
 
-        /* Perform the new stream callback */
-        if (test->on_new_stream)
-            test->on_new_stream(sp);
+    /* Perform the new stream callback */
+    if (test->on_new_stream)
+        test->on_new_stream(sp);
+    return 0;
+}
+
+int
+iperf_create_streams(struct iperf_test *test, int sender)
+{
+    if (NULL == test)
+    {
+        iperf_err(NULL, "No test\n");
+        return -1;
+    }
+    struct iperf_time start, end, diff;
+    int i, n, *fds;
+    int orig_bind_port = test->bind_port;
+
+    fds = calloc(test->num_streams, sizeof(int));
+    if (fds == NULL) {
+        i_errno = IECREATESTREAM;
+        return -1;
+    }
+
+    iperf_time_now(&start);
+    if (test->protocol->id == Ptcp)
+        n = tcp_connect_streams(test, sender, fds);
+    else {
+        for (n = 0; n < test->num_streams; n++) {
+            test->bind_port = stream_bind_port(test, sender, n);
+            fds[n] = test->protocol->connect(test);
+            test->bind_port = orig_bind_port;
+            if (fds[n] < 0)
+                break;
+        }
+        if (n < test->num_streams) {
+            while (n > 0)
+                close(fds[--n]);
+            n = -1;
+        }
     }
+    iperf_time_now(&end);
+    iperf_time_diff(&end, &start, &diff);
+    test->stream_connect_usecs += iperf_time_in_usecs(&diff);
+    if (n < 0) {
+        free(fds);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (client_new_stream(test, fds[i], sender) < 0) {
+            while (++i < n)
+                close(fds[i]);
+            free(fds);
+            return -1;
+        }
+    }
+    free(fds);
+    return 0;
+}
 
+static int
+client_create_streams(struct iperf_test *test)
+{
+    if (test->mode == BIDIRECTIONAL)
+    {
+        if (iperf_create_streams(test, 1) < 0)
+            return -1;
+        if (iperf_create_streams(test, 0) < 0)
+            return -1;
+    }
+    else if (iperf_create_streams(test, test->mode) < 0)
+        return -1;
+    iperf_time_now(&test->startup.streams);
     return 0;
 }
 
+/*
+ * Servers that have answered a fast-start cookie without PARAM_EXCHANGE.
+ * Later tests to them connect their data streams right behind the
+ * parameters, which the server then accepts as soon as it has read them.
+ * Shared by all tests in the process, so it is protected by a mutex.
+ */
+#define FAST_START_SERVERS 16
+
+static pthread_mutex_t fast_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    char *host;
+    int port;
+} fast_start_servers[FAST_START_SERVERS];
+static int fast_start_next;
+
+static int
+fast_start_server_known(struct iperf_test *test)
+{
+    int i, found = 0;
+
+    pthread_mutex_lock(&fast_start_mutex);
+    for (i = 0; i < FAST_START_SERVERS && !found; i++)
+        if (fast_start_servers[i].host != NULL &&
+            fast_start_servers[i].port == test->server_port &&
+            strcmp(fast_start_servers[i].host, test->server_hostname) == 0)
+            found = 1;
+    pthread_mutex_unlock(&fast_start_mutex);
+    return found;
+}
+
+static void
+fast_start_server_remember(struct iperf_test *test)
+{
+    if (fast_start_server_known(test))
+        return;
+    pthread_mutex_lock(&fast_start_mutex);
+    free(fast_start_servers[fast_start_next].host);
+    fast_start_servers[fast_start_next].host = strdup(test->server_hostname);
+    fast_start_servers[fast_start_next].port = test->server_port;
+    fast_start_next = (fast_start_next + 1) % FAST_START_SERVERS;
+    pthread_mutex_unlock(&fast_start_mutex);
+}
+
+/*
+ * Early connects rely on the server's listening socket staying the same
+ * across the parameter exchange, which iperf_tcp_listen() only guarantees
+ * when none of these options are set.
+ */
+static int
+fast_start_early_connect(struct iperf_test *test)
+{
+    return test->protocol->id == Ptcp && !test->no_delay && !test->mptcp &&
+        !test->settings->mss && !test->settings->socket_bufsize &&
+        fast_start_server_known(test);
+}
+
 static void
 test_timer_proc(TimerClientData client_data, struct iperf_time *nowP)
 {
@@ -195,6 +427,13 @@ client_stats_timer_proc(TimerClientData client_data, struct iperf_time *nowP)
 
     if (test->done)
         return;
+    /* Streams released here start sending in the next interval */
+    iperf_check_ramp(test);
+    /* Converged: the main loop closes this interval as the last one */
+    if (iperf_check_converge(test)) {
+        test->done = 1;
+        return;
+    }
     if (test->stats_callback)
 	test->stats_callback(test);
 }
@@ -214,6 +453,7 @@ static int
 create_client_timers(struct iperf_test * test)
 {
     struct iperf_time now;
+    struct iperf_stream *sp;
     TimerClientData cd;
     if (NULL == test)
     {
@@ -230,21 +470,40 @@ create_client_timers(struct iperf_test * test)
     test->timer = test->stats_timer = test->reporter_timer = NULL;
     if (test->duration != 0) {
 	test->done = 0;
-        test->timer = tmr_create(&now, test_timer_proc, cd, ( test->duration + test->omit ) * SEC_TO_US, 0);
+        test->timer = tmr_create_q(test->timers, &now, test_timer_proc, cd, ( test->duration + test->omit ) * SEC_TO_US, 0);
         if (test->timer == NULL) {
             i_errno = IEINITTEST;
             return -1;
 	}
     }
     if (test->stats_interval != 0) {
-        test->stats_timer = tmr_create(&now, client_stats_timer_proc, cd, test->stats_interval * SEC_TO_US, 1);
+        test->stats_timer = tmr_create_q(test->timers, &now, client_stats_timer_proc, cd, test->stats_interval * SEC_TO_US, 1);
         if (test->stats_timer == NULL) {
             i_errno = IEINITTEST;
             return -1;
 	}
+        /* A window of intervals covering the --converge seconds */
+        if (test->converge_min > 0) {
+            test->converge = iperf_converge_new((int) ceil(test->converge_min / test->stats_interval), test->converge_tolerance);
+            if (test->converge == NULL) {
+                i_errno = IEINITTEST;
+                return -1;
+            }
+        }
+        /* --ramp sends on the first stream only, and releases the others one by one */
+        if (test->ramp_gain > 0 && test->mode == SENDER) {
+            test->ramp = iperf_ramp_new(test->num_streams, test->ramp_gain);
+            if (test->ramp == NULL) {
+                i_errno = IEINITTEST;
+                return -1;
+            }
+            SLIST_FOREACH(sp, &test->streams, streams)
+                sp->ramp_held = sp != SLIST_FIRST(&test->streams);
+            cpu_util(&test->ramp_cpu, NULL);
+        }
     }
     if (test->reporter_interval != 0) {
-        test->reporter_timer = tmr_create(&now, client_reporter_timer_proc, cd, test->reporter_interval * SEC_TO_US, 1);
+        test->reporter_timer = tmr_create_q(test->timers, &now, client_reporter_timer_proc, cd, test->reporter_interval * SEC_TO_US, 1);
         if (test->reporter_timer == NULL) {
             i_errno = IEINITTEST;
             return -1;
@@ -292,7 +551,10 @@ create_client_omit_timer(struct iperf_test * test)
 	}
 	test->omitting = 1;
 	cd.p = test;
-	test->omit_timer = tmr_create(&now, client_omit_timer_proc, cd, test->omit * SEC_TO_US, 0);
+	/* A microsecond past the interval timers, so that the last omitted
+	 * interval still closes first when the clock has not moved since
+	 * they were set (always, on a virtual clock) */
+	test->omit_timer = tmr_create_q(test->timers, &now, client_omit_timer_proc, cd, test->omit * SEC_TO_US + 1, 0);
 	if (test->omit_timer == NULL) {
 	    i_errno = IEINITTEST;
 	    return -1;
@@ -335,23 +597,27 @@ iperf_handle_message_client(struct iperf_test *test)
 
     switch (test->state) {
         case PARAM_EXCHANGE:
+            if (test->fast_start) {
+                /* Parameters already sent behind the cookie; the server predates fast-start */
+                test->fast_start_server = 0;
+                break;
+            }
             if (iperf_exchange_parameters(test) < 0)
                 return -1;
             if (test->on_connect)
                 test->on_connect(test);
             break;
         case CREATE_STREAMS:
-            if (test->mode == BIDIRECTIONAL)
-            {
-                if (iperf_create_streams(test, 1) < 0)
-                    return -1;
-                if (iperf_create_streams(test, 0) < 0)
+            iperf_time_now(&test->startup.create_streams);
+            if (test->fast_start_server)
+                fast_start_server_remember(test);
+            /* Unless they were already connected early */
+            if (SLIST_EMPTY(&test->streams))
+                if (client_create_streams(test) < 0)
                     return -1;
-            }
-            else if (iperf_create_streams(test, test->mode) < 0)
-                return -1;
             break;
         case TEST_START:
+            iperf_time_now(&test->startup.test_start);
             if (iperf_init_test(test) < 0)
                 return -1;
             if (create_client_timers(test) < 0)
@@ -362,7 +628,13 @@ iperf_handle_message_client(struct iperf_test *test)
 		if (iperf_create_send_timers(test) < 0)
 		    return -1;
             break;
+        case COMPRESS_ACCEPTED:
+            /* The server decodes compressed messages too, not just sends them */
+            test->compress_ok = 1;
+            break;
         case TEST_RUNNING:
+            iperf_time_now(&test->startup.test_running);
+            iperf_print_startup(test);
             break;
         case EXCHANGE_RESULTS:
             if (iperf_exchange_results(test) < 0)
@@ -383,7 +655,7 @@ iperf_handle_message_client(struct iperf_test *test)
 	     * ending summary statistics.
 	     */
 	    signed char oldstate = test->state;
-	    cpu_util(test->cpu_util);
+	    cpu_util(&test->cpu_state, test->cpu_util);
 	    test->state = DISPLAY_RESULTS;
 	    test->reporter_callback(test);
 	    test->state = oldstate;
@@ -429,11 +701,21 @@ iperf_connect(struct iperf_test *test)
     FD_ZERO(&test->write_set);
 
     make_cookie(test->cookie);
+    if (test->fast_start)
+        test->cookie[0] = COOKIE_FAST_START;
+
+    iperf_time_now(&test->startup.begin);
+
+    /* Resolve the server once for the control channel and all streams */
+    if (iperf_resolve_addresses(test) < 0) {
+        i_errno = IECONNECT;
+        return -1;
+    }
 
     /* Create and connect the control channel */
     if (test->ctrl_sck < 0)
 	// Create the control channel using an ephemeral port
-	test->ctrl_sck = netdial(test->settings->domain, Ptcp, test->bind_address, test->bind_dev, 0, test->server_hostname, test->server_port, test->settings->connect_timeout);
+	test->ctrl_sck = netdial_addr(Ptcp, test->bind_addrinfo, test->bind_dev, 0, test->server_addrinfo, test->settings->connect_timeout);
     if (test->ctrl_sck < 0) {
         i_errno = IECONNECT;
         return -1;
@@ -465,6 +747,7 @@ iperf_connect(struct iperf_test *test)
         i_errno = IESENDCOOKIE;
         return -1;
     }
+    iperf_time_now(&test->startup.connected);
 
     FD_SET(test->ctrl_sck, &test->read_set);
     if (test->ctrl_sck > test->max_fd) test->max_fd = test->ctrl_sck;
@@ -532,6 +815,23 @@ iperf_connect(struct iperf_test *test)
 	}
     }
 
+    /*
+     * Fast start: send the parameters right behind the cookie.  The byte
+     * stream is what the server reads anyway, so older servers still work;
+     * they just send PARAM_EXCHANGE, which is then ignored.  The UDP block
+     * size above has to be settled first.
+     */
+    if (test->fast_start) {
+        if (iperf_exchange_parameters(test) < 0)
+            return -1;
+        test->fast_start_server = 1;
+        if (test->on_connect)
+            test->on_connect(test);
+        if (fast_start_early_connect(test))
+            if (client_create_streams(test) < 0)
+                return -1;
+    }
+
     return 0;
 }
 
@@ -619,7 +919,7 @@ iperf_run_client(struct iperf_test * test)
         goto cleanup_and_fail;
 
     /* Begin calculating CPU utilization */
-    cpu_util(NULL);
+    cpu_util(&test->cpu_state, NULL);
     if (test->mode != SENDER)
         rcv_timeout_us = (test->settings->rcv_timeout.secs * SEC_TO_US) + test->settings->rcv_timeout.usecs;
     else
@@ -633,7 +933,7 @@ iperf_run_client(struct iperf_test * test)
 	memcpy(&read_set, &test->read_set, sizeof(fd_set));
 	memcpy(&write_set, &test->write_set, sizeof(fd_set));
 	iperf_time_now(&now);
-	timeout = tmr_timeout(&now);
+	timeout = tmr_timeout_q(test->timers, &now);
 
         // In reverse active mode client ensures data is received
         if (test->state == TEST_RUNNING && rcv_timeout_us > 0) {
@@ -712,35 +1012,21 @@ iperf_run_client(struct iperf_test * test)
 	        startup = 0;
 
                 /* Create and spin up threads */
-                pthread_attr_t attr;
-                if (pthread_attr_init(&attr) != 0) {
-                    i_errno = IEPTHREADATTRINIT;
+                if (client_start_threads(test) < 0)
                     goto cleanup_and_fail;
-                }
-
-                SLIST_FOREACH(sp, &test->streams, streams) {
-                    if (pthread_create(&(sp->thr), &attr, &iperf_client_worker_run, sp) != 0) {
-                        i_errno = IEPTHREADCREATE;
-                        goto cleanup_and_fail;
-                    }
-                    sp->thread_created = 1;
-                    if (test->debug_level >= DEBUG_LEVEL_INFO) {
-                        iperf_printf(test, "Thread FD %d created\n", sp->socket);
-                    }
-                }
                 if (test->debug_level >= DEBUG_LEVEL_INFO) {
                     iperf_printf(test, "All threads created\n");
                 }
-                if (pthread_attr_destroy(&attr) != 0) {
-                    i_errno = IEPTHREADATTRDESTROY;
-                    goto cleanup_and_fail;
-                }
 
 	    }
 
             /* Run the timers. */
             iperf_time_now(&now);
-            tmr_run(&now);
+            tmr_run_q(test->timers, &now);
+
+            /* Spin up the streams the --ramp has just released */
+            if (test->ramp && !test->done && client_start_threads(test) < 0)
+                goto cleanup_and_fail;
 
 	    /*
 	     * Is the test done yet?  We have to be out of omitting
@@ -790,7 +1076,7 @@ iperf_run_client(struct iperf_test * test)
 
 		/* Yes, done!  Send TEST_END. */
 		test->done = 1;
-		cpu_util(test->cpu_util);
+		cpu_util(&test->cpu_state, test->cpu_util);
 		test->stats_callback(test);
 		if (iperf_set_send_state(test, TEST_END) != 0)
                     goto cleanup_and_fail;
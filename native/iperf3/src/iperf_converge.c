@@ -0,0 +1,129 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "iperf_converge.h"
+
+struct iperf_converge
+{
+    double   *rates;		/* ring of the window's interval rates */
+    int       window;
+    int       count;		/* added so far, up to window */
+    int       next;		/* where the next one goes */
+    double    tolerance;
+};
+
+/* t for 1 to 30 degrees of freedom */
+static const double t95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+double
+iperf_converge_t95(int df)
+{
+    if (df < 1)
+        return INFINITY;
+    if (df <= (int) (sizeof(t95) / sizeof(t95[0])))
+        return t95[df - 1];
+    /* The first terms of the Cornish-Fisher expansion about z = 1.960 */
+    return 1.960 + 2.372 / df;
+}
+
+struct iperf_converge *
+iperf_converge_new(int window, double tolerance)
+{
+    struct iperf_converge *cv;
+
+    cv = calloc(1, sizeof(*cv));
+    if (cv == NULL)
+        return NULL;
+    cv->window = window > IPERF_CONVERGE_MIN_WINDOW ? window : IPERF_CONVERGE_MIN_WINDOW;
+    cv->tolerance = tolerance;
+    cv->rates = calloc(cv->window, sizeof(double));
+    if (cv->rates == NULL) {
+        free(cv);
+        return NULL;
+    }
+    return cv;
+}
+
+void
+iperf_converge_free(struct iperf_converge *cv)
+{
+    if (cv == NULL)
+        return;
+    free(cv->rates);
+    free(cv);
+}
+
+void
+iperf_converge_reset(struct iperf_converge *cv)
+{
+    cv->count = cv->next = 0;
+}
+
+void
+iperf_converge_estimate(struct iperf_converge *cv, struct iperf_converge_estimate *estimate)
+{
+    double sum = 0, sq = 0, mean;
+    int i, n = cv->count;
+
+    estimate->intervals = n;
+    estimate->bits_per_second = estimate->ci_bits_per_second = estimate->relative_ci = 0;
+    if (n == 0)
+        return;
+    for (i = 0; i < n; i++)
+        sum += cv->rates[i];
+    mean = sum / n;
+    estimate->bits_per_second = mean;
+    if (n < 2)
+        return;
+    for (i = 0; i < n; i++)
+        sq += (cv->rates[i] - mean) * (cv->rates[i] - mean);
+    estimate->ci_bits_per_second = iperf_converge_t95(n - 1) * sqrt(sq / (n - 1) / n);
+    if (mean > 0)
+        estimate->relative_ci = estimate->ci_bits_per_second / mean;
+}
+
+int
+iperf_converge_add(struct iperf_converge *cv, double bits_per_second)
+{
+    struct iperf_converge_estimate estimate;
+
+    cv->rates[cv->next] = bits_per_second;
+    cv->next = (cv->next + 1) % cv->window;
+    if (cv->count < cv->window)
+        ++cv->count;
+    if (cv->count < cv->window)
+        return 0;
+
+    iperf_converge_estimate(cv, &estimate);
+    return estimate.bits_per_second > 0 && estimate.relative_ci <= cv->tolerance;
+}
@@ -34,9 +34,7 @@
 #include "iperf.h"
 #include "iperf_api.h"
 
-int gerror;
-
-char iperf_timestrerr[100];
+IPERF_THREAD_LOCAL int gerror;
 
 /* Do a printf to stderr. */
 void
@@ -45,15 +43,16 @@ iperf_err(struct iperf_test *test, const char *format, ...)
     va_list argp;
     char str[1000];
     time_t now;
-    struct tm *ltm = NULL;
+    struct tm ltm;
+    char timestr[100];
     char *ct = NULL;
 
     /* Timestamp if requested */
     if (test != NULL && test->timestamps) {
 	time(&now);
-	ltm = localtime(&now);
-	strftime(iperf_timestrerr, sizeof(iperf_timestrerr), test->timestamp_format, ltm);
-	ct = iperf_timestrerr;
+	localtime_r(&now, &ltm);
+	strftime(timestr, sizeof(timestr), test->timestamp_format, &ltm);
+	ct = timestr;
     }
 
     va_start(argp, format);
@@ -112,15 +111,16 @@ iperf_exit(struct iperf_test *test, int exit_code, const char *format, va_list a
 {
     char str[1000];
     time_t now;
-    struct tm *ltm = NULL;
+    struct tm ltm;
+    char timestr[100];
     char *ct = NULL;
 
     /* Timestamp if requested */
     if (test != NULL && test->timestamps) {
 	time(&now);
-	ltm = localtime(&now);
-	strftime(iperf_timestrerr, sizeof(iperf_timestrerr), iperf_get_test_timestamp_format(test), ltm);
-	ct = iperf_timestrerr;
+	localtime_r(&now, &ltm);
+	strftime(timestr, sizeof(timestr), iperf_get_test_timestamp_format(test), &ltm);
+	ct = timestr;
     }
 
     vsnprintf(str, sizeof(str), format, argp);
@@ -158,12 +158,12 @@ iperf_exit(struct iperf_test *test, int exit_code, const char *format, va_list a
     exit(exit_code);
 }
 
-int i_errno;
+IPERF_THREAD_LOCAL int i_errno;
 
 char *
 iperf_strerror(int int_errno)
 {
-    static char errstr[256];
+    static IPERF_THREAD_LOCAL char errstr[256];
     int len, perr, herr;
     perr = herr = 0;
 
@@ -533,6 +533,24 @@ iperf_strerror(int int_errno)
             snprintf(errstr, len, "control connection Keepalive period should be larger than the full retry period (interval * count)");
             perr = 1;
             break;
+        case IEJSONDETAIL:
+            snprintf(errstr, len, "bad JSON detail level (must be sums, streams or full)");
+            break;
+        case IECOMPRESS:
+            snprintf(errstr, len, "bad compression threshold (must be a positive number of bytes)");
+            break;
+        case IEMICROBURST:
+            snprintf(errstr, len, "bad microburst stall threshold (must be a positive number of ms)");
+            break;
+        case IECONVERGE:
+            snprintf(errstr, len, "bad --converge (needs positive seconds and percent, a time-limited test and interval reports)");
+            break;
+        case IERAMP:
+            snprintf(errstr, len, "bad --ramp (needs a positive percent, a client sending without -R or --bidir, and interval reports)");
+            break;
+        case IESEARCH:
+            snprintf(errstr, len, "bad --search (needs a percent under 100, block sizes UDP allows, and a UDP client test with a -b and -t limit, without --bidir, --converge or --ramp)");
+            break;
         case IESETCNTLKA:
             snprintf(errstr, len, "unable to set socket keepalive (SO_KEEPALIVE) option");
             perr = 1;
@@ -118,10 +118,15 @@ const char usage_longstr[] = "Usage: iperf3 [-s|-c host] [options]\n"
                            "  -V, --verbose             more detailed output\n"
                            "  -J, --json                output in JSON format\n"
                            "  --json-stream             output in line-delimited JSON format\n"
+                           "  --json-detail sums|streams|full\n"
+                           "                            JSON detail: interval and end sums only, plus\n"
+                           "                            per-stream objects, or also TCP_INFO fields (default)\n"
                            "  --logfile f               send output to a log file\n"
                            "  --forceflush              force flushing output at every interval\n"
                            "  --timestamps<=format>     emit a timestamp at the start of each output line\n"
                            "                            (optional \"=\" and format string as per strftime(3))\n"
+                           "  --microburst[=#]          record throughput in 1 ms buckets and report peaks and\n"
+                           "                            stalls of at least # ms (default %d ms)\n"
 
                            "  --rcv-timeout #           idle timeout for receiving data (default %d ms)\n"
 #if defined(HAVE_TCP_USER_TIMEOUT)
@@ -167,6 +172,10 @@ const char usage_longstr[] = "Usage: iperf3 [-s|-c host] [options]\n"
 #endif /* HAVE_SCTP_H */
                            "  -u, --udp                 use UDP rather than TCP\n"
                            "  --connect-timeout #       timeout for control connection setup (ms)\n"
+                           "  --fast-start              send parameters with the cookie and, to servers\n"
+                           "                            known to support it, connect streams early\n"
+                           "  --compress[=#[KMG]]       compress control messages of at least # bytes\n"
+                           "                            (default %d) if the server supports it\n"
                            "  -b, --bitrate #[KMG][/#]  target bitrate in bits/sec (0 for unlimited)\n"
                            "                            (default %d Mbit/sec for UDP, unlimited for TCP)\n"
                            "                            (optional slash and packet count for burst mode)\n"
@@ -177,6 +186,9 @@ const char usage_longstr[] = "Usage: iperf3 [-s|-c host] [options]\n"
 			   "                            bits/sec (Linux only)\n"
 #endif
                            "  -t, --time      #         time in seconds to transmit for (default %d secs)\n"
+                           "  --converge[=#[/#]]        end the test once the last # seconds of intervals agree\n"
+                           "                            to within # percent at 95%% confidence (default %d/%d),\n"
+                           "                            or at -t otherwise\n"
                            "  -n, --bytes     #[KMG]    transmit until the end of the interval when the client sent or received\n"
                            "                            (per direction) at least this number of bytes (instead of -t or -k)\n"
                            "  -k, --blockcount #[KMG]   transmit until the end of the interval when the client sent or received\n"
@@ -185,6 +197,12 @@ const char usage_longstr[] = "Usage: iperf3 [-s|-c host] [options]\n"
 			   "                            (default %d KB for TCP, dynamic or %d for UDP)\n"
                            "  --cport         <port>    bind to a specific client port (TCP and UDP, default: ephemeral port)\n"
                            "  -P, --parallel  #         number of parallel client streams to run\n"
+                           "  --ramp[=#]                send on one stream at first and add one every %d\n"
+                           "                            intervals until the last adds under # percent (default %d),\n"
+                           "                            up to -P streams (default %d)\n"
+                           "  --search[=#[/#,...]]      with -u, search for the highest rate up to -b (default\n"
+                           "                            %d Mbit/sec) that loses at most # percent (default 0),\n"
+                           "                            in -t second trials (default %d), at each listed -l\n"
                            "  -R, --reverse             run in reverse mode (server sends, client receives)\n"
                            "  --bidir                   run in bidirectional mode.\n"
                            "                            Client and server send and receive data.\n"
@@ -345,6 +363,54 @@ const char report_window[] =
 const char report_autotune[] =
 "Using TCP Autotuning\n";
 
+const char report_stream_setup[] =
+"Stream setup: %d streams connected in %.3f ms, set up in %.3f ms, shared payload %" PRId64 " bytes, max RSS %" PRId64 " KB\n";
+
+const char report_compress[] =
+"Control compression: sent %" PRIu64 " -> %" PRIu64 " bytes, received %" PRIu64 " -> %" PRIu64 " bytes, %.3f ms%s\n";
+
+const char report_converged[] =
+"Converged after %.2f sec: %ss/sec +/- %.1f%% at 95%% confidence over %d intervals\n";
+
+const char report_not_converged[] =
+"Not converged (%s): %ss/sec +/- %.1f%% at 95%% confidence over %d intervals, wanted %.1f%%\n";
+
+const char report_ramp_header[] =
+"Ramp  Streams  Bitrate              Gain      CPU\n";
+
+const char report_ramp_step[] =
+"Ramp  %7d  %ss/sec  %s  %s\n";
+
+const char report_ramp_saturated[] =
+"Ramp saturated at %d streams: the next added under %.1f%%\n";
+
+const char report_ramp_cpu[] =
+"Ramp saturated at %d streams: CPU use reached %.0f%%\n";
+
+const char report_ramp_not_saturated[] =
+"Ramp not saturated (%s) at %d streams\n";
+
+const char report_search_start[] =
+"Search up to %ss/sec in %d second trials, passing at most %.3f%% lost\n";
+
+const char report_search_header[] =
+"Search  Blksize  Offered              Received             Lost/Total Datagrams     Jitter\n";
+
+const char report_search_trial[] =
+"Search  %7d  %ss/sec  %ss/sec  %" PRId64 "/%" PRId64 " (%.3g%%)  %.3f ms  %s\n";
+
+const char report_search_max[] =
+"Search at %d byte blocks: %ss/sec after %d trials\n";
+
+const char report_search_none[] =
+"Search at %d byte blocks: no rate lost %.3f%% or less after %d trials\n";
+
+const char report_microburst[] =
+"[%3d]%s   1 ms peak %ss/sec, cv %.2f, %" PRId64 " stalls, longest %" PRId64 " ms\n";
+
+const char report_startup[] =
+"Startup: connected %.1f ms, create streams %.1f ms, streams connected %.1f ms, test start %.1f ms, running %.1f ms%s\n";
+
 const char report_omit_done[] =
 "Finished omit period, starting real test\n";
 
@@ -0,0 +1,244 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iperf_config.h"
+#include "iperf.h"
+#include "iperf_microburst.h"
+
+struct iperf_microburst
+{
+    atomic_uint_fast64_t *buckets;	/* bytes per bucket, indexed modulo the ring */
+    uint64_t  mask;			/* ring size - 1 */
+    struct iperf_time origin;		/* start of bucket 0 */
+    /*
+     * One past the newest bucket the stream has reached.  The stream
+     * clears the buckets it skips before moving this on, so anything
+     * below it is final once its time is past.
+     */
+    atomic_uint_fast64_t reached;
+    /* Everything below belongs to the main thread */
+    uint64_t  base;			/* first bucket since the last restart */
+    uint64_t  closed;			/* first bucket of the open interval */
+    uint64_t  stall_buckets;
+    uint64_t  zero_run;			/* empty buckets at the end of the closed ones */
+    struct iperf_microburst_summary total;
+    double    total_sum_sq;		/* of bytes per bucket, for the total cv */
+};
+
+static uint64_t
+bucket_of(struct iperf_microburst *mb, struct iperf_time *t)
+{
+    struct iperf_time diff;
+
+    /* iperf_time_diff() returns 1 when t is not after the origin */
+    if (iperf_time_diff(t, &mb->origin, &diff))
+        return 0;
+    return iperf_time_in_usecs(&diff) / IPERF_MICROBURST_BUCKET_USECS;
+}
+
+struct iperf_microburst *
+iperf_microburst_new(int stall_ms, uint64_t capacity)
+{
+    struct iperf_microburst *mb;
+    uint64_t size = 1;
+
+    if (capacity > IPERF_MICROBURST_MAX_BUCKETS)
+        capacity = IPERF_MICROBURST_MAX_BUCKETS;
+    while (size < capacity)
+        size <<= 1;
+
+    mb = (struct iperf_microburst *) calloc(1, sizeof(*mb));
+    if (mb == NULL)
+        return NULL;
+    mb->buckets = (atomic_uint_fast64_t *) calloc(size, sizeof(*mb->buckets));
+    if (mb->buckets == NULL) {
+        free(mb);
+        return NULL;
+    }
+    mb->mask = size - 1;
+    mb->stall_buckets = stall_ms > 0 ? (uint64_t) stall_ms * 1000 / IPERF_MICROBURST_BUCKET_USECS : 1;
+    if (mb->stall_buckets == 0)
+        mb->stall_buckets = 1;
+    iperf_time_now(&mb->origin);
+    return mb;
+}
+
+void
+iperf_microburst_free(struct iperf_microburst *mb)
+{
+    if (mb == NULL)
+        return;
+    free(mb->buckets);
+    free(mb);
+}
+
+void
+iperf_microburst_start(struct iperf_microburst *mb, struct iperf_time *now)
+{
+    uint64_t i;
+
+    for (i = 0; i <= mb->mask; ++i)
+        mb->buckets[i] = 0;
+    mb->origin = *now;
+    mb->reached = 0;
+    mb->base = 0;
+    mb->closed = 0;
+    mb->zero_run = 0;
+    memset(&mb->total, 0, sizeof(mb->total));
+    mb->total_sum_sq = 0;
+}
+
+void
+iperf_microburst_restart(struct iperf_microburst *mb, struct iperf_time *now)
+{
+    struct iperf_microburst_summary omitted;
+
+    iperf_microburst_close(mb, now, &omitted);
+    mb->base = mb->closed;
+    mb->zero_run = 0;
+    memset(&mb->total, 0, sizeof(mb->total));
+    mb->total_sum_sq = 0;
+}
+
+void
+iperf_microburst_add(struct iperf_microburst *mb, struct iperf_time *now, uint64_t bytes)
+{
+    uint64_t b = bucket_of(mb, now);
+    uint64_t reached = mb->reached;
+
+    if (b >= reached) {
+        /* Entering a new bucket: clear the ones skipped, at most the ring */
+        uint64_t from = reached;
+        if (b - from > mb->mask)
+            from = b - mb->mask;
+        for (; from <= b; ++from)
+            mb->buckets[from & mb->mask] = 0;
+        mb->reached = b + 1;
+    } else if (b + 1 < reached) {
+        b = reached - 1;	/* never write behind the newest bucket */
+    }
+    mb->buckets[b & mb->mask] += bytes;
+}
+
+static void
+summary_add_stall(struct iperf_microburst_summary *s, uint64_t run)
+{
+    int64_t ms = run * IPERF_MICROBURST_BUCKET_USECS / 1000;
+
+    ++s->stalls;
+    s->stall_ms += ms;
+    if (ms > s->longest_stall_ms)
+        s->longest_stall_ms = ms;
+}
+
+static double
+coefficient_of_variation(uint64_t n, double sum, double sum_sq)
+{
+    double mean, var;
+
+    if (n == 0 || sum <= 0)
+        return 0;
+    mean = sum / n;
+    var = sum_sq / n - mean * mean;
+    return var > 0 ? sqrt(var) / mean : 0;
+}
+
+void
+iperf_microburst_close(struct iperf_microburst *mb, struct iperf_time *end,
+                       struct iperf_microburst_summary *interval)
+{
+    uint64_t last = bucket_of(mb, end);	/* the bucket holding end is still open */
+    uint64_t reached = mb->reached;
+    uint64_t horizon = last > reached ? last : reached;
+    uint64_t b, bytes, peak = 0;
+    double sum_sq = 0;
+
+    memset(interval, 0, sizeof(*interval));
+    if (horizon > mb->closed + mb->mask + 1) {
+        /* The stream has reused the buckets that were not closed in time */
+        mb->closed = horizon - mb->mask - 1;
+        mb->zero_run = 0;
+    }
+    for (b = mb->closed; b < last; ++b) {
+        bytes = b < reached ? mb->buckets[b & mb->mask] : 0;
+        interval->bytes += bytes;
+        sum_sq += (double) bytes * bytes;
+        if (bytes > peak)
+            peak = bytes;
+        if (bytes == 0) {
+            ++mb->zero_run;
+        } else {
+            if (mb->zero_run >= mb->stall_buckets)
+                summary_add_stall(interval, mb->zero_run);
+            mb->zero_run = 0;
+        }
+    }
+    if (last > mb->closed) {
+        interval->buckets = last - mb->closed;
+        mb->closed = last;
+    }
+    interval->peak_bits_per_second = peak * 8.0 * 1000000 / IPERF_MICROBURST_BUCKET_USECS;
+    interval->cv = coefficient_of_variation(interval->buckets, interval->bytes, sum_sq);
+
+    mb->total.buckets += interval->buckets;
+    mb->total.bytes += interval->bytes;
+    mb->total_sum_sq += sum_sq;
+    if (interval->peak_bits_per_second > mb->total.peak_bits_per_second)
+        mb->total.peak_bits_per_second = interval->peak_bits_per_second;
+    mb->total.stalls += interval->stalls;
+    mb->total.stall_ms += interval->stall_ms;
+    if (interval->longest_stall_ms > mb->total.longest_stall_ms)
+        mb->total.longest_stall_ms = interval->longest_stall_ms;
+}
+
+void
+iperf_microburst_totals(struct iperf_microburst *mb, struct iperf_microburst_summary *total)
+{
+    *total = mb->total;
+    total->cv = coefficient_of_variation(mb->total.buckets, mb->total.bytes, mb->total_sum_sq);
+}
+
+uint64_t
+iperf_microburst_buckets(struct iperf_microburst *mb, uint64_t *out, uint64_t max, uint64_t *first)
+{
+    uint64_t reached = mb->reached;
+    uint64_t horizon = mb->closed > reached ? mb->closed : reached;
+    uint64_t start = horizon > mb->mask + 1 ? horizon - mb->mask - 1 : 0;
+    uint64_t n = 0, b;
+
+    if (start < mb->base)
+        start = mb->base;
+    *first = start - mb->base;
+    if (out == NULL)
+        return mb->closed > start ? (mb->closed - start < max ? mb->closed - start : max) : 0;
+    for (b = start; b < mb->closed && n < max; ++b)
+        out[n++] = b < reached ? mb->buckets[b & mb->mask] : 0;
+    return n;
+}
@@ -0,0 +1,103 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#ifndef __IPERF_MICROBURST_H
+#define __IPERF_MICROBURST_H
+
+#include <stdint.h>
+
+#include "iperf_time.h"
+
+/*
+ * Per-stream throughput in 1 ms buckets, for the stalls and bursts that
+ * interval reports average away (--microburst).  The stream's thread adds
+ * the bytes of each send or receive; the main thread closes reporting
+ * intervals and summarizes the buckets each one spans.  The buckets are a
+ * ring preallocated when the stream is created, so recording never
+ * allocates and a reader that falls behind by more than the ring loses the
+ * oldest buckets rather than blocking the stream.
+ */
+
+#define IPERF_MICROBURST_BUCKET_USECS 1000
+#define IPERF_MICROBURST_MAX_BUCKETS (1 << 18)	/* about 4.4 minutes */
+
+struct iperf_microburst;
+
+struct iperf_microburst_summary
+{
+    uint64_t  buckets;			/* 1 ms buckets covered */
+    uint64_t  bytes;
+    double    peak_bits_per_second;	/* busiest bucket */
+    double    cv;			/* coefficient of variation of the buckets */
+    int64_t   stalls;			/* zero-byte runs of at least the stall threshold */
+    int64_t   stall_ms;			/* their total length */
+    int64_t   longest_stall_ms;
+};
+
+/*
+ * A recorder keeping at least capacity buckets, which is rounded up to a
+ * power of two.  A run of stall_ms or more empty buckets counts as a stall
+ * once data flows again.  Returns NULL when out of memory.
+ */
+struct iperf_microburst *iperf_microburst_new(int stall_ms, uint64_t capacity);
+void iperf_microburst_free(struct iperf_microburst *mb);
+
+/*
+ * Forget everything recorded and start bucket 0 at now; only before the
+ * stream's thread starts adding
+ */
+void iperf_microburst_start(struct iperf_microburst *mb, struct iperf_time *now);
+
+/*
+ * Drops the buckets before now from the totals and from what
+ * iperf_microburst_buckets() returns, as at the end of the omitted
+ * seconds.  The ring itself is left to the stream's thread, which may keep
+ * adding meanwhile.
+ */
+void iperf_microburst_restart(struct iperf_microburst *mb, struct iperf_time *now);
+
+/* Called by the stream's thread only */
+void iperf_microburst_add(struct iperf_microburst *mb, struct iperf_time *now, uint64_t bytes);
+
+/*
+ * Closes the interval ending at end: summarizes the buckets since the last
+ * close into interval, and adds them to the test totals.
+ */
+void iperf_microburst_close(struct iperf_microburst *mb, struct iperf_time *end,
+                            struct iperf_microburst_summary *interval);
+
+/* Everything closed so far */
+void iperf_microburst_totals(struct iperf_microburst *mb, struct iperf_microburst_summary *total);
+
+/*
+ * Copies up to max closed buckets, oldest first, into out and returns how
+ * many; with out NULL only counts them.  *first is set to the index of the
+ * oldest since the start or restart, which is not 0 once the ring has
+ * wrapped.
+ */
+uint64_t iperf_microburst_buckets(struct iperf_microburst *mb, uint64_t *out, uint64_t max, uint64_t *first);
+
+#endif
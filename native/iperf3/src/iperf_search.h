@@ -0,0 +1,101 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#ifndef __IPERF_SEARCH_H
+#define __IPERF_SEARCH_H
+
+#include <stdint.h>
+
+/*
+ * Lossless-rate search (--search), after RFC 2544's throughput test: for
+ * each block size, short UDP trials at rates picked by binary search
+ * between 0 and the most to try, each passing when it loses no more than
+ * the tolerance.  The first trial runs at the most; the search ends when
+ * the highest passing and lowest failing rates are within
+ * IPERF_SEARCH_RESOLUTION of the most, and the highest passing one is the
+ * block size's lossless rate.  Like RFC 2544's, trials rest in between,
+ * which also lets the server get back to listening.
+ */
+
+#define IPERF_SEARCH_RESOLUTION 0.01	/* of the most to try */
+#define IPERF_SEARCH_MAX_BLKSIZES 8
+#define IPERF_SEARCH_REST_MS 500	/* between trials, for the server to listen again */
+
+struct iperf_search;
+struct iperf_test;
+
+struct iperf_search_trial
+{
+    int       blksize;
+    uint64_t  rate;			/* offered, bits per second */
+    double    bits_per_second;		/* as received */
+    int64_t   packets;			/* sent */
+    int64_t   lost;
+    double    lost_percent;
+    double    jitter;			/* ms */
+    int       passed;
+};
+
+struct iperf_search_result
+{
+    int       blksize;
+    uint64_t  max_rate;			/* highest passing, 0 if none did */
+    int       trials;
+};
+
+/*
+ * A search up to max_rate bits per second, passing trials that lose at
+ * most loss_tolerance percent.  Returns NULL when out of memory.
+ */
+struct iperf_search *iperf_search_new(uint64_t max_rate, double loss_tolerance);
+void iperf_search_free(struct iperf_search *search);
+
+/* Starts searching at another block size; -1 once there are too many */
+int iperf_search_begin(struct iperf_search *search, int blksize);
+
+/* The rate of the next trial at this block size, or 0 when it is done */
+uint64_t iperf_search_next_rate(struct iperf_search *search);
+
+/*
+ * Records a trial at the rate iperf_search_next_rate() gave, setting its
+ * lost_percent and passed.  Returns -1 when out of memory.
+ */
+int iperf_search_add(struct iperf_search *search, struct iperf_search_trial *trial);
+
+/* Every trial, in the order they ran; returns their number */
+int iperf_search_trials(struct iperf_search *search, const struct iperf_search_trial **trials);
+/* One result per block size begun; returns their number */
+int iperf_search_results(struct iperf_search *search, const struct iperf_search_result **results);
+
+/*
+ * Runs test's search as a client: each trial is a test of its own from
+ * new_trial(arg), set up like test, against the same server.  Prints the
+ * trials and results the way test reports; returns -1 with i_errno set if
+ * a trial failed.
+ */
+int iperf_run_search(struct iperf_test *test, struct iperf_test *(*new_trial)(void *arg), void *arg);
+
+#endif
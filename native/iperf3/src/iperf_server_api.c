@@ -204,7 +204,15 @@ iperf_accept(struct iperf_test *test)
         FD_SET(test->ctrl_sck, &test->read_set);
         if (test->ctrl_sck > test->max_fd) test->max_fd = test->ctrl_sck;
 
-        if (iperf_set_send_state(test, PARAM_EXCHANGE) != 0)
+        /*
+         * A fast-start client sends its parameters right behind the
+         * cookie without waiting for PARAM_EXCHANGE.  Not sending it
+         * tells the client we understood, so it may connect streams
+         * early next time.
+         */
+        if (test->cookie[0] == COOKIE_FAST_START)
+            iperf_set_test_state(test, PARAM_EXCHANGE);
+        else if (iperf_set_send_state(test, PARAM_EXCHANGE) != 0)
             goto error_handling;
         if (iperf_exchange_parameters(test) < 0)
             goto error_handling;
@@ -270,12 +278,17 @@ iperf_handle_message_server(struct iperf_test *test)
             break;
         case TEST_END:
             test->done = 1;
-            cpu_util(test->cpu_util);
+            cpu_util(&test->cpu_state, test->cpu_util);
             test->stats_callback(test);
+            /*
+             * Stop polling the streams; cleanup_server() closes them.
+             * Closing them here too would close each descriptor twice,
+             * and the second close() could hit a socket another test in
+             * this process has since been given the same number.
+             */
             SLIST_FOREACH(sp, &test->streams, streams) {
                 FD_CLR(sp->socket, &test->read_set);
                 FD_CLR(sp->socket, &test->write_set);
-                close(sp->socket);
             }
             test->reporter_callback(test);
             if (iperf_set_send_state(test, EXCHANGE_RESULTS) != 0)
@@ -295,17 +308,17 @@ iperf_handle_message_server(struct iperf_test *test)
 	    // Temporarily be in DISPLAY_RESULTS phase so we can get
 	    // ending summary statistics.
 	    signed char oldstate = test->state;
-	    cpu_util(test->cpu_util);
+	    cpu_util(&test->cpu_state, test->cpu_util);
 	    test->state = DISPLAY_RESULTS;
 	    test->reporter_callback(test);
 	    test->state = oldstate;
 
             // XXX: Remove this line below!
 	    iperf_err(test, "the client has terminated");
+            /* As for TEST_END, cleanup_server() closes the streams. */
             SLIST_FOREACH(sp, &test->streams, streams) {
                 FD_CLR(sp->socket, &test->read_set);
                 FD_CLR(sp->socket, &test->write_set);
-                close(sp->socket);
             }
             iperf_set_test_state(test, IPERF_DONE);
             break;
@@ -377,7 +390,7 @@ create_server_timers(struct iperf_test * test)
     test->timer = test->stats_timer = test->reporter_timer = NULL;
     if (test->duration != 0 ) {
         test->done = 0;
-        test->timer = tmr_create(&now, server_timer_proc, cd, (test->duration + test->omit + grace_period) * SEC_TO_US, 0);
+        test->timer = tmr_create_q(test->timers, &now, server_timer_proc, cd, (test->duration + test->omit + grace_period) * SEC_TO_US, 0);
         if (test->timer == NULL) {
             i_errno = IEINITTEST;
             return -1;
@@ -386,14 +399,14 @@ create_server_timers(struct iperf_test * test)
 
     test->stats_timer = test->reporter_timer = NULL;
     if (test->stats_interval != 0) {
-        test->stats_timer = tmr_create(&now, server_stats_timer_proc, cd, test->stats_interval * SEC_TO_US, 1);
+        test->stats_timer = tmr_create_q(test->timers, &now, server_stats_timer_proc, cd, test->stats_interval * SEC_TO_US, 1);
         if (test->stats_timer == NULL) {
             i_errno = IEINITTEST;
             return -1;
 	}
     }
     if (test->reporter_interval != 0) {
-        test->reporter_timer = tmr_create(&now, server_reporter_timer_proc, cd, test->reporter_interval * SEC_TO_US, 1);
+        test->reporter_timer = tmr_create_q(test->timers, &now, server_reporter_timer_proc, cd, test->reporter_interval * SEC_TO_US, 1);
         if (test->reporter_timer == NULL) {
             i_errno = IEINITTEST;
             return -1;
@@ -436,7 +449,10 @@ create_server_omit_timer(struct iperf_test * test)
 	}
 	test->omitting = 1;
 	cd.p = test;
-	test->omit_timer = tmr_create(&now, server_omit_timer_proc, cd, test->omit * SEC_TO_US, 0);
+	/* A microsecond past the interval timers, so that the last omitted
+	 * interval still closes first when the clock has not moved since
+	 * they were set (always, on a virtual clock) */
+	test->omit_timer = tmr_create_q(test->timers, &now, server_omit_timer_proc, cd, test->omit * SEC_TO_US + 1, 0);
 	if (test->omit_timer == NULL) {
 	    i_errno = IEINITTEST;
 	    return -1;
@@ -529,6 +545,43 @@ cleanup_server(struct iperf_test *test)
 }
 
 
+/*
+ * Starts the test once all of its streams are in: checks the requested
+ * rate against the server's limit, starts the timers and tells the client.
+ * Also used by the simulation (iperf_sim.c).
+ */
+int
+iperf_server_start_test(struct iperf_test *test)
+{
+    /* Ensure that total requested data rate is not above limit */
+    iperf_size_t total_requested_rate = test->num_streams * test->settings->rate * (test->mode == BIDIRECTIONAL? 2 : 1);
+    if (test->settings->bitrate_limit > 0 && total_requested_rate > test->settings->bitrate_limit) {
+        if (iperf_get_verbose(test))
+            iperf_err(test, "Client total requested throughput rate of %" PRIu64 " bps exceeded %" PRIu64 " bps limit",
+                      total_requested_rate, test->settings->bitrate_limit);
+        i_errno = IETOTALRATE;
+        return -1;
+    }
+
+    // Begin calculating CPU utilization
+    cpu_util(&test->cpu_state, NULL);
+
+    if (iperf_set_send_state(test, TEST_START) != 0)
+        return -1;
+    if (iperf_init_test(test) < 0)
+        return -1;
+    if (create_server_timers(test) < 0)
+        return -1;
+    if (create_server_omit_timer(test) < 0)
+        return -1;
+    if (test->mode != RECEIVER)
+        if (iperf_create_send_timers(test) < 0)
+            return -1;
+    if (iperf_set_send_state(test, TEST_RUNNING) != 0)
+        return -1;
+    return 0;
+}
+
 int
 iperf_run_server(struct iperf_test *test)
 {
@@ -607,7 +660,7 @@ iperf_run_server(struct iperf_test *test)
         memcpy(&write_set, &test->write_set, sizeof(fd_set));
 
 	iperf_time_now(&now);
-	timeout = tmr_timeout(&now);
+	timeout = tmr_timeout_q(test->timers, &now);
 
         // Ensure select() will timeout to allow handling error cases that require server restart
         if (test->state == IPERF_START) {       // In idle mode server may need to restart
@@ -867,46 +920,11 @@ iperf_run_server(struct iperf_test *test)
                     }
                     test->prot_listener = -1;
 
-		    /* Ensure that total requested data rate is not above limit */
-		    iperf_size_t total_requested_rate = test->num_streams * test->settings->rate * (test->mode == BIDIRECTIONAL? 2 : 1);
-		    if (test->settings->bitrate_limit > 0 && total_requested_rate > test->settings->bitrate_limit) {
-                        if (iperf_get_verbose(test))
-                            iperf_err(test, "Client total requested throughput rate of %" PRIu64 " bps exceeded %" PRIu64 " bps limit",
-                                      total_requested_rate, test->settings->bitrate_limit);
+		    if (iperf_server_start_test(test) < 0) {
 			cleanup_server(test);
-			i_errno = IETOTALRATE;
 			return -1;
 		    }
 
-		    // Begin calculating CPU utilization
-		    cpu_util(NULL);
-
-		    if (iperf_set_send_state(test, TEST_START) != 0) {
-			cleanup_server(test);
-                        return -1;
-		    }
-                    if (iperf_init_test(test) < 0) {
-			cleanup_server(test);
-                        return -1;
-		    }
-		    if (create_server_timers(test) < 0) {
-			cleanup_server(test);
-                        return -1;
-		    }
-		    if (create_server_omit_timer(test) < 0) {
-			cleanup_server(test);
-                        return -1;
-		    }
-		    if (test->mode != RECEIVER)
-			if (iperf_create_send_timers(test) < 0) {
-			    cleanup_server(test);
-			    return -1;
-			}
-		    if (iperf_set_send_state(test, TEST_RUNNING) != 0) {
-			cleanup_server(test);
-                        return -1;
-		    }
-
                     /* Create and spin up threads */
                     pthread_attr_t attr;
                     if (pthread_attr_init(&attr) != 0) {
@@ -940,7 +958,7 @@ iperf_run_server(struct iperf_test *test)
 	    (timeout != NULL && timeout->tv_sec == 0 && timeout->tv_usec == 0)) {
 	    /* Run the timers. */
 	    iperf_time_now(&now);
-	    tmr_run(&now);
+	    tmr_run_q(test->timers, &now);
 	}
     }
 
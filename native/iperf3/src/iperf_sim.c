@@ -0,0 +1,772 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "iperf_config.h"
+#include "iperf.h"
+#include "iperf_api.h"
+#include "iperf_locale.h"
+#include "iperf_sim.h"
+#include "iperf_time.h"
+#include "net.h"
+#include "timer.h"
+
+/*
+ * The simulation plays both ends' main loops in turn on one thread: it
+ * runs the timers that are due, lets every stream send and receive all it
+ * can at that instant, then moves the virtual clock straight on to the
+ * next timer, arrival or rate-limit green light.  Each end's streams have
+ * a socket of a socketpair, so that everything that only looks at the
+ * descriptor works, but no data goes over it.  Only the results exchange
+ * at the end needs both ends at once; the server's side of it runs on a
+ * thread of its own, at the same virtual time.
+ *
+ * A null link (rate 0) keeps the same loop on the real clock, with no
+ * path model: each pair of streams shares a byte ring, which the sender
+ * copies its blocks into and the reader copies them out of, so what the
+ * test measures is the engine itself.
+ */
+
+#define SIM_ORIGIN_SECS 1000	/* where the virtual clock starts; not 0 */
+#define SIM_MIN_WINDOW_BLOCKS 4
+#define NS_PER_USEC 1000ULL
+#define NS_PER_SEC 1000000000ULL
+
+/* Blocks travelling one way, oldest first, with the time each arrives */
+struct sim_ring
+{
+    uint32_t *bytes;
+    uint64_t *at;		/* ns */
+    uint32_t  size;
+    uint32_t  head;
+    uint32_t  count;
+};
+
+/* One direction's bottleneck */
+struct sim_path
+{
+    uint64_t  rate;		/* bits per second */
+    uint64_t  delay;		/* ns */
+    uint64_t  free_at;		/* ns; when it has sent everything queued */
+};
+
+/* The connection under a pair of streams, one at each end */
+struct sim_pipe
+{
+    struct sim_path *path;
+    uint32_t  window;
+    uint32_t  in_flight;	/* sent and not yet acknowledged */
+    struct sim_ring data;	/* on the way to the reader */
+    struct sim_ring acks;	/* on the way back to the sender */
+    char     *buf;		/* a null link's window bytes, in_flight of them from head */
+    uint32_t  head;
+    struct sim_pipe *next;
+};
+
+struct iperf_sim
+{
+    struct iperf_test *client;
+    struct iperf_test *server;
+    struct sim_path up;		/* client to server */
+    struct sim_path down;
+    uint32_t  window;
+    int       null_link;	/* on the real clock; see above */
+    uint64_t  now;		/* ns */
+    struct sim_pipe *pipes;
+    int       server_errno;	/* of the server's end of the results exchange */
+};
+
+static uint64_t
+sim_now(void)
+{
+    struct iperf_time now;
+
+    iperf_time_now(&now);
+    return now.secs * NS_PER_SEC + now.usecs * NS_PER_USEC;
+}
+
+static void
+sim_set_clock(struct iperf_sim *sim, uint64_t ns)
+{
+    struct iperf_time now;
+
+    sim->now = ns;
+    now.secs = ns / NS_PER_SEC;
+    now.usecs = ns % NS_PER_SEC / NS_PER_USEC;
+    iperf_time_virtual_set(&now);
+}
+
+/*************************************************************/
+
+static int
+ring_init(struct sim_ring *r, uint32_t size)
+{
+    r->bytes = calloc(size, sizeof(*r->bytes));
+    r->at = calloc(size, sizeof(*r->at));
+    r->size = size;
+    r->head = r->count = 0;
+    return r->bytes != NULL && r->at != NULL ? 0 : -1;
+}
+
+static void
+ring_push(struct sim_ring *r, uint32_t bytes, uint64_t at)
+{
+    uint32_t i = (r->head + r->count++) % r->size;
+
+    r->bytes[i] = bytes;
+    r->at[i] = at;
+}
+
+static uint32_t
+ring_pop(struct sim_ring *r)
+{
+    uint32_t bytes = r->bytes[r->head];
+
+    r->head = (r->head + 1) % r->size;
+    --r->count;
+    return bytes;
+}
+
+/* When the oldest block arrives, UINT64_MAX if there is none */
+static uint64_t
+ring_next(struct sim_ring *r)
+{
+    return r->count ? r->at[r->head] : UINT64_MAX;
+}
+
+/*************************************************************/
+
+static struct sim_pipe *
+sim_pipe_new(struct iperf_sim *sim, struct sim_path *path)
+{
+    struct sim_pipe *pipe;
+    /* Every block is a whole blksize, so this many can be in flight */
+    uint32_t blocks = sim->window / sim->client->settings->blksize + 1;
+
+    pipe = calloc(1, sizeof(*pipe));
+    if (pipe == NULL)
+        return NULL;
+    pipe->next = sim->pipes;
+    sim->pipes = pipe;
+    pipe->path = path;
+    pipe->window = sim->window;
+    if (sim->null_link)
+        return (pipe->buf = malloc(sim->window)) != NULL ? pipe : NULL;
+    if (ring_init(&pipe->data, blocks) < 0 || ring_init(&pipe->acks, blocks) < 0)
+        return NULL;
+    return pipe;
+}
+
+static void
+sim_pipes_free(struct iperf_sim *sim)
+{
+    struct sim_pipe *pipe;
+
+    while ((pipe = sim->pipes) != NULL) {
+        sim->pipes = pipe->next;
+        free(pipe->data.bytes);
+        free(pipe->data.at);
+        free(pipe->acks.bytes);
+        free(pipe->acks.at);
+        free(pipe->buf);
+        free(pipe);
+    }
+}
+
+/* Takes the acknowledgements that have come back off the window */
+static void
+sim_pipe_ack(struct sim_pipe *pipe, uint64_t now)
+{
+    while (ring_next(&pipe->acks) <= now)
+        pipe->in_flight -= ring_pop(&pipe->acks);
+}
+
+/* Whether the reader has something to read now */
+static int
+sim_pipe_readable(struct sim_pipe *pipe)
+{
+    if (pipe->buf != NULL)
+        return pipe->in_flight > 0;
+    return ring_next(&pipe->data) <= sim_now();
+}
+
+/* Copies n bytes into or out of a null link's ring, from its offset at */
+static void
+sim_pipe_copy(struct sim_pipe *pipe, uint32_t at, char *data, uint32_t n, int in)
+{
+    uint32_t first;
+
+    at %= pipe->window;
+    first = n < pipe->window - at ? n : pipe->window - at;
+    if (in) {
+        memcpy(pipe->buf + at, data, first);
+        memcpy(pipe->buf, data + first, n - first);
+    } else {
+        memcpy(data, pipe->buf + at, first);
+        memcpy(data + first, pipe->buf, n - first);
+    }
+}
+
+/*************************************************************/
+
+/* The protocol's send: a whole block onto the path, if the window has room */
+static int
+sim_send(struct iperf_stream *sp)
+{
+    struct sim_pipe *pipe = sp->data;
+    struct sim_path *path = pipe->path;
+    uint64_t now = sim_now();
+    int r;
+
+    sim_pipe_ack(pipe, now);
+    if (!sp->pending_size)
+        sp->pending_size = sp->settings->blksize;
+    if (pipe->in_flight + sp->pending_size > pipe->window)
+        return NET_SOFTERROR;
+
+    r = sp->pending_size;
+    if (path->free_at < now)
+        path->free_at = now;
+    path->free_at += (uint64_t) r * 8 * NS_PER_SEC / path->rate;
+    ring_push(&pipe->data, r, path->free_at + path->delay);
+    pipe->in_flight += r;
+
+    sp->pending_size = 0;
+    sp->result->bytes_sent += r;
+    sp->result->bytes_sent_this_interval += r;
+    return r;
+}
+
+/* The protocol's recv: the oldest block that has arrived, if any */
+static int
+sim_recv(struct iperf_stream *sp)
+{
+    struct sim_pipe *pipe = sp->data;
+    uint64_t now = sim_now();
+    int r;
+
+    if (ring_next(&pipe->data) > now)
+        return 0;
+    r = ring_pop(&pipe->data);
+    ring_push(&pipe->acks, r, now + pipe->path->delay);
+
+    /* Only count bytes received while we're in the correct state. */
+    if (sp->test->state == TEST_RUNNING) {
+        sp->result->bytes_received += r;
+        sp->result->bytes_received_this_interval += r;
+    }
+    return r;
+}
+
+/* A null link's send: a whole block into the ring, if it has room */
+static int
+sim_null_send(struct iperf_stream *sp)
+{
+    struct sim_pipe *pipe = sp->data;
+    int r;
+
+    if (!sp->pending_size)
+        sp->pending_size = sp->settings->blksize;
+    if (pipe->in_flight + sp->pending_size > pipe->window)
+        return NET_SOFTERROR;
+
+    r = sp->pending_size;
+    sim_pipe_copy(pipe, pipe->head + pipe->in_flight, sp->buffer, r, 1);
+    pipe->in_flight += r;
+
+    sp->pending_size = 0;
+    sp->result->bytes_sent += r;
+    sp->result->bytes_sent_this_interval += r;
+    return r;
+}
+
+/* A null link's recv: up to a block out of the ring */
+static int
+sim_null_recv(struct iperf_stream *sp)
+{
+    struct sim_pipe *pipe = sp->data;
+    uint32_t r = pipe->in_flight;
+
+    if (r > (uint32_t) sp->settings->blksize)
+        r = sp->settings->blksize;
+    sim_pipe_copy(pipe, pipe->head, sp->buffer, r, 0);
+    pipe->head = (pipe->head + r) % pipe->window;
+    pipe->in_flight -= r;
+
+    /* Only count bytes received while we're in the correct state. */
+    if (sp->test->state == TEST_RUNNING) {
+        sp->result->bytes_received += r;
+        sp->result->bytes_received_this_interval += r;
+    }
+    return r;
+}
+
+/* Nothing listens or connects; the simulation pairs the streams itself */
+static int
+sim_listen(struct iperf_test *test)
+{
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (s < 0)
+        i_errno = IELISTEN;
+    return s;
+}
+
+static int
+sim_accept(struct iperf_test *test)
+{
+    i_errno = IEACCEPT;
+    return -1;
+}
+
+static int
+sim_connect(struct iperf_test *test)
+{
+    i_errno = IESTREAMCONNECT;
+    return -1;
+}
+
+/*
+ * Puts the simulated protocol in front of TCP, so that the test, and the
+ * server once it has the client's parameters, picks it for TCP
+ */
+static int
+sim_set_protocol(struct iperf_test *test, int null_link)
+{
+    struct protocol *sim;
+
+    sim = (struct protocol *) calloc(1, sizeof(struct protocol));
+    if (sim == NULL) {
+        i_errno = IEPROTOCOL;
+        return -1;
+    }
+    sim->id = Ptcp;
+    sim->name = "sim";
+    sim->accept = sim_accept;
+    sim->listen = sim_listen;
+    sim->connect = sim_connect;
+    sim->send = null_link ? sim_null_send : sim_send;
+    sim->recv = null_link ? sim_null_recv : sim_recv;
+    SLIST_INSERT_HEAD(&test->protocols, sim, protocols);
+    return set_protocol(test, Ptcp);
+}
+
+/*************************************************************/
+
+/* Connects num_streams pairs of streams, sending from the client if sender */
+static int
+sim_connect_streams(struct iperf_sim *sim, int sender)
+{
+    struct iperf_stream *sp;
+    struct sim_pipe *pipe;
+    int i, fds[2];
+
+    for (i = 0; i < sim->client->num_streams; i++) {
+        pipe = sim_pipe_new(sim, sender ? &sim->up : &sim->down);
+        if (pipe == NULL) {
+            i_errno = IECREATESTREAM;
+            return -1;
+        }
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            i_errno = IESTREAMCONNECT;
+            return -1;
+        }
+        if ((sp = iperf_new_stream(sim->client, fds[0], sender)) == NULL) {
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+        sp->data = pipe;
+        if ((sp = iperf_new_stream(sim->server, fds[1], !sender)) == NULL) {
+            close(fds[1]);
+            return -1;
+        }
+        sp->data = pipe;
+    }
+    return 0;
+}
+
+/* The server's CREATE_STREAMS, in the order the client connects them */
+static int
+sim_create_streams(struct iperf_sim *sim)
+{
+    struct iperf_test *server = sim->server;
+
+    if (sim->client->mode == BIDIRECTIONAL) {
+        if (sim_connect_streams(sim, 1) < 0 || sim_connect_streams(sim, 0) < 0)
+            return -1;
+    } else if (sim_connect_streams(sim, sim->client->mode) < 0)
+        return -1;
+
+    FD_CLR(server->prot_listener, &server->read_set);
+    close(server->prot_listener);
+    server->prot_listener = -1;
+    return iperf_server_start_test(server);
+}
+
+/*
+ * Handles the client's next message from the server, which must be there
+ * already.  The messages that would connect streams or report the wall
+ * clock are handled here; iperf_handle_message_client() does the rest.
+ */
+static int
+sim_client_message(struct iperf_sim *sim)
+{
+    struct iperf_test *test = sim->client;
+    signed char state;
+
+    if (recv(test->ctrl_sck, &state, sizeof(state), MSG_PEEK | MSG_DONTWAIT) != sizeof(state)) {
+        i_errno = IERECVMESSAGE;
+        return -1;
+    }
+    if (state != PARAM_EXCHANGE && state != CREATE_STREAMS)
+        return iperf_handle_message_client(test);
+
+    if (read(test->ctrl_sck, &test->state, sizeof(state)) != sizeof(state)) {
+        i_errno = IERECVMESSAGE;
+        return -1;
+    }
+    if (state == PARAM_EXCHANGE)
+        return iperf_exchange_parameters(test);
+    iperf_time_now(&test->startup.create_streams);
+    test->startup.streams = test->startup.create_streams;
+    return sim_create_streams(sim);
+}
+
+/*************************************************************/
+
+/* What ends the client's test, as in iperf_run_client() */
+static int
+sim_client_done(struct iperf_test *test)
+{
+    return (!test->omitting) &&
+        (test->done ||
+         (test->settings->bytes != 0 && (test->bytes_sent >= test->settings->bytes ||
+                                         test->bytes_received >= test->settings->bytes)) ||
+         (test->settings->blocks != 0 && (test->blocks_sent >= test->settings->blocks ||
+                                          test->blocks_received >= test->settings->blocks)));
+}
+
+/* Lets a stream send or receive all it can now; 1 if it moved any data */
+static int
+sim_stream_move(struct iperf_stream *sp)
+{
+    struct sim_pipe *pipe = sp->data;
+    iperf_size_t before;
+    int green, moved = 0;
+
+    if (!sp->sender) {
+        while (sim_pipe_readable(pipe)) {
+            if (iperf_recv_mt(sp) < 0)
+                return -1;
+            moved = 1;
+        }
+        return moved;
+    }
+
+    if (sp->test->done || sp->ramp_held)
+        return 0;
+    for (;;) {
+        before = sp->result->bytes_sent;
+        green = sp->green_light;
+        if (iperf_send_mt(sp) < 0)
+            return -1;
+        if (sp->result->bytes_sent != before)
+            moved = 1;
+        /* Stop once blocked, unless the throttle has only just turned green */
+        else if (green || !sp->green_light)
+            return moved;
+    }
+}
+
+static int
+sim_move_data(struct iperf_sim *sim)
+{
+    struct iperf_test *tests[2] = { sim->client, sim->server };
+    struct iperf_stream *sp;
+    struct sim_pipe *pipe;
+    int i, r, progress;
+
+    for (pipe = sim->pipes; pipe != NULL; pipe = pipe->next)
+        sim_pipe_ack(pipe, sim->now);
+
+    /*
+     * With no delay, what is read frees window at the same instant.  A null
+     * link never stops moving, so it gets one pass, as a select() would.
+     */
+    do {
+        progress = 0;
+        for (i = 0; i < 2; i++)
+            SLIST_FOREACH(sp, &tests[i]->streams, streams) {
+                if ((r = sim_stream_move(sp)) < 0)
+                    return -1;
+                progress |= r;
+            }
+    } while (progress && !sim->null_link);
+    return 0;
+}
+
+/* The next time anything happens: a timer, an arrival or a green light */
+static uint64_t
+sim_next_event(struct iperf_sim *sim)
+{
+    struct iperf_test *tests[2] = { sim->client, sim->server };
+    struct iperf_stream *sp;
+    struct iperf_time now;
+    struct timeval *timeout;
+    struct sim_pipe *pipe;
+    uint64_t next = UINT64_MAX, t;
+    int i;
+
+    iperf_time_now(&now);
+    for (i = 0; i < 2; i++) {
+        timeout = tmr_timeout_q(tests[i]->timers, &now);
+        if (timeout != NULL) {
+            t = sim->now + timeout->tv_sec * NS_PER_SEC + timeout->tv_usec * NS_PER_USEC;
+            if (t < next)
+                next = t;
+        }
+        /* A throttled sender goes green once its average drops below the rate */
+        if (tests[i]->settings->rate != 0)
+            SLIST_FOREACH(sp, &tests[i]->streams, streams) {
+                if (!sp->sender || sp->green_light || sp->ramp_held)
+                    continue;
+                t = (uint64_t) sp->result->start_time_fixed.secs * NS_PER_SEC +
+                    sp->result->start_time_fixed.usecs * NS_PER_USEC +
+                    (uint64_t) (sp->result->bytes_sent * 8.0 / tests[i]->settings->rate * NS_PER_SEC) + 1;
+                if (t < next)
+                    next = t;
+            }
+    }
+    for (pipe = sim->pipes; pipe != NULL; pipe = pipe->next) {
+        if ((t = ring_next(&pipe->data)) < next)
+            next = t;
+        if ((t = ring_next(&pipe->acks)) < next)
+            next = t;
+    }
+    if (next == UINT64_MAX)
+        return next;
+
+    /* iperf_time has microseconds */
+    next = (next + NS_PER_USEC - 1) / NS_PER_USEC * NS_PER_USEC;
+    if (next <= sim->now)
+        next = sim->now + NS_PER_USEC;
+    return next;
+}
+
+static int
+sim_run_timers(struct iperf_sim *sim)
+{
+    struct iperf_time now;
+
+    iperf_time_now(&now);
+    tmr_run_q(sim->client->timers, &now);
+    tmr_run_q(sim->server->timers, &now);
+    return sim_client_done(sim->client);
+}
+
+/*************************************************************/
+
+/* The server's end of the test, from TEST_END to IPERF_DONE */
+static void *
+sim_server_end(void *arg)
+{
+    struct iperf_sim *sim = arg;
+
+    if (!sim->null_link)
+        sim_set_clock(sim, sim->now);
+    while (sim->server->state != IPERF_DONE)
+        if (iperf_handle_message_server(sim->server) < 0) {
+            sim->server_errno = i_errno;
+            break;
+        }
+    return NULL;
+}
+
+static int
+sim_end(struct iperf_sim *sim)
+{
+    struct iperf_test *client = sim->client;
+    struct iperf_stream *sp;
+    pthread_t thread;
+    int rc = 0;
+
+    /* As iperf_run_client(), but for the CPU use on a virtual clock */
+    client->done = 1;
+    client->stats_callback(client);
+    if (iperf_set_send_state(client, TEST_END) != 0)
+        return -1;
+
+    if (pthread_create(&thread, NULL, sim_server_end, sim) != 0) {
+        i_errno = IEPTHREADCREATE;
+        return -1;
+    }
+    while (client->state != IPERF_DONE) {
+        if (iperf_handle_message_client(client) < 0) {
+            rc = -1;
+            /* Don't leave the server waiting */
+            shutdown(client->ctrl_sck, SHUT_RDWR);
+            break;
+        }
+        if (client->state == EXCHANGE_RESULTS && !sim->null_link)
+            memset(client->remote_cpu_util, 0, sizeof(client->remote_cpu_util));
+    }
+    pthread_join(thread, NULL);
+    if (!sim->null_link)
+        memset(sim->server->cpu_util, 0, sizeof(sim->server->cpu_util));
+    if (rc == 0 && sim->server_errno) {
+        i_errno = sim->server_errno;
+        rc = -1;
+    }
+    if (rc == 0) {
+        /* iperf_client_end() closed them */
+        SLIST_FOREACH(sp, &client->streams, streams)
+            sp->socket = -1;
+        client->ctrl_sck = -1;
+    }
+    return rc;
+}
+
+static void
+sim_close(struct iperf_sim *sim)
+{
+    struct iperf_test *tests[2] = { sim->client, sim->server };
+    struct iperf_stream *sp;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        SLIST_FOREACH(sp, &tests[i]->streams, streams) {
+            if (sp->socket >= 0)
+                close(sp->socket);
+            sp->socket = -1;
+        }
+        if (tests[i]->prot_listener >= 0)
+            close(tests[i]->prot_listener);
+        tests[i]->prot_listener = -1;
+        if (tests[i]->ctrl_sck >= 0)
+            close(tests[i]->ctrl_sck);
+        tests[i]->ctrl_sck = -1;
+    }
+}
+
+int
+iperf_sim_run(struct iperf_test *client, struct iperf_test *server,
+              const struct iperf_sim_link *link)
+{
+    struct iperf_sim sim;
+    uint64_t bdp, next;
+    int fds[2], rc = -1;
+
+    if (client->role != 'c' || server->role != 's') {
+        i_errno = IENOROLE;
+        return -1;
+    }
+    if (client->protocol->id != Ptcp) {
+        i_errno = IEUNIMP;
+        return -1;
+    }
+
+    memset(&sim, 0, sizeof(sim));
+    sim.client = client;
+    sim.server = server;
+    sim.null_link = link->rate == 0;
+    sim.up.rate = sim.down.rate = link->rate;
+    sim.up.delay = sim.down.delay = link->delay_usecs * NS_PER_USEC;
+    bdp = link->rate * 2 * link->delay_usecs / 8 / 1000000;
+    sim.window = link->window ? link->window : bdp < UINT32_MAX ? bdp : UINT32_MAX;
+    if (sim.window < (uint32_t) client->settings->blksize * (link->window ? 1 : SIM_MIN_WINDOW_BLOCKS))
+        sim.window = client->settings->blksize * (link->window ? 1 : SIM_MIN_WINDOW_BLOCKS);
+
+    if (sim_set_protocol(client, sim.null_link) < 0 || sim_set_protocol(server, sim.null_link) < 0)
+        return -1;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        i_errno = IECONNECT;
+        return -1;
+    }
+    client->ctrl_sck = fds[0];
+    server->ctrl_sck = fds[1];
+    client->fast_start = 0;
+    server->prot_listener = -1;
+
+    if (!sim.null_link)
+        sim_set_clock(&sim, SIM_ORIGIN_SECS * NS_PER_SEC);
+    iperf_time_now(&client->startup.begin);
+    client->startup.connected = client->startup.begin;
+    if ((client->json_output && iperf_json_start(client) < 0) ||
+        (server->json_output && iperf_json_start(server) < 0))
+        goto done;
+
+    /* Parameters, streams, and the start, as the server would take them */
+    if (iperf_set_send_state(server, PARAM_EXCHANGE) != 0 ||
+        sim_client_message(&sim) < 0 ||
+        iperf_exchange_parameters(server) < 0)
+        goto done;
+    while (client->state != TEST_RUNNING)
+        if (sim_client_message(&sim) < 0)
+            goto done;
+
+    for (;;) {
+        if (sim_run_timers(&sim))
+            break;
+        if (sim_move_data(&sim) < 0)
+            goto done;
+        if (sim_client_done(client))
+            break;
+        if (sim.null_link)
+            continue;
+        if ((next = sim_next_event(&sim)) == UINT64_MAX) {
+            i_errno = IENOMSG;
+            goto done;
+        }
+        sim_set_clock(&sim, next);
+    }
+    if (sim_end(&sim) < 0)
+        goto done;
+
+    if (client->json_output) {
+        if (iperf_json_finish(client) < 0)
+            goto done;
+    } else {
+        iperf_printf(client, "\n");
+        iperf_printf(client, "%s", report_done);
+    }
+    if (server->json_output && iperf_json_finish(server) < 0)
+        goto done;
+    rc = 0;
+
+done:
+    iflush(client);
+    iflush(server);
+    sim_close(&sim);
+    sim_pipes_free(&sim);
+    iperf_time_virtual_set(NULL);
+    return rc;
+}
@@ -58,6 +58,8 @@ int iperf_tcp_send(struct iperf_stream *) /* __attribute__((hot)) */;
 int iperf_tcp_listen(struct iperf_test *);
 
 int iperf_tcp_connect(struct iperf_test *);
+int iperf_tcp_connect_start(struct iperf_test *);
+int iperf_tcp_connect_finish(struct iperf_test *, int s);
 
 
 #endif
@@ -31,12 +31,20 @@
 #include "iperf_config.h"
 #include "iperf_time.h"
 
+#if !defined(IPERF_THREAD_LOCAL)
+#define IPERF_THREAD_LOCAL __thread
+#endif // IPERF_THREAD_LOCAL
+
+/* The calling thread's virtual clock, while it has one */
+static IPERF_THREAD_LOCAL int virtual_clock;
+static IPERF_THREAD_LOCAL struct iperf_time virtual_now;
+
 #ifdef HAVE_CLOCK_GETTIME
 
 #include <time.h>
 
-int
-iperf_time_now(struct iperf_time *time1)
+static int
+system_time_now(struct iperf_time *time1)
 {
     struct timespec ts;
     int result;
@@ -52,8 +60,8 @@ iperf_time_now(struct iperf_time *time1)
 
 #include <sys/time.h>
 
-int
-iperf_time_now(struct iperf_time *time1)
+static int
+system_time_now(struct iperf_time *time1)
 {
     struct timeval tv;
     int result;
@@ -65,6 +73,38 @@ iperf_time_now(struct iperf_time *time1)
 
 #endif
 
+int
+iperf_time_now(struct iperf_time *time1)
+{
+    if (virtual_clock) {
+        *time1 = virtual_now;
+        return 0;
+    }
+    return system_time_now(time1);
+}
+
+/* iperf_time_virtual_set
+ *
+ * Runs the calling thread on a virtual clock that reads now until it is
+ * set again; NULL goes back to the system clock.
+ */
+void
+iperf_time_virtual_set(const struct iperf_time *now)
+{
+    if (now == NULL) {
+        virtual_clock = 0;
+        return;
+    }
+    virtual_now = *now;
+    virtual_clock = 1;
+}
+
+int
+iperf_time_is_virtual(void)
+{
+    return virtual_clock;
+}
+
 /* iperf_time_add_usecs
  *
  * Add a number of microseconds to a iperf_time.
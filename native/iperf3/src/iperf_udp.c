@@ -520,7 +520,8 @@ iperf_udp_connect(struct iperf_test *test)
     int i, max_len_wait_for_reply;
 
     /* Create and bind our local socket. */
-    if ((s = netdial(test->settings->domain, Pudp, test->bind_address, test->bind_dev, test->bind_port, test->server_hostname, test->server_port, -1)) < 0) {
+    if (iperf_resolve_addresses(test) < 0 ||
+        (s = netdial_addr(Pudp, test->bind_addrinfo, test->bind_dev, test->bind_port, test->server_addrinfo, -1)) < 0) {
         i_errno = IESTREAMCONNECT;
         return -1;
     }
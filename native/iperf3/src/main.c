@@ -48,7 +48,7 @@
 #include "units.h"
 
 
-static int run(struct iperf_test *test);
+static int run(struct iperf_test *test, int argc, char **argv);
 
 
 /**************************************************************************/
@@ -121,7 +121,7 @@ main(int argc, char **argv)
         exit(1);
     }
 
-    if (run(test) < 0)
+    if (run(test, argc, argv) < 0)
         iperf_errexit(test, "error - %s", iperf_strerror(i_errno));
 
     iperf_free_test(test);
@@ -140,14 +140,40 @@ sigend_handler(int sig)
     longjmp(sigend_jmp_buf, 1);
 }
 
+/* The command line, to set up each --search trial the way it asks */
+struct search_args
+{
+    int argc;
+    char **argv;
+};
+
+static struct iperf_test *
+new_search_trial(void *arg)
+{
+    struct search_args *args = arg;
+    struct iperf_test *trial;
+
+    trial = iperf_new_test();
+    if (!trial)
+	return NULL;
+    iperf_defaults(trial);
+    if (iperf_parse_arguments(trial, args->argc, args->argv) < 0) {
+	iperf_free_test(trial);
+	return NULL;
+    }
+    return trial;
+}
+
 /**************************************************************************/
 static int
-run(struct iperf_test *test)
+run(struct iperf_test *test, int argc, char **argv)
 {
+    struct search_args search_args = { argc, argv };
+
     /* Termination signals. */
     iperf_catch_sigend(sigend_handler);
     if (setjmp(sigend_jmp_buf))
-	iperf_got_sigend(test, signed_sig);
+	iperf_got_sigend(test->search_trial ? test->search_trial : test, signed_sig);
 
     /* Ignore SIGPIPE to simplify error handling */
     signal(SIGPIPE, SIG_IGN);
@@ -198,7 +224,10 @@ run(struct iperf_test *test)
 		i_errno = IEPIDFILE;
 		iperf_errexit(test, "error - %s", iperf_strerror(i_errno));
 	    }
-	    if (iperf_run_client(test) < 0)
+	    if (test->search) {
+		if (iperf_run_search(test, new_search_trial, &search_args) < 0)
+		    iperf_errexit(test, "error - %s", iperf_strerror(i_errno));
+	    } else if (iperf_run_client(test) < 0)
 		iperf_errexit(test, "error - %s", iperf_strerror(i_errno));
 	    iperf_delete_pidfile(test);
             break;
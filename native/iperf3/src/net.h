@@ -28,8 +28,11 @@
 #define __NET_H
 
 int timeout_connect(int s, const struct sockaddr *name, socklen_t namelen, int timeout);
+struct addrinfo *netresolve(int domain, int type, const char *host, int port);
+int create_socket_addr(int type, int proto, const struct addrinfo *local_res, const char *bind_dev, int local_port, const struct addrinfo *server_res);
 int create_socket(int domain, int type, int proto, const char *local, const char *bind_dev, int local_port, const char *server, int port, struct addrinfo **server_res_out);
 int netdial(int domain, int proto, const char *local, const char *bind_dev, int local_port, const char *server, int port, int timeout);
+int netdial_addr(int proto, const struct addrinfo *local_res, const char *bind_dev, int local_port, const struct addrinfo *server_res, int timeout);
 int netannounce(int domain, int proto, const char *local, const char *bind_dev, int port);
 int Nread(int fd, char *buf, size_t count, int prot);
 int Nrecv(int fd, char *buf, size_t count, int prot, int sock_opt);
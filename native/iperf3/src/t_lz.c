@@ -0,0 +1,93 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iperf_lz.h"
+
+static int
+roundtrip(const char *name, const char *src, size_t len)
+{
+    size_t cap = iperf_lz_bound(len), clen;
+    char *c = malloc(cap), *d = malloc(len + 1);
+    long dlen;
+    int rc = 0;
+
+    clen = iperf_lz_compress(src, len, c, cap);
+    dlen = iperf_lz_decompress(c, clen, d, len);
+    printf("%s: %zu -> %zu bytes\n", name, len, clen);
+    if (clen == 0 || dlen != (long) len || memcmp(src, d, len) != 0) {
+        printf("%s: round trip failed\n", name);
+        rc = -1;
+    }
+    /* A buffer one byte short must be refused, not overrun */
+    if (len > 0 && iperf_lz_decompress(c, clen, d, len - 1) != -1) {
+        printf("%s: short output buffer accepted\n", name);
+        rc = -1;
+    }
+    free(c);
+    free(d);
+    return rc;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *line = "{\"id\":5,\"bytes\":1175000000,\"retransmits\":0,\"jitter\":0,\"errors\":0},";
+    size_t i, n = 2000, len = strlen(line);
+    char *text = malloc(len * n + 1), *noise = malloc(65536), out[64];
+    unsigned int seed = 1;
+    int rc = 0;
+
+    for (i = 0; i < n; i++)
+        memcpy(text + i * len, line, len);
+    text[len * n] = '\0';
+    for (i = 0; i < 65536; i++)
+        noise[i] = (char) (rand_r(&seed) >> 7);
+
+    rc |= roundtrip("empty", "", 0);
+    rc |= roundtrip("short", "abc", 3);
+    rc |= roundtrip("repeated", text, len * n);
+    rc |= roundtrip("random", noise, 65536);
+    rc |= roundtrip("run", memset(noise, 'x', 65536), 65536);
+
+    /* Incompressible input must not fit in less room than it takes */
+    if (iperf_lz_compress("abcdefgh", 8, out, 8) != 0) {
+        printf("incompressible input fit in its own size\n");
+        rc = -1;
+    }
+    /* A match reaching back before the start of the output is corrupt */
+    if (iperf_lz_decompress("\x10" "a" "\x05\x00", 4, out, sizeof(out)) != -1) {
+        printf("bad offset accepted\n");
+        rc = -1;
+    }
+
+    free(text);
+    free(noise);
+    exit(rc ? -1 : 0);
+}
@@ -0,0 +1,143 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "iperf_microburst.h"
+
+static struct iperf_time origin = { 1000, 0 };
+
+/* origin + ms milliseconds, plus usecs into that millisecond */
+static struct iperf_time *
+at(uint64_t ms, uint32_t usecs)
+{
+    static struct iperf_time t;
+    uint64_t us = ms * 1000 + usecs;
+
+    t.secs = origin.secs + us / 1000000;
+    t.usecs = origin.usecs + us % 1000000;
+    return &t;
+}
+
+int
+main(void)
+{
+    struct iperf_microburst *mb;
+    struct iperf_microburst_summary s;
+    uint64_t out[64], first, n, i;
+
+    mb = iperf_microburst_new(10, 50);	/* rounded up to 64 buckets */
+    assert(mb != NULL);
+    iperf_microburst_start(mb, &origin);
+
+    /* 1000 bytes in each of ms 0-9, a 15 ms stall, then 3000 bytes in ms 25 */
+    for (i = 0; i < 10; ++i) {
+        iperf_microburst_add(mb, at(i, 100), 600);
+        iperf_microburst_add(mb, at(i, 900), 400);
+    }
+    iperf_microburst_add(mb, at(25, 0), 3000);
+    iperf_microburst_close(mb, at(30, 0), &s);
+    assert(s.buckets == 30);
+    assert(s.bytes == 13000);
+    assert(s.peak_bits_per_second == 3000 * 8 * 1000.0);
+    assert(s.stalls == 1);
+    assert(s.stall_ms == 15);
+    assert(s.longest_stall_ms == 15);
+    assert(s.cv > 1.0);
+
+    /* A run still open at the close is counted when data resumes */
+    iperf_microburst_close(mb, at(40, 0), &s);	/* ms 26-39 empty, not yet a stall */
+    assert(s.stalls == 0);
+    assert(s.bytes == 0);
+    iperf_microburst_add(mb, at(45, 0), 100);
+    iperf_microburst_close(mb, at(50, 0), &s);
+    assert(s.stalls == 1);
+    assert(s.longest_stall_ms == 19);
+
+    /* Steady traffic has no stalls and no variation */
+    for (i = 50; i < 60; ++i)
+        iperf_microburst_add(mb, at(i, 0), 500);
+    iperf_microburst_close(mb, at(60, 0), &s);
+    assert(s.stalls == 0);
+    assert(s.cv == 0);
+    assert(s.peak_bits_per_second == 500 * 8 * 1000.0);
+
+    iperf_microburst_totals(mb, &s);
+    assert(s.buckets == 60);
+    assert(s.bytes == 18100);
+    assert(s.stalls == 2);
+    assert(s.stall_ms == 34);
+    assert(s.longest_stall_ms == 19);
+
+    /* The ring keeps the newest 64 buckets */
+    n = iperf_microburst_buckets(mb, NULL, UINT64_MAX, &first);
+    assert(n == 60);
+    n = iperf_microburst_buckets(mb, out, 64, &first);
+    assert(first == 0 && n == 60);
+    assert(out[0] == 1000 && out[25] == 3000 && out[45] == 100 && out[59] == 500);
+    iperf_microburst_add(mb, at(100, 0), 7);
+    iperf_microburst_close(mb, at(101, 0), &s);
+    assert(s.buckets == 41);
+    n = iperf_microburst_buckets(mb, out, 64, &first);
+    assert(first == 101 - 64 && n == 64);
+    assert(out[n - 1] == 7 && out[0] == 0);
+
+    /* A reader that falls a whole ring behind loses the oldest buckets */
+    iperf_microburst_add(mb, at(300, 0), 9);
+    iperf_microburst_close(mb, at(301, 0), &s);
+    assert(s.buckets == 64);
+    assert(s.bytes == 9);
+
+    /* Starting again forgets everything */
+    iperf_microburst_start(mb, at(1000, 0));
+    iperf_microburst_totals(mb, &s);
+    assert(s.buckets == 0 && s.stalls == 0);
+    n = iperf_microburst_buckets(mb, out, 64, &first);
+    assert(n == 0);
+
+    /* Restarting after omitted seconds drops them but keeps the ring */
+    iperf_microburst_start(mb, &origin);
+    for (i = 0; i < 5; ++i)
+        iperf_microburst_add(mb, at(i, 0), 9000);
+    iperf_microburst_add(mb, at(5, 0), 100);	/* the stream is ahead of the restart */
+    iperf_microburst_restart(mb, at(5, 0));
+    for (i = 6; i < 10; ++i)
+        iperf_microburst_add(mb, at(i, 0), 100);
+    iperf_microburst_close(mb, at(10, 0), &s);
+    assert(s.buckets == 5 && s.bytes == 500);
+    iperf_microburst_totals(mb, &s);
+    assert(s.buckets == 5 && s.bytes == 500);
+    assert(s.peak_bits_per_second == 100 * 8 * 1000.0);
+    n = iperf_microburst_buckets(mb, out, 64, &first);
+    assert(first == 0 && n == 5);
+    assert(out[0] == 100 && out[4] == 100);
+
+    iperf_microburst_free(mb);
+
+    return 0;
+}
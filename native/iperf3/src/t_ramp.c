@@ -0,0 +1,124 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <assert.h>
+#include <stdio.h>
+
+#include "iperf_ramp.h"
+
+/* Feeds a step's intervals at rate; returns the streams asked for after it */
+static int
+step(struct iperf_ramp *ramp, double rate, double cpu)
+{
+    int i, streams = 0;
+
+    for (i = 0; i < IPERF_RAMP_STEP_INTERVALS; i++)
+        streams = iperf_ramp_add(ramp, rate, cpu);
+    return streams;
+}
+
+int
+main(void)
+{
+    struct iperf_ramp *ramp;
+    const struct iperf_ramp_step *steps;
+    int rc;
+
+    /* Window-limited streams until the link is full at 100 Mbit/s */
+    ramp = iperf_ramp_new(8, 0.10);
+    assert(ramp != NULL);
+    assert(iperf_ramp_streams(ramp) == 1);
+    assert(iperf_ramp_saturation(ramp) == 0);
+    rc = iperf_ramp_add(ramp, 30e6, 0);
+    assert(rc == 1);
+    rc = iperf_ramp_add(ramp, 30e6, 0);
+    assert(rc == 2);
+    rc = step(ramp, 60e6, 0);
+    assert(rc == 3);
+    rc = step(ramp, 90e6, 0);
+    assert(rc == 4);
+    assert(iperf_ramp_stop(ramp) == IPERF_RAMP_RUNNING);
+    rc = step(ramp, 98e6, 0);
+    assert(rc == 4);
+    assert(iperf_ramp_stop(ramp) == IPERF_RAMP_SATURATED);
+    assert(iperf_ramp_saturation(ramp) == 3);
+    /* It no longer moves */
+    rc = step(ramp, 200e6, 0);
+    assert(rc == 4);
+    assert(iperf_ramp_steps(ramp, &steps) == 4);
+    assert(steps[0].streams == 1 && steps[0].bits_per_second == 30e6);
+    assert(steps[3].streams == 4 && steps[3].bits_per_second == 98e6);
+    iperf_ramp_end(ramp);
+    assert(iperf_ramp_stop(ramp) == IPERF_RAMP_SATURATED);
+    iperf_ramp_free(ramp);
+
+    /* A loss is saturation too */
+    ramp = iperf_ramp_new(8, 0.10);
+    step(ramp, 100e6, 0);
+    rc = step(ramp, 80e6, 0);
+    assert(rc == 2);
+    assert(iperf_ramp_stop(ramp) == IPERF_RAMP_SATURATED);
+    assert(iperf_ramp_saturation(ramp) == 1);
+    iperf_ramp_free(ramp);
+
+    /* A saturated CPU stops it where it is */
+    ramp = iperf_ramp_new(8, 0.10);
+    step(ramp, 1e9, 40);
+    rc = step(ramp, 2e9, 95);
+    assert(rc == 2);
+    assert(iperf_ramp_stop(ramp) == IPERF_RAMP_CPU);
+    assert(iperf_ramp_saturation(ramp) == 2);
+    assert(iperf_ramp_steps(ramp, &steps) == 2 && steps[1].cpu_percent == 95);
+    iperf_ramp_free(ramp);
+
+    /* Still gaining with every stream sending */
+    ramp = iperf_ramp_new(2, 0.10);
+    step(ramp, 1e9, 0);
+    rc = step(ramp, 2e9, 0);
+    assert(rc == 2);
+    assert(iperf_ramp_stop(ramp) == IPERF_RAMP_MAX_STREAMS);
+    assert(iperf_ramp_saturation(ramp) == 2);
+    iperf_ramp_free(ramp);
+
+    /* The test ending first */
+    ramp = iperf_ramp_new(8, 0.10);
+    step(ramp, 1e9, 0);
+    iperf_ramp_add(ramp, 2e9, 0);
+    iperf_ramp_end(ramp);
+    assert(iperf_ramp_stop(ramp) == IPERF_RAMP_ENDED);
+    assert(iperf_ramp_saturation(ramp) == 1);
+    assert(iperf_ramp_steps(ramp, &steps) == 1);
+    iperf_ramp_free(ramp);
+
+    /* -P 1 has nothing to ramp */
+    ramp = iperf_ramp_new(1, 0.10);
+    rc = step(ramp, 1e9, 0);
+    assert(rc == 1);
+    assert(iperf_ramp_stop(ramp) == IPERF_RAMP_MAX_STREAMS);
+    iperf_ramp_free(ramp);
+
+    return 0;
+}
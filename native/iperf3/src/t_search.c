@@ -0,0 +1,132 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <assert.h>
+#include <stdio.h>
+
+#include "iperf_search.h"
+
+/*
+ * Searches at blksize over a link that drops whatever is offered beyond
+ * capacity, plus floor percent of the rest; returns the trials it took
+ */
+static int
+search_link(struct iperf_search *search, int blksize, double capacity, double floor)
+{
+    struct iperf_search_trial trial = { 0 };
+    uint64_t rate;
+    int trials = 0;
+
+    iperf_search_begin(search, blksize);
+    while ((rate = iperf_search_next_rate(search)) != 0) {
+        trial.blksize = blksize ? blksize : 1448;
+        trial.rate = rate;
+        trial.packets = 100000;
+        trial.lost = rate > capacity ? trial.packets * (rate - capacity) / rate : 0;
+        trial.lost += (trial.packets - trial.lost) * floor / 100;
+        iperf_search_add(search, &trial);
+        ++trials;
+    }
+    return trials;
+}
+
+int
+main(void)
+{
+    struct iperf_search *search;
+    struct iperf_search_trial trial = { 0 };
+    const struct iperf_search_trial *trials;
+    const struct iperf_search_result *results;
+    int n, rc;
+
+    /* Nothing to search before a block size */
+    search = iperf_search_new(1000000000, 0);
+    assert(search != NULL);
+    assert(iperf_search_next_rate(search) == 0);
+
+    /* Lossless up to 437 Mbit/s: the first trial at the most, then halving */
+    rc = search_link(search, 1400, 437e6, 0);
+    assert(rc == 8);
+    assert(iperf_search_results(search, &results) == 1);
+    assert(results[0].blksize == 1400 && results[0].trials == 8);
+    assert(results[0].max_rate <= 437000000 && results[0].max_rate > 427000000);
+    assert(iperf_search_trials(search, &trials) == 8);
+    assert(trials[0].rate == 1000000000 && !trials[0].passed);
+    assert(trials[0].lost_percent > 56 && trials[0].lost_percent < 57);
+    assert(trials[1].rate == 500000000 && !trials[1].passed);
+    assert(trials[2].rate == 250000000 && trials[2].passed && trials[2].lost_percent == 0);
+    assert(trials[3].rate == 375000000);
+
+    /* The next block size starts over; a dynamic one is the trials' */
+    rc = search_link(search, 0, 2e9, 0);
+    assert(rc == 1);
+    assert(iperf_search_results(search, &results) == 2);
+    assert(results[1].blksize == 1448 && results[1].max_rate == 1000000000);
+    assert(iperf_search_trials(search, &trials) == 9);
+
+    /* Never lossless */
+    rc = search_link(search, 64, 2e9, 1);
+    assert(rc == 8);
+    assert(iperf_search_results(search, &results) == 3);
+    assert(results[2].max_rate == 0);
+    iperf_search_free(search);
+
+    /* The same link within a 1% tolerance */
+    search = iperf_search_new(1000000000, 1);
+    search_link(search, 1400, 437e6, 0.5);
+    iperf_search_results(search, &results);
+    assert(results[0].max_rate > 437000000 && results[0].max_rate <= 441500000);
+    iperf_search_free(search);
+
+    /* Nothing arriving fails, and more lost than sent counts as none */
+    search = iperf_search_new(1000000, 0);
+    iperf_search_begin(search, 1400);
+    trial.rate = iperf_search_next_rate(search);
+    assert(trial.rate == 1000000);
+    iperf_search_add(search, &trial);
+    assert(iperf_search_trials(search, &trials) == 1 && !trials[0].passed);
+    trial.rate = iperf_search_next_rate(search);
+    assert(trial.rate == 500000);
+    trial.packets = 100;
+    trial.lost = -2;
+    iperf_search_add(search, &trial);
+    assert(iperf_search_trials(search, &trials) == 2 && trials[1].passed && trials[1].lost == 0);
+    iperf_search_free(search);
+
+    /* A rate too small to halve to the resolution still ends */
+    search = iperf_search_new(3, 0);
+    n = search_link(search, 1400, 0, 0);
+    assert(n == 2);
+    for (n = 1; n < IPERF_SEARCH_MAX_BLKSIZES; ++n) {
+        rc = iperf_search_begin(search, 1400);
+        assert(rc == 0);
+    }
+    rc = iperf_search_begin(search, 1400);
+    assert(rc == -1);
+    iperf_search_free(search);
+
+    return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * iperf, Copyright (c) 2014-2025, The Regents of the University of
+ * California, through Lawrence Berkeley National Laboratory (subject
+ * to receipt of any required approvals from the U.S. Dept. of
+ * Energy).  All rights reserved.
+ *
+ * If you have questions about your rights to use or distribute this
+ * software, please contact Berkeley Lab's Technology Transfer
+ * Department at TTD@lbl.gov.
+ *
+ * NOTICE.  This software is owned by the U.S. Department of Energy.
+ * As such, the U.S. Government has been granted for itself and others
+ * acting on its behalf a paid-up, nonexclusive, irrevocable,
+ * worldwide license in the Software to reproduce, prepare derivative
+ * works, and perform publicly and display publicly.  Beginning five
+ * (5) years after the date permission to assert copyright is obtained
+ * from the U.S. Department of Energy, and subject to any subsequent
+ * five (5) year renewals, the U.S. Government is granted for itself
+ * and others acting on its behalf a paid-up, nonexclusive,
+ * irrevocable, worldwide license in the Software to reproduce,
+ * prepare derivative works, distribute copies to the public, perform
+ * publicly and display publicly, and to permit others to do so.
+ *
+ * This code is distributed under a BSD style license, see the LICENSE
+ * file for complete information.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iperf.h"
+#include "iperf_api.h"
+#include "iperf_sim.h"
+
+struct sim_case {
+    int duration;
+    uint64_t blocks;		/* -k, 0 for none */
+    int omit;
+    int streams;
+    int blksize;		/* 0 for the default */
+    int reverse;
+    int bidirectional;
+    uint64_t rate;		/* -b per stream, 0 for none */
+    int json;
+    int converge_min;		/* --converge, 0 for none */
+    double converge_tolerance;
+    double ramp_gain;		/* --ramp, 0 for none */
+    struct iperf_sim_link link;
+};
+
+struct sim_output {
+    char *client;
+    char *server;
+    size_t client_len, server_len;
+    uint64_t sent_bytes;	/* client to server, as received */
+    double sent_bps;
+    double reverse_bps;		/* server to client, as received */
+    double seconds;		/* of real time */
+    int converge_stop;
+    int ramp_stop;
+    int ramp_saturation;
+};
+
+static struct iperf_test *
+new_test(const struct sim_case *c, char role, FILE *out)
+{
+    struct iperf_test *test = iperf_new_test();
+
+    if (test == NULL)
+        return NULL;
+    iperf_defaults(test);
+    test->outfile = out;
+    if (c->json)
+        iperf_set_test_json_output(test, 1);
+    if (role == 'c') {
+        iperf_set_test_duration(test, c->duration);
+        iperf_set_test_blocks(test, c->blocks);
+        iperf_set_test_omit(test, c->omit);
+        iperf_set_test_num_streams(test, c->streams);
+        if (c->blksize)
+            iperf_set_test_blksize(test, c->blksize);
+        if (c->rate)
+            iperf_set_test_rate(test, c->rate);
+        iperf_set_test_reverse(test, c->reverse);
+        iperf_set_test_bidirectional(test, c->bidirectional);
+        iperf_set_test_converge(test, c->converge_min, c->converge_tolerance);
+        iperf_set_test_ramp(test, c->ramp_gain);
+    }
+    iperf_set_test_role(test, role);
+    return test;
+}
+
+static void
+free_output(struct sim_output *o)
+{
+    free(o->client);
+    free(o->server);
+}
+
+/* Runs a simulated test; the rates are summed over the data streams */
+static int
+run(const struct sim_case *c, struct sim_output *o)
+{
+    struct iperf_test *client, *server;
+    struct iperf_stream *sp;
+    struct timespec t0, t1;
+    FILE *cout, *sout;
+    double secs;
+    int rc;
+
+    memset(o, 0, sizeof(*o));
+    cout = open_memstream(&o->client, &o->client_len);
+    sout = open_memstream(&o->server, &o->server_len);
+    client = new_test(c, 'c', cout);
+    server = new_test(c, 's', sout);
+    if (client == NULL || server == NULL)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc = iperf_sim_run(client, server, &c->link);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    o->seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (rc < 0)
+        printf("iperf_sim_run: %s\n", iperf_strerror(i_errno));
+
+    /* The server's streams know what arrived */
+    secs = c->duration ? c->duration : 1;
+    SLIST_FOREACH(sp, &server->streams, streams) {
+        if (sp->sender)
+            o->reverse_bps += sp->result->bytes_received * 8 / secs;
+        else {
+            o->sent_bps += sp->result->bytes_received * 8 / secs;
+            o->sent_bytes += sp->result->bytes_received;
+        }
+    }
+
+    o->converge_stop = iperf_get_test_converge_stop(client);
+    if (client->ramp) {
+        o->ramp_stop = iperf_ramp_stop(client->ramp);
+        o->ramp_saturation = iperf_ramp_saturation(client->ramp);
+    }
+    iperf_free_test(client);
+    iperf_free_test(server);
+    fclose(cout);
+    fclose(sout);
+    return rc;
+}
+
+static int
+near(double value, double expected, double tolerance)
+{
+    return value > expected * (1 - tolerance) && value < expected * (1 + tolerance);
+}
+
+int
+main(void)
+{
+    struct sim_case c;
+    struct sim_output a, b;
+    int rc;
+
+    /* A minute over a 100 Mbit/s, 10 ms path takes well under a minute */
+    memset(&c, 0, sizeof(c));
+    c.duration = 60;
+    c.streams = 4;
+    c.link.rate = 100000000;
+    c.link.delay_usecs = 10000;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(a.seconds < c.duration / 4);
+    assert(near(a.sent_bps, 100e6, 0.01));
+    assert(a.reverse_bps == 0);
+    assert(strstr(a.client, "sender") != NULL && strstr(a.client, "receiver") != NULL);
+    assert(strstr(a.client, "iperf Done.") != NULL);
+    assert(strstr(a.server, "receiver") != NULL);
+
+    /* ... and says the same, byte for byte, every time */
+    rc = run(&c, &b);
+    assert(rc == 0);
+    assert(a.client_len == b.client_len && memcmp(a.client, b.client, a.client_len) == 0);
+    assert(a.server_len == b.server_len && memcmp(a.server, b.server, a.server_len) == 0);
+    free_output(&a);
+    free_output(&b);
+
+    /* So does the JSON, omitted seconds included */
+    c.duration = 10;
+    c.omit = 2;
+    c.json = 1;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    rc = run(&c, &b);
+    assert(rc == 0);
+    assert(a.client_len == b.client_len && memcmp(a.client, b.client, a.client_len) == 0);
+    assert(strstr(a.client, "\"omitted\":\ttrue") != NULL);
+    assert(near(a.sent_bps, 100e6, 0.01));
+    free_output(&a);
+    free_output(&b);
+
+    /* A rate limit holds each stream to it */
+    memset(&c, 0, sizeof(c));
+    c.duration = 10;
+    c.streams = 2;
+    c.rate = 20000000;
+    c.link.rate = 1000000000;
+    c.link.delay_usecs = 1000;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(near(a.sent_bps, 40e6, 0.01));
+    free_output(&a);
+
+    /* A window short of the path's bandwidth-delay product limits a stream to window / RTT */
+    memset(&c, 0, sizeof(c));
+    c.duration = 10;
+    c.streams = 1;
+    c.blksize = 16384;
+    c.link.rate = 1000000000;
+    c.link.delay_usecs = 50000;
+    c.link.window = 65536;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(near(a.sent_bps, 65536 * 8 / 0.1, 0.02));
+    free_output(&a);
+
+    /* Each direction has a path of its own */
+    memset(&c, 0, sizeof(c));
+    c.duration = 10;
+    c.streams = 2;
+    c.bidirectional = 1;
+    c.link.rate = 50000000;
+    c.link.delay_usecs = 5000;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(near(a.sent_bps, 50e6, 0.01));
+    assert(near(a.reverse_bps, 50e6, 0.01));
+    free_output(&a);
+
+    c.bidirectional = 0;
+    c.reverse = 1;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(a.sent_bps == 0);
+    assert(near(a.reverse_bps, 50e6, 0.01));
+    free_output(&a);
+
+    /*
+     * A steady path converges within a second of the window being full:
+     * the first second also fills the window, so it is a little faster...
+     */
+    memset(&c, 0, sizeof(c));
+    c.duration = 30;
+    c.streams = 2;
+    c.converge_min = 3;
+    c.converge_tolerance = 0.05;
+    c.link.rate = 100000000;
+    c.link.delay_usecs = 10000;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(a.converge_stop == IPERF_CONVERGE_CONVERGED);
+    assert(strstr(a.client, "3.00-4.00") != NULL && strstr(a.client, "4.00-5.00") == NULL);
+    assert(strstr(a.client, "Converged after 4.00 sec") != NULL);
+    free_output(&a);
+
+    /* ... after any omitted seconds, and not to a tolerance it can't meet */
+    c.duration = 6;
+    c.omit = 2;
+    c.converge_tolerance = 1e-9;
+    c.json = 1;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(a.converge_stop == IPERF_CONVERGE_MAX_DURATION);
+    assert(strstr(a.client, "\"stop_reason\":\t\"max_duration\"") != NULL);
+    assert(near(a.sent_bps, 100e6, 0.01));
+    free_output(&a);
+
+    /*
+     * Each stream's window holds it to about 25 Mbit/s over 20 ms, so the
+     * ramp adds streams until four fill the link and a fifth adds nothing
+     */
+    memset(&c, 0, sizeof(c));
+    c.duration = 12;
+    c.streams = 8;
+    c.blksize = 8192;
+    c.ramp_gain = 0.10;
+    c.link.rate = 100000000;
+    c.link.delay_usecs = 10000;
+    c.link.window = 65536;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(a.ramp_stop == IPERF_RAMP_SATURATED);
+    assert(a.ramp_saturation == 4);
+    assert(strstr(a.client, "Ramp saturated at 4 streams") != NULL);
+    free_output(&a);
+
+    /* A null link moves every block, through a ring the blocks wrap around */
+    memset(&c, 0, sizeof(c));
+    c.blocks = 10000;
+    c.streams = 2;
+    c.blksize = 1000;
+    c.link.window = 4096;
+    rc = run(&c, &a);
+    assert(rc == 0);
+    assert(a.sent_bytes >= 10000 * 1000 && a.sent_bytes <= 10002 * 1000);
+    assert(a.sent_bytes % 1000 == 0);
+    assert(strstr(a.client, "iperf Done.") != NULL);
+    free_output(&a);
+
+    return 0;
+}
@@ -98,8 +98,12 @@ save_tcpinfo(struct iperf_stream *sp, struct iperf_interval_results *irp)
 	defined(TCP_INFO)
     socklen_t tcp_info_length = sizeof(struct tcp_info);
 
-    if (getsockopt(sp->socket, IPPROTO_TCP, TCP_INFO, (void *)&irp->tcpInfo, &tcp_info_length) < 0)
-	iperf_err(sp->test, "getsockopt - %s", strerror(errno));
+    if (getsockopt(sp->socket, IPPROTO_TCP, TCP_INFO, (void *)&irp->tcpInfo, &tcp_info_length) < 0) {
+	/* Simulated streams (iperf_sim.c) are not TCP sockets and have none */
+	if (errno != EOPNOTSUPP)
+	    iperf_err(sp->test, "getsockopt - %s", strerror(errno));
+	memset(&irp->tcpInfo, 0, sizeof(irp->tcpInfo));
+    }
 
     if (sp->test->debug) {
 	printf("tcpi_snd_cwnd %u tcpi_snd_mss %u tcpi_rtt %u\n",
@@ -27,14 +27,36 @@
  * Based on timers.c by Jef Poskanzer. Used with permission.
  */
 
+
 #include <sys/types.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "timer.h"
 #include "iperf_time.h"
 
-static Timer* timers = NULL;
-static Timer* free_timers = NULL;
+/*
+** Pending timers are kept in a binary min-heap ordered by expiry time, so
+** that creating, resetting and cancelling a timer is O(log n) and finding
+** the next one to expire is O(1), however many timers there are.  Each
+** timer remembers its queue and its slot in that queue's heap, so it can
+** be removed or moved without a search.
+**
+** Every iperf test has a queue of its own, so tests running in parallel
+** threads never share timer state.  The queue-less calls use a default
+** queue for programs with a single timer loop.
+*/
+struct TimerQueueStruct
+{
+    Timer** heap;
+    int heap_len;
+    int heap_size;
+    Timer* free_timers;
+    unsigned long serial;	/* orders timers due at the same time */
+    struct timeval timeout;	/* returned by tmr_timeout_q() */
+};
+
+static TimerQueue default_queue;
 
 TimerClientData JunkClientData;
 
@@ -57,80 +79,149 @@ getnow( struct iperf_time* nowP, struct iperf_time* nowP2 )
 }
 
 
+/* Timers due at the same time run in the order they were scheduled, as
+** they did when the queue was a sorted list; the stats timer has to run
+** before the reporter timer that prints what it collected.
+*/
+static int
+heap_before( TimerQueue* q, int i, int j )
+{
+    int cmp = iperf_time_compare(&q->heap[i]->time, &q->heap[j]->time);
+
+    if ( cmp != 0 )
+	return cmp < 0;
+    return q->heap[i]->serial - q->heap[j]->serial > ULONG_MAX / 2;
+}
+
+
 static void
-list_add( Timer* t )
+heap_swap( TimerQueue* q, int i, int j )
 {
-    Timer* t2;
-    Timer* t2prev;
+    Timer* t = q->heap[i];
 
-    if ( timers == NULL ) {
-	/* The list is empty. */
-	timers = t;
-	t->prev = t->next = NULL;
-    } else {
-	if (iperf_time_compare(&t->time, &timers->time) < 0) {
-	    /* The new timer goes at the head of the list. */
-	    t->prev = NULL;
-	    t->next = timers;
-	    timers->prev = t;
-	    timers = t;
-	} else {
-	    /* Walk the list to find the insertion point. */
-	    for ( t2prev = timers, t2 = timers->next; t2 != NULL;
-		  t2prev = t2, t2 = t2->next ) {
-		if (iperf_time_compare(&t->time, &t2->time) < 0) {
-		    /* Found it. */
-		    t2prev->next = t;
-		    t->prev = t2prev;
-		    t->next = t2;
-		    t2->prev = t;
-		    return;
-		}
-	    }
-	    /* Oops, got to the end of the list.  Add to tail. */
-	    t2prev->next = t;
-	    t->prev = t2prev;
-	    t->next = NULL;
-	}
+    q->heap[i] = q->heap[j];
+    q->heap[j] = t;
+    q->heap[i]->heap_index = i;
+    q->heap[j]->heap_index = j;
+}
+
+
+static void
+heap_up( TimerQueue* q, int i )
+{
+    while ( i > 0 && heap_before( q, i, (i - 1) / 2 ) ) {
+	heap_swap( q, i, (i - 1) / 2 );
+	i = (i - 1) / 2;
     }
 }
 
 
 static void
-list_remove( Timer* t )
+heap_down( TimerQueue* q, int i )
 {
-    if ( t->prev == NULL )
-	timers = t->next;
-    else
-	t->prev->next = t->next;
-    if ( t->next != NULL )
-	t->next->prev = t->prev;
+    int child;
+
+    for (;;) {
+	child = 2 * i + 1;
+	if ( child >= q->heap_len )
+	    break;
+	if ( child + 1 < q->heap_len && heap_before( q, child + 1, child ) )
+	    ++child;
+	if ( ! heap_before( q, child, i ) )
+	    break;
+	heap_swap( q, i, child );
+	i = child;
+    }
+}
+
+
+static int
+heap_add( TimerQueue* q, Timer* t )
+{
+    Timer** h;
+    int size;
+
+    if ( q->heap_len == q->heap_size ) {
+	size = q->heap_size ? q->heap_size * 2 : 16;
+	h = (Timer**) realloc( q->heap, size * sizeof(Timer*) );
+	if ( h == NULL )
+	    return -1;
+	q->heap = h;
+	q->heap_size = size;
+    }
+    t->serial = q->serial++;
+    t->heap_index = q->heap_len;
+    q->heap[q->heap_len++] = t;
+    heap_up( q, t->heap_index );
+    return 0;
+}
+
+
+static void
+heap_resort( Timer* t )
+{
+    heap_up( t->queue, t->heap_index );
+    heap_down( t->queue, t->heap_index );
+}
+
+
+/* Restore the heap order after t's expiry time has changed.  Like a new
+** timer, it goes after the others due at the same time.
+*/
+static void
+heap_requeue( Timer* t )
+{
+    t->serial = t->queue->serial++;
+    heap_resort( t );
 }
 
 
 static void
-list_resort( Timer* t )
+heap_remove( Timer* t )
 {
-    /* Remove the timer from the list. */
-    list_remove( t );
-    /* And add it back in, sorted correctly. */
-    list_add( t );
+    TimerQueue* q = t->queue;
+    int i = t->heap_index;
+
+    t->heap_index = -1;
+    if ( --q->heap_len == i )
+	return;
+    /* Fill the hole with the last timer, which may belong above or below it. */
+    q->heap[i] = q->heap[q->heap_len];
+    q->heap[i]->heap_index = i;
+    heap_resort( q->heap[i] );
+}
+
+
+TimerQueue*
+tmr_queue_new( void )
+{
+    return (TimerQueue*) calloc( 1, sizeof(TimerQueue) );
+}
+
+
+void
+tmr_queue_free( TimerQueue* q )
+{
+    if ( q == NULL )
+	return;
+    tmr_destroy_q( q );
+    free( (void*) q );
 }
 
 
 Timer*
-tmr_create(
-    struct iperf_time* nowP, TimerProc* timer_proc, TimerClientData client_data,
-    int64_t usecs, int periodic )
+tmr_create_q(
+    TimerQueue* q, struct iperf_time* nowP, TimerProc* timer_proc,
+    TimerClientData client_data, int64_t usecs, int periodic )
 {
     struct iperf_time now;
     Timer* t;
 
     getnow( nowP, &now );
 
-    if ( free_timers != NULL ) {
-	t = free_timers;
-	free_timers = t->next;
+    if ( q->free_timers != NULL ) {
+	t = q->free_timers;
+	q->free_timers = t->next;
     } else {
 	t = (Timer*) malloc( sizeof(Timer) );
 	if ( t == NULL )
@@ -142,63 +233,90 @@ tmr_create(
     t->usecs = usecs;
     t->periodic = periodic;
     t->time = now;
+    t->queue = q;
     iperf_time_add_usecs(&t->time, usecs);
-    /* Add the new timer to the active list. */
-    list_add( t );
+    /* Add the new timer to the heap. */
+    if ( heap_add( q, t ) < 0 ) {
+	t->next = q->free_timers;
+	q->free_timers = t;
+	return NULL;
+    }
 
     return t;
 }
 
 
+Timer*
+tmr_create(
+    struct iperf_time* nowP, TimerProc* timer_proc, TimerClientData client_data,
+    int64_t usecs, int periodic )
+{
+    return tmr_create_q( &default_queue, nowP, timer_proc, client_data, usecs, periodic );
+}
+
+
 struct timeval*
-tmr_timeout( struct iperf_time* nowP )
+tmr_timeout_q( TimerQueue* q, struct iperf_time* nowP )
 {
     struct iperf_time now, diff;
     int64_t usecs;
     int past;
-    static struct timeval timeout;
 
     getnow( nowP, &now );
-    /* Since the list is sorted, we only need to look at the first timer. */
-    if ( timers == NULL )
+    /* The earliest timer is always at the top of the heap. */
+    if ( q->heap_len == 0 )
 	return NULL;
-    past = iperf_time_diff(&timers->time, &now, &diff);
+    past = iperf_time_diff(&q->heap[0]->time, &now, &diff);
     if (past)
         usecs = 0;
     else
         usecs = iperf_time_in_usecs(&diff);
-    timeout.tv_sec = usecs / 1000000LL;
-    timeout.tv_usec = usecs % 1000000LL;
-    return &timeout;
+    q->timeout.tv_sec = usecs / 1000000LL;
+    q->timeout.tv_usec = usecs % 1000000LL;
+    return &q->timeout;
+}
+
+
+struct timeval*
+tmr_timeout( struct iperf_time* nowP )
+{
+    return tmr_timeout_q( &default_queue, nowP );
 }
 
 
 void
-tmr_run( struct iperf_time* nowP )
+tmr_run_q( TimerQueue* q, struct iperf_time* nowP )
 {
     struct iperf_time now;
     Timer* t;
-    Timer* next;
 
     getnow( nowP, &now );
-    for ( t = timers; t != NULL; t = next ) {
-	next = t->next;
-	/* Since the list is sorted, as soon as we find a timer
-	** that isn't ready yet, we are done.
-	*/
+    while ( q->heap_len > 0 ) {
+	t = q->heap[0];
+	/* As soon as the earliest timer isn't ready yet, we are done. */
 	if (iperf_time_compare(&t->time, &now) > 0)
 	    break;
 	(t->timer_proc)( t->client_data, &now );
+	/* The callback may have cancelled the timer itself. */
+	if ( t->heap_index < 0 )
+	    continue;
 	if ( t->periodic ) {
 	    /* Reschedule. */
 	    iperf_time_add_usecs(&t->time, t->usecs);
-	    list_resort( t );
+	    heap_requeue( t );
 	} else
 	    tmr_cancel( t );
     }
 }
 
 
+void
+tmr_run( struct iperf_time* nowP )
+{
+    tmr_run_q( &default_queue, nowP );
+}
+
+
 void
 tmr_reset( struct iperf_time* nowP, Timer* t )
 {
@@ -207,39 +325,57 @@ tmr_reset( struct iperf_time* nowP, Timer* t )
     getnow( nowP, &now );
     t->time = now;
     iperf_time_add_usecs( &t->time, t->usecs );
-    list_resort( t );
+    heap_requeue( t );
 }
 
 
 void
 tmr_cancel( Timer* t )
 {
-    /* Remove it from the active list. */
-    list_remove( t );
-    /* And put it on the free list. */
-    t->next = free_timers;
-    free_timers = t;
-    t->prev = NULL;
+    TimerQueue* q = t->queue;
+
+    /* Remove it from the heap. */
+    heap_remove( t );
+    /* And put it on its queue's free list. */
+    t->next = q->free_timers;
+    q->free_timers = t;
 }
 
 
-void
-tmr_cleanup( void )
+static void
+cleanup_q( TimerQueue* q )
 {
     Timer* t;
 
-    while ( free_timers != NULL ) {
-	t = free_timers;
-	free_timers = t->next;
+    while ( q->free_timers != NULL ) {
+	t = q->free_timers;
+	q->free_timers = t->next;
 	free( (void*) t );
     }
 }
 
 
+void
+tmr_cleanup( void )
+{
+    cleanup_q( &default_queue );
+}
+
+
+void
+tmr_destroy_q( TimerQueue* q )
+{
+    while ( q->heap_len > 0 )
+	tmr_cancel( q->heap[q->heap_len - 1] );
+    free( (void*) q->heap );
+    q->heap = NULL;
+    q->heap_size = 0;
+    cleanup_q( q );
+}
+
+
 void
 tmr_destroy( void )
 {
-    while ( timers != NULL )
-	tmr_cancel( timers );
-    tmr_cleanup();
+    tmr_destroy_q( &default_queue );
 }
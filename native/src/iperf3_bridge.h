@@ -2,6 +2,7 @@
 #define IPERF3_BRIDGE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,15 +11,77 @@ extern "C" {
 // Platform-agnostic iperf3 bridge interface
 // This header can be used by both Android (JNI) and iOS (Objective-C++)
 
+// Why a client test with convergeMinSeconds ended; the values are iperf's
+// IPERF_CONVERGE_ ones
+typedef enum {
+    IPERF3_CONVERGE_OFF = 0,
+    IPERF3_CONVERGE_CONVERGED = 1,
+    IPERF3_CONVERGE_MAX_DURATION = 2,  // the duration ran out first
+    IPERF3_CONVERGE_INTERRUPTED = 3
+} Iperf3ConvergeStop;
+
+// Why the ramp of a client test with rampStreams stopped adding streams;
+// the values are iperf's IPERF_RAMP_ ones
+typedef enum {
+    IPERF3_RAMP_OFF = 0,
+    IPERF3_RAMP_SATURATED = 1,     // the last stream added less than rampGain
+    IPERF3_RAMP_CPU = 2,           // this host's CPU was saturated
+    IPERF3_RAMP_MAX_STREAMS = 3,   // every stream was sending
+    IPERF3_RAMP_ENDED = 4          // the test ended first
+} Iperf3RampStop;
+
+// End-of-test summary, computed from the test's stream results the way
+// iperf's own summary is.  Sent and received are the two ends of the data
+// direction (the client-to-server one for a bidirectional test), so they
+// agree with the JSON's sum_sent and sum_received.
 typedef struct {
     bool success;
     double sentBitsPerSecond;
     double receivedBitsPerSecond;
     double sendMbps;
     double receiveMbps;
-    double rtt;         // Mean RTT in milliseconds (TCP only)
-    double jitter;      // Jitter in milliseconds (UDP only)
-    char* jsonOutput;
+    long long sentBytes;
+    long long receivedBytes;
+    double seconds;             // sender's test time
+    // TCP
+    double rtt;                 // Mean RTT in milliseconds, 0 if not measured here
+    double rttMin;
+    double rttMax;
+    long long retransmits;
+    // UDP
+    double jitter;              // Jitter in milliseconds
+    long long packets;
+    long long lostPackets;
+    double lostPercent;
+    // Total CPU use of this and the other host, in percent
+    double cpuLocal;
+    double cpuRemote;
+    // 1 ms buckets, with microburstStallMs; see Iperf3StreamProgress
+    double peakBitsPerSecond;
+    double burstCv;
+    long long stalls;
+    long long stallMs;
+    long long longestStallMs;
+    // With keepMicroburstBuckets: bytes per ms over the data streams.
+    // Bucket 0 is the first ms after any omitted seconds; a test longer than
+    // the recorder keeps starts at microburstFirstBucket instead.
+    unsigned long long* microburstBuckets;
+    size_t microburstBucketCount;
+    size_t microburstFirstBucket;
+    // With convergeMinSeconds: why the test ended, and the 95% confidence
+    // interval of the throughput of its last window of intervals, relative
+    // to their mean
+    Iperf3ConvergeStop convergeStop;
+    double convergeRelativeCi;
+    // With rampStreams: why the ramp stopped, the most streams still worth
+    // adding, and the throughput curve, rampBitsPerSecond[i] with i + 1
+    // streams sending
+    Iperf3RampStop rampStop;
+    int rampSaturationStreams;
+    double* rampBitsPerSecond;
+    size_t rampStepCount;
+    char* jsonOutput;           // the test's own rendering, not a copy; NULL unless asked for
+    size_t jsonOutputLength;    // bytes, without the terminating NUL
     char* errorMessage;
     int errorCode;
 } Iperf3Result;
@@ -34,25 +97,279 @@ typedef void (*Iperf3ProgressCallback)(
     double rtt
 );
 
-// Core iperf3 wrapper functions
-Iperf3Result* iperf3_run_client_test(
-    const char* host,
-    int port,
-    int duration,
-    int parallel,
-    bool reverse,
-    bool use_udp,
-    long bandwidth,  // Target bandwidth in bits/sec (for UDP, 0 = unlimited)
+// One stream's figures for one interval, read straight from iperf's
+// interval results.  The same struct carries the sums over all streams.
+// Fields that do not apply to the protocol or direction are 0.
+typedef struct {
+    int id;                     // iperf stream id; 0 for a sum
+    bool sender;                // this end sends on the stream(s)
+    long long bytes;
+    double seconds;
+    double bitsPerSecond;
+    // TCP, on the sending end
+    long long retransmits;
+    long long cwnd;             // congestion window in bytes; summed for a sum
+    double rtt;                 // smoothed RTT in ms; mean of the streams for a sum
+    double rttVar;              // RTT variance in ms
+    // UDP
+    long long packets;
+    long long lostPackets;      // receiving end only
+    long long outOfOrder;       // receiving end only
+    double jitter;              // ms, receiving end only; mean for a sum
+    // This end's own 1 ms buckets, with microburstStallMs: the busiest
+    // bucket's rate, the buckets' coefficient of variation, and the runs of
+    // empty buckets that count as stalls.  A sum has the highest peak and cv
+    // of its streams and the stalls of all of them.
+    double peakBitsPerSecond;
+    double burstCv;
+    long long stalls;
+    long long stallMs;
+    long long longestStallMs;
+} Iperf3StreamProgress;
+
+// One interval report.  sum covers the streams carrying data from client
+// to server; in bidirectional tests sumReverse covers the other direction.
+// streams points into session memory and is only valid during the callback.
+typedef struct {
+    int interval;               // 1-based
+    double start;               // seconds since the test started
+    double end;
+    long long timestampNs;      // CLOCK_MONOTONIC when iperf reported it, for latency
+    bool omitted;
+    bool bidirectional;
+    Iperf3StreamProgress sum;
+    Iperf3StreamProgress sumReverse;
+    int streamCount;
+    const Iperf3StreamProgress* streams;
+} Iperf3IntervalProgress;
+
+typedef void (*Iperf3IntervalCallback)(
+    void* context,
+    const Iperf3IntervalProgress* progress
+);
+
+// Latest interval of a running session, for callers that poll instead of
+// subscribing to the progress callback
+typedef struct {
+    int interval;
+    long bytesTransferred;
+    double bitsPerSecond;
+    double jitter;
+    int lostPackets;
+    double rtt;
+} Iperf3Progress;
+
+// Client test parameters
+typedef struct {
+    const char* host;
+    int port;
+    int duration;
+    int parallel;
+    bool reverse;
+    bool useUdp;
+    long bandwidth;  // Target bandwidth in bits/sec (for UDP, 0 = 1 Mbit/sec default)
+    bool includeJson;  // Also render iperf's full JSON into the result
+    int microburstStallMs;  // Record 1 ms buckets, counting stalls this long; 0 = off
+    bool keepMicroburstBuckets;  // Also return the buckets in the result
+    bool bidirectional;  // Both directions at once; reverse is then ignored
+    int blockSize;  // Bytes per write or datagram, 0 = iperf's default
+    // End the test once the throughput of the last convergeMinSeconds of
+    // intervals agrees to within convergeTolerance (a fraction, 0 for 5%)
+    // at 95% confidence; duration is then the most it runs.  0 = off.
+    int convergeMinSeconds;
+    double convergeTolerance;
+    // Send on one stream at first and add one every two intervals while
+    // each adds at least rampGain (a fraction, 0 for 10%) to the throughput,
+    // up to parallel streams (8 if parallel is 1).  Not with reverse or
+    // bidirectional.
+    bool rampStreams;
+    double rampGain;
+} Iperf3ClientConfig;
+
+typedef enum {
+    IPERF3_SESSION_CREATED = 0,
+    IPERF3_SESSION_RUNNING,
+    IPERF3_SESSION_FINISHED
+} Iperf3SessionState;
+
+// One client or server test.  All state lives in the session, so any number
+// of sessions can run at the same time, each on its own thread.
+//
+// Lifecycle: create, optionally set a progress callback, then either run it
+// on the calling thread or start it on a thread of its own and later wait
+// for it.  Cancel may be called from any thread.  Free always cancels and
+// joins a started session first.
+typedef struct Iperf3Session Iperf3Session;
+
+// Create returns NULL only when out of memory.  If the test could not be set
+// up, the session is already FINISHED and its result carries the error.
+Iperf3Session* iperf3_session_create_client(const Iperf3ClientConfig* config);
+// A server session keeps serving tests one after another until cancelled
+Iperf3Session* iperf3_session_create_server(int port, bool use_udp);
+
+// Must be called before the session is run or started.  The callback is
+// called on the session's thread, or on its delivery thread with
+// asynchronous delivery.
+void iperf3_session_set_progress_callback(
+    Iperf3Session* session,
     Iperf3ProgressCallback progressCallback,
     void* callbackContext
 );
 
-void iperf3_request_client_cancel(void);
-bool iperf3_start_server_test(int port, bool use_udp);
-bool iperf3_stop_server_test(void);
+// Like the progress callback, with per-stream and TCP/UDP detail.  Both may
+// be set; each is called once per delivered interval, on the same thread.
+void iperf3_session_set_interval_callback(
+    Iperf3Session* session,
+    Iperf3IntervalCallback intervalCallback,
+    void* callbackContext
+);
+
+// Moves both callbacks off the session's thread.  Each interval is queued in
+// a lock-free ring of capacity slots (0 for the default) and a delivery
+// thread hands it on, at most framesPerSecond times a second: when several
+// intervals wait for the same frame only the newest is delivered.  0 frames
+// per second delivers every interval.  The test never waits for the
+// callbacks; intervals arriving while the ring is full are dropped.  Must be
+// called before the session is run or started.
+bool iperf3_session_set_async_delivery(Iperf3Session* session, int framesPerSecond, int capacity);
+
+// What happened to the intervals of a session so far
+typedef struct {
+    long long delivered;        // passed to the callbacks
+    long long coalesced;        // skipped for a newer interval in the same frame
+    long long dropped;          // lost because the ring was full
+} Iperf3DeliveryStats;
+
+void iperf3_session_get_delivery_stats(Iperf3Session* session, Iperf3DeliveryStats* stats);
+
+// Runs the session to completion on the calling thread
+Iperf3Result* iperf3_session_run(Iperf3Session* session);
+// Runs the session on a new thread; returns false if it could not be started
+bool iperf3_session_start(Iperf3Session* session);
+// Joins a started session and returns its result
+Iperf3Result* iperf3_session_wait(Iperf3Session* session);
+
+// Detaches the result of a finished session, so that it can outlive the
+// session (for example while another runtime reads jsonOutput in place).
+// Returns NULL while the session is still running.  The caller releases
+// it with iperf3_free_result().
+Iperf3Result* iperf3_session_take_result(Iperf3Session* session);
+
+Iperf3SessionState iperf3_session_get_state(Iperf3Session* session);
+// Copies the latest interval; returns false if there is none yet
+bool iperf3_session_get_progress(Iperf3Session* session, Iperf3Progress* progress);
+
+void iperf3_session_cancel(Iperf3Session* session);
+void iperf3_session_free(Iperf3Session* session);
+
+// Device self-test: a server and clients in this process over loopback, so
+// the figures are what the device's own network stack and CPU can move with
+// no network in the way.  TCP and UDP each run at several stream counts;
+// the best run of each protocol is the device's capacity.
+#define IPERF3_SELFTEST_DEFAULT_PORT 15201
+#define IPERF3_SELFTEST_MAX_RUNS 8
+
+// One client test of a self-test
+typedef struct {
+    bool useUdp;
+    int parallel;
+    bool success;
+    double bitsPerSecond;       // as received
+    double cpuPercent;          // the whole process, so client and server
+    double pps;                 // UDP datagrams, or TCP writes, per second
+    double lostPercent;
+    int errorCode;
+} Iperf3SelfTestRun;
+
+typedef struct {
+    bool success;               // at least one run of each protocol succeeded
+    double tcpBitsPerSecond;    // of the fastest TCP run
+    double tcpCpuPerGbps;       // its CPU percent per Gbit/s received
+    double tcpPps;
+    double udpBitsPerSecond;    // of the fastest UDP run
+    double udpCpuPerGbps;
+    double udpPps;
+    double udpLostPercent;
+    int runCount;
+    Iperf3SelfTestRun runs[IPERF3_SELFTEST_MAX_RUNS];
+    char* errorMessage;
+    int errorCode;
+} Iperf3SelfTestResult;
+
+typedef struct Iperf3SelfTest Iperf3SelfTest;
+
+// Port 0 uses IPERF3_SELFTEST_DEFAULT_PORT; duration is per run, in
+// seconds.  Returns NULL only when out of memory.
+Iperf3SelfTest* iperf3_selftest_create(int port, int duration);
+// Runs every test on the calling thread, one after another, which takes
+// about runCount * duration seconds.  The result belongs to the self-test.
+const Iperf3SelfTestResult* iperf3_selftest_run(Iperf3SelfTest* selftest);
+// May be called from any thread; the run returns with what it has so far
+void iperf3_selftest_cancel(Iperf3SelfTest* selftest);
+void iperf3_selftest_free(Iperf3SelfTest* selftest);
+
+// UDP lossless-rate search, after RFC 2544's throughput test: short client
+// tests against one server at rates picked by binary search between 0 and
+// maxBandwidth, passing while they lose at most lossTolerance percent,
+// until the highest passing and lowest failing rates are within 1% of
+// maxBandwidth.  This runs at each block size in turn.
+#define IPERF3_SEARCH_MAX_BLOCK_SIZES 8
+
+typedef struct {
+    const char* host;
+    int port;
+    int trialSeconds;           // 0 for 2
+    bool reverse;               // the server sends
+    long maxBandwidth;          // bits/sec, 0 for 1 Gbit/sec
+    double lossTolerance;       // percent
+    const int* blockSizes;      // datagram sizes to search at; none for iperf's default
+    int blockSizeCount;
+} Iperf3SearchConfig;
+
+// One client test of a search
+typedef struct {
+    int blockSize;
+    double offeredBitsPerSecond;
+    double receivedBitsPerSecond;
+    long long packets;
+    long long lostPackets;
+    double lostPercent;
+    double jitter;              // ms
+    bool passed;
+} Iperf3SearchTrial;
+
+typedef struct {
+    int blockSize;
+    double maxBitsPerSecond;    // highest passing rate, 0 if none passed
+    int trialCount;
+} Iperf3SearchBlockResult;
+
+typedef struct {
+    bool success;               // every block size was searched to the end
+    int blockResultCount;
+    Iperf3SearchBlockResult blockResults[IPERF3_SEARCH_MAX_BLOCK_SIZES];
+    int trialCount;
+    const Iperf3SearchTrial* trials;  // in the order they ran
+    char* errorMessage;
+    int errorCode;
+} Iperf3SearchResult;
+
+typedef struct Iperf3Search Iperf3Search;
+
+// Returns NULL when out of memory or given more than
+// IPERF3_SEARCH_MAX_BLOCK_SIZES block sizes
+Iperf3Search* iperf3_search_create(const Iperf3SearchConfig* config);
+// Runs every trial on the calling thread, one after another.  The result
+// belongs to the search.
+const Iperf3SearchResult* iperf3_search_run(Iperf3Search* search);
+// May be called from any thread; the run returns with what it has so far
+void iperf3_search_cancel(Iperf3Search* search);
+void iperf3_search_free(Iperf3Search* search);
+
 const char* iperf3_get_version_string(void);
 
-// Cleanup function
+// Results returned by run and wait belong to the session and are freed with
+// it; this releases a result taken from its session
 void iperf3_free_result(Iperf3Result* result);
 
 #ifdef __cplusplus
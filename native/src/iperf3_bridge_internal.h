@@ -0,0 +1,27 @@
+#ifndef IPERF3_BRIDGE_INTERNAL_H
+#define IPERF3_BRIDGE_INTERNAL_H
+
+#include "iperf3_bridge.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bridge internals for the host benchmarks in native/bench; the apps only
+// use iperf3_bridge.h
+
+struct iperf_test;
+
+// A client session around a test the caller has set up, which the session
+// then owns and iperf3_session_free() frees.  NULL if out of memory.
+Iperf3Session* iperf3_session_wrap_test(struct iperf_test* test);
+
+// Turns the test's newest interval into an Iperf3IntervalProgress and hands
+// it on, as the reporter callback does, even if it was reported already
+void iperf3_session_report_interval(Iperf3Session* session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IPERF3_BRIDGE_INTERNAL_H
@@ -0,0 +1,288 @@
+#include "iperf3_ffi.h"
+#include "iperf3_bridge.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+// dart:ffi entry points over the session bridge.  See iperf3_ffi.h.
+
+// Records a handle keeps for Dart to read: two minutes of one-second intervals
+#define FFI_PROGRESS_CAPACITY 128
+
+// The part of Dart's Dart_CObject (dart_native_api.h) an int64 message
+// needs.  The padding keeps it as large as the real union, which Dart
+// reads only as far as the type requires.
+typedef struct {
+    int32_t type;
+    union {
+        int64_t as_int64;
+        void* pad[5];
+    } value;
+} FfiCObject;
+
+#define FFI_COBJECT_INT64 3         // Dart_CObject_kInt64
+
+typedef bool (*FfiPostCObjectFn)(int64_t port, FfiCObject* message);
+
+struct Iperf3FfiHandle {
+    Iperf3Session* session;
+    int64_t port;
+    FfiPostCObjectFn post;
+    pthread_t thread;
+    bool thread_started;
+    // Single-producer single-consumer: the bridge's delivery thread advances
+    // tail, the Dart isolate advances head
+    Iperf3FfiProgress records[FFI_PROGRESS_CAPACITY];
+    _Atomic int64_t head;
+    _Atomic int64_t tail;
+    _Atomic int64_t dropped;
+};
+
+// The result Dart sees, and the bridge result its pointers point into
+typedef struct {
+    Iperf3FfiResult result;
+    Iperf3Result* owned;
+} FfiResultBox;
+
+static void post_int64(Iperf3FfiHandle* handle, int64_t value) {
+    if (!handle->post || handle->port == 0) {
+        return;
+    }
+    FfiCObject message;
+    memset(&message, 0, sizeof(message));
+    message.type = FFI_COBJECT_INT64;
+    message.value.as_int64 = value;
+    handle->post(handle->port, &message);
+}
+
+// Runs on the bridge's delivery thread, never on the test's own
+static void interval_callback(void* context, const Iperf3IntervalProgress* progress) {
+    Iperf3FfiHandle* handle = (Iperf3FfiHandle*)context;
+    int64_t tail = atomic_load_explicit(&handle->tail, memory_order_relaxed);
+    int64_t head = atomic_load_explicit(&handle->head, memory_order_acquire);
+    if (tail - head >= FFI_PROGRESS_CAPACITY) {
+        // Dart is not keeping up; it learns of the gap from the result
+        atomic_fetch_add_explicit(&handle->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    Iperf3FfiProgress* record = &handle->records[tail % FFI_PROGRESS_CAPACITY];
+    const Iperf3StreamProgress* sum = &progress->sum;
+    record->timestampNs = progress->timestampNs;
+    record->interval = progress->interval;
+    record->start = progress->start;
+    record->end = progress->end;
+    record->omitted = progress->omitted;
+    record->streamCount = progress->streamCount;
+    record->bytes = sum->bytes;
+    record->bitsPerSecond = sum->bitsPerSecond;
+    record->retransmits = sum->retransmits;
+    record->cwnd = sum->cwnd;
+    record->rtt = sum->rtt;
+    record->rttVar = sum->rttVar;
+    record->packets = sum->packets;
+    record->lostPackets = sum->lostPackets;
+    record->outOfOrder = sum->outOfOrder;
+    record->jitter = sum->jitter;
+    record->reverseBytes = progress->bidirectional ? progress->sumReverse.bytes : 0;
+    record->reverseBitsPerSecond = progress->bidirectional ? progress->sumReverse.bitsPerSecond : 0;
+    record->peakBitsPerSecond = sum->peakBitsPerSecond;
+    record->burstCv = sum->burstCv;
+    record->stalls = sum->stalls;
+    record->stallMs = sum->stallMs;
+    record->longestStallMs = sum->longestStallMs;
+    atomic_store_explicit(&handle->tail, tail + 1, memory_order_release);
+
+    post_int64(handle, tail + 1);
+}
+
+static Iperf3FfiHandle* handle_new(Iperf3Session* session) {
+    if (!session) {
+        return NULL;
+    }
+    Iperf3FfiHandle* handle = (Iperf3FfiHandle*)calloc(1, sizeof(Iperf3FfiHandle));
+    if (!handle) {
+        iperf3_session_free(session);
+        return NULL;
+    }
+    handle->session = session;
+    atomic_init(&handle->head, 0);
+    atomic_init(&handle->tail, 0);
+    atomic_init(&handle->dropped, 0);
+    iperf3_session_set_interval_callback(session, interval_callback, handle);
+    return handle;
+}
+
+int32_t iperf3_ffi_abi_version(void) {
+    return IPERF3_FFI_ABI_VERSION;
+}
+
+const char* iperf3_ffi_version(void) {
+    return iperf3_get_version_string();
+}
+
+int64_t iperf3_ffi_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+Iperf3FfiHandle* iperf3_ffi_create_client(
+    const char* host, int32_t port, int32_t duration, int32_t parallel,
+    int64_t bandwidth, int32_t flags, int32_t microburstStallMs,
+    int32_t convergeMinSeconds, double convergeTolerance, double rampGain) {
+    Iperf3ClientConfig config = {
+        .host = host,
+        .port = port,
+        .duration = duration,
+        .parallel = parallel,
+        .reverse = (flags & IPERF3_FFI_REVERSE) != 0,
+        .useUdp = (flags & IPERF3_FFI_UDP) != 0,
+        .bandwidth = (long)bandwidth,
+        .includeJson = (flags & IPERF3_FFI_INCLUDE_JSON) != 0,
+        .microburstStallMs = microburstStallMs,
+        .keepMicroburstBuckets = (flags & IPERF3_FFI_MICROBURST_BUCKETS) != 0,
+        .convergeMinSeconds = convergeMinSeconds,
+        .convergeTolerance = convergeTolerance,
+        .rampStreams = (flags & IPERF3_FFI_RAMP) != 0,
+        .rampGain = rampGain,
+    };
+    return handle_new(iperf3_session_create_client(&config));
+}
+
+Iperf3FfiHandle* iperf3_ffi_create_server(int32_t port, int32_t udp) {
+    return handle_new(iperf3_session_create_server(port, udp != 0));
+}
+
+static void* ffi_thread_func(void* arg) {
+    Iperf3FfiHandle* handle = (Iperf3FfiHandle*)arg;
+    // Returns after the last interval has been handed to interval_callback
+    iperf3_session_run(handle->session);
+    post_int64(handle, IPERF3_FFI_FINISHED);
+    return NULL;
+}
+
+int32_t iperf3_ffi_start(
+    Iperf3FfiHandle* handle, int64_t port, void* postCObject, int32_t framesPerSecond) {
+    if (!handle || handle->thread_started) {
+        return -1;
+    }
+    handle->port = port;
+    handle->post = (FfiPostCObjectFn)postCObject;
+    // Posting happens on the delivery thread, so a slow isolate never
+    // holds up the test
+    if (!iperf3_session_set_async_delivery(handle->session, framesPerSecond, 0)) {
+        return -1;
+    }
+    if (pthread_create(&handle->thread, NULL, ffi_thread_func, handle) != 0) {
+        return -1;
+    }
+    handle->thread_started = true;
+    return 0;
+}
+
+int32_t iperf3_ffi_read_progress(
+    Iperf3FfiHandle* handle, Iperf3FfiProgress* out, int32_t max) {
+    if (!handle || !out || max <= 0) {
+        return 0;
+    }
+    int64_t head = atomic_load_explicit(&handle->head, memory_order_relaxed);
+    int64_t tail = atomic_load_explicit(&handle->tail, memory_order_acquire);
+    int32_t count = 0;
+    while (head < tail && count < max) {
+        out[count++] = handle->records[head % FFI_PROGRESS_CAPACITY];
+        head++;
+    }
+    atomic_store_explicit(&handle->head, head, memory_order_release);
+    return count;
+}
+
+Iperf3FfiResult* iperf3_ffi_take_result(Iperf3FfiHandle* handle) {
+    if (!handle) {
+        return NULL;
+    }
+    Iperf3Result* owned = iperf3_session_take_result(handle->session);
+    if (!owned) {
+        return NULL;
+    }
+    FfiResultBox* box = (FfiResultBox*)calloc(1, sizeof(FfiResultBox));
+    if (!box) {
+        iperf3_free_result(owned);
+        return NULL;
+    }
+    box->owned = owned;
+
+    Iperf3DeliveryStats stats;
+    iperf3_session_get_delivery_stats(handle->session, &stats);
+
+    Iperf3FfiResult* result = &box->result;
+    result->success = owned->success;
+    result->errorCode = owned->errorCode;
+    result->errorMessage = owned->errorMessage;
+    result->sentBitsPerSecond = owned->sentBitsPerSecond;
+    result->receivedBitsPerSecond = owned->receivedBitsPerSecond;
+    result->sentBytes = owned->sentBytes;
+    result->receivedBytes = owned->receivedBytes;
+    result->seconds = owned->seconds;
+    result->rtt = owned->rtt;
+    result->rttMin = owned->rttMin;
+    result->rttMax = owned->rttMax;
+    result->retransmits = owned->retransmits;
+    result->jitter = owned->jitter;
+    result->packets = owned->packets;
+    result->lostPackets = owned->lostPackets;
+    result->lostPercent = owned->lostPercent;
+    result->cpuLocal = owned->cpuLocal;
+    result->cpuRemote = owned->cpuRemote;
+    result->json = (const uint8_t*)owned->jsonOutput;
+    result->jsonLength = (int64_t)owned->jsonOutputLength;
+    result->progressDelivered = stats.delivered;
+    result->progressCoalesced = stats.coalesced;
+    result->progressDropped = stats.dropped +
+        atomic_load_explicit(&handle->dropped, memory_order_relaxed);
+    result->peakBitsPerSecond = owned->peakBitsPerSecond;
+    result->burstCv = owned->burstCv;
+    result->stalls = owned->stalls;
+    result->stallMs = owned->stallMs;
+    result->longestStallMs = owned->longestStallMs;
+    result->microburstBuckets = (const uint64_t*)owned->microburstBuckets;
+    result->microburstBucketCount = (int64_t)owned->microburstBucketCount;
+    result->microburstFirstBucket = (int64_t)owned->microburstFirstBucket;
+    result->convergeStop = owned->convergeStop;
+    result->convergeRelativeCi = owned->convergeRelativeCi;
+    result->rampStop = owned->rampStop;
+    result->rampSaturationStreams = owned->rampSaturationStreams;
+    result->rampBitsPerSecond = owned->rampBitsPerSecond;
+    result->rampStepCount = (int64_t)owned->rampStepCount;
+    return result;
+}
+
+void iperf3_ffi_free_result(Iperf3FfiResult* result) {
+    if (!result) {
+        return;
+    }
+    FfiResultBox* box = (FfiResultBox*)result;   // result is the box's first member
+    iperf3_free_result(box->owned);
+    free(box);
+}
+
+void iperf3_ffi_cancel(Iperf3FfiHandle* handle) {
+    if (handle) {
+        iperf3_session_cancel(handle->session);
+    }
+}
+
+void iperf3_ffi_free(Iperf3FfiHandle* handle) {
+    if (!handle) {
+        return;
+    }
+    if (handle->thread_started) {
+        iperf3_session_cancel(handle->session);
+        pthread_join(handle->thread, NULL);
+    }
+    iperf3_session_free(handle->session);
+    free(handle);
+}
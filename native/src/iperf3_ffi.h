@@ -0,0 +1,147 @@
+#ifndef IPERF3_FFI_H
+#define IPERF3_FFI_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// C ABI over the bridge for dart:ffi, so Dart can drive tests without a
+// platform channel.  Only fixed-width types cross it, and the structs only
+// ever grow at the end; bump IPERF3_FFI_ABI_VERSION when they do.
+//
+// A handle owns one bridge session.  Progress is copied into a ring of
+// Iperf3FfiProgress records and announced on a Dart native port: each
+// message is the record count so far, or IPERF3_FFI_FINISHED once the test
+// is over.  The Dart isolate reads the records out with
+// iperf3_ffi_read_progress() and, after IPERF3_FFI_FINISHED, takes the
+// result, which it must free with iperf3_ffi_free_result().
+
+#define IPERF3_FFI_ABI_VERSION 4
+#define IPERF3_FFI_FINISHED (-1)
+
+#if defined(_WIN32)
+#define IPERF3_FFI_EXPORT __declspec(dllexport)
+#else
+// Kept even when nothing in the app calls them, for lookup at run time
+#define IPERF3_FFI_EXPORT __attribute__((visibility("default"), used))
+#endif
+
+// Client flags
+#define IPERF3_FFI_REVERSE 0x1
+#define IPERF3_FFI_UDP 0x2
+#define IPERF3_FFI_INCLUDE_JSON 0x4
+#define IPERF3_FFI_MICROBURST_BUCKETS 0x8  // keep the 1 ms buckets for the result
+#define IPERF3_FFI_RAMP 0x10                // ramp the streams up, see Iperf3ClientConfig
+
+typedef struct Iperf3FfiHandle Iperf3FfiHandle;
+
+// One interval: the header and the sums, without per-stream records
+typedef struct {
+    int64_t timestampNs;        // monotonic clock when iperf reported it
+    int64_t interval;
+    double start;
+    double end;
+    int64_t omitted;
+    int64_t streamCount;
+    int64_t bytes;
+    double bitsPerSecond;
+    int64_t retransmits;
+    int64_t cwnd;
+    double rtt;                 // ms
+    double rttVar;
+    int64_t packets;
+    int64_t lostPackets;
+    int64_t outOfOrder;
+    double jitter;              // ms
+    int64_t reverseBytes;       // bidirectional tests only
+    double reverseBitsPerSecond;
+    double peakBitsPerSecond;   // 1 ms buckets, with microburstStallMs
+    double burstCv;
+    int64_t stalls;
+    int64_t stallMs;
+    int64_t longestStallMs;
+} Iperf3FfiProgress;
+
+// Mirrors Iperf3Result with fixed-width fields.  json points at the
+// rendering the test made, valid until the result is freed.
+typedef struct {
+    int64_t success;
+    int64_t errorCode;
+    const char* errorMessage;
+    double sentBitsPerSecond;
+    double receivedBitsPerSecond;
+    int64_t sentBytes;
+    int64_t receivedBytes;
+    double seconds;
+    double rtt;
+    double rttMin;
+    double rttMax;
+    int64_t retransmits;
+    double jitter;
+    int64_t packets;
+    int64_t lostPackets;
+    double lostPercent;
+    double cpuLocal;
+    double cpuRemote;
+    const uint8_t* json;
+    int64_t jsonLength;
+    int64_t progressDelivered;
+    int64_t progressCoalesced;
+    int64_t progressDropped;    // by the bridge or by a full Dart-side ring
+    double peakBitsPerSecond;
+    double burstCv;
+    int64_t stalls;
+    int64_t stallMs;
+    int64_t longestStallMs;
+    const uint64_t* microburstBuckets;  // bytes per ms, see Iperf3Result
+    int64_t microburstBucketCount;
+    int64_t microburstFirstBucket;
+    int64_t convergeStop;       // Iperf3ConvergeStop, with convergeMinSeconds
+    double convergeRelativeCi;
+    int64_t rampStop;           // Iperf3RampStop, with IPERF3_FFI_RAMP
+    int64_t rampSaturationStreams;
+    const double* rampBitsPerSecond;    // by streams sending, from 1
+    int64_t rampStepCount;
+} Iperf3FfiResult;
+
+IPERF3_FFI_EXPORT int32_t iperf3_ffi_abi_version(void);
+IPERF3_FFI_EXPORT const char* iperf3_ffi_version(void);
+// CLOCK_MONOTONIC in ns, the clock of Iperf3FfiProgress.timestampNs
+IPERF3_FFI_EXPORT int64_t iperf3_ffi_now_ns(void);
+
+// Return NULL only when out of memory; a test that could not be set up
+// finishes at once with its error in the result
+IPERF3_FFI_EXPORT Iperf3FfiHandle* iperf3_ffi_create_client(
+    const char* host, int32_t port, int32_t duration, int32_t parallel,
+    int64_t bandwidth, int32_t flags, int32_t microburstStallMs,
+    int32_t convergeMinSeconds, double convergeTolerance, double rampGain);
+IPERF3_FFI_EXPORT Iperf3FfiHandle* iperf3_ffi_create_server(int32_t port, int32_t udp);
+
+// Runs the test on a thread of its own.  postCObject is Dart's
+// NativeApi.postCObject and port a ReceivePort's native port; with port 0
+// nothing is posted.  Progress is sent at most framesPerSecond times a
+// second, 0 for every interval.  Returns 0 on success.
+IPERF3_FFI_EXPORT int32_t iperf3_ffi_start(
+    Iperf3FfiHandle* handle, int64_t port, void* postCObject, int32_t framesPerSecond);
+
+// Copies up to max unread records into out, oldest first; returns how many
+IPERF3_FFI_EXPORT int32_t iperf3_ffi_read_progress(
+    Iperf3FfiHandle* handle, Iperf3FfiProgress* out, int32_t max);
+
+// The result once the test has finished, else NULL.  Each call detaches
+// the result, so it can be taken only once.
+IPERF3_FFI_EXPORT Iperf3FfiResult* iperf3_ffi_take_result(Iperf3FfiHandle* handle);
+IPERF3_FFI_EXPORT void iperf3_ffi_free_result(Iperf3FfiResult* result);
+
+// Safe from any thread while the test runs
+IPERF3_FFI_EXPORT void iperf3_ffi_cancel(Iperf3FfiHandle* handle);
+// Cancels and joins the test first; nothing is posted afterwards
+IPERF3_FFI_EXPORT void iperf3_ffi_free(Iperf3FfiHandle* handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IPERF3_FFI_H